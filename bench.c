@@ -0,0 +1,856 @@
+/*
+  Copyright (C) CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#include "libs/pilight/core/threads.h"
+#include "libs/pilight/core/pilight.h"
+#include "libs/pilight/core/options.h"
+#include "libs/pilight/core/log.h"
+#include "libs/pilight/core/json.h"
+#include "libs/pilight/core/common.h"
+#include "libs/pilight/core/dso.h"
+#include "libs/pilight/core/gc.h"
+#include "libs/pilight/core/capture.h"
+#include "libs/pilight/config/config.h"
+#include "libs/pilight/config/devices.h"
+#include "libs/pilight/config/snapshot.h"
+#include "libs/pilight/lua_c/lua.h"
+
+#include "libs/pilight/protocols/protocol.h"
+
+/*
+ * Replays a capture made with pilight-daemon --record through
+ * the same receive, decode, update and broadcast steps the
+ * daemon takes, but without any hardware, threads or sockets.
+ *
+ * With --protocols, every protocol instead decodes a pulse train
+ * made by its own createCode and a set of noise frames, so slow
+ * validate and parseCode functions stand out.
+ *
+ * With --arena, the messages of the first replay are decoded
+ * again, both into malloc'd nodes and into an arena, the way
+ * the broadcast thread decodes them.
+ *
+ * With --json, a JSON file, like a large configuration, is
+ * validated and decoded repeatedly.
+ */
+
+#define NOISE_FRAMES		64
+#define JSON_LOOPS			100
+
+#define STAGE_DECODE		0
+#define STAGE_UPDATE		1
+#define STAGE_BROADCAST	2
+#define STAGE_NR				3
+
+typedef struct bench_stage_t {
+	const char *name;
+	uint64_t *samples;
+	unsigned long nr;
+	unsigned long size;
+} bench_stage_t;
+
+typedef struct bench_protocol_t {
+	struct protocol_t *protocol;
+	unsigned long matched;
+	unsigned long decoded;
+	uint64_t cputime;
+} bench_protocol_t;
+
+/* The messages decoded from a single frame */
+typedef struct bench_frame_t {
+	char **output;
+	char **protoname;
+	int nr;
+	int cursor;
+	uint64_t cputime;
+} bench_frame_t;
+
+static struct bench_stage_t stages[STAGE_NR] = {
+	{ "decode", NULL, 0, 0 },
+	{ "update", NULL, 0, 0 },
+	{ "broadcast", NULL, 0, 0 }
+};
+
+static struct bench_protocol_t *bprotocols = NULL;
+static int nrbprotocols = 0;
+
+static unsigned long frames = 0;
+static unsigned long noiseframes = 0;
+static unsigned long messages = 0;
+static unsigned long updates = 0;
+static uint64_t busy = 0;
+
+static unsigned int seed = 0x9e3779b9;
+
+static int noise_quality = NOISE_FILTER_QUALITY;
+static int noise_lengths = NOISE_FILTER_LENGTHS;
+
+/* Messages of the first replay, for --arena */
+static char **recorded = NULL;
+static unsigned long nrrecorded = 0;
+static unsigned long recordedsize = 0;
+static int record = 0;
+
+static char *lua_root = LUA_ROOT;
+
+int main_gc(void) {
+	log_shell_disable();
+
+	options_gc();
+	config_gc();
+	protocol_gc();
+	threads_gc();
+
+	plua_gc();
+	dso_gc();
+	log_gc();
+	gc_clear();
+
+	int i = 0;
+	for(i=0;i<STAGE_NR;i++) {
+		if(stages[i].samples != NULL) {
+			FREE(stages[i].samples);
+		}
+		stages[i].samples = NULL;
+		stages[i].nr = 0;
+		stages[i].size = 0;
+	}
+	if(bprotocols != NULL) {
+		FREE(bprotocols);
+	}
+	nrbprotocols = 0;
+
+	unsigned long x = 0;
+	for(x=0;x<nrrecorded;x++) {
+		FREE(recorded[x]);
+	}
+	if(recorded != NULL) {
+		FREE(recorded);
+	}
+	recorded = NULL;
+	nrrecorded = 0;
+	recordedsize = 0;
+
+	FREE(progname);
+	xfree();
+
+	return EXIT_SUCCESS;
+}
+
+static uint64_t cputime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL+(uint64_t)ts.tv_nsec;
+}
+
+static void stage_add(int stage, uint64_t ns) {
+	struct bench_stage_t *s = &stages[stage];
+
+	if(s->nr == s->size) {
+		s->size = (s->size == 0) ? 1024 : s->size*2;
+		if((s->samples = REALLOC(s->samples, sizeof(uint64_t)*s->size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	s->samples[s->nr++] = ns;
+	busy += ns;
+}
+
+static int cmp_uint64(const void *a, const void *b) {
+	uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_cputime(const void *a, const void *b) {
+	uint64_t x = ((struct bench_protocol_t *)a)->cputime;
+	uint64_t y = ((struct bench_protocol_t *)b)->cputime;
+
+	return (x < y) - (x > y);
+}
+
+static double percentile(struct bench_stage_t *s, int p) {
+	unsigned long i = 0;
+
+	if(s->nr == 0) {
+		return 0;
+	}
+	i = (s->nr*p+99)/100;
+	if(i > 0) {
+		i--;
+	}
+	return (double)s->samples[i]/1000.0;
+}
+
+static void bench_record(char *message) {
+	if(nrrecorded == recordedsize) {
+		recordedsize = (recordedsize == 0) ? 1024 : recordedsize*2;
+		if((recorded = REALLOC(recorded, sizeof(char *)*recordedsize)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	if((recorded[nrrecorded++] = STRDUP(message)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+}
+
+static void bench_update(char *protoname, char *message) {
+	struct JsonNode *jmessage = NULL, *jret = NULL, *jsettings = NULL;
+	char *out = NULL;
+	uint64_t start = 0;
+
+	start = uv_hrtime();
+	if((jmessage = json_decode(message)) == NULL) {
+		return;
+	}
+	if(devices_update(protoname, jmessage, RECEIVER, &jret) == 0) {
+		updates++;
+	}
+	stage_add(STAGE_UPDATE, uv_hrtime()-start);
+
+	start = uv_hrtime();
+	if(jret != NULL) {
+		out = json_stringify(jret, NULL);
+		json_free(out);
+		json_delete(jret);
+	}
+	if((jsettings = json_find_member(jmessage, "settings")) != NULL) {
+		json_remove_from_parent(jsettings);
+		json_delete(jsettings);
+	}
+	out = json_stringify(jmessage, NULL);
+	json_free(out);
+	json_delete(jmessage);
+	stage_add(STAGE_BROADCAST, uv_hrtime()-start);
+}
+
+/*
+ * Called by protocol_dispatch for every protocol that looked
+ * at the frame. The time since the previous call is the time
+ * this protocol spent in validate and parseCode.
+ */
+static int bench_protocol(struct protocol_t *protocol, int matched, void *userdata) {
+	struct bench_frame_t *frame = userdata;
+	struct bench_protocol_t *bprotocol = NULL;
+	uint64_t cpu = 0;
+
+	while(bprotocols[frame->cursor].protocol != protocol) {
+		frame->cursor++;
+	}
+	bprotocol = &bprotocols[frame->cursor];
+
+	if(matched == 1) {
+		bprotocol->matched++;
+		if(protocol->message != NULL) {
+			if(json_check(protocol->message, NULL) == true) {
+				JsonWriter w;
+
+				json_writer_init(&w);
+				json_writer_begin_object(&w, NULL);
+				json_writer_node(&w, "message", protocol->message);
+				json_writer_string(&w, "origin", "receiver");
+				json_writer_string(&w, "protocol", protocol->id);
+				if(protocol->repeats > -1) {
+					json_writer_number(&w, "repeats", protocol->repeats, 0);
+				}
+				json_writer_end_object(&w);
+
+				bprotocol->decoded++;
+				frame->protoname[frame->nr] = protocol->id;
+				frame->output[frame->nr++] = json_writer_finish(&w);
+			}
+			json_delete(protocol->message);
+		}
+		protocol->message = NULL;
+	}
+
+	cpu = cputime();
+	bprotocol->cputime += cpu-frame->cputime;
+	frame->cputime = cpu;
+
+	return 0;
+}
+
+static void bench_frame(struct capture_frame_t *capture, uint64_t timestamp) {
+	struct bench_frame_t frame;
+	char *output[nrbprotocols];
+	char *protoname[nrbprotocols];
+	uint64_t start = uv_hrtime();
+	int i = 0;
+
+	memset(&frame, 0, sizeof(struct bench_frame_t));
+	frame.output = output;
+	frame.protoname = protoname;
+	frame.cputime = cputime();
+
+	if(protocol_dispatch(capture->raw, capture->rawlen, capture->hwtype, timestamp,
+		 noise_quality, noise_lengths, bench_protocol, &frame) == -1) {
+		noiseframes++;
+	}
+	stage_add(STAGE_DECODE, uv_hrtime()-start);
+
+	for(i=0;i<frame.nr;i++) {
+		messages++;
+		if(record == 1) {
+			bench_record(output[i]);
+		}
+		bench_update(protoname[i], output[i]);
+		json_free(output[i]);
+	}
+	frames++;
+}
+
+static void bench_report(uint64_t elapsed) {
+	int i = 0;
+
+	printf("frames:\t\t%lu\n", frames);
+	printf("noise:\t\t%lu\n", noiseframes);
+	printf("messages:\t%lu\n", messages);
+	printf("updates:\t%lu\n", updates);
+	printf("elapsed:\t%.3f s\n", (double)elapsed/1000000000.0);
+	printf("busy:\t\t%.3f s\n", (double)busy/1000000000.0);
+	if(busy > 0) {
+		printf("throughput:\t%.0f frames/s\n", (double)frames/((double)busy/1000000000.0));
+	}
+
+	printf("\n%-12s %10s %10s %10s %10s %10s\n", "stage", "samples", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+	for(i=0;i<STAGE_NR;i++) {
+		qsort(stages[i].samples, stages[i].nr, sizeof(uint64_t), cmp_uint64);
+		printf("%-12s %10lu %10.1f %10.1f %10.1f %10.1f\n", stages[i].name, stages[i].nr,
+			percentile(&stages[i], 50), percentile(&stages[i], 90),
+			percentile(&stages[i], 99), percentile(&stages[i], 100));
+	}
+
+	qsort(bprotocols, nrbprotocols, sizeof(struct bench_protocol_t), cmp_cputime);
+
+	printf("\n%-24s %10s %10s %12s %12s\n", "protocol", "matched", "decoded", "cpu (ms)", "cpu/frame (us)");
+	for(i=0;i<nrbprotocols;i++) {
+		if(bprotocols[i].cputime == 0) {
+			continue;
+		}
+		printf("%-24s %10lu %10lu %12.3f %12.3f\n", bprotocols[i].protocol->id,
+			bprotocols[i].matched, bprotocols[i].decoded,
+			(double)bprotocols[i].cputime/1000000.0,
+			(frames > 0) ? (double)bprotocols[i].cputime/1000.0/(double)frames : 0.0);
+	}
+}
+
+/*
+ * Both allocators decode the same messages in turns, so
+ * neither of them profits from a warmer cache.
+ */
+static void bench_arena(void) {
+	JsonArena *arena = NULL;
+	JsonNode *json = NULL;
+	uint64_t start = 0, nsmalloc = 0, nsarena = 0;
+	unsigned long i = 0, nr = 0, bytes = 0;
+	int x = 0;
+
+	if(nrrecorded == 0) {
+		printf("\nno messages were decoded, nothing to compare the allocators with\n");
+		return;
+	}
+
+	for(x=0;x<JSON_LOOPS;x++) {
+		start = uv_hrtime();
+		for(i=0;i<nrrecorded;i++) {
+			if((json = json_decode(recorded[i])) != NULL) {
+				json_find_member(json, "message");
+				json_delete(json);
+			}
+		}
+		nsmalloc += uv_hrtime()-start;
+
+		start = uv_hrtime();
+		for(i=0;i<nrrecorded;i++) {
+			arena = json_arena_new();
+			if((json = json_decode_arena(arena, recorded[i])) != NULL) {
+				json_find_member(json, "message");
+			}
+			json_arena_free(arena);
+		}
+		nsarena += uv_hrtime()-start;
+	}
+	nr = nrrecorded*JSON_LOOPS;
+	for(i=0;i<nrrecorded;i++) {
+		bytes += strlen(recorded[i]);
+	}
+	bytes *= JSON_LOOPS;
+
+	printf("\n%-12s %10s %14s %10s\n", "allocator", "messages", "ns/message", "MB/s");
+	printf("%-12s %10lu %14.1f %10.1f\n", "malloc", nr, (double)nsmalloc/(double)nr,
+		(double)bytes/1000.0/((double)nsmalloc/1000000.0));
+	printf("%-12s %10lu %14.1f %10.1f\n", "arena", nr, (double)nsarena/(double)nr,
+		(double)bytes/1000.0/((double)nsarena/1000000.0));
+}
+
+static void bench_json_row(const char *name, size_t len, uint64_t ns, int iterations) {
+	printf("%-12s %12.3f %10.1f\n", name,
+		(double)ns/1000000.0/(double)iterations,
+		(double)len*(double)iterations/1000.0/((double)ns/1000000.0));
+}
+
+static int bench_json(char *file, int iterations) {
+	JsonArena *arena = NULL;
+	JsonNode *json = NULL;
+	char *content = NULL;
+	uint64_t start = 0, nsvalidate = 0, nsmalloc = 0, nsarena = 0;
+	size_t len = 0;
+	int i = 0;
+
+	if(file_get_contents(file, &content) != 0) {
+		return -1;
+	}
+	if((json = json_decode(content)) == NULL) {
+		logprintf(LOG_ERR, "%s does not contain valid JSON", file);
+		FREE(content);
+		return -1;
+	}
+	json_delete(json);
+	len = strlen(content);
+
+	for(i=0;i<iterations;i++) {
+		start = uv_hrtime();
+		json_validate(content);
+		nsvalidate += uv_hrtime()-start;
+
+		start = uv_hrtime();
+		json = json_decode(content);
+		json_delete(json);
+		nsmalloc += uv_hrtime()-start;
+
+		start = uv_hrtime();
+		arena = json_arena_new();
+		json_decode_arena(arena, content);
+		json_arena_free(arena);
+		nsarena += uv_hrtime()-start;
+	}
+
+	printf("%s: %lu bytes, %d times\n\n", file, (unsigned long)len, iterations);
+	printf("%-12s %12s %10s\n", "parser", "ms/parse", "MB/s");
+	bench_json_row("validate", len, nsvalidate, iterations);
+	bench_json_row("malloc", len, nsmalloc, iterations);
+	bench_json_row("arena", len, nsarena, iterations);
+
+	FREE(content);
+	return 0;
+}
+
+/* Always the same noise, so runs can be compared */
+static unsigned int noise(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/*
+ * Fill in the first value that createCode accepts for each
+ * id option and use the first state the protocol knows.
+ */
+static int bench_create(struct protocol_t *protocol, int *raw) {
+	const char *strings[] = { "A", "1", "a" };
+	const int numbers[] = { 1, 0, 2, 10, 100 };
+	struct options_t *options = protocol->options;
+	struct JsonNode *code = NULL;
+	int level = log_level_get(), state = 0, i = 0, x = 0, r = -1;
+	int nrids = 0, ids[8];
+
+	code = json_mkobject();
+	while(options != NULL) {
+		if(options->conftype == DEVICES_STATE && options->argtype == OPTION_NO_VALUE && state == 0) {
+			json_append_member(code, options->name, json_mknumber(1, 0));
+			state = 1;
+		} else if(options->conftype == DEVICES_ID && nrids < 8) {
+			ids[nrids++] = options->vartype;
+		}
+		options = options->next;
+	}
+
+	/* Most tries are expected to fail on a range check */
+	log_level_set(LOG_EMERG);
+
+	for(i=0;i<5 && r != 0;i++) {
+		struct JsonNode *jchild = NULL;
+
+		options = protocol->options;
+		x = 0;
+		while(options != NULL) {
+			if(options->conftype == DEVICES_ID && x < nrids) {
+				if((jchild = json_find_member(code, options->name)) != NULL) {
+					json_remove_from_parent(jchild);
+					json_delete(jchild);
+				}
+				if(ids[x++] == JSON_STRING) {
+					json_append_member(code, options->name, json_mkstring(strings[i % 3]));
+				} else {
+					json_append_member(code, options->name, json_mknumber(numbers[i], 0));
+				}
+			}
+			options = options->next;
+		}
+
+		memset(raw, 0, sizeof(int)*MAXPULSESTREAMLENGTH);
+		protocol->raw = raw;
+		protocol->rawlen = 0;
+		r = protocol->createCode(code);
+		if(protocol->message != NULL) {
+			json_delete(protocol->message);
+			protocol->message = NULL;
+		}
+	}
+
+	log_level_set(level);
+	json_delete(code);
+
+	if(r != 0 || protocol->rawlen <= 0 || protocol->rawlen > MAXPULSESTREAMLENGTH) {
+		return -1;
+	}
+	return protocol->rawlen;
+}
+
+/*
+ * Returns the total number of nanoseconds validate
+ * and parseCode took for all iterations.
+ */
+static uint64_t bench_decode(struct protocol_t *protocol, int *raw, int rawlen, int iterations, unsigned long *decoded) {
+	uint64_t start = uv_hrtime();
+	int i = 0;
+
+	for(i=0;i<iterations;i++) {
+		protocol->raw = raw;
+		protocol->rawlen = rawlen;
+		protocol->repeats = 1;
+		if(protocol->validate() == 0) {
+			protocol->parseCode();
+			if(protocol->message != NULL) {
+				(*decoded)++;
+				json_delete(protocol->message);
+				protocol->message = NULL;
+			}
+		}
+	}
+	return uv_hrtime()-start;
+}
+
+static void bench_protocols(int iterations) {
+	struct protocols_t *pnode = protocols;
+	struct protocol_t *protocol = NULL;
+	int raw[MAXPULSESTREAMLENGTH], frame[MAXPULSESTREAMLENGTH];
+	int rawlen = 0, len = 0, i = 0, x = 0;
+	unsigned long decoded = 0, ndecoded = 0;
+	uint64_t code = 0, nsnoise = 0;
+
+	printf("%-32s %6s %12s %8s %12s %8s\n", "protocol", "rawlen", "code (ns)", "decoded", "noise (ns)", "decoded");
+
+	while(pnode != NULL) {
+		protocol = pnode->listener;
+		pnode = pnode->next;
+
+		if(protocol->validate == NULL || protocol->parseCode == NULL) {
+			continue;
+		}
+
+		code = 0;
+		decoded = 0;
+		rawlen = -1;
+		if(protocol->createCode != NULL) {
+			rawlen = bench_create(protocol, raw);
+		}
+		if(rawlen > 0) {
+			memcpy(frame, raw, sizeof(int)*rawlen);
+			code = bench_decode(protocol, frame, rawlen, iterations, &decoded);
+		}
+
+		/*
+		 * Noise of the length the protocol expects reaches further
+		 * into parseCode than noise of an arbitrary length.
+		 */
+		if(rawlen <= 0) {
+			rawlen = (protocol->minrawlen > 0) ? protocol->minrawlen : protocol->rawlen;
+		}
+		if(rawlen <= 1 || rawlen > MAXPULSESTREAMLENGTH) {
+			rawlen = 50;
+		}
+
+		nsnoise = 0;
+		ndecoded = 0;
+		for(i=0;i<NOISE_FRAMES;i++) {
+			len = rawlen;
+			for(x=0;x<len-1;x++) {
+				frame[x] = 100+(int)(noise() % 1900);
+			}
+			frame[len-1] = 3000+(int)(noise() % 12000);
+			nsnoise += bench_decode(protocol, frame, len, (iterations/NOISE_FRAMES)+1, &ndecoded);
+		}
+
+		printf("%-32s %6d ", protocol->id, rawlen);
+		if(code > 0) {
+			printf("%12.1f %8lu ", (double)code/(double)iterations, decoded);
+		} else {
+			printf("%12s %8s ", "-", "-");
+		}
+		printf("%12.1f %8lu\n", (double)nsnoise/(double)(NOISE_FRAMES*((iterations/NOISE_FRAMES)+1)), ndecoded);
+	}
+}
+
+int main(int argc, char **argv) {
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	memcpy((void *)&pth_main_id, &pth_cur_id, sizeof(uv_thread_t));
+
+	atomicinit();
+	struct options_t *options = NULL;
+	struct capture_t *capture = NULL;
+	struct capture_frame_t frame;
+	char *configtmp = CONFIG_FILE;
+	char *file = NULL, *jsonfile = NULL;
+	int help = 0, realtime = 0, loops = 1, loop = 0, r = 0, micro = 0, arena = 0;
+	uint64_t start = 0, offset = 0, last = 0;
+
+	gc_attach(main_gc);
+
+	/* Catch all exit signals for gc */
+	gc_catch();
+
+	if((progname = MALLOC(14)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(progname, "pilight-bench");
+
+	log_shell_enable();
+	log_file_disable();
+	log_level_set(LOG_NOTICE);
+
+	options_add(&options, "H", "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "V", "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "C", "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "f", "file", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "r", "realtime", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "n", "loops", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]+");
+	options_add(&options, "p", "protocols", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "a", "arena", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "j", "json", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "Ll", "lua-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+
+	if(options_parse(options, argc, argv, 1) == -1) {
+		help = 1;
+	}
+
+	if(options_exists(options, "H") == 0 || help == 1) {
+		printf("Usage: %s [options]\n", progname);
+		printf("\t -H  --help\t\t\tdisplay usage summary\n");
+		printf("\t -V  --version\t\t\tdisplay version\n");
+		printf("\t -C  --config\t\t\tconfig file\n");
+		printf("\t -f  --file=xxxx\t\tcapture recorded with pilight-daemon --record\n");
+		printf("\t -r  --realtime\t\t\treplay at the recorded speed\n");
+		printf("\t -n  --loops=xxxx\t\treplay the capture xxxx times\n");
+		printf("\t -p  --protocols\t\tbenchmark the decoding of each protocol\n");
+		printf("\t -a  --arena\t\t\tcompare malloc and arena decoding of the messages\n");
+		printf("\t -j  --json=xxxx\t\tbenchmark decoding the JSON file xxxx\n");
+		printf("\t -Ls --storage-root=xxxx\tlocation of the storage lua modules\n");
+		printf("\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n");
+		goto close;
+	}
+
+	if(options_exists(options, "V") == 0) {
+		printf("%s v%s\n", progname, PILIGHT_VERSION);
+		goto close;
+	}
+
+	if(options_exists(options, "C") == 0) {
+		options_get_string(options, "C", &configtmp);
+	}
+
+	if(options_exists(options, "p") == 0) {
+		micro = 1;
+		loops = 10000;
+	}
+
+	if(options_exists(options, "j") == 0) {
+		options_get_string(options, "j", &jsonfile);
+		loops = 100;
+	}
+
+	if(options_exists(options, "f") == 0) {
+		options_get_string(options, "f", &file);
+	} else if(micro == 0 && jsonfile == NULL) {
+		logprintf(LOG_ERR, "a capture file is required");
+		goto close;
+	}
+
+	if(options_exists(options, "r") == 0) {
+		realtime = 1;
+	}
+
+	if(options_exists(options, "a") == 0) {
+		arena = 1;
+	}
+
+	if(options_exists(options, "n") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "n", &arg);
+		if((loops = atoi(arg)) <= 0) {
+			loops = 1;
+		}
+	}
+
+	if(options_exists(options, "Ls") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "Ls", &arg);
+		if(config_root(arg) == -1) {
+			logprintf(LOG_ERR, "%s is not valid storage lua modules path", arg);
+			goto close;
+		}
+	}
+
+	if(options_exists(options, "Ll") == 0) {
+		options_get_string(options, "Ll", &lua_root);
+	}
+
+	{
+		int len = strlen(lua_root)+strlen("lua/?/?.lua")+1;
+		char *lua_path = MALLOC(len);
+
+		if(lua_path == NULL) {
+			OUT_OF_MEMORY
+		}
+
+		plua_init();
+
+		memset(lua_path, '\0', len);
+		snprintf(lua_path, len, "%s/?/?.lua", lua_root);
+		plua_package_path(lua_path);
+
+		memset(lua_path, '\0', len);
+		snprintf(lua_path, len, "%s/?.lua", lua_root);
+		plua_package_path(lua_path);
+
+		FREE(lua_path);
+	}
+
+	if(micro == 1) {
+		protocol_init();
+		bench_protocols(loops);
+		options_delete(options);
+		main_gc();
+		return EXIT_SUCCESS;
+	}
+
+	if(jsonfile != NULL) {
+		r = bench_json(jsonfile, loops);
+		options_delete(options);
+		main_gc();
+		return (r == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(config_set_file(configtmp) == EXIT_FAILURE) {
+		goto close;
+	}
+
+	if((capture = capture_open(file, CAPTURE_READ)) == NULL) {
+		goto close;
+	}
+
+	protocol_init();
+	config_init();
+
+	struct lua_state_t *state = plua_get_free_state();
+	if(config_read(state->L, CONFIG_SETTINGS | CONFIG_REGISTRY | CONFIG_DEVICES) != EXIT_SUCCESS) {
+		assert(plua_check_stack(state->L, 0) == 0);
+		plua_clear_state(state);
+		goto close;
+	}
+	assert(plua_check_stack(state->L, 0) == 0);
+	plua_clear_state(state);
+
+	{
+		struct varcont_t val;
+
+		if(config_snapshot_get("settings", "noise-filter-quality", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			noise_quality = (int)val.number_;
+		}
+		if(config_snapshot_get("settings", "noise-filter-lengths", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			noise_lengths = (int)val.number_;
+		}
+	}
+
+	{
+		struct protocols_t *pnode = protocols;
+		while(pnode != NULL) {
+			if((bprotocols = REALLOC(bprotocols, sizeof(struct bench_protocol_t)*(nrbprotocols+1))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			memset(&bprotocols[nrbprotocols], 0, sizeof(struct bench_protocol_t));
+			bprotocols[nrbprotocols++].protocol = pnode->listener;
+			pnode = pnode->next;
+		}
+	}
+
+	start = uv_hrtime();
+	for(loop=0;loop<loops;loop++) {
+		uint64_t begin = uv_hrtime();
+
+		record = (arena == 1 && loop == 0);
+
+		if(loop > 0) {
+			capture_close(capture);
+			if((capture = capture_open(file, CAPTURE_READ)) == NULL) {
+				break;
+			}
+			/* Keep the repeats of the next loop apart from the last one */
+			offset += last+1000000;
+		}
+
+		while((r = capture_read(capture, &frame)) == 0) {
+			if(realtime == 1) {
+				uint64_t now = (uv_hrtime()-begin)/1000;
+				if(frame.timestamp > now) {
+					usleep(frame.timestamp-now);
+				}
+			}
+			last = frame.timestamp;
+			bench_frame(&frame, offset+frame.timestamp);
+		}
+		if(r == -1) {
+			break;
+		}
+	}
+
+	bench_report(uv_hrtime()-start);
+	if(arena == 1) {
+		bench_arena();
+	}
+
+	capture_close(capture);
+	options_delete(options);
+	main_gc();
+	return EXIT_SUCCESS;
+
+close:
+	if(capture != NULL) {
+		capture_close(capture);
+	}
+	options_delete(options);
+	main_gc();
+
+	return (EXIT_FAILURE);
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -58,10 +59,16 @@
 #include "libs/pilight/core/firmware.h"
 #include "libs/pilight/core/proc.h"
 #include "libs/pilight/core/ntp.h"
+#include "libs/pilight/core/metrics.h"
+#include "libs/pilight/core/dns.h"
+#include "libs/pilight/core/fetch.h"
+#include "libs/pilight/core/capture.h"
+#include "libs/pilight/core/airtime.h"
 #include "libs/pilight/config/config.h"
 #include "libs/pilight/config/hardware.h"
 #include "libs/pilight/lua_c/lua.h"
 #include "libs/pilight/lua_c/table.h"
+#include "libs/pilight/datatypes/ring.h"
 
 #ifdef EVENTS
 	#include "libs/pilight/events/events.h"
@@ -79,6 +86,7 @@
 #include "libs/pilight/config/devices.h"
 #include "libs/pilight/config/settings.h"
 #include "libs/pilight/config/gui.h"
+#include "libs/pilight/config/snapshot.h"
 
 static uv_signal_t **signal_req = NULL;
 static int signals[5] = { SIGINT, SIGQUIT, SIGTERM, SIGABRT, SIGTSTP };
@@ -97,6 +105,7 @@ typedef struct clients_t {
 	int core;
 	int stats;
 	int forward;
+	int batch;
 	char media[8];
 	double cpu;
 	double ram;
@@ -105,65 +114,97 @@ typedef struct clients_t {
 
 static struct clients_t *clients = NULL;
 
+/*
+ * The queues are rings of variable length slots,
+ * so the structs below are only the fixed part of
+ * each slot. The strings and pulses follow directly
+ * and the pointers point inside the same slot.
+ */
+#define SEND_PENDING		0
+#define SEND_ACTIVE			1
+#define SEND_SUPERSEDED	2
+#define SEND_DONE				3
+
+#define SEND_CLASS_RULE	0
+#define SEND_CLASS_BULK	1
+
+#define SEND_POLICY_FIFO			0
+#define SEND_POLICY_AIRTIME		1
+
 typedef struct sendqueue_t {
 	unsigned int id;
+	volatile int state;
 	char *protoname;
 	char *settings;
 	char *message;
+	char *key;
 	enum origin_t origin;
 	struct protocol_t *protopt;
-	int code[MAXPULSESTREAMLENGTH];
-	int length;
 	char uuid[UUID_LENGTH];
-	struct sendqueue_t *next;
+	uint64_t queued;
+	/* 1 while waiting for the duty cycle budget, 2 once sent or superseded */
+	volatile int deferred;
+	int length;
+	int code[];
 } sendqueue_t;
 
-static struct sendqueue_t *sendqueue;
-static struct sendqueue_t *sendqueue_head;
-
 typedef struct recvqueue_t {
-	int raw[MAXPULSESTREAMLENGTH];
 	int rawlen;
 	int hwtype;
 	int plslen;
-	struct recvqueue_t *next;
+	int raw[];
 } recvqueue_t;
 
-static struct recvqueue_t *recvqueue;
-static struct recvqueue_t *recvqueue_head;
-
-static pthread_mutex_t config_lock;
-static pthread_mutexattr_t config_attr;
-
-static pthread_mutex_t sendqueue_lock;
-static pthread_cond_t sendqueue_signal;
-static pthread_mutexattr_t sendqueue_attr;
-static unsigned short sendqueue_init = 0;
-
-static int sendqueue_number = 0;
-static int recvqueue_number = 0;
-
-static pthread_mutex_t recvqueue_lock;
-static pthread_cond_t recvqueue_signal;
-static pthread_mutexattr_t recvqueue_attr;
-static unsigned short recvqueue_init = 0;
-
 typedef struct bcqueue_t {
-	struct JsonNode *jmessage;
+	char *jmessage;
 	char *protoname;
 	enum origin_t origin;
-	struct bcqueue_t *next;
 } bcqueue_t;
 
-static struct bcqueue_t *bcqueue;
-static struct bcqueue_t *bcqueue_head;
-
-static pthread_mutex_t bcqueue_lock;
-static pthread_cond_t bcqueue_signal;
-static pthread_mutexattr_t bcqueue_attr;
-static unsigned short bcqueue_init = 0;
+/*
+ * The sends that are still waiting in the send queue,
+ * so a newer send to the same device can replace them.
+ * Only touched while holding the sendqueue_lock.
+ */
+typedef struct sendqueue_pending_t {
+	unsigned long seq;
+	unsigned int hash;
+	struct sendqueue_t *node;
+} sendqueue_pending_t;
+
+static struct sendqueue_pending_t *sendqueue_pending = NULL;
+static int sendqueue_pending_nr = 0;
+static int sendqueue_pending_size = 0;
+
+static struct ring_dt *sendqueue = NULL;
+static struct ring_dt *recvqueue = NULL;
+static struct ring_dt *bcqueue = NULL;
+
+static int sendqueue_size = SENDQUEUE_SIZE;
+static int recvqueue_size = RECVQUEUE_SIZE;
+static int bcqueue_size = BCQUEUE_SIZE;
+static int luastates = 8;
+
+static struct metric_t *metric_send = NULL;
+static struct metric_t *metric_superseded = NULL;
+static struct metric_t *metric_merged = NULL;
+static struct metric_t *metric_airtime_saved = NULL;
+static struct metric_t *metric_delay[2] = { NULL, NULL };
+static struct metric_t *metric_deferred[2] = { NULL, NULL };
+static volatile int sends_deferred = 0;
+static int send_policy = SEND_POLICY_AIRTIME;
+static struct metric_t *metric_noise = NULL;
+static int noise_quality = NOISE_FILTER_QUALITY;
+static int noise_lengths = NOISE_FILTER_LENGTHS;
+/* Record all received pulse trains */
+static struct capture_t *capture = NULL;
+
+/* Serializes the protocol createCode calls */
+static pthread_mutex_t sendqueue_lock;
+static pthread_mutexattr_t sendqueue_attr;
 
-static int bcqueue_number = 0;
+static pthread_mutex_t config_lock;
+static pthread_mutexattr_t config_attr;
 
 static struct protocol_t *procProtocol;
 
@@ -196,6 +237,17 @@ static char *master_server = NULL;
 static int master_port = 0;
 
 static int adhoc_pending = 0;
+/*
+ * When the master supports it, the receiver codes a
+ * node forwards are collected for adhoc_batch ms and
+ * sent as a single BATCH message. The batch buffer
+ * is only touched by the broadcaster thread.
+ */
+static volatile int adhoc_batch = 0;
+static char *batch_buffer = NULL;
+static size_t batch_len = 0;
+static size_t batch_size = 0;
+static uint64_t batch_start = 0;
 static char *configtmp = NULL;
 static int verbosity = LOG_INFO;
 struct socket_callback_t socket_callback;
@@ -220,6 +272,20 @@ static char *webserver_root = NULL;
 
 static char *lua_root = LUA_ROOT;
 
+static double queue_length(void *param) {
+	struct ring_stats_dt stats;
+
+	dt_ring_stats(param, &stats);
+	return (double)stats.items;
+}
+
+static double queue_dropped(void *param) {
+	struct ring_stats_dt stats;
+
+	dt_ring_stats(param, &stats);
+	return (double)stats.dropped;
+}
+
 static void *reason_forward_free(void *param) {
 	FREE(param);
 	return NULL;
@@ -265,47 +331,96 @@ static void client_remove(int id) {
 	}
 }
 
-static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_t origin) {
+/*
+ * Queue an already serialized message. Unless hasuuid is
+ * set the uuid of this instance is appended to it.
+ */
+static void broadcast_queue_str(char *protoname, const char *jstr, int hasuuid, enum origin_t origin) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(main_loop == 1) {
-		pthread_mutex_lock(&bcqueue_lock);
-		if(bcqueue_number <= 1024) {
-			struct bcqueue_t *bnode = MALLOC(sizeof(struct bcqueue_t));
-			if(bnode == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
-			}
+	if(main_loop == 1 && bcqueue != NULL) {
+		struct bcqueue_t *bnode = NULL;
+		char uuid[UUID_LENGTH+12];
+		size_t jlen = strlen(jstr), plen = strlen(protoname)+1, ulen = 0;
+
+		/*
+		 * Append the uuid to the serialized object
+		 * directly, instead of decoding and encoding
+		 * a copy of the message just for that.
+		 */
+		memset(uuid, 0, sizeof(uuid));
+		if(hasuuid == 0 && jstr[0] == '{' && strlen(pilight_uuid) > 0) {
+			ulen = (size_t)snprintf(uuid, sizeof(uuid), "%s\"uuid\":\"%s\"", (jstr[1] != '}') ? "," : "", pilight_uuid);
+		}
 
-			char *jstr = json_stringify(json, NULL);
-			bnode->jmessage = json_decode(jstr);
-			if(json_find_member(bnode->jmessage, "uuid") == NULL && strlen(pilight_uuid) > 0) {
-				json_append_member(bnode->jmessage, "uuid", json_mkstring(pilight_uuid));
+		if((bnode = dt_ring_reserve(bcqueue, sizeof(struct bcqueue_t)+jlen+ulen+1+plen)) != NULL) {
+			bnode->jmessage = (char *)(bnode+1);
+			bnode->protoname = bnode->jmessage+jlen+ulen+1;
+			if(ulen > 0) {
+				memcpy(bnode->jmessage, jstr, jlen-1);
+				memcpy(&bnode->jmessage[jlen-1], uuid, ulen);
+				strcpy(&bnode->jmessage[jlen+ulen-1], "}");
+			} else {
+				memcpy(bnode->jmessage, jstr, jlen+1);
 			}
-			json_free(jstr);
+			memcpy(bnode->protoname, protoname, plen);
+			bnode->origin = origin;
 
-			if((bnode->protoname = MALLOC(strlen(protoname)+1)) == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
-			}
-			strcpy(bnode->protoname, protoname);
+			dt_ring_commit(bcqueue);
+		} else {
+			logprintf(LOG_ERR, "broadcast queue full");
+		}
+	}
+}
 
-			bnode->origin = origin;
+static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_t origin) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-			if(bcqueue_number == 0) {
-				bcqueue = bnode;
-				bcqueue_head = bnode;
-			} else {
-				bcqueue_head->next = bnode;
-				bcqueue_head = bnode;
-			}
+	if(main_loop == 1 && bcqueue != NULL) {
+		char *jstr = json_stringify(json, NULL);
+		int hasuuid = (json->tag != JSON_OBJECT || json_find_member(json, "uuid") != NULL);
 
-			bcqueue_number++;
+		broadcast_queue_str(protoname, jstr, hasuuid, origin);
+		json_free(jstr);
+	}
+}
+
+static void batch_flush(void) {
+	if(batch_len > 0) {
+		if(sockfd > 0 && adhoc_batch > 0) {
+			socket_write(sockfd, "%s", batch_buffer);
 		} else {
-			logprintf(LOG_ERR, "broadcast queue full");
+			logprintf(LOG_DEBUG, "dropped batch for lost master connection");
 		}
-		pthread_mutex_unlock(&bcqueue_lock);
-		pthread_cond_signal(&bcqueue_signal);
+		batch_len = 0;
+	}
+}
+
+static void batch_append(char *protoname, char *message) {
+	size_t plen = strlen(protoname), mlen = strlen(message);
+	size_t need = plen+mlen+24;
+
+	if(batch_len > 0 && batch_len+need > ADHOC_BATCH_SIZE) {
+		batch_flush();
+	}
+	if(batch_len+need+7 > batch_size) {
+		batch_size = batch_len+need+7;
+		if(batch_size < ADHOC_BATCH_SIZE) {
+			batch_size = ADHOC_BATCH_SIZE;
+		}
+		if((batch_buffer = REALLOC(batch_buffer, batch_size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	if(batch_len == 0) {
+		strcpy(batch_buffer, "BATCH ");
+		batch_len = 6;
+		batch_start = uv_hrtime();
+	}
+	batch_len += (size_t)sprintf(&batch_buffer[batch_len], "%s:%lu:%s", protoname, (unsigned long)mlen, message);
+
+	if(batch_len >= ADHOC_BATCH_SIZE) {
+		batch_flush();
 	}
 }
 
@@ -313,23 +428,29 @@ void *broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	int broadcasted = 0/*, free_conf = 1*/;
+	struct bcqueue_t *bnode = NULL;
+	struct JsonArena *arena = NULL;
 
-	pthread_mutex_lock(&bcqueue_lock);
 	while(main_loop) {
-		if(bcqueue_number > 0) {
-			pthread_mutex_lock(&bcqueue_lock);
-
+		if((bnode = dt_ring_peek(bcqueue, NULL)) != NULL) {
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
+			/*
+			 * All trees decoded for this message only live until
+			 * the next one, so take them from a single arena.
+			 */
+			arena = json_arena_new();
+			struct JsonNode *jmessage = json_decode_arena(arena, bnode->jmessage);
+
 			broadcasted = 0;
 			struct JsonNode *jret = NULL;
 			char *origin = NULL;
 
-			if(json_find_string(bcqueue->jmessage, "origin", &origin) == 0) {
+			if(json_find_string(jmessage, "origin", &origin) == 0) {
 				if(strcmp(origin, "core") == 0) {
 					double tmp = 0;
-					json_find_number(bcqueue->jmessage, "type", &tmp);
-					char *conf = json_stringify(bcqueue->jmessage, NULL);
+					json_find_number(jmessage, "type", &tmp);
+					char *conf = json_stringify(jmessage, NULL);
 					struct clients_t *tmp_clients = clients;
 					while(tmp_clients) {
 						if(((int)tmp < 0 && tmp_clients->core == 1) ||
@@ -342,8 +463,10 @@ void *broadcast(void *param) {
 					}
 
 					if(pilight.runmode == ADHOC && sockfd > 0) {
-						struct JsonNode *jupdate = json_decode(conf);
-						json_append_member(jupdate, "action", json_mkstring("update"));
+						/* Keep the order of the codes sent to the master */
+						batch_flush();
+						struct JsonNode *jupdate = json_decode_arena(arena, conf);
+						json_append_member(jupdate, "action", json_mkstring_arena(arena, "update"));
 						char *ret = json_stringify(jupdate, NULL);
 						socket_write(sockfd, ret);
 						broadcasted = 1;
@@ -356,14 +479,14 @@ void *broadcast(void *param) {
 					eventpool_trigger(REASON_BROADCAST_CORE, reason_broadcast_core_free, conf);
 				} else {
 					/* Update the config */
-					if(devices_update(bcqueue->protoname, bcqueue->jmessage, bcqueue->origin, &jret) == 0) {
+					if(devices_update(bnode->protoname, jmessage, bnode->origin, &jret) == 0) {
 						char *tmp = json_stringify(jret, NULL);
 						struct clients_t *tmp_clients = clients;
 						unsigned short match1 = 0, match2 = 0;
 
 						while(tmp_clients) {
 							if(tmp_clients->config == 1) {
-								struct JsonNode *jtmp = json_decode(tmp);
+								struct JsonNode *jtmp = json_decode_arena(arena, tmp);
 								struct JsonNode *jdevices = json_find_member(jtmp, "devices");
 								if(jdevices != NULL) {
 									match1 = 0;
@@ -418,23 +541,23 @@ void *broadcast(void *param) {
 					/* The settings objects inside the broadcast queue is only of interest for the
 					   internal pilight functions. For the outside world we only communicate the
 					   message part of the queue so we remove the settings */
-					char *internal = json_stringify(bcqueue->jmessage, NULL);
+					char *internal = json_stringify(jmessage, NULL);
 
 					struct JsonNode *jsettings = NULL;
-					if((jsettings = json_find_member(bcqueue->jmessage, "settings"))) {
+					if((jsettings = json_find_member(jmessage, "settings"))) {
 						json_remove_from_parent(jsettings);
 						json_delete(jsettings);
 					}
-					struct JsonNode *tmp = json_find_member(bcqueue->jmessage, "action");
+					struct JsonNode *tmp = json_find_member(jmessage, "action");
 					if(tmp != NULL && tmp->tag == JSON_STRING && strcmp(tmp->string_, "update") == 0) {
 						json_remove_from_parent(tmp);
 						json_delete(tmp);
 					}
 
-					char *out = json_stringify(bcqueue->jmessage, NULL);
-					if(strcmp(bcqueue->protoname, "pilight_firmware") == 0) {
+					char *out = json_stringify(jmessage, NULL);
+					if(strcmp(bnode->protoname, "pilight_firmware") == 0) {
 						struct JsonNode *code = NULL;
-						if((code = json_find_member(bcqueue->jmessage, "message")) != NULL) {
+						if((code = json_find_member(jmessage, "message")) != NULL) {
 							json_find_number(code, "version", &firmware.version);
 							json_find_number(code, "lpf", &firmware.lpf);
 							json_find_number(code, "hpf", &firmware.hpf);
@@ -464,7 +587,7 @@ void *broadcast(void *param) {
 					}
 					broadcasted = 0;
 
-					struct JsonNode *childs = json_first_child(bcqueue->jmessage);
+					struct JsonNode *childs = json_first_child(jmessage);
 					int nrchilds = 0;
 					while(childs) {
 						nrchilds++;
@@ -484,13 +607,18 @@ void *broadcast(void *param) {
 					}
 
 					if(pilight.runmode == ADHOC && sockfd > 0) {
-						struct JsonNode *jupdate = json_decode(internal);
-						json_append_member(jupdate, "action", json_mkstring("update"));
-						char *ret = json_stringify(jupdate, NULL);
-						socket_write(sockfd, ret);
+						if(adhoc_batch > 0 && strstr(internal, "\"protocol\":") != NULL) {
+							batch_append(bnode->protoname, internal);
+						} else {
+							batch_flush();
+							struct JsonNode *jupdate = json_decode_arena(arena, internal);
+							json_append_member(jupdate, "action", json_mkstring_arena(arena, "update"));
+							char *ret = json_stringify(jupdate, NULL);
+							socket_write(sockfd, ret);
+							json_delete(jupdate);
+							json_free(ret);
+						}
 						broadcasted = 1;
-						json_delete(jupdate);
-						json_free(ret);
 					}
 					if((broadcasted == 1 || nodaemon == 1) && (strcmp(out, "{}") != 0 && nrchilds > 1)) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", out);
@@ -500,54 +628,62 @@ void *broadcast(void *param) {
 					eventpool_trigger(REASON_BROADCAST_CORE, reason_broadcast_core_free, out);
 				}
 			}
-			struct bcqueue_t *tmp = bcqueue;
-			FREE(tmp->protoname);
-			json_delete(tmp->jmessage);
-			bcqueue = bcqueue->next;
-			FREE(tmp);
-			bcqueue_number--;
-			pthread_mutex_unlock(&bcqueue_lock);
-		} else {
-			pthread_cond_wait(&bcqueue_signal, &bcqueue_lock);
+			json_delete(jmessage);
+			json_arena_free(arena);
+			dt_ring_release(bcqueue);
+		} else if(batch_len > 0) {
+			/* Wait for more codes until the batch window closes */
+			uint64_t now = uv_hrtime(), window = (uint64_t)adhoc_batch*1000000;
+			if(now-batch_start >= window) {
+				batch_flush();
+			} else if(dt_ring_timedwait(bcqueue, window-(now-batch_start)) == -1) {
+				break;
+			}
+		} else if(dt_ring_wait(bcqueue) == -1) {
+			break;
 		}
 	}
+	if(batch_buffer != NULL) {
+		FREE(batch_buffer);
+	}
+	batch_len = 0;
+	batch_size = 0;
 	return (void *)NULL;
 }
 
 static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	int i = 0;
+	struct recvqueue_t *rnode = NULL;
 
-	if(main_loop == 1) {
-		pthread_mutex_lock(&recvqueue_lock);
-		if(recvqueue_number <= 1024) {
-			struct recvqueue_t *rnode = MALLOC(sizeof(struct recvqueue_t));
-			if(rnode == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
-			}
-			for(i=0;i<rawlen;i++) {
-				rnode->raw[i] = raw[i];
-			}
+	if(main_loop == 1 && recvqueue != NULL) {
+		if(rawlen > MAXPULSESTREAMLENGTH) {
+			rawlen = MAXPULSESTREAMLENGTH;
+		}
+		if(capture != NULL) {
+			capture_write(capture, raw, rawlen, plslen, hwtype);
+		}
+		if((rnode = dt_ring_reserve(recvqueue, sizeof(struct recvqueue_t)+(sizeof(int)*rawlen))) != NULL) {
+			memcpy(rnode->raw, raw, sizeof(int)*rawlen);
 			rnode->rawlen = rawlen;
 			rnode->plslen = plslen;
 			rnode->hwtype = hwtype;
 
-			if(recvqueue_number == 0) {
-				recvqueue = rnode;
-				recvqueue_head = rnode;
-			} else {
-				recvqueue_head->next = rnode;
-				recvqueue_head = rnode;
-			}
-
-			recvqueue_number++;
+			dt_ring_commit(recvqueue);
 		} else {
 			logprintf(LOG_ERR, "receiver queue full");
 		}
-		pthread_mutex_unlock(&recvqueue_lock);
-		pthread_cond_signal(&recvqueue_signal);
+	}
+}
+
+static void receiver_metrics(protocol_t *protocol) {
+	char labels[255];
+
+	if(protocol->received == NULL) {
+		snprintf(labels, sizeof(labels), "protocol=\"%s\"", protocol->id);
+		protocol->received = metrics_counter("pilight_frames_received_total", labels, "Codes matching the pulse train of a protocol");
+		protocol->decoded = metrics_counter("pilight_frames_decoded_total", labels, "Codes decoded into a message");
+		protocol->dropped = metrics_counter("pilight_frames_dropped_total", labels, "Codes that did not result in a valid message");
 	}
 }
 
@@ -555,29 +691,32 @@ static void receiver_create_message(protocol_t *protocol) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	if(protocol->message != NULL) {
-		char *valid = json_stringify(protocol->message, NULL);
-		json_delete(protocol->message);
-		if(valid != NULL && json_validate(valid) == true) {
-			struct JsonNode *jmessage = json_mkobject();
-
-			json_append_member(jmessage, "message", json_decode(valid));
-			json_append_member(jmessage, "origin", json_mkstring("receiver"));
-			json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
+		receiver_metrics(protocol);
+		/* Checking the tree is cheaper than parsing its output again */
+		if(json_check(protocol->message, NULL) == true) {
+			metrics_inc(protocol->decoded, 1);
+			JsonWriter w;
+
+			json_writer_init(&w);
+			json_writer_begin_object(&w, NULL);
+			json_writer_node(&w, "message", protocol->message);
+			json_writer_string(&w, "origin", "receiver");
+			json_writer_string(&w, "protocol", protocol->id);
 			if(strlen(pilight_uuid) > 0) {
-				json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
+				json_writer_string(&w, "uuid", pilight_uuid);
 			}
 			if(protocol->repeats > -1) {
-				json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
+				json_writer_number(&w, "repeats", protocol->repeats, 0);
 			}
-			char *output = json_stringify(jmessage, NULL);
-			struct JsonNode *json = json_decode(output);
-			broadcast_queue(protocol->id, json, RECEIVER);
+			json_writer_end_object(&w);
+
+			char *output = json_writer_finish(&w);
+			broadcast_queue_str(protocol->id, output, 1, RECEIVER);
 			json_free(output);
-			json_delete(json);
-			json = NULL;
-			json_delete(jmessage);
+		} else {
+			metrics_inc(protocol->dropped, 1);
 		}
-		json_free(valid);
+		json_delete(protocol->message);
 	}
 	protocol->message = NULL;
 }
@@ -616,76 +755,233 @@ static void *receiveAPI1(int reason, void *param, void *userdata) {
 	return NULL;
 }
 
+static int receive_parse_protocol(struct protocol_t *protocol, int matched, void *userdata) {
+	struct recvqueue_t *rnode = userdata;
+
+	if(matched == 1) {
+		logprintf(LOG_DEBUG, "recevied pulse length of %d", rnode->plslen);
+		receiver_metrics(protocol);
+		metrics_inc(protocol->received, 1);
+		if(protocol->message == NULL) {
+			metrics_inc(protocol->dropped, 1);
+		}
+		receiver_create_message(protocol);
+	}
+	return (main_loop == 1) ? 0 : -1;
+}
+
 void *receive_parse_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	pthread_mutex_lock(&recvqueue_lock);
-	while(main_loop) {
-		if(recvqueue_number > 0) {
-			pthread_mutex_lock(&recvqueue_lock);
+	struct recvqueue_t *rnode = NULL;
 
+	while(main_loop) {
+		if((rnode = dt_ring_peek(recvqueue, NULL)) != NULL) {
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
-			struct protocol_t *protocol = NULL;
-			struct protocols_t *pnode = protocols;
+			gettimeofday(&tv, NULL);
+			if(protocol_dispatch(rnode->raw, rnode->rawlen, rnode->hwtype,
+				 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec,
+				 noise_quality, noise_lengths, receive_parse_protocol, rnode) == -1) {
+				metrics_inc(metric_noise, 1);
+			}
+
+			dt_ring_release(recvqueue);
+		} else if(dt_ring_wait(recvqueue) == -1) {
+			break;
+		}
+	}
+	return (void *)NULL;
+}
 
-			while(pnode != NULL && main_loop) {
-				protocol = pnode->listener;
+/*
+ * Sends triggered by rules go before the sends
+ * of users, the webGUI and other bulk senders.
+ */
+static int send_class(struct sendqueue_t *snode) {
+	if(snode->origin == ORIGIN_ACTION || snode->origin == ORIGIN_RULE) {
+		return SEND_CLASS_RULE;
+	}
+	return SEND_CLASS_BULK;
+}
 
-				if((protocol->hwtype == recvqueue->hwtype || protocol->hwtype == -1 || recvqueue->hwtype == -1) &&
-				   (protocol->parseCode != NULL && protocol->validate != NULL)) {
+static uint64_t send_airtime(struct sendqueue_t *snode) {
+	struct protocol_t *protocol = snode->protopt;
 
-					if(recvqueue->rawlen < MAXPULSESTREAMLENGTH) {
-						protocol->raw = recvqueue->raw;
-					}
-					protocol->rawlen = recvqueue->rawlen;
+	if(protocol->hwtype == RF433 || protocol->hwtype == RF868) {
+		return airtime_frame(snode->code, snode->length, protocol->txrpt);
+	}
+	return 0;
+}
 
-					if(protocol->validate() == 0) {
-						logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
-						gettimeofday(&tv, NULL);
-						if(protocol->first > 0) {
-							protocol->first = protocol->second;
-						}
-						protocol->second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
-						if(protocol->first == 0) {
-							protocol->first = protocol->second;
-						}
+static void send_code_node(struct sendqueue_t *snode) {
+	int i = 0;
 
-						/* Reset # of repeats after a certain delay */
-						if(((int)protocol->second-(int)protocol->first) > 500000) {
-							protocol->repeats = 0;
-						}
+	sending = 1;
 
-						protocol->repeats++;
-						if(protocol->parseCode != NULL) {
-							logprintf(LOG_DEBUG, "recevied pulse length of %d", recvqueue->plslen);
-							logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", protocol->repeats, protocol->id);
-							logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
-							protocol->parseCode();
-							receiver_create_message(protocol);
-						}
-					}
+	struct protocol_t *protocol = snode->protopt;
+
+	/*
+	 * The message and settings were serialized and
+	 * validated by send_queue, so they can be copied
+	 * into the broadcast as is.
+	 */
+	JsonWriter w;
+	int message = 0, hasuuid = 0;
+
+	if(snode->message != NULL && strcmp(snode->message, "{}") != 0) {
+		json_writer_init(&w);
+		json_writer_begin_object(&w, NULL);
+		message = 1;
+
+		json_writer_string(&w, "origin", "sender");
+		json_writer_string(&w, "protocol", protocol->id);
+		json_writer_raw(&w, "message", snode->message);
+		if(strlen(snode->uuid) > 0) {
+			json_writer_string(&w, "uuid", snode->uuid);
+			hasuuid = 1;
+		}
+		json_writer_number(&w, "repeat", 1, 0);
+	}
+	if(snode->settings != NULL && strcmp(snode->settings, "{}") != 0) {
+		if(message == 0) {
+			json_writer_init(&w);
+			json_writer_begin_object(&w, NULL);
+			message = 1;
+		}
+		json_writer_raw(&w, "settings", snode->settings);
+	}
+
+	if(protocol->hwtype == RF433 || protocol->hwtype == RF868) {
+		logprintf(LOG_DEBUG, "**** RAW CODE ****");
+		if(log_level_get() >= LOG_DEBUG) {
+			for(i=0;i<snode->length;i++) {
+				printf("%d ", snode->code[i]);
+			}
+			printf("\n");
+		}
+		logprintf(LOG_DEBUG, "**** RAW CODE ****");
+
+		struct plua_metatable_t *table = NULL;
+		plua_metatable_init(&table);
+
+		char key[255];
+		memset(&key, 0, 255);
+
+		plua_metatable_set_number(table, "rawlen", snode->length);
+		plua_metatable_set_number(table, "txrpt", protocol->txrpt);
+		plua_metatable_set_string(table, "protocol", protocol->id);
+		plua_metatable_set_number(table, "hwtype", protocol->hwtype);
+		plua_metatable_set_string(table, "uuid", "0");
+
+		for(i=0;i<snode->length;i++) {
+			snprintf(key, 255, "pulses.%d", i+1);
+			plua_metatable_set_number(table, key, snode->code[i]);
+		}
+
+		eventpool_trigger(REASON_SEND_CODE+10000, reason_send_code_free, table);
+		metrics_observe(metric_send, (double)(uv_hrtime()-snode->queued)/1000000000);
+		metrics_observe(metric_delay[send_class(snode)], (double)(uv_hrtime()-snode->queued)/1000000000);
+	}
+
+	if(strcmp(protocol->id, "raw") == 0) {
+		int plslen = snode->code[snode->length-1]/PULSE_DIV;
+		receive_queue(snode->code, snode->length, plslen, -1);
+	}
+
+	if(message == 1) {
+		json_writer_end_object(&w);
+		char *out = json_writer_finish(&w);
+		broadcast_queue_str(snode->protoname, out, hasuuid, snode->origin);
+		json_free(out);
+	}
+
+	sending = 0;
+}
+
+/*
+ * Sends waiting for the duty cycle budget keep their slot,
+ * and no slot after them can be released before they were
+ * sent. They are counted, so a send queue filled up by a
+ * band without budget can be told apart from a busy one.
+ */
+static void send_defer(struct sendqueue_t *snode) {
+	int band = (snode->protopt->hwtype == RF868) ? 1 : 0;
+
+	if(__sync_bool_compare_and_swap(&snode->deferred, 0, 1) == 1) {
+		__sync_add_and_fetch(&sends_deferred, 1);
+		metrics_add(metric_deferred[band], 1);
+	}
+}
+
+static void send_undefer(struct sendqueue_t *snode) {
+	int band = (snode->protopt->hwtype == RF868) ? 1 : 0;
+
+	if(__sync_lock_test_and_set(&snode->deferred, 2) == 1) {
+		__sync_sub_and_fetch(&sends_deferred, 1);
+		metrics_add(metric_deferred[band], -1);
+	}
+}
+
+/*
+ * Picks the next send with the airtime policy. Every
+ * class keeps its order within a band, but a rule send
+ * can pass bulk sends and a band that ran out of its
+ * duty cycle budget doesn't hold up the other bands.
+ * A band a rule send is waiting on is closed to bulk
+ * sends, so they can't keep using up the budget the
+ * rule send needs. When nothing can be sent, delay is
+ * set to the number of microseconds until something can.
+ */
+static struct sendqueue_t *send_code_next(uint64_t *delay) {
+	struct sendqueue_t *snode = NULL;
+	int blocked[SHELLY+1], class = 0, hwtype = 0;
+	uint64_t d = 0;
+
+	memset(blocked, 0, sizeof(blocked));
+	*delay = 0;
+
+	/*
+	 * Rule sends go first. The bands they left blocked
+	 * stay blocked while looking for a bulk send.
+	 */
+	for(class=SEND_CLASS_RULE;class<=SEND_CLASS_BULK;class++) {
+		snode = NULL;
+		while((snode = dt_ring_next(sendqueue, snode, NULL)) != NULL) {
+			if(snode->state != SEND_PENDING) {
+				continue;
+			}
+			hwtype = snode->protopt->hwtype;
+			if(hwtype < 0 || hwtype > SHELLY) {
+				hwtype = RFNONE;
+			}
+			if(blocked[hwtype] == 1) {
+				send_defer(snode);
+				continue;
+			}
+			if(send_class(snode) != class) {
+				continue;
+			}
+
+			if((d = airtime_delay(hwtype, send_airtime(snode))) > 0) {
+				send_defer(snode);
+				blocked[hwtype] = 1;
+				if(*delay == 0 || d < *delay) {
+					*delay = d;
 				}
-				pnode = pnode->next;
+				continue;
 			}
 
-			struct recvqueue_t *tmp = recvqueue;
-			recvqueue = recvqueue->next;
-			FREE(tmp);
-			recvqueue_number--;
-			pthread_mutex_unlock(&recvqueue_lock);
-		} else {
-			pthread_cond_wait(&recvqueue_signal, &recvqueue_lock);
+			return snode;
 		}
 	}
-	return (void *)NULL;
+
+	return NULL;
 }
 
 void *send_code(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	int i = 0;
-
 	/* Make sure the pilight sender gets
 	   the highest priority available */
 #ifdef _WIN32
@@ -697,102 +993,209 @@ void *send_code(void *param) {
 	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
 #endif
 
-	pthread_mutex_lock(&sendqueue_lock);
+	struct sendqueue_t *snode = NULL;
+	struct ring_stats_dt stats;
+	uint64_t delay = 0;
 
 	while(main_loop) {
-		if(sendqueue_number > 0) {
-			pthread_mutex_lock(&sendqueue_lock);
-
-			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+		if(send_policy == SEND_POLICY_FIFO) {
+			if((snode = dt_ring_peek(sendqueue, NULL)) != NULL) {
+				logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+
+				/* A newer send to the same device replaced this one */
+				if(__sync_bool_compare_and_swap(&snode->state, SEND_PENDING, SEND_ACTIVE) == 1) {
+					send_code_node(snode);
+					airtime_use(snode->protopt->hwtype, send_airtime(snode));
+				}
+				dt_ring_release(sendqueue);
+			} else if(dt_ring_wait(sendqueue) == -1) {
+				break;
+			}
+			continue;
+		}
 
-			sending = 1;
+		/*
+		 * With the airtime policy sends can leave out of
+		 * order, so a slot is only released once all slots
+		 * before it were sent or superseded.
+		 */
+		while((snode = dt_ring_peek(sendqueue, NULL)) != NULL &&
+			(snode->state == SEND_DONE || snode->state == SEND_SUPERSEDED)) {
+			dt_ring_release(sendqueue);
+		}
+		if(snode == NULL) {
+			if(dt_ring_wait(sendqueue) == -1) {
+				break;
+			}
+			continue;
+		}
 
-			struct protocol_t *protocol = sendqueue->protopt;
+		dt_ring_stats(sendqueue, &stats);
+		if((snode = send_code_next(&delay)) != NULL) {
+			if(__sync_bool_compare_and_swap(&snode->state, SEND_PENDING, SEND_ACTIVE) == 1) {
+				logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+				send_undefer(snode);
+				send_code_node(snode);
+				airtime_use(snode->protopt->hwtype, send_airtime(snode));
+				__sync_lock_test_and_set(&snode->state, SEND_DONE);
+			}
+			continue;
+		}
 
-			struct JsonNode *message = NULL;
+		if(delay > 0) {
+			logprintf(LOG_DEBUG, "duty cycle budget used, next send in %.1f seconds", (double)delay/1000000);
+		}
+		if(dt_ring_timedwait_enqueued(sendqueue, stats.enqueued, delay*1000) == -1) {
+			break;
+		}
+	}
+	return (void *)NULL;
+}
 
-			if(sendqueue->message != NULL && strcmp(sendqueue->message, "{}") != 0) {
-				if(json_validate(sendqueue->message) == true) {
-					if(message == NULL) {
-						message = json_mkobject();
-					}
-					json_append_member(message, "origin", json_mkstring("sender"));
-					json_append_member(message, "protocol", json_mkstring(protocol->id));
-					json_append_member(message, "message", json_decode(sendqueue->message));
-					if(strlen(sendqueue->uuid) > 0) {
-						json_append_member(message, "uuid", json_mkstring(sendqueue->uuid));
-					}
-					json_append_member(message, "repeat", json_mknumber(1, 0));
-				}
-			}
-			if(sendqueue->settings != NULL && strcmp(sendqueue->settings, "{}") != 0) {
-				if(json_validate(sendqueue->settings) == true) {
-					if(message == NULL) {
-						message = json_mkobject();
-					}
-					json_append_member(message, "settings", json_decode(sendqueue->settings));
-				}
+/*
+ * The values of the id options identify the device
+ * a code is meant for. Returns NULL when the protocol
+ * doesn't have any, like the raw protocol.
+ */
+static char *sendqueue_key(struct protocol_t *protocol, struct JsonNode *jcode, size_t *len) {
+	struct options_t *tmp_options = protocol->options;
+	struct JsonNode *jtmp = NULL;
+	JsonWriter w;
+	char *stmp = NULL;
+	int nr = 0;
+
+	json_writer_init(&w);
+	json_writer_begin_object(&w, NULL);
+	while(tmp_options) {
+		if(tmp_options->conftype == DEVICES_ID) {
+			if((jtmp = json_find_member(jcode, tmp_options->name)) != NULL && jtmp->tag == JSON_NUMBER) {
+				json_writer_number(&w, tmp_options->name, jtmp->number_, jtmp->decimals_);
+				nr++;
+			} else if(json_find_string(jcode, tmp_options->name, &stmp) == 0) {
+				json_writer_string(&w, tmp_options->name, stmp);
+				nr++;
 			}
+		}
+		tmp_options = tmp_options->next;
+	}
+	json_writer_end_object(&w);
 
-			if(protocol->hwtype == RF433 || protocol->hwtype == RF868) {
-				logprintf(LOG_DEBUG, "**** RAW CODE ****");
-				if(log_level_get() >= LOG_DEBUG) {
-					for(i=0;i<sendqueue->length;i++) {
-						printf("%d ", sendqueue->code[i]);
-					}
-					printf("\n");
-				}
-				logprintf(LOG_DEBUG, "**** RAW CODE ****");
+	if(nr == 0) {
+		json_writer_free(&w);
+		return NULL;
+	}
+	*len = json_writer_length(&w)+1;
+	return json_writer_finish(&w);
+}
 
-				struct plua_metatable_t *table = NULL;
-				plua_metatable_init(&table);
+static unsigned int sendqueue_hash(int *code, int length) {
+	unsigned int hash = 2166136261u;
+	int i = 0;
 
-				char key[255];
-				memset(&key, 0, 255);
+	for(i=0;i<length;i++) {
+		hash = (hash ^ (unsigned int)code[i]) * 16777619u;
+	}
+	return hash;
+}
 
-				plua_metatable_set_number(table, "rawlen", sendqueue->length);
-				plua_metatable_set_number(table, "txrpt", protocol->txrpt);
-				plua_metatable_set_string(table, "protocol", protocol->id);
-				plua_metatable_set_number(table, "hwtype", protocol->hwtype);
-				plua_metatable_set_string(table, "uuid", "0");
+/* The time in milliseconds the hardware needs to send a code */
+static unsigned long long sendqueue_airtime(struct protocol_t *protocol, int *code, int length) {
+	return airtime_frame(code, length, protocol->txrpt)/1000;
+}
 
-				for(i=0;i<sendqueue->length;i++) {
-					snprintf(key, 255, "pulses.%d", i+1);
-					plua_metatable_set_number(table, key, sendqueue->code[i]);
-				}
+/*
+ * Walk the sends that weren't transmitted yet and forget
+ * the ones that left the queue. Returns the pending send
+ * with the exact same pulse train, so the new one doesn't
+ * have to be queued, or NULL.
+ */
+static struct sendqueue_t *sendqueue_coalesce(struct protocol_t *protocol, unsigned int hash, unsigned long *seq) {
+	struct sendqueue_pending_t *pending = NULL;
+	struct sendqueue_t *node = NULL, *merged = NULL;
+	struct ring_stats_dt stats;
+	unsigned long long airtime = 0;
+	int i = 0, n = 0;
+
+	dt_ring_stats(sendqueue, &stats);
+	*seq = stats.enqueued;
+
+	for(i=0;i<sendqueue_pending_nr;i++) {
+		pending = &sendqueue_pending[i];
+		node = pending->node;
+
+		/*
+		 * Released slots are only reused by the
+		 * next reserve, which also needs our lock.
+		 */
+		if(pending->seq < stats.dequeued || node->state != SEND_PENDING) {
+			continue;
+		}
 
-				eventpool_trigger(REASON_SEND_CODE+10000, reason_send_code_free, table);
-			}
+		if(merged == NULL && node->protopt == protocol && pending->hash == hash &&
+			node->length == protocol->rawlen &&
+			memcmp(node->code, protocol->raw, sizeof(int)*protocol->rawlen) == 0) {
+			airtime = sendqueue_airtime(protocol, protocol->raw, protocol->rawlen);
+			metrics_inc(metric_merged, 1);
+			metrics_inc(metric_airtime_saved, airtime);
+			logprintf(LOG_DEBUG, "merged %s send with an identical pending one, saved %llu ms", protocol->id, airtime);
+			merged = node;
+		}
+		if(n != i) {
+			sendqueue_pending[n] = *pending;
+		}
+		n++;
+	}
+	sendqueue_pending_nr = n;
 
-			if(strcmp(protocol->id, "raw") == 0) {
-				int plslen = sendqueue->code[sendqueue->length-1]/PULSE_DIV;
-				receive_queue(sendqueue->code, sendqueue->length, plslen, -1);
-			}
+	return merged;
+}
 
-			if(message != NULL) {
-				broadcast_queue(sendqueue->protoname, message, sendqueue->origin);
-				json_delete(message);
-				message = NULL;
-			}
+/*
+ * Pending sends to the same device are replaced by the
+ * one that is kept. This is only done once the new send
+ * is sure to be queued, so a full queue never loses both.
+ */
+static void sendqueue_supersede(struct protocol_t *protocol, char *key, struct sendqueue_t *keep) {
+	struct sendqueue_t *node = NULL;
+	struct ring_stats_dt stats;
+	unsigned long long airtime = 0;
+	int i = 0;
 
-			struct sendqueue_t *tmp = sendqueue;
-			if(tmp->message != NULL) {
-				FREE(tmp->message);
-			}
-			if(tmp->settings != NULL) {
-				FREE(tmp->settings);
-			}
-			FREE(tmp->protoname);
-			sendqueue = sendqueue->next;
-			FREE(tmp);
-			sendqueue_number--;
-			sending = 0;
-			pthread_mutex_unlock(&sendqueue_lock);
-		} else {
-			pthread_cond_wait(&sendqueue_signal, &sendqueue_lock);
+	if(key == NULL) {
+		return;
+	}
+
+	dt_ring_stats(sendqueue, &stats);
+
+	for(i=0;i<sendqueue_pending_nr;i++) {
+		node = sendqueue_pending[i].node;
+
+		/* The reserve of the new send may have reused a released slot */
+		if(sendqueue_pending[i].seq < stats.dequeued) {
+			continue;
+		}
+		if(node != keep && node->key != NULL && node->protopt == protocol && strcmp(node->key, key) == 0 &&
+			__sync_bool_compare_and_swap(&node->state, SEND_PENDING, SEND_SUPERSEDED) == 1) {
+			send_undefer(node);
+			airtime = sendqueue_airtime(protocol, node->code, node->length);
+			metrics_inc(metric_superseded, 1);
+			metrics_inc(metric_airtime_saved, airtime);
+			logprintf(LOG_DEBUG, "superseded pending %s send, saved %llu ms", protocol->id, airtime);
 		}
 	}
-	return (void *)NULL;
+}
+
+static void sendqueue_pending_add(struct sendqueue_t *node, unsigned int hash, unsigned long seq) {
+	if(sendqueue_pending_nr == sendqueue_pending_size) {
+		sendqueue_pending_size = (sendqueue_pending_size == 0) ? 16 : sendqueue_pending_size*2;
+		if((sendqueue_pending = REALLOC(sendqueue_pending, sizeof(struct sendqueue_pending_t)*sendqueue_pending_size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	sendqueue_pending[sendqueue_pending_nr].seq = seq;
+	sendqueue_pending[sendqueue_pending_nr].hash = hash;
+	sendqueue_pending[sendqueue_pending_nr].node = node;
+	sendqueue_pending_nr++;
 }
 
 /* Send a specific code */
@@ -868,86 +1271,122 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 			protocol->raw = raw;
 			if(match == 1 && protocol->createCode != NULL) {
 				/* Let the protocol create his code */
-				if(protocol->createCode(jcode) == 0 && main_loop == 1) {
-					if(sendqueue_number <= 1024) {
-						struct sendqueue_t *mnode = MALLOC(sizeof(struct sendqueue_t));
-						if(mnode == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						gettimeofday(&tcurrent, NULL);
-						mnode->origin = origin;
-						mnode->id = 1000000 * (unsigned int)tcurrent.tv_sec + (unsigned int)tcurrent.tv_usec;
-						mnode->message = NULL;
+				if(protocol->createCode(jcode) == 0 && main_loop == 1 && sendqueue != NULL) {
+					struct sendqueue_t *mnode = NULL, *merged = NULL;
+					char *jsonstr = NULL, *strsett = NULL, *key = NULL;
+					size_t mlen = 0, slen = 0, klen = 0, plen = strlen(protocol->id)+1;
+					unsigned int hash = sendqueue_hash(protocol->raw, protocol->rawlen);
+					unsigned long seq = 0;
+
+					key = sendqueue_key(protocol, jcode, &klen);
+					if((merged = sendqueue_coalesce(protocol, hash, &seq)) != NULL) {
+						sendqueue_supersede(protocol, key, merged);
 						if(protocol->message != NULL) {
-							char *jsonstr = json_stringify(protocol->message, NULL);
 							json_delete(protocol->message);
-							if(json_validate(jsonstr) == true) {
-								if((mnode->message = MALLOC(strlen(jsonstr)+1)) == NULL) {
-									fprintf(stderr, "out of memory\n");
-									exit(EXIT_FAILURE);
-								}
-								strcpy(mnode->message, jsonstr);
-							}
-							json_free(jsonstr);
 							protocol->message = NULL;
 						}
+						if(key != NULL) {
+							json_free(key);
+						}
+						pthread_mutex_unlock(&sendqueue_lock);
+						return 0;
+					}
 
-						mnode->length = protocol->rawlen;
-						memcpy(mnode->code, protocol->raw, sizeof(int)*protocol->rawlen);
-
-						if((mnode->protoname = MALLOC(strlen(protocol->id)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
+					if(protocol->message != NULL) {
+						if(json_check(protocol->message, NULL) == true) {
+							jsonstr = json_stringify(protocol->message, NULL);
+							mlen = strlen(jsonstr)+1;
 						}
-						strcpy(mnode->protoname, protocol->id);
-						mnode->protopt = protocol;
+						json_delete(protocol->message);
+						protocol->message = NULL;
+					}
 
-						struct options_t *tmp_options = protocol->options;
-						char *stmp = NULL;
-						struct JsonNode *jsettings = json_mkobject();
-						struct JsonNode *jtmp = NULL;
-						while(tmp_options) {
-							if(tmp_options->conftype == DEVICES_SETTING) {
-								if(tmp_options->vartype == JSON_NUMBER &&
-								  (jtmp = json_find_member(jcode, tmp_options->name)) != NULL &&
-								   jtmp->tag == JSON_NUMBER) {
-									json_append_member(jsettings, tmp_options->name, json_mknumber(jtmp->number_, jtmp->decimals_));
-								} else if(tmp_options->vartype == JSON_STRING && json_find_string(jcode, tmp_options->name, &stmp) == 0) {
-									json_append_member(jsettings, tmp_options->name, json_mkstring(stmp));
-								}
+					struct options_t *tmp_options = protocol->options;
+					char *stmp = NULL;
+					struct JsonNode *jtmp = NULL;
+					JsonWriter w;
+
+					json_writer_init(&w);
+					json_writer_begin_object(&w, NULL);
+					while(tmp_options) {
+						if(tmp_options->conftype == DEVICES_SETTING) {
+							if(tmp_options->vartype == JSON_NUMBER &&
+								(jtmp = json_find_member(jcode, tmp_options->name)) != NULL &&
+								 jtmp->tag == JSON_NUMBER) {
+								json_writer_number(&w, tmp_options->name, jtmp->number_, jtmp->decimals_);
+							} else if(tmp_options->vartype == JSON_STRING && json_find_string(jcode, tmp_options->name, &stmp) == 0) {
+								json_writer_string(&w, tmp_options->name, stmp);
 							}
-							tmp_options = tmp_options->next;
-						}
-						char *strsett = json_stringify(jsettings, NULL);
-						if((mnode->settings = MALLOC(strlen(strsett)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
 						}
-						strcpy(mnode->settings, strsett);
-						json_free(strsett);
-						json_delete(jsettings);
-
-						if(uuid != NULL) {
-							strcpy(mnode->uuid, uuid);
+						tmp_options = tmp_options->next;
+					}
+					json_writer_end_object(&w);
+					slen = json_writer_length(&w)+1;
+					strsett = json_writer_finish(&w);
+
+					size_t codelen = sizeof(int)*protocol->rawlen;
+					if((mnode = dt_ring_reserve(sendqueue, sizeof(struct sendqueue_t)+codelen+plen+mlen+slen+klen)) == NULL) {
+						if(sends_deferred > 0) {
+							logprintf(LOG_ERR, "send queue full, %d sends wait for the duty cycle budget", sends_deferred);
 						} else {
-							memset(mnode->uuid, '\0', UUID_LENGTH);
+							logprintf(LOG_ERR, "send queue full");
 						}
-						if(sendqueue_number == 0) {
-							sendqueue = mnode;
-							sendqueue_head = mnode;
-						} else {
-							sendqueue_head->next = mnode;
-							sendqueue_head = mnode;
+						if(jsonstr != NULL) {
+							json_free(jsonstr);
 						}
-						sendqueue_number++;
-					} else {
-						logprintf(LOG_ERR, "send queue full");
+						if(key != NULL) {
+							json_free(key);
+						}
+						json_free(strsett);
 						pthread_mutex_unlock(&sendqueue_lock);
 						return -1;
 					}
+
+					gettimeofday(&tcurrent, NULL);
+					mnode->origin = origin;
+					mnode->state = SEND_PENDING;
+					mnode->id = 1000000 * (unsigned int)tcurrent.tv_sec + (unsigned int)tcurrent.tv_usec;
+					mnode->queued = uv_hrtime();
+					mnode->deferred = 0;
+
+					mnode->length = protocol->rawlen;
+					memcpy(mnode->code, protocol->raw, codelen);
+
+					mnode->protoname = (char *)mnode->code+codelen;
+					strcpy(mnode->protoname, protocol->id);
+					mnode->protopt = protocol;
+
+					mnode->message = NULL;
+					if(mlen > 0) {
+						mnode->message = mnode->protoname+plen;
+						strcpy(mnode->message, jsonstr);
+					}
+					if(jsonstr != NULL) {
+						json_free(jsonstr);
+					}
+
+					mnode->settings = mnode->protoname+plen+mlen;
+					strcpy(mnode->settings, strsett);
+					json_free(strsett);
+
+					mnode->key = NULL;
+					if(key != NULL) {
+						mnode->key = mnode->settings+slen;
+						strcpy(mnode->key, key);
+						json_free(key);
+					}
+
+					if(uuid != NULL) {
+						strcpy(mnode->uuid, uuid);
+					} else {
+						memset(mnode->uuid, '\0', UUID_LENGTH);
+					}
+
+					sendqueue_supersede(protocol, mnode->key, NULL);
+
+					dt_ring_commit(sendqueue);
+					sendqueue_pending_add(mnode, hash, seq);
 					pthread_mutex_unlock(&sendqueue_lock);
-					pthread_cond_signal(&sendqueue_signal);
 					return 0;
 				} else {
 					pthread_mutex_unlock(&sendqueue_lock);
@@ -1158,6 +1597,182 @@ static void *control_device1(int reason, void *param, void *userdata) {
 	return NULL;
 }
 
+/*
+ * FNV-1a over every device, so a node can tell which of its
+ * devices differ from those of the master.
+ */
+static unsigned long long config_hash(unsigned long long hash, const char *str) {
+	while(*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static struct JsonNode *config_device_hashes(struct JsonNode *jdevices, char *version) {
+	struct JsonNode *jhashes = json_mkobject();
+	struct JsonNode *jchild = json_first_child(jdevices);
+	unsigned long long total = 0xcbf29ce484222325ULL, hash = 0;
+	char buf[17];
+
+	while(jchild) {
+		char *content = json_stringify(jchild, NULL);
+		hash = config_hash(0xcbf29ce484222325ULL, content);
+		json_free(content);
+
+		snprintf(buf, sizeof(buf), "%016llx", hash);
+		json_append_member(jhashes, jchild->key, json_mkstring(buf));
+
+		total = config_hash(total, jchild->key);
+		total = config_hash(total, buf);
+		jchild = jchild->next;
+	}
+	snprintf(version, 17, "%016llx", total);
+
+	return jhashes;
+}
+
+/*
+ * Answers a config request of a node. A node that sends the
+ * version and device hashes of its last sync gets either an
+ * unchanged message or only the devices that were added, changed
+ * or removed since. Others get the full config as before.
+ */
+static void config_sync_node(struct JsonNode *json, struct JsonNode *jsend, struct JsonNode *jconfig) {
+	struct JsonNode *jdevices = json_find_member(jconfig, "devices");
+	struct JsonNode *jknown = json_find_member(json, "devices");
+	struct JsonNode *jhashes = NULL, *jchild = NULL, *jnext = NULL, *jhash = NULL, *jold = NULL;
+	char version[17], *known = NULL;
+
+	jhashes = config_device_hashes(jdevices, version);
+	json_append_member(jsend, "version", json_mkstring(version));
+
+	if(json_find_string(json, "version", &known) == 0 && strcmp(known, version) == 0) {
+		json_append_member(jsend, "unchanged", json_mknumber(1, 0));
+		json_delete(jhashes);
+		json_delete(jconfig);
+		return;
+	}
+
+	if(jknown == NULL || jknown->tag != JSON_OBJECT) {
+		json_append_member(jsend, "config", jconfig);
+		json_append_member(jsend, "hashes", jhashes);
+		return;
+	}
+
+	struct JsonNode *jdelta = json_mkobject();
+	struct JsonNode *jchanged = json_mkobject();
+	struct JsonNode *jremoved = json_mkarray();
+
+	jchild = json_first_child(jknown);
+	while(jchild) {
+		if(json_find_member(jdevices, jchild->key) == NULL) {
+			json_append_element(jremoved, json_mkstring(jchild->key));
+		}
+		jchild = jchild->next;
+	}
+
+	jchild = json_first_child(jdevices);
+	while(jchild) {
+		jnext = jchild->next;
+		jhash = json_find_member(jhashes, jchild->key);
+		jold = json_find_member(jknown, jchild->key);
+		if(jold == NULL || jold->tag != JSON_STRING || strcmp(jold->string_, jhash->string_) != 0) {
+			char *key = STRDUP(jchild->key);
+			if(key == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			json_remove_from_parent(jchild);
+			json_append_member(jchanged, key, jchild);
+			FREE(key);
+		} else {
+			json_remove_from_parent(jhash);
+			json_delete(jhash);
+		}
+		jchild = jnext;
+	}
+
+	json_append_member(jdelta, "devices", jchanged);
+	json_append_member(jdelta, "removed", jremoved);
+	json_append_member(jsend, "delta", jdelta);
+	json_append_member(jsend, "hashes", jhashes);
+	json_delete(jconfig);
+}
+
+/*
+ * The generation a client wants the changed values since.
+ * Anything that isn't a valid generation gets a full dump,
+ * just like since 0.
+ */
+static unsigned long values_since(double since) {
+	if(since < 1 || since >= (double)ULONG_MAX) {
+		return 0;
+	}
+	return (unsigned long)since;
+}
+
+/*
+ * A batch holds one or more codes forwarded by a node, each
+ * written as <protocol>:<length>:<json>. Each code is checked
+ * like a single update, but the json objects are queued as
+ * they are, so they don't have to be encoded again just to
+ * get them into the broadcast queue.
+ */
+static void socket_parse_batch(int sd, char *buffer) {
+	struct clients_t *tmp_clients = clients;
+	struct JsonNode *jcode = NULL;
+	char *p = buffer, *json = NULL, *end = NULL, *last = NULL, *pname = NULL, c = 0;
+	unsigned long len = 0;
+	int nr = 0, invalid = 0;
+
+	while(tmp_clients) {
+		if(tmp_clients->id == sd) {
+			break;
+		}
+		tmp_clients = tmp_clients->next;
+	}
+	if(tmp_clients == NULL || tmp_clients->batch == 0) {
+		logprintf(LOG_NOTICE, "client sent a batch without identifying for it");
+		return;
+	}
+
+	last = &buffer[strlen(buffer)];
+	while(p < last) {
+		if((json = strchr(p, ':')) == NULL || json == p) {
+			break;
+		}
+		*json++ = '\0';
+		len = strtoul(json, &end, 10);
+		if(end == json || *end != ':') {
+			break;
+		}
+		json = end+1;
+		if(len < 2 || (unsigned long)(last-json) < len || json[0] != '{' || json[len-1] != '}') {
+			break;
+		}
+		c = json[len];
+		json[len] = '\0';
+		if((jcode = json_decode(json)) != NULL && jcode->tag == JSON_OBJECT &&
+			json_find_string(jcode, "protocol", &pname) == 0 && strcmp(pname, p) == 0) {
+			broadcast_queue_str(p, json, (json_find_member(jcode, "uuid") != NULL), MASTER);
+			nr++;
+		} else {
+			logprintf(LOG_NOTICE, "client \"%s\" sent an invalid %s code in a batch", tmp_clients->uuid, p);
+			invalid++;
+		}
+		if(jcode != NULL) {
+			json_delete(jcode);
+		}
+		json[len] = c;
+		p = &json[len];
+	}
+
+	if(p < last) {
+		logprintf(LOG_NOTICE, "client \"%s\" sent a malformed batch", tmp_clients->uuid);
+	}
+	logprintf(LOG_DEBUG, "socket recv: batch of %d codes from client \"%s\", %d rejected", nr, tmp_clients->uuid, invalid);
+}
+
 /* Parse the incoming buffer from the client */
 static void socket_parse_data(int i, char *buffer) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -1181,6 +1796,8 @@ static void socket_parse_data(int i, char *buffer) {
 
 	if(strcmp(buffer, "HEART") == 0) {
 		socket_write(sd, "BEAT");
+	} else if(pilight.runmode != ADHOC && strncmp(buffer, "BATCH ", 6) == 0) {
+		socket_parse_batch(sd, &buffer[6]);
 	} else {
 		if(pilight.runmode != ADHOC) {
 			logprintf(LOG_DEBUG, "socket recv: %s", buffer);
@@ -1191,11 +1808,10 @@ static void socket_parse_data(int i, char *buffer) {
 		if(strstr(buffer, " HTTP/")) {
 			client_webserver_parse_code(i, buffer);
 			socket_close(sd);
-		} else if(json_validate(buffer) == true) {
+		} else if((json = json_decode(buffer)) != NULL) {
 #else
-		if(json_validate(buffer) == true) {
+		if((json = json_decode(buffer)) != NULL) {
 #endif
-			json = json_decode(buffer);
 			if((json_find_string(json, "action", &action)) == 0) {
 				tmp_clients = clients;
 				while(tmp_clients) {
@@ -1217,6 +1833,7 @@ static void socket_parse_data(int i, char *buffer) {
 						client->config = 0;
 						client->receiver = 0;
 						client->forward = 0;
+						client->batch = 0;
 						client->stats = 0;
 						client->cpu = 0;
 						client->ram = 0;
@@ -1298,7 +1915,15 @@ static void socket_parse_data(int i, char *buffer) {
 							}
 						}
 					}
-					socket_write(sd, "{\"status\":\"success\"}");
+					/* Nodes that ask for it can batch their codes */
+					double batch = 0;
+					if(error == 0 && client->forward == 1 &&
+						json_find_number(json, "batch", &batch) == 0 && (int)batch == 1) {
+						client->batch = 1;
+						socket_write(sd, "{\"status\":\"success\",\"batch\":%d}", ADHOC_BATCH_WINDOW);
+					} else {
+						socket_write(sd, "{\"status\":\"success\"}");
+					}
 				} else if(strcmp(action, "send") == 0) {
 					if(send_queue(json, SENDER) == 0) {
 						socket_write(sd, "{\"status\":\"success\"}");
@@ -1431,13 +2056,18 @@ static void socket_parse_data(int i, char *buffer) {
 				} else if(strcmp(action, "request config") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 					struct JsonNode *jconfig = NULL;
+					struct JsonNode *jdevices = NULL;
 					if(client->forward == 1) {
 						jconfig = config_print(CONFIG_FORWARD, client->media);
 					} else {
 						jconfig = config_print(CONFIG_INTERNAL, client->media);
 					}
 					json_append_member(jsend, "message", json_mkstring("config"));
-					json_append_member(jsend, "config", jconfig);
+					if(client->forward == 1 && (jdevices = json_find_member(jconfig, "devices")) != NULL && jdevices->tag == JSON_OBJECT) {
+						config_sync_node(json, jsend, jconfig);
+					} else {
+						json_append_member(jsend, "config", jconfig);
+					}
 					char *output = json_stringify(jsend, NULL);
 					str_replace("%", "%%", &output);
 					socket_write(sd, output);
@@ -1445,9 +2075,22 @@ static void socket_parse_data(int i, char *buffer) {
 					json_delete(jsend);
 				} else if(strcmp(action, "request values") == 0) {
 					struct JsonNode *jsend = json_mkobject();
-					struct JsonNode *jvalues = devices_values(client->media);
+					struct JsonNode *jvalues = NULL;
+					unsigned long generation = 0;
+					double since = 0;
+					int full = 0, delta = 0;
+					if(json_find_number(json, "since", &since) == 0) {
+						delta = 1;
+						jvalues = devices_values_since(client->media, values_since(since), &generation, &full);
+					} else {
+						jvalues = devices_values(client->media);
+					}
 					json_append_member(jsend, "message", json_mkstring("values"));
 					json_append_member(jsend, "values", jvalues);
+					if(delta == 1) {
+						json_append_member(jsend, "generation", json_mknumber((double)generation, 0));
+						json_append_member(jsend, "full", json_mknumber(full, 0));
+					}
 					char *output = json_stringify(jsend, NULL);
 					socket_write(sd, output);
 					json_free(output);
@@ -1532,8 +2175,7 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 			logprintf(LOG_DEBUG, "socket recv: %s", buffer);
 		}
 
-		if(json_validate(buffer) == true) {
-			json = json_decode(buffer);
+		if((json = json_decode(buffer)) != NULL) {
 			if((json_find_string(json, "status", &status)) == 0) {
 				if(strcmp(status, "success") == 0) {
 					if((*respons = MALLOC(strlen("{\"status\":\"success\"}")+1)) == NULL) {
@@ -1807,11 +2449,26 @@ static int socket_parse_responses(char *buffer, char *media, char **respons) {
 					struct JsonNode *jsend = json_mkobject();
 #ifdef PILIGHT_REWRITE
 					struct JsonNode *jvalues = values_print(media);
+					json_append_member(jsend, "message", json_mkstring("values"));
+					json_append_member(jsend, "values", jvalues);
 #else
-					JsonNode *jvalues = devices_values(media);
-#endif
+					JsonNode *jvalues = NULL;
+					unsigned long generation = 0;
+					double since = 0;
+					int full = 0, delta = 0;
+					if(json_find_number(json, "since", &since) == 0) {
+						delta = 1;
+						jvalues = devices_values_since(media, values_since(since), &generation, &full);
+					} else {
+						jvalues = devices_values(media);
+					}
 					json_append_member(jsend, "message", json_mkstring("values"));
 					json_append_member(jsend, "values", jvalues);
+					if(delta == 1) {
+						json_append_member(jsend, "generation", json_mknumber((double)generation, 0));
+						json_append_member(jsend, "full", json_mknumber(full, 0));
+					}
+#endif
 					char *output = json_stringify(jsend, NULL);
 					if((*respons = MALLOC(strlen(output)+1)) == NULL) {
 						OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
@@ -1872,8 +2529,7 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 		media = client->media;
 	}
 
-	if(json_validate(data->buffer) == true) {
-		json = json_decode(data->buffer);
+	if((json = json_decode(data->buffer)) != NULL) {
 		if((json_find_string(json, "action", &action)) == 0) {
 			if(strcmp(action, "identify") == 0) {
 				/* Check if client doesn't already exist */
@@ -1885,6 +2541,7 @@ static void *socket_parse_data1(int reason, void *param, void *userdata) {
 					client->config = 0;
 					client->receiver = 0;
 					client->forward = 0;
+					client->batch = 0;
 					client->stats = 0;
 					client->cpu = 0;
 					strcpy(client->media, "all");
@@ -2117,7 +2774,10 @@ void *clientize(void *param) {
   char *recvBuff = NULL, *output = NULL;
 	char *message = NULL, *action = NULL;
 	char *origin = NULL, *protocol = NULL;
-	int client_loop = 0, config_synced = 0;
+	int client_loop = 0, config_synced = 0, resync = 0;
+	/* Device hashes and version of the last master config */
+	struct JsonNode *jsynced = NULL;
+	char version[17] = { '\0' };
 
 	while(main_loop) {
 
@@ -2156,6 +2816,7 @@ void *clientize(void *param) {
 		json_append_member(joptions, "forward", json_mknumber(1, 0));
 		json_append_member(joptions, "config", json_mknumber(1, 0));
 		json_append_member(json, "uuid", json_mkstring(pilight_uuid));
+		json_append_member(json, "batch", json_mknumber(1, 0));
 		json_append_member(json, "options", joptions);
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
@@ -2166,14 +2827,42 @@ void *clientize(void *param) {
 		json_free(output);
 		json_delete(json);
 
-		if(socket_read(sockfd, &recvBuff, 1) != 0
-		   || strcmp(recvBuff, "{\"status\":\"success\"}") != 0) {
+		adhoc_batch = 0;
+		if(socket_read(sockfd, &recvBuff, 1) != 0) {
 			continue;
 		}
+		/* Older masters don't support batching */
+		if(strcmp(recvBuff, "{\"status\":\"success\"}") != 0) {
+			char *status = NULL;
+			double window = 0;
+			if((json = json_decode(recvBuff)) == NULL) {
+				continue;
+			}
+			if(json_find_string(json, "status", &status) != 0 || strcmp(status, "success") != 0) {
+				json_delete(json);
+				continue;
+			}
+			if(json_find_number(json, "batch", &window) == 0 && (int)window > 0) {
+				adhoc_batch = (int)window;
+			}
+			json_delete(json);
+		}
 		logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
 
+request:
+		resync = 0;
 		json = json_mkobject();
 		json_append_member(json, "action", json_mkstring("request config"));
+		if(jsynced != NULL && strlen(version) > 0) {
+			struct JsonNode *jknown = json_mkobject();
+			struct JsonNode *jchild = json_first_child(jsynced);
+			while(jchild) {
+				json_append_member(jknown, jchild->key, json_mkstring(jchild->string_));
+				jchild = jchild->next;
+			}
+			json_append_member(json, "version", json_mkstring(version));
+			json_append_member(json, "devices", jknown);
+		}
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
 			json_free(output);
@@ -2185,12 +2874,48 @@ void *clientize(void *param) {
 
 		if(socket_read(sockfd, &recvBuff, 0) == 0) {
 			logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
-			if(json_validate(recvBuff) == true) {
-				json = json_decode(recvBuff);
+			if((json = json_decode(recvBuff)) != NULL) {
 				if(json_find_string(json, "message", &message) == 0) {
 					if(strcmp(message, "config") == 0) {
 						struct JsonNode *jconfig = NULL;
-						if((jconfig = json_find_member(json, "config")) != NULL) {
+						struct JsonNode *jdelta = NULL;
+						struct JsonNode *jhashes = NULL;
+						char *stmp = NULL;
+						double itmp = 0;
+						int ret = -1;
+
+						if(json_find_number(json, "unchanged", &itmp) == 0 && (int)itmp == 1) {
+							logprintf(LOG_DEBUG, "master configuration unchanged");
+							config_synced = 1;
+						} else if((jdelta = json_find_member(json, "delta")) != NULL && jsynced != NULL) {
+							pthread_mutex_lock(&config_lock);
+#ifdef EVENTS
+							rules_gc();
+#endif
+							ret = config_devices_delta(json_find_member(jdelta, "devices"), json_find_member(jdelta, "removed"));
+							pthread_mutex_unlock(&config_lock);
+
+							if(ret == 0) {
+								struct JsonNode *jchild = json_first_child(json_find_member(jdelta, "removed"));
+								while(jchild) {
+									struct JsonNode *jold = NULL;
+									if(jchild->tag == JSON_STRING && (jold = json_find_member(jsynced, jchild->string_)) != NULL) {
+										json_remove_from_parent(jold);
+										json_delete(jold);
+									}
+									jchild = jchild->next;
+								}
+								logprintf(LOG_DEBUG, "applied master configuration changes");
+								config_synced = 1;
+							} else {
+								/*
+								 * Part of the devices may already be gone,
+								 * so start over from the full configuration.
+								 */
+								logprintf(LOG_WARNING, "failed to apply master configuration changes, requesting the full configuration");
+								resync = 1;
+							}
+						} else if((jconfig = json_find_member(json, "config")) != NULL) {
 
 							pthread_mutex_lock(&config_lock);
 							gui_gc();
@@ -2203,14 +2928,49 @@ void *clientize(void *param) {
 							if(config_parse(jconfig, CONFIG_DEVICES) == 0) {
 								logprintf(LOG_DEBUG, "loaded master configuration");
 								config_synced = 1;
+								ret = 0;
+								if(jsynced != NULL) {
+									json_delete(jsynced);
+								}
+								jsynced = json_mkobject();
 							} else {
 								logprintf(LOG_WARNING, "failed to load master configuration");
 							}
 						}
+
+						/*
+						 * Remember what was synced so the next
+						 * reconnect only needs the differences.
+						 */
+						if(ret == 0 && json_find_string(json, "version", &stmp) == 0 && strlen(stmp) < sizeof(version) &&
+							(jhashes = json_find_member(json, "hashes")) != NULL && jhashes->tag == JSON_OBJECT) {
+							struct JsonNode *jchild = json_first_child(jhashes);
+							while(jchild) {
+								struct JsonNode *jold = json_find_member(jsynced, jchild->key);
+								if(jold != NULL) {
+									json_remove_from_parent(jold);
+									json_delete(jold);
+								}
+								if(jchild->tag == JSON_STRING) {
+									json_append_member(jsynced, jchild->key, json_mkstring(jchild->string_));
+								}
+								jchild = jchild->next;
+							}
+							strcpy(version, stmp);
+						} else if(config_synced == 0 || ret == 0) {
+							if(jsynced != NULL) {
+								json_delete(jsynced);
+								jsynced = NULL;
+							}
+							version[0] = '\0';
+						}
 					}
 				}
 				json_delete(json);
 			}
+			if(resync == 1) {
+				goto request;
+			}
 		}
 
 		while(client_loop && config_synced) {
@@ -2234,8 +2994,7 @@ void *clientize(void *param) {
 			char **array = NULL;
 			unsigned int z = explode(recvBuff, "\n", &array), q = 0;
 			for(q=0;q<z;q++) {
-				if(json_validate(array[q]) == true) {
-					json = json_decode(array[q]);
+				if((json = json_decode(array[q])) != NULL) {
 					if(json_find_string(json, "action", &action) == 0) {
 						if(strcmp(action, "send") == 0 ||
 						   strcmp(action, "control") == 0) {
@@ -2258,6 +3017,9 @@ void *clientize(void *param) {
 	if(recvBuff != NULL) {
 		FREE(recvBuff);
 	}
+	if(jsynced != NULL) {
+		json_delete(jsynced);
+	}
 
 	adhoc_pending = 0;
 	return NULL;
@@ -2347,20 +3109,16 @@ int main_gc(void) {
 	events_gc();
 #endif
 
-	if(recvqueue_init == 1) {
-		pthread_mutex_unlock(&recvqueue_lock);
-		pthread_cond_signal(&recvqueue_signal);
-		usleep(1000);
+	if(recvqueue != NULL) {
+		dt_ring_stop(recvqueue);
 	}
 
-	if(sendqueue_init == 1) {
-		pthread_mutex_unlock(&sendqueue_lock);
-		pthread_cond_signal(&sendqueue_signal);
+	if(sendqueue != NULL) {
+		dt_ring_stop(sendqueue);
 	}
 
-	if(bcqueue_init == 1) {
-		pthread_mutex_unlock(&bcqueue_lock);
-		pthread_cond_signal(&bcqueue_signal);
+	if(bcqueue != NULL) {
+		dt_ring_stop(bcqueue);
 	}
 
 	struct clients_t *tmp_clients;
@@ -2412,6 +3170,28 @@ int main_gc(void) {
 	ntp_gc();
 	whitelist_free();
 	threads_gc();
+	if(capture != NULL) {
+		capture_close(capture);
+		capture = NULL;
+	}
+
+	if(recvqueue != NULL) {
+		dt_ring_free(recvqueue);
+		recvqueue = NULL;
+	}
+	if(sendqueue != NULL) {
+		dt_ring_free(sendqueue);
+		sendqueue = NULL;
+	}
+	if(sendqueue_pending != NULL) {
+		FREE(sendqueue_pending);
+		sendqueue_pending_nr = 0;
+		sendqueue_pending_size = 0;
+	}
+	if(bcqueue != NULL) {
+		dt_ring_free(bcqueue);
+		bcqueue = NULL;
+	}
 #ifndef _WIN32
 	wiringXGC();
 #endif
@@ -2419,6 +3199,9 @@ int main_gc(void) {
 	log_gc();
 	ssl_gc();
 	plua_gc();
+	metrics_gc();
+	dns_gc();
+	fetch_gc();
 
 	uv_stop(uv_default_loop());
 	options_delete(options);
@@ -2517,16 +3300,58 @@ static void pilight_abort(uv_timer_t *timer_req) {
 	exit(EXIT_FAILURE);
 }
 
+static struct JsonNode *queue_stats(void) {
+	struct JsonNode *jqueues = json_mkobject();
+	struct ring_dt *rings[3] = { recvqueue, sendqueue, bcqueue };
+	char *names[3] = { "receive", "send", "broadcast" };
+	struct ring_stats_dt stats;
+	int i = 0;
+
+	for(i=0;i<3;i++) {
+		if(rings[i] == NULL) {
+			continue;
+		}
+		dt_ring_stats(rings[i], &stats);
+
+		struct JsonNode *jqueue = json_mkobject();
+		json_append_member(jqueue, "size", json_mknumber(stats.size, 0));
+		json_append_member(jqueue, "used", json_mknumber(stats.used, 0));
+		json_append_member(jqueue, "items", json_mknumber(stats.items, 0));
+		json_append_member(jqueue, "enqueued", json_mknumber(stats.enqueued, 0));
+		json_append_member(jqueue, "dequeued", json_mknumber(stats.dequeued, 0));
+		json_append_member(jqueue, "dropped", json_mknumber(stats.dropped, 0));
+		json_append_member(jqueue, "highwater", json_mknumber(stats.highwater, 0));
+		json_append_member(jqueue, "maxitems", json_mknumber(stats.maxitems, 0));
+		json_append_member(jqueues, names[i], jqueue);
+	}
+
+	return jqueues;
+}
+
+static struct JsonNode *lua_stats(void) {
+	struct JsonNode *jlua = json_mkobject();
+	struct plua_stats_t stats;
+
+	plua_get_stats(&stats);
+
+	json_append_member(jlua, "states", json_mknumber(stats.states, 0));
+	json_append_member(jlua, "maxstates", json_mknumber(stats.maxstates, 0));
+	json_append_member(jlua, "busy", json_mknumber(stats.busy, 0));
+	json_append_member(jlua, "peakbusy", json_mknumber(stats.peakbusy, 0));
+	json_append_member(jlua, "acquired", json_mknumber(stats.acquired, 0));
+	json_append_member(jlua, "affinity", json_mknumber(stats.affinity, 0));
+	json_append_member(jlua, "waits", json_mknumber(stats.waits, 0));
+	json_append_member(jlua, "waittime", json_mknumber(stats.waittime, 0));
+	json_append_member(jlua, "maxwait", json_mknumber(stats.maxwait, 0));
+
+	return jlua;
+}
+
 static void pilight_stats(uv_timer_t *timer_req) {
 	int watchdog = 1, stats = 1;
 	// double itmp = 0.0;
-	{
-		struct lua_state_t *state = plua_get_free_state();
-		config_setting_get_number(state->L, "watchdog-enable", 0, &watchdog);
-		config_setting_get_number(state->L, "stats-enable", 0, &stats);
-		assert(plua_check_stack(state->L, 0) == 0);
-		plua_clear_state(state);
-	}
+	config_setting_get_number(NULL, "watchdog-enable", 0, &watchdog);
+	config_setting_get_number(NULL, "stats-enable", 0, &stats);
 
 	if(pilight.runmode == STANDALONE) {
 		registerVersion();
@@ -2548,6 +3373,8 @@ static void pilight_stats(uv_timer_t *timer_req) {
 			json_append_member(code, "cpu", json_mknumber(cpu, 16));
 			logprintf(LOG_DEBUG, "cpu: %f%%", cpu);
 			json_append_member(procProtocol->message, "values", code);
+			json_append_member(procProtocol->message, "queues", queue_stats());
+			json_append_member(procProtocol->message, "lua", lua_stats());
 			json_append_member(procProtocol->message, "origin", json_mkstring("core"));
 			json_append_member(procProtocol->message, "type", json_mknumber(PROCESS, 0));
 			struct clients_t *tmp_clients = clients;
@@ -2644,6 +3471,7 @@ int start_pilight(int argc, char **argv) {
 	options_add(&options, "Ls", "storage-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "Ll", "lua-root", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "D", "debug", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, "R", "record", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "256", "stacktracer", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "257", "threadprofiler", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 	options_add(&options, "258", "debuglevel", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-2]{1}");
@@ -2692,6 +3520,14 @@ int start_pilight(int argc, char **argv) {
 		nodaemon = 1;
 	}
 
+	if(options_exists(options, "R") == 0) {
+		char *arg = NULL;
+		options_get_string(options, "R", &arg);
+		if((capture = capture_open(arg, CAPTURE_WRITE)) == NULL) {
+			goto clear;
+		}
+	}
+
 	if(options_exists(options, "257") == 0) {
 		threadprofiler = 1;
 		verbosity = LOG_ERR;
@@ -2733,6 +3569,7 @@ int start_pilight(int argc, char **argv) {
 									"\t -F  --foreground\t\tdo not daemonize\n"
 									"\t -D  --debug\t%sdo not daemonize and\n"
 									"\t\t\t%sshow debug information\n"
+									"\t -R  --record=xxxx\t\trecord received pulse trains\n"
 									"\n"
 									"\t -Ls --storage-root=xxxx\tlocation of the storage lua modules\n"
 									"\t -Ll --lua-root=xxxx\t\tlocation of the plain lua modules\n"
@@ -3128,16 +3965,54 @@ int start_pilight(int argc, char **argv) {
 		plua_metatable_set_number(table, "registry.hardware.RF433.maxgaplen", maxgaplen);
 		plua_metatable_set_number(table, "registry.hardware.RF433.minrawlen", minrawlen);
 		plua_metatable_set_number(table, "registry.hardware.RF433.maxrawlen", maxrawlen);
+		config_snapshot_publish();
+		config_generation_bump();
 	}
 
 	{
 		struct lua_state_t *state = plua_get_free_state();
 		config_setting_get_number(state->L, "port", 0, &port);
 		config_setting_get_number(state->L, "standalone", 0, &standalone);
+		config_setting_get_number(state->L, "receive-queue-size", 0, &recvqueue_size);
+		config_setting_get_number(state->L, "send-queue-size", 0, &sendqueue_size);
+		config_setting_get_number(state->L, "broadcast-queue-size", 0, &bcqueue_size);
+		config_setting_get_number(state->L, "lua-states", 0, &luastates);
+		if(config_setting_get_string(state->L, "send-policy", 0, &stmp) == 0) {
+			if(strcmp(stmp, "fifo") == 0) {
+				send_policy = SEND_POLICY_FIFO;
+			}
+			FREE(stmp);
+		}
 		assert(plua_check_stack(state->L, 0) == 0);
 		plua_clear_state(state);
 	}
 
+	{
+		struct varcont_t val;
+		double duty433 = DUTY_CYCLE_433, duty868 = DUTY_CYCLE_868;
+		int window = DUTY_CYCLE_WINDOW;
+
+		if(config_snapshot_get("settings", "duty-cycle-433", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			duty433 = val.number_;
+		}
+		if(config_snapshot_get("settings", "duty-cycle-868", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			duty868 = val.number_;
+		}
+		if(config_snapshot_get("settings", "duty-cycle-window", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			window = (int)val.number_;
+		}
+		airtime_budget(RF433, duty433, window);
+		airtime_budget(RF868, duty868, window);
+
+		if(config_snapshot_get("settings", "noise-filter-quality", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			noise_quality = (int)val.number_;
+		}
+		if(config_snapshot_get("settings", "noise-filter-lengths", 0, &val) == 0 && val.type_ == LUA_TNUMBER) {
+			noise_lengths = (int)val.number_;
+		}
+	}
+	plua_set_max_states(luastates);
+
 	pilight.runmode = STANDALONE;
 	if(standalone == 0 || (master_server != NULL && master_port > 0)) {
 		if(master_server != NULL && master_port > 0) {
@@ -3185,24 +4060,49 @@ int start_pilight(int argc, char **argv) {
 	pthread_mutexattr_init(&sendqueue_attr);
 	pthread_mutexattr_settype(&sendqueue_attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&sendqueue_lock, &sendqueue_attr);
-	pthread_cond_init(&sendqueue_signal, NULL);
-	sendqueue_init = 1;
 
 	pthread_mutexattr_init(&config_attr);
 	pthread_mutexattr_settype(&config_attr, PTHREAD_MUTEX_RECURSIVE);
 	pthread_mutex_init(&config_lock, &config_attr);
 
-	pthread_mutexattr_init(&recvqueue_attr);
-	pthread_mutexattr_settype(&recvqueue_attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&recvqueue_lock, &recvqueue_attr);
-	pthread_cond_init(&recvqueue_signal, NULL);
-	recvqueue_init = 1;
-
-	pthread_mutexattr_init(&bcqueue_attr);
-	pthread_mutexattr_settype(&bcqueue_attr, PTHREAD_MUTEX_RECURSIVE);
-	pthread_mutex_init(&bcqueue_lock, &bcqueue_attr);
-	pthread_cond_init(&bcqueue_signal, NULL);
-	bcqueue_init = 1;
+	/*
+	 * The send queue producers are already serialized
+	 * by the sendqueue_lock. The receive and broadcast
+	 * queues are fed by the hardware, socket and
+	 * event threads alike.
+	 */
+	sendqueue = dt_ring_init(sendqueue_size, RING_SPSC);
+	recvqueue = dt_ring_init(recvqueue_size, RING_MPSC);
+	bcqueue = dt_ring_init(bcqueue_size, RING_MPSC);
+
+	metrics_gauge_callback("pilight_queue_length", "queue=\"recvqueue\"", "Number of items waiting in a queue", queue_length, recvqueue);
+	metrics_gauge_callback("pilight_queue_length", "queue=\"sendqueue\"", NULL, queue_length, sendqueue);
+	metrics_gauge_callback("pilight_queue_length", "queue=\"bcqueue\"", NULL, queue_length, bcqueue);
+	metrics_counter_callback("pilight_queue_dropped_total", "queue=\"recvqueue\"", "Items dropped because a queue was full", queue_dropped, recvqueue);
+	metrics_counter_callback("pilight_queue_dropped_total", "queue=\"sendqueue\"", NULL, queue_dropped, sendqueue);
+	metrics_counter_callback("pilight_queue_dropped_total", "queue=\"bcqueue\"", NULL, queue_dropped, bcqueue);
+	{
+		double bounds[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+		metric_send = metrics_histogram("pilight_send_latency_seconds", NULL,
+			"Time between a send request and handing its pulses to the hardware", bounds, sizeof(bounds)/sizeof(bounds[0]));
+	}
+	metric_superseded = metrics_counter("pilight_send_coalesced_total", "reason=\"superseded\"",
+		"Pending sends dropped because a newer send replaced or duplicated them");
+	metric_merged = metrics_counter("pilight_send_coalesced_total", "reason=\"merged\"", NULL);
+	metric_airtime_saved = metrics_counter("pilight_send_airtime_saved_milliseconds_total", NULL,
+		"Transmit time saved by coalescing pending sends");
+	metric_noise = metrics_counter("pilight_frames_noise_total", NULL,
+		"Pulse trains dropped as noise before reaching the protocols");
+	{
+		double bounds[] = { 0.01, 0.1, 0.5, 1, 5, 30, 60, 300 };
+		metric_delay[SEND_CLASS_RULE] = metrics_histogram("pilight_send_queue_delay_seconds", "class=\"rule\"",
+			"Time a send waited in the send queue", bounds, sizeof(bounds)/sizeof(bounds[0]));
+		metric_delay[SEND_CLASS_BULK] = metrics_histogram("pilight_send_queue_delay_seconds", "class=\"bulk\"",
+			NULL, bounds, sizeof(bounds)/sizeof(bounds[0]));
+	}
+	metric_deferred[0] = metrics_gauge("pilight_send_deferred", "band=\"433\"",
+		"Sends in the send queue waiting for the duty cycle budget of their band");
+	metric_deferred[1] = metrics_gauge("pilight_send_deferred", "band=\"868\"", NULL);
 
 	/* Run certain daemon functions from the socket library */
 	socket_callback.client_disconnected_callback = &socket_client_disconnected;
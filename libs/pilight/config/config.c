@@ -36,12 +36,18 @@
 #include "hardware.h"
 #include "rules.h"
 #include "gui.h"
+#include "snapshot.h"
 
 static int init = 0;
 static char *string = NULL;
 static struct plua_metatable_t *table = NULL;
 static char root[PATH_MAX] = { 0 };
 static char type[255] = "json";
+/*
+ * Bumped whenever something that ends up in config_print or
+ * devices_values changes, so their output can be cached.
+ */
+static volatile unsigned long generation = 1;
 
 int config_root(char *path) {
 	if(strlen(path) > PATH_MAX) {
@@ -193,7 +199,7 @@ char *config_get_file(void) {
 	return string;
 }
 
-int config_parse(struct JsonNode *root, unsigned short objects) {
+static int config_parse_objects(struct JsonNode *root, unsigned short objects) {
 
 	if(((objects & CONFIG_DEVICES) == CONFIG_DEVICES) || ((objects & CONFIG_ALL) == CONFIG_ALL)) {
 		struct JsonNode *jnode = json_find_member(root, "devices");
@@ -230,6 +236,15 @@ int config_parse(struct JsonNode *root, unsigned short objects) {
 	return 0;
 }
 
+int config_parse(struct JsonNode *root, unsigned short objects) {
+	int ret = config_parse_objects(root, objects);
+
+	/* Also when parsing failed halfway */
+	config_generation_bump();
+
+	return ret;
+}
+
 int config_read(lua_State *L, unsigned short objects) {
 	if(string != NULL) {
 		if(((objects & CONFIG_SETTINGS) == CONFIG_SETTINGS) || ((objects & CONFIG_ALL) == CONFIG_ALL)) {
@@ -243,6 +258,9 @@ int config_read(lua_State *L, unsigned short objects) {
 				return -1;
 			}
 		}
+
+		config_snapshot_publish();
+		config_generation_bump();
 	}
 
 	if(((objects & CONFIG_HARDWARE) == CONFIG_HARDWARE) || ((objects & CONFIG_ALL) == CONFIG_ALL)) {
@@ -256,14 +274,13 @@ int config_read(lua_State *L, unsigned short objects) {
 	/* Read JSON config file */
 	if(file_get_contents(string, &content) == 0) {
 		/* Validate JSON and turn into JSON object */
-		if(json_validate(content) == false) {
+		struct JsonNode *root = json_decode(content);
+		if(root == NULL) {
 			logprintf(LOG_ERR, "config is not in a valid json format");
 			FREE(content);
 			return EXIT_FAILURE;
 		}
 
-		struct JsonNode *root = json_decode(content);
-
 		if(config_parse(root, objects) == -1) {
 			json_delete(root);
 			FREE(content);
@@ -285,14 +302,12 @@ struct JsonNode *config_print(int level, const char *media) {
 	/* Read JSON config file */
 	if(file_get_contents(string, &content) == 0) {
 		/* Validate JSON and turn into JSON object */
-		if(json_validate(content) == false) {
+		if((root = json_decode(content)) == NULL) {
 			logprintf(LOG_ERR, "config is not in a valid json format");
 			FREE(content);
 			return NULL;
 		}
 
-		root = json_decode(content);
-
 		struct JsonNode *jchild1 = config_devices_sync(level, media);
 		struct JsonNode *jchild = json_find_member(root, "devices");
 		json_remove_from_parent(jchild);
@@ -396,6 +411,22 @@ struct JsonNode *config_print(int level, const char *media) {
 	return root;
 }
 
+unsigned long config_generation(void) {
+	return __sync_add_and_fetch(&generation, 0);
+}
+
+unsigned long config_generation_bump(void) {
+	return __sync_add_and_fetch(&generation, 1);
+}
+
+/*
+ * Only publishes next when nobody else bumped the
+ * generation since current was read.
+ */
+int config_generation_publish(unsigned long current, unsigned long next) {
+	return __sync_bool_compare_and_swap(&generation, current, next);
+}
+
 struct plua_metatable_t *config_get_metatable(void) {
 	return table;
 }
@@ -431,6 +462,8 @@ int config_gc(void) {
 		string = NULL;
 	}
 
+	config_snapshot_gc();
+
 	if(table != NULL) {
 		plua_metatable_free(table);
 		table = NULL;
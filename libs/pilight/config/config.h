@@ -35,6 +35,9 @@ struct JsonNode *config_print(int level, const char *media);
 int config_parse(struct JsonNode *root, unsigned short objects);
 int config_read(lua_State *L, unsigned short objects);
 int config_write(int level, char *media);
+unsigned long config_generation(void);
+unsigned long config_generation_bump(void);
+int config_generation_publish(unsigned long current, unsigned long next);
 struct plua_metatable_t *config_get_metatable(void);
 int config_exists(char *module);
 int config_set_file(char *settfile);
@@ -51,6 +51,7 @@ struct config_t *config_devices;
 
 /* Struct to store the locations */
 static struct devices_t *devices = NULL;
+static unsigned long devices_base = 0;
 
 int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNode **out) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -80,6 +81,8 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	double itmp;
 	/* Do we need to update the devices file */
 	unsigned short update = 0;
+	/* Did any device value or timestamp change */
+	unsigned short changed = 0;
 	/* The new state value */
 	int vsize = 255;
 	char *vstring_ = MALLOC(vsize);
@@ -367,6 +370,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 											update = 1;
 										}
 										dptr->timestamp = utct;
+										changed = 1;
 									}
 									//break;
 								}
@@ -385,6 +389,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 									strcpy(sptr->values->string_, sstring_);
 									sptr->values->type = JSON_STRING;
 									dptr->timestamp = utct;
+									changed = 1;
 									update = 1;
 								} else if((stateType == JSON_NUMBER &&
 										   sptr->values->type == JSON_NUMBER &&
@@ -393,6 +398,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 									sptr->values->decimals = sdecimals_;
 									sptr->values->type = JSON_NUMBER;
 									dptr->timestamp = utct;
+									changed = 1;
 									update = 1;
 								}
 								if(sptr->values->type == JSON_STRING && json_find_string(rval, sptr->name, &stmp) != 0) {
@@ -465,6 +471,30 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 		json_delete(rval);
 		json_delete(rroot);
 	}
+	if(update == 1 || changed == 1) {
+		unsigned long current = 0, next = 0;
+
+		/*
+		 * Every changed device got the current timestamp. Devices
+		 * that changed earlier within the same second are stamped
+		 * again, which only means they are sent once more.
+		 *
+		 * The devices are stamped before the new generation is
+		 * published, so a values request can never return the new
+		 * generation without these devices. When the generation was
+		 * bumped by someone else in the meantime, the devices are
+		 * stamped again with a generation that wasn't handed out yet.
+		 */
+		do {
+			current = config_generation();
+			next = current+1;
+			for(dptr = devices; dptr != NULL; dptr = dptr->next) {
+				if(dptr->timestamp == utct) {
+					dptr->generation = next;
+				}
+			}
+		} while(config_generation_publish(current, next) == 0);
+	}
 	FREE(vstring_);
 	return (update == 1) ? 0 : -1;
 }
@@ -560,6 +590,15 @@ int devices_valid_value(char *sid, char *name, char *value) {
 }
 
 struct JsonNode *devices_values(const char *media) {
+	return devices_values_since(media, 0, NULL, NULL);
+}
+
+/*
+ * Only returns the devices that changed after generation since.
+ * A full snapshot is returned when since is 0, or when it dates
+ * from before the devices were last (re)loaded.
+ */
+struct JsonNode *devices_values_since(const char *media, unsigned long since, unsigned long *generation, int *full) {
 	/* Temporary pointer to the different structure */
 	struct devices_t *tmp_devices = NULL;
 	struct devices_settings_t *tmp_settings = NULL;
@@ -573,12 +612,27 @@ struct JsonNode *devices_values(const char *media) {
 	struct JsonNode *jdevices = NULL;
 	struct options_t *opt = NULL;
 
-	int match = 0;
+	int match = 0, all = 0;
+	unsigned long current = config_generation();
+
+	if(since == 0 || since < devices_base || since > current) {
+		all = 1;
+	}
+	if(generation != NULL) {
+		*generation = current;
+	}
+	if(full != NULL) {
+		*full = all;
+	}
 
 	tmp_devices = devices;
 
 	while(tmp_devices) {
 		match = 0;
+		if(all == 0 && tmp_devices->generation <= since) {
+			tmp_devices = tmp_devices->next;
+			continue;
+		}
 		if((gui_values = gui_media(tmp_devices->id)) != NULL) {
 			while(gui_values) {
 				if(gui_values->type == JSON_STRING) {
@@ -1579,6 +1633,7 @@ static int devices_parse(JsonNode *root) {
 				strcpy(dnode->id, jdevices->key);
 				dnode->nrthreads = 0;
 				dnode->timestamp = 0;
+				dnode->generation = 0;
 				dnode->protocol_threads = NULL;
 				dnode->settings = NULL;
 				dnode->next = NULL;
@@ -1678,80 +1733,99 @@ clear:
 	return have_error;
 }
 
-int devices_gc(void) {
+static void devices_free(struct devices_t *dtmp) {
 	int i = 0;
-	struct devices_t *dtmp = NULL;
 	struct devices_settings_t *stmp = NULL;
 	struct devices_values_t *vtmp = NULL;
 	struct protocols_t *ptmp = NULL;
 
-	pthread_mutex_lock(&mutex_lock);
-	/* Free devices structure */
-	while(devices) {
-		dtmp = devices;
-
 #if defined(EVENTS) && defined(PILIGHT_STAGING)
-		event_action_thread_free(dtmp);
+	event_action_thread_free(dtmp);
 #endif
 
-		while(dtmp->settings) {
-			stmp = dtmp->settings;
-			while(stmp->values) {
-				vtmp = stmp->values;
-				if(vtmp->type == JSON_STRING && vtmp->string_ != NULL) {
-					FREE(vtmp->string_);
-				}
-				if(vtmp->name) {
-					FREE(vtmp->name);
-				}
-				stmp->values = stmp->values->next;
-				FREE(vtmp);
+	while(dtmp->settings) {
+		stmp = dtmp->settings;
+		while(stmp->values) {
+			vtmp = stmp->values;
+			if(vtmp->type == JSON_STRING && vtmp->string_ != NULL) {
+				FREE(vtmp->string_);
 			}
-			if(stmp->values != NULL) {
-				FREE(stmp->values);
+			if(vtmp->name) {
+				FREE(vtmp->name);
 			}
-			if(stmp->name) {
-				FREE(stmp->name);
-			}
-			dtmp->settings = dtmp->settings->next;
-			FREE(stmp);
+			stmp->values = stmp->values->next;
+			FREE(vtmp);
 		}
-		while(dtmp->protocols) {
-			ptmp = dtmp->protocols;
-			if(ptmp->listener != NULL && ptmp->listener->threadGC != NULL) {
-				ptmp->listener->threadGC();
-			}
-			if(ptmp->name != NULL) {
-				FREE(ptmp->name);
-			}
-			if(ptmp->listener != NULL) {
-				FREE(ptmp->listener);
-			}
-			dtmp->protocols = dtmp->protocols->next;
-			FREE(ptmp);
+		if(stmp->values != NULL) {
+			FREE(stmp->values);
 		}
-		if(dtmp->nrthreads > 0) {
-			for(i=0;i<dtmp->nrthreads;i++) {
-				thread_stop(dtmp->protocol_threads[i]->id);
-			}
+		if(stmp->name) {
+			FREE(stmp->name);
 		}
-		if(dtmp->protocols != NULL) {
-			FREE(dtmp->protocols);
+		dtmp->settings = dtmp->settings->next;
+		FREE(stmp);
+	}
+	while(dtmp->protocols) {
+		ptmp = dtmp->protocols;
+		if(ptmp->listener != NULL && ptmp->listener->threadGC != NULL) {
+			ptmp->listener->threadGC();
 		}
-		if(dtmp->settings != NULL) {
-			FREE(dtmp->settings);
+		if(ptmp->name != NULL) {
+			FREE(ptmp->name);
 		}
-		if(dtmp->id != NULL) {
-			FREE(dtmp->id);
+		if(ptmp->listener != NULL) {
+			FREE(ptmp->listener);
 		}
-		if(dtmp->protocol_threads != NULL) {
-			FREE(dtmp->protocol_threads);
+		dtmp->protocols = dtmp->protocols->next;
+		FREE(ptmp);
+	}
+	if(dtmp->nrthreads > 0) {
+		for(i=0;i<dtmp->nrthreads;i++) {
+			thread_stop(dtmp->protocol_threads[i]->id);
 		}
-		devices = devices->next;
-		FREE(dtmp);
 	}
-	if(devices != NULL) {
-		FREE(devices);
+	if(dtmp->protocols != NULL) {
+		FREE(dtmp->protocols);
+	}
+	if(dtmp->settings != NULL) {
+		FREE(dtmp->settings);
+	}
+	if(dtmp->id != NULL) {
+		FREE(dtmp->id);
+	}
+	if(dtmp->protocol_threads != NULL) {
+		FREE(dtmp->protocol_threads);
+	}
+	FREE(dtmp);
+}
+
+static void devices_remove(const char *id) {
+	struct devices_t *tmp = devices, *prev = NULL;
+
+	while(tmp) {
+		if(strcmp(tmp->id, id) == 0) {
+			if(prev == NULL) {
+				devices = tmp->next;
+			} else {
+				prev->next = tmp->next;
+			}
+			devices_free(tmp);
+			break;
+		}
+		prev = tmp;
+		tmp = tmp->next;
+	}
+}
+
+int devices_gc(void) {
+	struct devices_t *dtmp = NULL;
+
+	pthread_mutex_lock(&mutex_lock);
+	/* Free devices structure */
+	while(devices) {
+		dtmp = devices;
+		devices = devices->next;
+		devices_free(dtmp);
 	}
 	devices = NULL;
 
@@ -1762,11 +1836,49 @@ int devices_gc(void) {
 }
 
 int config_devices_parse(struct JsonNode *root) {
-	if(devices_parse(root) == 0 && devices_validate_settings() == 0) {
-		return 0;
-	} else {
-		return 1;
+	int ret = (devices_parse(root) == 0 && devices_validate_settings() == 0) ? 0 : 1;
+
+	/*
+	 * A delta can not tell which devices were removed, so anyone
+	 * asking for changes since before this gets a full snapshot.
+	 */
+	devices_base = config_generation_bump();
+
+	return ret;
+}
+
+/*
+ * Applies a partial devices object as sent by a master. Devices
+ * in jremoved are dropped, devices in jdevices are (re)created and
+ * all other devices are left untouched.
+ */
+int config_devices_delta(struct JsonNode *jdevices, struct JsonNode *jremoved) {
+	struct JsonNode *jchild = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&mutex_lock);
+	if(jremoved != NULL && jremoved->tag == JSON_ARRAY) {
+		jchild = json_first_child(jremoved);
+		while(jchild) {
+			if(jchild->tag == JSON_STRING) {
+				devices_remove(jchild->string_);
+			}
+			jchild = jchild->next;
+		}
+	}
+	if(jdevices != NULL && jdevices->tag == JSON_OBJECT) {
+		jchild = json_first_child(jdevices);
+		while(jchild) {
+			devices_remove(jchild->key);
+			jchild = jchild->next;
+		}
+		ret = (devices_parse(jdevices) == 0 && devices_validate_settings() == 0) ? 0 : 1;
 	}
+	pthread_mutex_unlock(&mutex_lock);
+
+	devices_base = config_generation_bump();
+
+	return ret;
 }
 
 void devices_init(void) {
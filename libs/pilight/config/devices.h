@@ -80,6 +80,8 @@ struct devices_t {
 	int cst_uuid;
 	int nrthreads;
 	time_t timestamp;
+	/* config generation of the last value change */
+	unsigned long generation;
 #ifdef EVENTS
 	int lastrule;
 	int prevrule;
@@ -98,7 +100,9 @@ int devices_get(char *sid, struct devices_t **dev);
 int devices_valid_state(char *sid, char *state);
 int devices_valid_value(char *sid, char *name, char *value);
 struct JsonNode *devices_values(const char *media);
+struct JsonNode *devices_values_since(const char *media, unsigned long since, unsigned long *generation, int *full);
 int config_devices_parse(struct JsonNode *root);
+int config_devices_delta(struct JsonNode *jdevices, struct JsonNode *jremoved);
 void devices_init(void);
 int devices_gc(void);
 struct JsonNode *config_devices_sync(int level, const char *media);
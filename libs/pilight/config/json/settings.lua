@@ -72,6 +72,14 @@ function M.read(f)
 
 		'stats-enable',
 
+		'receive-queue-size', 'send-queue-size', 'broadcast-queue-size',
+
+		'send-policy', 'duty-cycle-433', 'duty-cycle-868', 'duty-cycle-window',
+
+		'noise-filter-quality', 'noise-filter-lengths',
+
+		'lua-states',
+
 		'whitelist'
 	};
 
@@ -143,6 +151,74 @@ function M.read(f)
 		end
 	end
 
+	--
+	-- The queue sizes are in bytes and should
+	-- at least fit a couple of full pulse trains
+	--
+	keys = { 'receive-queue-size', 'send-queue-size', 'broadcast-queue-size' }
+	for k, v in pairs(keys) do
+		if settings[v] ~= nil then
+			s = settings[v];
+			if type(tonumber(s)) ~= 'number' or tonumber(s) < 65536 then
+				error('config setting "' .. v .. '" must contain a number of at least 65536');
+			end
+		end
+	end
+
+	v = 'send-policy';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(s) ~= 'string' or (s ~= 'airtime' and s ~= 'fifo') then
+			error('config setting "' .. v .. '" must be either "airtime" or "fifo"');
+		end
+	end
+
+	--
+	-- The duty cycles are a percentage of the window,
+	-- 0 disables the limit
+	--
+	keys = { 'duty-cycle-433', 'duty-cycle-868' }
+	for k, v in pairs(keys) do
+		if settings[v] ~= nil then
+			s = settings[v];
+			if type(tonumber(s)) ~= 'number' or tonumber(s) < 0 or tonumber(s) > 100 then
+				error('config setting "' .. v .. '" must contain a number from 0 to 100');
+			end
+		end
+	end
+
+	v = 'duty-cycle-window';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(tonumber(s)) ~= 'number' or tonumber(s) < 60 then
+			error('config setting "' .. v .. '" must contain a number of at least 60');
+		end
+	end
+
+	v = 'noise-filter-quality';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(tonumber(s)) ~= 'number' or tonumber(s) < 0 or tonumber(s) > 100 then
+			error('config setting "' .. v .. '" must contain a number from 0 to 100');
+		end
+	end
+
+	v = 'noise-filter-lengths';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(tonumber(s)) ~= 'number' or tonumber(s) < 1 or tonumber(s) > 8 then
+			error('config setting "' .. v .. '" must contain a number from 1 to 8');
+		end
+	end
+
+	v = 'lua-states';
+	if settings[v] ~= nil then
+		s = settings[v];
+		if type(tonumber(s)) ~= 'number' or tonumber(s) < 4 or tonumber(s) > 16 then
+			error('config setting "' .. v .. '" must contain a number from 4 to 16');
+		end
+	end
+
 	v = 'adhoc-mode';
 	if settings[v] ~= nil then
 		s = settings[v];
@@ -223,15 +299,27 @@ function M.read(f)
 			for k, x in pairs(pilight.common.explode(s, ',')) do
 				x = x:gsub("%s+", "");
 				if type(x) == 'string' then
-					local ip4 = {x:match("([%d*]+)%.([%d*]+)%.([%d*]+)%.([%d*]+)")};
+					local bits = nil;
+					local addr, prefix = x:match("^(.+)/(%d+)$");
+					if addr ~= nil then
+						x = addr;
+						bits = tonumber(prefix);
+					end
+					local ip4 = {x:match("^([%d*]+)%.([%d*]+)%.([%d*]+)%.([%d*]+)$")};
 					local ip6 = x:match("^([a-fA-F0-9:]+)$");
 					if ip4 ~= nil and #ip4 == 4 then
+						if bits ~= nil and (bits > 32 or x:find('*', 1, true) ~= nil) then
+							error('config setting "' .. v .. '" must contain a valid ip address');
+						end
 						for _, y in pairs(ip4) do
 							if y ~= '*' and (tonumber(y) > 255 or tonumber(y) < 0) then
 								error('config setting "' .. v .. '" must contain a valid ip address');
 							end
 						end
 					elseif ip6 ~= nil and #ip6 > 0 then
+						if bits ~= nil and bits > 128 then
+							error('config setting "' .. v .. '" must contain a valid ip address');
+						end
 						local nc, dc = 0, false;
 						for chunk, colons in ip6:gmatch("([^:]*)(:*)") do
 							if nc > (dc and 7 or 8) then
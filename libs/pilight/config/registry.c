@@ -31,6 +31,7 @@
 
 #include "config.h"
 #include "registry.h"
+#include "snapshot.h"
 
 static int config_callback_get(lua_State *L, char *module, char *key, struct varcont_t *ret) {
 	struct lua_state_t *state = plua_get_module(L, "storage", module);
@@ -186,21 +187,38 @@ static int config_callback_set_boolean(lua_State *L, char *module, char *key, in
 }
 
 int config_registry_get(lua_State *L, char *key, struct varcont_t *ret) {
-	return config_callback_get(L, "registry", key, ret);
+	int x = config_snapshot_get("registry", key, -1, ret);
+
+	if(x == -1 && L != NULL) {
+		return config_callback_get(L, "registry", key, ret);
+	}
+	return (x == 0) ? 0 : 1;
 }
 
 int config_registry_set_number(lua_State *L, char *key, double val) {
-	return config_callback_set_number(L, "registry", key, val);
+	int x = config_callback_set_number(L, "registry", key, val);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
 
 int config_registry_set_boolean(lua_State *L, char *key, int val) {
-	return config_callback_set_boolean(L, "registry", key, val);
+	int x = config_callback_set_boolean(L, "registry", key, val);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
 
 int config_registry_set_string(lua_State *L, char *key, char *val) {
-	return config_callback_set_string(L, "registry", key, val);
+	int x = config_callback_set_string(L, "registry", key, val);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
 
 int config_registry_set_null(lua_State *L, char *key) {
-	return config_callback_set_string(L, "registry", key, NULL);
+	int x = config_callback_set_string(L, "registry", key, NULL);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
\ No newline at end of file
@@ -31,6 +31,7 @@
 
 #include "config.h"
 #include "settings.h"
+#include "snapshot.h"
 
 int config_callback_get_number(lua_State *L, char *module, char *key, int idx, int *ret) {
 	struct lua_state_t *state = plua_get_current_state(L);
@@ -206,18 +207,56 @@ int config_callback_set_number(lua_State *L, char *module, char *key, int idx, i
 	return x;
 }
 
+/*
+ * Settings are read from the published snapshot. Only
+ * when nothing was published yet the storage module is
+ * called directly.
+ */
 int config_setting_get_number(lua_State *L, char *key, int idx, int *ret) {
+	struct varcont_t val;
+	int x = config_snapshot_get("settings", key, idx, &val);
+
+	if(x == 0) {
+		if(val.type_ != LUA_TNUMBER) {
+			if(val.type_ == LUA_TSTRING) {
+				FREE(val.string_);
+			}
+			return -1;
+		}
+		*ret = (int)val.number_;
+		return 0;
+	} else if(x == 1 || L == NULL) {
+		return -1;
+	}
 	return config_callback_get_number(L, "settings", key, idx, ret);
 }
 
 int config_setting_get_string(lua_State *L, char *key, int idx, char **ret) {
+	struct varcont_t val;
+	int x = config_snapshot_get("settings", key, idx, &val);
+
+	if(x == 0) {
+		if(val.type_ != LUA_TSTRING) {
+			return -1;
+		}
+		*ret = val.string_;
+		return 0;
+	} else if(x == 1 || L == NULL) {
+		return -1;
+	}
 	return config_callback_get_string(L, "settings", key, idx, ret);
 }
 
 int config_setting_set_number(lua_State *L, char *key, int idx, int val) {
-	return config_callback_set_number(L, "settings", key, idx, val);
+	int x = config_callback_set_number(L, "settings", key, idx, val);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
 
 int config_setting_set_string(lua_State *L, char *key, int idx, char *val) {
-	return config_callback_set_string(L, "settings", key, idx, val);
+	int x = config_callback_set_string(L, "settings", key, idx, val);
+	config_snapshot_publish();
+	config_generation_bump();
+	return x;
 }
@@ -0,0 +1,220 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../core/pilight.h"
+#include "../core/common.h"
+#include "../core/mem.h"
+#include "../core/network.h"
+#include "../core/rcu.h"
+#include "../lua_c/lua.h"
+
+#include "config.h"
+#include "snapshot.h"
+
+/*
+ * The settings and registry tables are flattened into a
+ * sorted array of dotted paths like "settings.log-level",
+ * "settings.ntp-servers.1" or "registry.pilight.version.current".
+ */
+typedef struct snapshot_entry_t {
+	char *key;
+	struct varcont_t val;
+} snapshot_entry_t;
+
+typedef struct snapshot_t {
+	struct snapshot_entry_t *entries;
+	int nr;
+	int size;
+} snapshot_t;
+
+static struct rcu_t current;
+
+static void snapshot_add(struct snapshot_t *snap, char *key, struct varcont_t *val) {
+	if(snap->nr == snap->size) {
+		snap->size = (snap->size == 0) ? 32 : snap->size*2;
+		if((snap->entries = REALLOC(snap->entries, sizeof(struct snapshot_entry_t)*snap->size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+	struct snapshot_entry_t *entry = &snap->entries[snap->nr++];
+
+	if((entry->key = STRDUP(key)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(&entry->val, 0, sizeof(struct varcont_t));
+	entry->val.type_ = val->type_;
+	switch(val->type_) {
+		case LUA_TSTRING:
+			if((entry->val.string_ = STRDUP(val->string_)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		break;
+		case LUA_TBOOLEAN:
+			entry->val.bool_ = (int)val->number_;
+		break;
+		case LUA_TNUMBER:
+			entry->val.number_ = val->number_;
+		break;
+	}
+}
+
+static void snapshot_walk(struct snapshot_t *snap, struct plua_metatable_t *table, char *path, int len) {
+	int x = 0, n = 0;
+
+	uv_mutex_lock(&table->lock);
+	for(x=0;x<table->nrvar;x++) {
+		uv_mutex_lock(&table->table[x].lock);
+		if(table->table[x].key.type_ == LUA_TSTRING) {
+			n = snprintf(&path[len], 1024-len, ".%s", table->table[x].key.string_);
+		} else if(table->table[x].key.type_ == LUA_TNUMBER) {
+			n = snprintf(&path[len], 1024-len, ".%d", (int)table->table[x].key.number_);
+		} else {
+			n = -1;
+		}
+		if(n > 0 && n < 1024-len) {
+			switch(table->table[x].val.type_) {
+				case LUA_TTABLE:
+					snapshot_walk(snap, table->table[x].val.void_, path, len+n);
+				break;
+				case LUA_TSTRING:
+				case LUA_TNUMBER:
+				case LUA_TBOOLEAN:
+					snapshot_add(snap, path, &table->table[x].val);
+				break;
+			}
+		}
+		path[len] = '\0';
+		uv_mutex_unlock(&table->table[x].lock);
+	}
+	uv_mutex_unlock(&table->lock);
+}
+
+static int snapshot_cmp(const void *a, const void *b) {
+	return strcmp(((struct snapshot_entry_t *)a)->key, ((struct snapshot_entry_t *)b)->key);
+}
+
+static void snapshot_free(struct snapshot_t *snap) {
+	int i = 0;
+
+	if(snap == NULL) {
+		return;
+	}
+	for(i=0;i<snap->nr;i++) {
+		if(snap->entries[i].val.type_ == LUA_TSTRING) {
+			FREE(snap->entries[i].val.string_);
+		}
+		FREE(snap->entries[i].key);
+	}
+	if(snap->entries != NULL) {
+		FREE(snap->entries);
+	}
+	FREE(snap);
+}
+
+static void snapshot_swap(struct snapshot_t *snap) {
+	snapshot_free(rcu_publish(&current, snap));
+}
+
+void config_snapshot_publish(void) {
+	struct plua_metatable_t *table = config_get_metatable();
+	struct snapshot_t *snap = NULL;
+	char path[1024];
+	int x = 0;
+
+	if(table == NULL) {
+		snapshot_swap(NULL);
+		whitelist_update();
+		return;
+	}
+
+	if((snap = MALLOC(sizeof(struct snapshot_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(snap, 0, sizeof(struct snapshot_t));
+
+	uv_mutex_lock(&table->lock);
+	for(x=0;x<table->nrvar;x++) {
+		uv_mutex_lock(&table->table[x].lock);
+		if(table->table[x].key.type_ == LUA_TSTRING &&
+			table->table[x].val.type_ == LUA_TTABLE &&
+			(strcmp(table->table[x].key.string_, "settings") == 0 ||
+			 strcmp(table->table[x].key.string_, "registry") == 0)) {
+			memset(path, 0, sizeof(path));
+			strncpy(path, table->table[x].key.string_, sizeof(path)-1);
+			snapshot_walk(snap, table->table[x].val.void_, path, strlen(path));
+		}
+		uv_mutex_unlock(&table->table[x].lock);
+	}
+	uv_mutex_unlock(&table->lock);
+
+	qsort(snap->entries, snap->nr, sizeof(struct snapshot_entry_t), snapshot_cmp);
+
+	snapshot_swap(snap);
+
+	whitelist_update();
+}
+
+static struct snapshot_entry_t *snapshot_find(struct snapshot_t *snap, char *key) {
+	struct snapshot_entry_t tmp;
+
+	tmp.key = key;
+	return bsearch(&tmp, snap->entries, snap->nr, sizeof(struct snapshot_entry_t), snapshot_cmp);
+}
+
+/*
+ * Returns 0 and a copy of the value when found, 1 when the
+ * key does not exist and -1 when nothing was published yet.
+ * Strings are duplicated and must be freed by the caller.
+ *
+ * With an idx of 0 or higher, the lookup follows the settings
+ * semantics: a plain value is returned as is, a list returns
+ * its idx'th element.
+ */
+int config_snapshot_get(char *section, char *key, int idx, struct varcont_t *ret) {
+	struct snapshot_entry_t *entry = NULL;
+	struct snapshot_t *snap = NULL;
+	char path[1024];
+	int r = 1, token = 0;
+
+	if(key == NULL || ret == NULL) {
+		return 1;
+	}
+
+	if((snap = rcu_read_lock(&current, &token)) == NULL) {
+		rcu_read_unlock(&current, token);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s.%s", section, key);
+	if((entry = snapshot_find(snap, path)) == NULL && idx >= 0) {
+		snprintf(path, sizeof(path), "%s.%s.%d", section, key, idx+1);
+		entry = snapshot_find(snap, path);
+	}
+
+	if(entry != NULL) {
+		memcpy(ret, &entry->val, sizeof(struct varcont_t));
+		if(entry->val.type_ == LUA_TSTRING) {
+			if((ret->string_ = STRDUP(entry->val.string_)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+		}
+		r = 0;
+	}
+
+	rcu_read_unlock(&current, token);
+
+	return r;
+}
+
+void config_snapshot_gc(void) {
+	snapshot_swap(NULL);
+}
@@ -0,0 +1,23 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _CONFIG_SNAPSHOT_H_
+#define _CONFIG_SNAPSHOT_H_
+
+#include "../core/common.h"
+
+/*
+ * Read only copy of the settings and registry storage.
+ * A new copy is published after every write, so readers
+ * never have to enter a Lua state or take a lock.
+ */
+void config_snapshot_publish(void);
+int config_snapshot_get(char *section, char *key, int idx, struct varcont_t *ret);
+void config_snapshot_gc(void);
+
+#endif
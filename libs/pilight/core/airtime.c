@@ -0,0 +1,213 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../libuv/uv.h"
+#include "pilight.h"
+#include "../protocols/protocol.h"
+#include "log.h"
+#include "metrics.h"
+#include "airtime.h"
+
+static struct airtime_band_t bands[] = {
+	{ RF433, "433" },
+	{ RF868, "868" }
+};
+
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+
+static double airtime_utilization(void *param);
+static double airtime_total(void *param);
+
+static void airtime_init(void) {
+	char labels[32];
+	unsigned int i = 0;
+
+	uv_mutex_init(&lock);
+
+	for(i=0;i<sizeof(bands)/sizeof(bands[0]);i++) {
+		bands[i].window = 3600*1000000ULL;
+
+		snprintf(labels, sizeof(labels), "band=\"%s\"", bands[i].name);
+		metrics_gauge_callback("pilight_airtime_utilization_ratio", labels,
+			(i == 0) ? "Share of the duty cycle window spent sending" : NULL, airtime_utilization, &bands[i]);
+		metrics_counter_callback("pilight_airtime_seconds_total", labels,
+			(i == 0) ? "Time spent sending" : NULL, airtime_total, &bands[i]);
+	}
+}
+
+static struct airtime_band_t *airtime_band(int hwtype) {
+	unsigned int i = 0;
+
+	uv_once(&once, airtime_init);
+
+	for(i=0;i<sizeof(bands)/sizeof(bands[0]);i++) {
+		if(bands[i].hwtype == hwtype) {
+			return &bands[i];
+		}
+	}
+	return NULL;
+}
+
+static uint64_t airtime_now(void) {
+	return uv_hrtime()/1000;
+}
+
+static uint64_t airtime_width(struct airtime_band_t *band) {
+	return band->window/AIRTIME_BUCKETS;
+}
+
+/*
+ * The airtime used within the last window
+ * when bucket e is the current one.
+ */
+static uint64_t airtime_used(struct airtime_band_t *band, uint64_t e) {
+	uint64_t used = 0;
+	int i = 0;
+
+	for(i=0;i<AIRTIME_BUCKETS;i++) {
+		if(band->epoch[i] <= e && e-band->epoch[i] < AIRTIME_BUCKETS) {
+			used += band->used[i];
+		}
+	}
+	return used;
+}
+
+static double airtime_utilization(void *param) {
+	struct airtime_band_t *band = param;
+	double r = 0.0;
+
+	uv_mutex_lock(&lock);
+	r = (double)airtime_used(band, airtime_now()/airtime_width(band))/(double)band->window;
+	uv_mutex_unlock(&lock);
+
+	return r;
+}
+
+static double airtime_total(void *param) {
+	struct airtime_band_t *band = param;
+	double r = 0.0;
+
+	uv_mutex_lock(&lock);
+	r = (double)band->total/1000000;
+	uv_mutex_unlock(&lock);
+
+	return r;
+}
+
+/*
+ * A percentage of 0 or 100 and up means the band isn't
+ * limited. The window is in seconds.
+ */
+void airtime_budget(int hwtype, double percent, int window) {
+	struct airtime_band_t *band = airtime_band(hwtype);
+
+	if(band == NULL) {
+		return;
+	}
+
+	uv_mutex_lock(&lock);
+	if(window > 0) {
+		band->window = (uint64_t)window*1000000;
+	}
+	memset(band->epoch, 0, sizeof(band->epoch));
+	memset(band->used, 0, sizeof(band->used));
+
+	band->percent = percent;
+	band->budget = 0;
+	if(percent > 0 && percent < 100) {
+		band->budget = (uint64_t)((double)band->window*percent/100);
+		logprintf(LOG_DEBUG, "duty cycle of the %s band limited to %.2f%% of %d seconds",
+			band->name, percent, (int)(band->window/1000000));
+	}
+	uv_mutex_unlock(&lock);
+}
+
+/*
+ * The time in microseconds the hardware needs to send a
+ * pulse train, including all repeats.
+ */
+uint64_t airtime_frame(int *code, int length, int txrpt) {
+	uint64_t usec = 0;
+	int i = 0;
+
+	for(i=0;i<length;i++) {
+		if(code[i] > 0) {
+			usec += (unsigned int)code[i];
+		}
+	}
+	return usec*(uint64_t)((txrpt > 0) ? txrpt : 1);
+}
+
+/*
+ * Returns 0 when a frame of usec microseconds can be sent
+ * right away, otherwise the number of microseconds until
+ * enough airtime expired from the window. A frame larger
+ * than the whole budget is allowed on an idle band.
+ */
+uint64_t airtime_delay(int hwtype, uint64_t usec) {
+	struct airtime_band_t *band = airtime_band(hwtype);
+	uint64_t now = 0, width = 0, e = 0, k = 0, used = 0, delay = 0;
+	int idx = 0;
+
+	if(band == NULL || band->budget == 0) {
+		return 0;
+	}
+
+	uv_mutex_lock(&lock);
+	now = airtime_now();
+	width = airtime_width(band);
+	e = now/width;
+
+	used = airtime_used(band, e);
+	if(used == 0 || used+usec <= band->budget) {
+		uv_mutex_unlock(&lock);
+		return 0;
+	}
+
+	/* Expire the buckets from old to new */
+	for(k=(e >= AIRTIME_BUCKETS-1) ? e-(AIRTIME_BUCKETS-1) : 0;k<=e;k++) {
+		idx = k%AIRTIME_BUCKETS;
+		if(band->epoch[idx] != k) {
+			continue;
+		}
+		used -= band->used[idx];
+		if(used == 0 || used+usec <= band->budget) {
+			delay = (k+AIRTIME_BUCKETS)*width-now;
+			break;
+		}
+	}
+	uv_mutex_unlock(&lock);
+
+	return (delay > 0) ? delay : 1;
+}
+
+void airtime_use(int hwtype, uint64_t usec) {
+	struct airtime_band_t *band = airtime_band(hwtype);
+	uint64_t e = 0;
+	int idx = 0;
+
+	if(band == NULL) {
+		return;
+	}
+
+	uv_mutex_lock(&lock);
+	e = airtime_now()/airtime_width(band);
+	idx = e%AIRTIME_BUCKETS;
+	if(band->epoch[idx] != e) {
+		band->epoch[idx] = e;
+		band->used[idx] = 0;
+	}
+	band->used[idx] += usec;
+	band->total += usec;
+	uv_mutex_unlock(&lock);
+}
@@ -0,0 +1,38 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _AIRTIME_H_
+#define _AIRTIME_H_
+
+#include <stdint.h>
+
+/*
+ * Rolling duty cycle budget of the RF433 and RF868 bands. The
+ * airtime used within the window is kept in AIRTIME_BUCKETS
+ * buckets, so old transmissions expire bucket by bucket. Other
+ * hardware types are never limited.
+ */
+#define AIRTIME_BUCKETS	60
+
+typedef struct airtime_band_t {
+	int hwtype;
+	char *name;
+	double percent;
+	uint64_t window;
+	uint64_t budget;
+	uint64_t total;
+	uint64_t epoch[AIRTIME_BUCKETS];
+	uint64_t used[AIRTIME_BUCKETS];
+} airtime_band_t;
+
+void airtime_budget(int hwtype, double percent, int window);
+uint64_t airtime_frame(int *code, int length, int txrpt);
+uint64_t airtime_delay(int hwtype, uint64_t usec);
+void airtime_use(int hwtype, uint64_t usec);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bitslicer.h"
+
+int bitslicer_validate(const struct bitslicer_t *slicer, const int *raw, int rawlen) {
+	if(rawlen <= 0 || (rawlen != slicer->rawlen[0] && rawlen != slicer->rawlen[1])) {
+		return -1;
+	}
+	if(raw[rawlen-1] < slicer->minfooter || raw[rawlen-1] > slicer->maxfooter) {
+		return -1;
+	}
+	if(slicer->start > -1 && (slicer->start >= rawlen || raw[slicer->start] < slicer->minstart)) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns the number of bits decoded. The comparison result
+ * is shifted in directly, so the loop doesn't branch on the
+ * pulse lengths.
+ */
+int bitslicer_decode(const struct bitslicer_t *slicer, const int *raw, int rawlen, uint64_t *bits) {
+	const int threshold = slicer->threshold, stride = slicer->stride;
+	uint64_t out = 0;
+	int x = 0, i = 0;
+
+	for(x=slicer->offset;x<rawlen && i<64;x+=stride) {
+		out |= (uint64_t)(raw[x] > threshold) << i++;
+	}
+	*bits = out;
+
+	return i;
+}
+
+unsigned long long bitslicer_field_rev(uint64_t bits, int s, int e) {
+	unsigned long long out = 0;
+
+	for(;s<=e;s++) {
+		out = (out << 1) | ((bits >> s) & 1);
+	}
+	return out;
+}
@@ -0,0 +1,58 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _BITSLICER_H_
+#define _BITSLICER_H_
+
+#include <stdint.h>
+
+/*
+ * Describes a fixed length OOK pulse train where every bit is
+ * carried by one pulse out of a group of stride pulses. A pulse
+ * longer than the threshold is a 1. Bit 0 of the decoded word
+ * is the first bit received.
+ *
+ * All pulse lengths are in the same unit as the raw pulses, so
+ * footers usually need to be multiplied by PULSE_DIV.
+ */
+typedef struct bitslicer_t {
+	/* Accepted frame lengths, a 0 disables the second one */
+	int rawlen[2];
+	/* Range of the last pulse of a frame */
+	int minfooter;
+	int maxfooter;
+	/* Pulse that must be at least minstart long, -1 to skip */
+	int start;
+	int minstart;
+	/* First pulse carrying a bit and the distance to the next one */
+	int offset;
+	int stride;
+	int threshold;
+} bitslicer_t;
+
+int bitslicer_validate(const struct bitslicer_t *slicer, const int *raw, int rawlen);
+int bitslicer_decode(const struct bitslicer_t *slicer, const int *raw, int rawlen, uint64_t *bits);
+
+/*
+ * Same semantics as binToDec and binToDecRev, but on a decoded
+ * word. In bitslicer_field, bit s is the least significant bit,
+ * in bitslicer_field_rev, bit s is the most significant bit.
+ */
+static inline int bitslicer_bit(uint64_t bits, int i) {
+	return (int)((bits >> i) & 1);
+}
+
+static inline unsigned long long bitslicer_field(uint64_t bits, int s, int e) {
+	int len = e-s+1;
+
+	return (bits >> s) & ((len >= 64) ? ~0ULL : ((1ULL << len)-1));
+}
+
+unsigned long long bitslicer_field_rev(uint64_t bits, int s, int e);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "mem.h"
+#include "capture.h"
+
+#define CAPTURE_LINE	(MAXPULSESTREAMLENGTH*12+64)
+
+struct capture_t *capture_open(const char *file, int mode) {
+	struct capture_t *capture = NULL;
+	FILE *fp = NULL;
+
+	if((fp = fopen(file, (mode == CAPTURE_WRITE) ? "w" : "r")) == NULL) {
+		logprintf(LOG_ERR, "cannot open capture file %s: %s", file, strerror(errno));
+		return NULL;
+	}
+
+	if((capture = MALLOC(sizeof(struct capture_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(capture, 0, sizeof(struct capture_t));
+	capture->fp = fp;
+	capture->mode = mode;
+	uv_mutex_init(&capture->lock);
+
+	if(mode == CAPTURE_WRITE) {
+		fprintf(fp, "# pilight capture v1\n");
+		fprintf(fp, "# <usec> <hwtype> <plslen> <rawlen> <pulses...>\n");
+		fflush(fp);
+	}
+
+	return capture;
+}
+
+/*
+ * Can be called from several threads at once,
+ * every frame is written as a single line.
+ */
+int capture_write(struct capture_t *capture, int *raw, int rawlen, int plslen, int hwtype) {
+	char line[CAPTURE_LINE];
+	uint64_t now = uv_hrtime()/1000;
+	int len = 0, i = 0;
+
+	if(capture == NULL || capture->mode != CAPTURE_WRITE) {
+		return -1;
+	}
+	if(rawlen > MAXPULSESTREAMLENGTH) {
+		rawlen = MAXPULSESTREAMLENGTH;
+	}
+
+	uv_mutex_lock(&capture->lock);
+	if(capture->start == 0) {
+		capture->start = now;
+	}
+	len = snprintf(line, sizeof(line), "%llu %d %d %d",
+		(unsigned long long)(now-capture->start), hwtype, plslen, rawlen);
+	for(i=0;i<rawlen;i++) {
+		len += snprintf(&line[len], sizeof(line)-len, " %d", raw[i]);
+	}
+	line[len++] = '\n';
+
+	if(fwrite(line, 1, len, capture->fp) != (size_t)len) {
+		uv_mutex_unlock(&capture->lock);
+		logprintf(LOG_ERR, "failed to write capture: %s", strerror(errno));
+		return -1;
+	}
+	fflush(capture->fp);
+	capture->line++;
+	uv_mutex_unlock(&capture->lock);
+
+	return 0;
+}
+
+/*
+ * Returns 0 when a frame was read, 1 at the end of
+ * the file and -1 when a line could not be parsed.
+ */
+int capture_read(struct capture_t *capture, struct capture_frame_t *frame) {
+	char line[CAPTURE_LINE], *p = NULL, *end = NULL;
+	int i = 0;
+
+	if(capture == NULL || capture->mode != CAPTURE_READ) {
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), capture->fp) != NULL) {
+		capture->line++;
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+			continue;
+		}
+
+		p = line;
+		frame->timestamp = strtoull(p, &end, 10);
+		if(end == p) {
+			break;
+		}
+		p = end;
+		frame->hwtype = (int)strtol(p, &end, 10);
+		if(end == p) {
+			break;
+		}
+		p = end;
+		frame->plslen = (int)strtol(p, &end, 10);
+		if(end == p) {
+			break;
+		}
+		p = end;
+		frame->rawlen = (int)strtol(p, &end, 10);
+		if(end == p || frame->rawlen < 0 || frame->rawlen > MAXPULSESTREAMLENGTH) {
+			break;
+		}
+		p = end;
+		for(i=0;i<frame->rawlen;i++) {
+			frame->raw[i] = (int)strtol(p, &end, 10);
+			if(end == p) {
+				break;
+			}
+			p = end;
+		}
+		if(i < frame->rawlen) {
+			break;
+		}
+		return 0;
+	}
+
+	if(p == NULL) {
+		return 1;
+	}
+
+	logprintf(LOG_ERR, "malformed capture frame on line %lu", capture->line);
+	return -1;
+}
+
+void capture_close(struct capture_t *capture) {
+	if(capture != NULL) {
+		fclose(capture->fp);
+		uv_mutex_destroy(&capture->lock);
+		FREE(capture);
+	}
+}
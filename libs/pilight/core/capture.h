@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "defines.h"
+#include "../../libuv/uv.h"
+
+/*
+ * A capture file holds received pulse trains, one per line:
+ *
+ * <microseconds since first frame> <hwtype> <plslen> <rawlen> <pulses...>
+ *
+ * Lines starting with a # are comments.
+ */
+#define CAPTURE_READ		0
+#define CAPTURE_WRITE		1
+
+typedef struct capture_frame_t {
+	uint64_t timestamp;
+	int hwtype;
+	int plslen;
+	int rawlen;
+	int raw[MAXPULSESTREAMLENGTH];
+} capture_frame_t;
+
+typedef struct capture_t {
+	FILE *fp;
+	int mode;
+	uint64_t start;
+	unsigned long line;
+	uv_mutex_t lock;
+} capture_t;
+
+struct capture_t *capture_open(const char *file, int mode);
+int capture_write(struct capture_t *capture, int *raw, int rawlen, int plslen, int hwtype);
+int capture_read(struct capture_t *capture, struct capture_frame_t *frame);
+void capture_close(struct capture_t *capture);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+#else
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <netdb.h>
+	#include <arpa/inet.h>
+#endif
+
+#include "../../libuv/uv.h"
+#include "defines.h"
+#include "log.h"
+#include "mem.h"
+#include "dns.h"
+
+#define DNS_PENDING		0
+#define DNS_RESOLVED	1
+#define DNS_FAILED		2
+
+typedef struct dns_waiter_t {
+	dns_cb_t *callback;
+	void *userdata;
+
+	struct dns_waiter_t *next;
+} dns_waiter_t;
+
+static struct dns_entry_t *entries = NULL;
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+
+static void dns_init(void) {
+	uv_mutex_init(&lock);
+}
+
+static unsigned long long dns_now(void) {
+	return uv_hrtime()/1000000;
+}
+
+/*
+ * Should be called with the lock held. Expired
+ * entries are removed while searching, unless
+ * a lookup for them is still running or still
+ * has waiters attached. dns_cache_set can store
+ * a result in an entry while its lookup runs.
+ */
+static struct dns_entry_t *dns_find(char *host) {
+	struct dns_entry_t *tmp = entries, *prev = NULL, *next = NULL;
+	unsigned long long now = dns_now();
+
+	while(tmp) {
+		next = tmp->next;
+		if(tmp->state != DNS_PENDING && tmp->waiters == NULL && tmp->expire <= now) {
+			if(prev == NULL) {
+				entries = next;
+			} else {
+				prev->next = next;
+			}
+			FREE(tmp->host);
+			FREE(tmp);
+		} else {
+			if(strcmp(tmp->host, host) == 0) {
+				return tmp;
+			}
+			prev = tmp;
+		}
+		tmp = next;
+	}
+	return NULL;
+}
+
+static struct dns_entry_t *dns_add(char *host) {
+	struct dns_entry_t *entry = NULL;
+
+	if((entry = MALLOC(sizeof(struct dns_entry_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(entry, 0, sizeof(struct dns_entry_t));
+	if((entry->host = STRDUP(host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	entry->next = entries;
+	entries = entry;
+
+	return entry;
+}
+
+static void dns_store(struct dns_entry_t *entry, int family, char *ip) {
+	if(family == AF_INET || family == AF_INET6) {
+		entry->state = DNS_RESOLVED;
+		entry->family = family;
+		snprintf(entry->ip, sizeof(entry->ip), "%s", ip);
+		entry->expire = dns_now()+(DNS_CACHE_TTL*1000);
+	} else {
+		entry->state = DNS_FAILED;
+		entry->family = -1;
+		entry->ip[0] = '\0';
+		entry->expire = dns_now()+(DNS_NEGATIVE_TTL*1000);
+	}
+}
+
+/*
+ * Returns 0 on a cache hit, -1 when the host is known
+ * not to resolve and 1 when it should be looked up.
+ * The ip buffer should be INET6_ADDRSTRLEN+1 long.
+ */
+int dns_cache_get(char *host, int *family, char *ip) {
+	struct dns_entry_t *entry = NULL;
+	int r = 1;
+
+	uv_once(&once, dns_init);
+
+	uv_mutex_lock(&lock);
+	if((entry = dns_find(host)) != NULL) {
+		if(entry->state == DNS_RESOLVED) {
+			*family = entry->family;
+			strcpy(ip, entry->ip);
+			r = 0;
+		} else if(entry->state == DNS_FAILED) {
+			r = -1;
+		}
+	}
+	uv_mutex_unlock(&lock);
+
+	return r;
+}
+
+/*
+ * A family other than AF_INET or AF_INET6
+ * stores a failed lookup.
+ */
+void dns_cache_set(char *host, int family, char *ip) {
+	struct dns_entry_t *entry = NULL;
+
+	uv_once(&once, dns_init);
+
+	uv_mutex_lock(&lock);
+	if((entry = dns_find(host)) == NULL) {
+		entry = dns_add(host);
+	}
+	/*
+	 * A running lookup will overwrite this
+	 * result again when it finishes.
+	 */
+	dns_store(entry, family, ip);
+	uv_mutex_unlock(&lock);
+}
+
+static int dns_addrinfo(struct addrinfo *res, char *ip) {
+	struct addrinfo *p = NULL;
+
+	for(p = res; p != NULL; p = p->ai_next) {
+		if(p->ai_family == AF_INET6) {
+			struct sockaddr_in6 *h = (struct sockaddr_in6 *)p->ai_addr;
+			uv_inet_ntop(p->ai_family, (void *)&(h->sin6_addr), ip, INET6_ADDRSTRLEN+1);
+		} else if(p->ai_family == AF_INET) {
+			struct sockaddr_in *h = (struct sockaddr_in *)p->ai_addr;
+			uv_inet_ntop(p->ai_family, (void *)&(h->sin_addr), ip, INET6_ADDRSTRLEN+1);
+		} else {
+			continue;
+		}
+		if(strlen(ip) > 0) {
+			return p->ai_family;
+		}
+	}
+	return -1;
+}
+
+static void dns_notify(struct dns_waiter_t *waiters, int family, char *ip) {
+	struct dns_waiter_t *tmp = NULL;
+
+	while(waiters) {
+		tmp = waiters;
+		waiters = waiters->next;
+		tmp->callback(family, (family == -1) ? NULL : ip, tmp->userdata);
+		FREE(tmp);
+	}
+}
+
+static void dns_resolved(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+	struct dns_entry_t *entry = NULL;
+	struct dns_waiter_t *waiters = NULL;
+	char *host = req->data, ip[INET6_ADDRSTRLEN+1];
+	int family = -1;
+
+	memset(ip, '\0', sizeof(ip));
+
+	if(status == 0) {
+		family = dns_addrinfo(res, ip);
+	} else if(status != UV_ECANCELED) {
+		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", host, uv_strerror(status));
+	}
+
+	uv_mutex_lock(&lock);
+	if((entry = dns_find(host)) != NULL) {
+		dns_store(entry, family, ip);
+		waiters = entry->waiters;
+		entry->waiters = NULL;
+	}
+	uv_mutex_unlock(&lock);
+
+	/*
+	 * Callbacks are free to start new
+	 * lookups so call them unlocked.
+	 */
+	dns_notify(waiters, family, ip);
+
+	if(res != NULL) {
+		uv_freeaddrinfo(res);
+	}
+	FREE(host);
+	FREE(req);
+}
+
+/*
+ * Resolves a host without blocking the main loop. The
+ * callback is called directly for ip addresses and
+ * cached hosts, otherwise from the main loop once the
+ * lookup is done. Lookups for a host already being
+ * resolved are attached to the running lookup.
+ */
+int dns_resolve(char *host, dns_cb_t *callback, void *userdata) {
+	struct dns_entry_t *entry = NULL;
+	struct dns_waiter_t *waiter = NULL, *waiters = NULL;
+	struct addrinfo hints;
+	uv_getaddrinfo_t *req = NULL;
+	char ip[INET6_ADDRSTRLEN+1], buf[sizeof(struct in6_addr)];
+	int family = -1, r = 0;
+
+	uv_once(&once, dns_init);
+
+	if(uv_inet_pton(AF_INET, host, buf) == 0) {
+		callback(AF_INET, host, userdata);
+		return 0;
+	}
+	if(uv_inet_pton(AF_INET6, host, buf) == 0) {
+		callback(AF_INET6, host, userdata);
+		return 0;
+	}
+
+	uv_mutex_lock(&lock);
+	if((entry = dns_find(host)) != NULL && entry->state != DNS_PENDING) {
+		family = entry->family;
+		strcpy(ip, entry->ip);
+		uv_mutex_unlock(&lock);
+
+		callback(family, (family == -1) ? NULL : ip, userdata);
+		return 0;
+	}
+
+	if((waiter = MALLOC(sizeof(struct dns_waiter_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	waiter->callback = callback;
+	waiter->userdata = userdata;
+
+	if(entry != NULL) {
+		waiter->next = entry->waiters;
+		entry->waiters = waiter;
+		uv_mutex_unlock(&lock);
+		return 0;
+	}
+
+	entry = dns_add(host);
+	entry->state = DNS_PENDING;
+	waiter->next = NULL;
+	entry->waiters = waiter;
+
+	if((req = MALLOC(sizeof(uv_getaddrinfo_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((req->data = STRDUP(host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if((r = uv_getaddrinfo(uv_default_loop(), req, dns_resolved, host, NULL, &hints)) != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_getaddrinfo: %s", uv_strerror(r));
+		dns_store(entry, -1, NULL);
+		waiters = entry->waiters;
+		entry->waiters = NULL;
+		uv_mutex_unlock(&lock);
+
+		dns_notify(waiters, -1, NULL);
+		FREE(req->data);
+		FREE(req);
+		return -1;
+		/*LCOV_EXCL_STOP*/
+	}
+	uv_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Lookups still running when the main loop
+ * stopped won't call their callbacks anymore.
+ */
+void dns_gc(void) {
+	struct dns_entry_t *tmp = NULL;
+	struct dns_waiter_t *waiter = NULL;
+
+	uv_once(&once, dns_init);
+
+	uv_mutex_lock(&lock);
+	while(entries) {
+		tmp = entries;
+		entries = entries->next;
+		while(tmp->waiters) {
+			waiter = tmp->waiters;
+			tmp->waiters = tmp->waiters->next;
+			FREE(waiter);
+		}
+		FREE(tmp->host);
+		FREE(tmp);
+	}
+	uv_mutex_unlock(&lock);
+}
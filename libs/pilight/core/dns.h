@@ -0,0 +1,46 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _DNS_H_
+#define _DNS_H_
+
+#ifdef _WIN32
+	#include <ws2tcpip.h>
+#else
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+#endif
+
+/*
+ * Hostname cache shared by all network modules. Successful
+ * lookups are kept for DNS_CACHE_TTL seconds, failed lookups
+ * for DNS_NEGATIVE_TTL seconds.
+ */
+typedef struct dns_entry_t {
+	char *host;
+	int state;
+	int family;
+	char ip[INET6_ADDRSTRLEN+1];
+	unsigned long long expire;
+
+	struct dns_waiter_t *waiters;
+	struct dns_entry_t *next;
+} dns_entry_t;
+
+/*
+ * The family is AF_INET or AF_INET6 on success,
+ * -1 when the host could not be resolved.
+ */
+typedef void (dns_cb_t)(int family, char *ip, void *userdata);
+
+int dns_cache_get(char *host, int *family, char *ip);
+void dns_cache_set(char *host, int family, char *ip);
+int dns_resolve(char *host, dns_cb_t *callback, void *userdata);
+void dns_gc(void);
+
+#endif
@@ -44,6 +44,7 @@
 #include "log.h"
 #include "../../libuv/uv.h"
 #include "mem.h"
+#include "metrics.h"
 #include "network.h"
 
 static uv_async_t *async_event_req = NULL;
@@ -76,6 +77,7 @@ static uv_async_t *thread_async_req = NULL;
 
 static int nrlisteners[REASON_END+10000] = {0};
 static struct eventqueue_t *eventqueue = NULL;
+static int eventqueue_number = 0;
 
 static int threads = EVENTPOOL_NO_THREADS;
 static uv_mutex_t listeners_lock;
@@ -298,6 +300,7 @@ void eventpool_trigger(int reason, void *(*done)(void *), void *data) {
 		node->next = eventqueue;
 		eventqueue = node;
 	}
+	eventqueue_number++;
 
 	/*
 	 * If the eventqueue size is above
@@ -388,6 +391,7 @@ static void eventpool_execute(uv_async_t *handle) {
 			}
 		}
 		eventqueue = eventqueue->next;
+		eventqueue_number--;
 		FREE(queue);
 	}
 	uv_mutex_unlock(&listeners_lock);
@@ -470,6 +474,7 @@ int eventpool_gc(void) {
 		eventqueue = eventqueue->next;
 		FREE(queue);
 	}
+	eventqueue_number = 0;
 	struct eventpool_listener_t *listeners = NULL;
 	while(eventpool_listeners) {
 		listeners = eventpool_listeners;
@@ -669,6 +674,12 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 		if(custom_poll_data->host != NULL) {
 			mbedtls_ssl_set_hostname(&custom_poll_data->ssl.ctx, custom_poll_data->host);
 		}
+		if(custom_poll_data->ssl.session != NULL) {
+			if((r = mbedtls_ssl_set_session(&custom_poll_data->ssl.ctx, custom_poll_data->ssl.session)) < 0) {
+				mbedtls_strerror(r, (char *)&buffer, BUFFER_SIZE);
+				logprintf(LOG_DEBUG, "mbedtls_ssl_set_session: %s", buffer);
+			}
+		}
 	}
 
 	if(custom_poll_data->is_ssl == 1 && custom_poll_data->ssl.handshake == 0) {
@@ -694,6 +705,9 @@ void uv_custom_poll_cb(uv_poll_t *req, int status, int events) {
 			/*LCOV_EXCL_STOP*/
 		} else {
 			custom_poll_data->ssl.handshake = 1;
+			if(custom_poll_data->handshake_cb != NULL) {
+				custom_poll_data->handshake_cb(req);
+			}
 		}
 		custom_poll_data->dowrite = 1;
 		goto end;
@@ -989,6 +1003,10 @@ int uv_custom_write(uv_poll_t *req) {
 	return 0;
 }
 
+static double eventpool_queue_length(void *param) {
+	return (double)eventqueue_number;
+}
+
 void eventpool_init(enum eventpool_threads_t t) {
 	/*
 	 * Make sure we execute in the main thread
@@ -1002,6 +1020,8 @@ void eventpool_init(enum eventpool_threads_t t) {
 	eventpoolinit = 1;
 	threads = t;
 
+	metrics_gauge_callback("pilight_queue_length", "queue=\"eventpool\"", "Number of items waiting in a queue", eventpool_queue_length, NULL);
+
 	uv_mutex_init(&thread_lock);
 	if((thread_async_req = MALLOC(sizeof(uv_async_t))) == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
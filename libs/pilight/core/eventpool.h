@@ -171,11 +171,16 @@ struct uv_custom_poll_t {
 	void (*write_cb)(uv_poll_t *);
 	void (*close_cb)(uv_poll_t *);
 	void (*read_cb)(uv_poll_t *, ssize_t *, char *);
+	void (*handshake_cb)(uv_poll_t *);
 
 	struct {
 		int init;
 		int handshake;
 		mbedtls_ssl_context ctx;
+		/*
+		 * Offered to the server for resumption
+		 */
+		mbedtls_ssl_session *session;
 	} ssl;
 
   struct iobuf_t recv_iobuf;
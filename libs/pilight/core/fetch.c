@@ -0,0 +1,317 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../../libuv/uv.h"
+#include "pilight.h"
+#include "log.h"
+#include "mem.h"
+#include "http.h"
+#include "json.h"
+#include "eventpool.h"
+#include "fetch.h"
+
+static struct fetch_t *fetches = NULL;
+
+/*
+ * Callbacks are always called from the main loop and
+ * without the lock held. The cached response is only
+ * replaced from the main loop as well, so it can't
+ * change while a callback uses it. Callbacks are free
+ * to fetch another url.
+ */
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+static int scheduled = 0;
+
+static void fetch_init(void) {
+	uv_mutex_init(&lock);
+}
+
+static void fetch_lock(void) {
+	uv_mutex_lock(&lock);
+}
+
+static void fetch_unlock(void) {
+	uv_mutex_unlock(&lock);
+}
+
+static void fetch_notify(struct fetch_waiter_t *waiters, int code, struct JsonNode *json) {
+	struct fetch_waiter_t *tmp = NULL;
+
+	while(waiters) {
+		tmp = waiters;
+		waiters = waiters->next;
+		tmp->callback(code, json, tmp->userdata);
+		FREE(tmp);
+	}
+}
+
+static void fetch_wakeup_work(uv_work_t *req) {
+}
+
+/*
+ * Hands the cached responses to the callers that asked
+ * for them since the last wakeup. Callers of a request
+ * that couldn't be started get a 404, like the http
+ * library reports requests that never got a response.
+ */
+static void fetch_deliver(uv_work_t *req, int status) {
+	struct fetch_t *fetch = NULL;
+	struct fetch_waiter_t *cached = NULL, *failed = NULL;
+	struct JsonNode *json = NULL;
+
+	FREE(req);
+
+	while(1) {
+		fetch_lock();
+		scheduled = 0;
+		for(fetch = fetches; fetch != NULL; fetch = fetch->next) {
+			if(fetch->cached != NULL || fetch->failed != NULL) {
+				break;
+			}
+		}
+		if(fetch == NULL) {
+			fetch_unlock();
+			break;
+		}
+		cached = fetch->cached;
+		failed = fetch->failed;
+		fetch->cached = NULL;
+		fetch->failed = NULL;
+		json = fetch->json;
+		fetch_unlock();
+
+		fetch_notify(cached, 200, json);
+		fetch_notify(failed, 404, NULL);
+	}
+}
+
+/*
+ * Should be called with the lock held. The after
+ * work callback of a work request always runs on
+ * the main loop, whatever thread queued it.
+ */
+static void fetch_wakeup(void) {
+	uv_work_t *req = NULL;
+
+	if(scheduled == 1) {
+		return;
+	}
+	scheduled = 1;
+
+	if((req = MALLOC(sizeof(uv_work_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_queue_work_s(req, "fetch", fetch_wakeup_work, fetch_deliver);
+}
+
+static void fetch_append(struct fetch_waiter_t **list, fetch_cb_t *callback, void *userdata) {
+	struct fetch_waiter_t *waiter = NULL, *tmp = NULL;
+
+	if((waiter = MALLOC(sizeof(struct fetch_waiter_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	waiter->callback = callback;
+	waiter->userdata = userdata;
+	waiter->next = NULL;
+
+	/*
+	 * Keep the order in which the devices polled
+	 */
+	if(*list == NULL) {
+		*list = waiter;
+	} else {
+		tmp = *list;
+		while(tmp->next != NULL) {
+			tmp = tmp->next;
+		}
+		tmp->next = waiter;
+	}
+}
+
+static void fetch_concat(struct fetch_waiter_t **list, struct fetch_waiter_t *waiters) {
+	while(*list != NULL) {
+		list = &(*list)->next;
+	}
+	*list = waiters;
+}
+
+static unsigned long long fetch_now(void) {
+	return uv_hrtime()/1000000000;
+}
+
+static void fetch_done(int code, char *data, int size, char *type, void *userdata) {
+	struct fetch_t *fetch = userdata;
+	struct fetch_waiter_t *waiters = NULL;
+	struct JsonNode *json = NULL;
+
+	if(code == 200 && data != NULL && type != NULL && strstr(type, "application/json") != NULL) {
+		json = json_decode(data);
+	}
+
+	fetch_lock();
+	fetch->pending = 0;
+	waiters = fetch->waiters;
+	fetch->waiters = NULL;
+
+	/*
+	 * Only successful responses are reused,
+	 * failures are retried on the next poll.
+	 */
+	if(json != NULL) {
+		if(fetch->json != NULL) {
+			json_delete(fetch->json);
+		}
+		fetch->json = json;
+		fetch->last = fetch_now();
+	}
+	fetch_unlock();
+
+	fetch_notify(waiters, code, json);
+}
+
+void fetch_json(char *url, int min_interval, fetch_cb_t *callback, void *userdata) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct fetch_t *fetch = NULL;
+
+	uv_once(&once, fetch_init);
+
+	fetch_lock();
+	for(fetch = fetches; fetch != NULL; fetch = fetch->next) {
+		if(strcmp(fetch->url, url) == 0) {
+			break;
+		}
+	}
+	if(fetch == NULL) {
+		if((fetch = MALLOC(sizeof(struct fetch_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memset(fetch, 0, sizeof(struct fetch_t));
+		if((fetch->url = STRDUP(url)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		fetch->next = fetches;
+		fetches = fetch;
+	}
+
+	if(fetch->pending == 0 && fetch->json != NULL && (fetch_now()-fetch->last) < (unsigned long long)min_interval) {
+		logprintf(LOG_DEBUG, "reusing response of %s", url);
+		fetch_append(&fetch->cached, callback, userdata);
+		fetch_wakeup();
+		fetch_unlock();
+		return;
+	}
+
+	fetch_append(&fetch->waiters, callback, userdata);
+
+	if(fetch->pending == 1) {
+		fetch_unlock();
+		return;
+	}
+	fetch->pending = 1;
+	fetch_unlock();
+
+	/*
+	 * The http library doesn't call fetch_done when
+	 * the request can't be started, e.g. for https
+	 * urls without a working SSL library.
+	 */
+	if(http_get_content(fetch->url, fetch_done, fetch) == -1) {
+		fetch_lock();
+		fetch->pending = 0;
+		fetch_concat(&fetch->failed, fetch->waiters);
+		fetch->waiters = NULL;
+		fetch_wakeup();
+		fetch_unlock();
+	}
+}
+
+static void fetch_remove(struct fetch_waiter_t **list, void *userdata) {
+	struct fetch_waiter_t *tmp = *list, *prev = NULL, *next = NULL;
+
+	while(tmp) {
+		next = tmp->next;
+		if(userdata == NULL || tmp->userdata == userdata) {
+			if(prev == NULL) {
+				*list = next;
+			} else {
+				prev->next = next;
+			}
+			FREE(tmp);
+		} else {
+			prev = tmp;
+		}
+		tmp = next;
+	}
+}
+
+/*
+ * Should be called from the main loop before the
+ * userdata of an outstanding fetch is freed.
+ */
+void fetch_cancel(void *userdata) {
+	struct fetch_t *fetch = NULL;
+
+	uv_once(&once, fetch_init);
+
+	fetch_lock();
+	for(fetch = fetches; fetch != NULL; fetch = fetch->next) {
+		fetch_remove(&fetch->waiters, userdata);
+		fetch_remove(&fetch->cached, userdata);
+		fetch_remove(&fetch->failed, userdata);
+	}
+	fetch_unlock();
+}
+
+/*
+ * Fetches still running are kept, because
+ * the http library still points to them.
+ */
+void fetch_gc(void) {
+	struct fetch_t *fetch = NULL, *prev = NULL, *next = NULL;
+
+	uv_once(&once, fetch_init);
+
+	fetch_lock();
+	fetch = fetches;
+	while(fetch) {
+		next = fetch->next;
+		fetch_remove(&fetch->waiters, NULL);
+		fetch_remove(&fetch->cached, NULL);
+		fetch_remove(&fetch->failed, NULL);
+		if(fetch->json != NULL) {
+			json_delete(fetch->json);
+			fetch->json = NULL;
+		}
+		if(fetch->pending == 0) {
+			if(prev == NULL) {
+				fetches = next;
+			} else {
+				prev->next = next;
+			}
+			FREE(fetch->url);
+			FREE(fetch);
+		} else {
+			prev = fetch;
+		}
+		fetch = next;
+	}
+	fetch_unlock();
+
+	logprintf(LOG_DEBUG, "garbage collected fetch library");
+}
@@ -0,0 +1,54 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _FETCH_H_
+#define _FETCH_H_
+
+#include "json.h"
+
+/*
+ * Shared retrieval of JSON documents for API protocols.
+ * Polls of the same url are combined into a single
+ * request and the decoded response is handed to every
+ * caller. A response is reused for min_interval seconds,
+ * so an url is never fetched more often than that, no
+ * matter how many devices ask for it.
+ *
+ * fetch_json must be called from the main loop, which
+ * is where the callbacks are called as well, also for
+ * cached responses. The JsonNode passed to the callback is
+ * owned by the fetch cache and is NULL when the response
+ * could not be decoded.
+ */
+typedef void (fetch_cb_t)(int code, struct JsonNode *json, void *userdata);
+
+typedef struct fetch_waiter_t {
+	fetch_cb_t *callback;
+	void *userdata;
+	struct fetch_waiter_t *next;
+} fetch_waiter_t;
+
+typedef struct fetch_t {
+	char *url;
+	int pending;
+	unsigned long long last;
+	struct JsonNode *json;
+	/* Waiting for the running request */
+	struct fetch_waiter_t *waiters;
+	/* Served from the cache on the next wakeup */
+	struct fetch_waiter_t *cached;
+	/* Told on the next wakeup the request failed */
+	struct fetch_waiter_t *failed;
+	struct fetch_t *next;
+} fetch_t;
+
+void fetch_json(char *url, int min_interval, fetch_cb_t *callback, void *userdata);
+void fetch_cancel(void *userdata);
+void fetch_gc(void);
+
+#endif
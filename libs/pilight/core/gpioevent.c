@@ -0,0 +1,327 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/ioctl.h>
+#endif
+#ifdef __linux__
+	#include <linux/gpio.h>
+#endif
+
+#include "log.h"
+#include "mem.h"
+#include "gpioevent.h"
+
+static void gpioevent_flush(struct gpioevent_t *event, int notify) {
+	int *slot = NULL;
+
+	if(event->length == 0) {
+		return;
+	}
+
+	/*
+	 * The whole frame is dropped when the consumer
+	 * didn't keep up.
+	 */
+	if((slot = dt_ring_reserve(event->ring, sizeof(int)*event->length)) == NULL) {
+		metrics_inc(event->overruns, 1);
+		event->length = 0;
+		return;
+	}
+	memcpy(slot, event->frame, sizeof(int)*event->length);
+	dt_ring_commit(event->ring);
+	metrics_inc(event->frames, 1);
+	event->length = 0;
+
+	if(notify == 1 && event->notify != NULL) {
+		event->notify(event->userdata);
+	}
+}
+
+/*
+ * Only a ring, for sources that read their edges
+ * themselves and feed them through gpioevent_push.
+ * The metrics may be NULL.
+ */
+struct gpioevent_t *gpioevent_init(int gap, struct metric_t *frames, struct metric_t *overruns) {
+	struct gpioevent_t *event = NULL;
+
+	if((event = MALLOC(sizeof(struct gpioevent_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(event, 0, sizeof(struct gpioevent_t));
+	event->fd = -1;
+	event->wakeup[0] = -1;
+	event->wakeup[1] = -1;
+	event->gap = gap;
+	event->frames = frames;
+	event->overruns = overruns;
+	event->ring = dt_ring_init(GPIOEVENT_RING_SIZE, RING_SPSC);
+
+	return event;
+}
+
+/*
+ * The callback is called from the producer, which can be
+ * the capture thread, so it must be thread safe, like
+ * uv_async_send.
+ */
+void gpioevent_notify(struct gpioevent_t *event, void (*notify)(void *), void *userdata) {
+	event->userdata = userdata;
+	__sync_synchronize();
+	event->notify = notify;
+}
+
+/*
+ * Must only be called by a single producer. Without a
+ * gap a frame only ends when it reaches WIRINGX_BUFFER
+ * or when the producer calls gpioevent_commit.
+ */
+void gpioevent_push(struct gpioevent_t *event, int *pulses, int nr) {
+	int i = 0;
+
+	for(i=0;i<nr;i++) {
+		event->frame[event->length++] = pulses[i];
+		if(event->gap > 0 && pulses[i] > event->gap) {
+			gpioevent_flush(event, 1);
+		} else if(event->length == WIRINGX_BUFFER) {
+			gpioevent_flush(event, 0);
+		}
+	}
+}
+
+/*
+ * Ends the frame collected so far. Must only be called
+ * by the producer.
+ */
+void gpioevent_commit(struct gpioevent_t *event) {
+	gpioevent_flush(event, 0);
+}
+
+/*
+ * Copies up to size durations of the oldest frame into
+ * pulses and returns how many were copied, so a frame
+ * never continues into the next one. Must only be called
+ * by a single consumer.
+ */
+int gpioevent_read(struct gpioevent_t *event, int *pulses, int size) {
+	unsigned long len = 0, nr = 0, n = 0;
+	int *slot = NULL;
+
+	if((slot = dt_ring_peek(event->ring, &len)) == NULL) {
+		return 0;
+	}
+	nr = len/sizeof(int);
+	n = nr-event->offset;
+	if(n > (unsigned long)size) {
+		n = size;
+	}
+	memcpy(pulses, &slot[event->offset], sizeof(int)*n);
+	event->offset += n;
+	if(event->offset == nr) {
+		dt_ring_release(event->ring);
+		event->offset = 0;
+	}
+
+	return (int)n;
+}
+
+void gpioevent_close(struct gpioevent_t *event) {
+	if(event == NULL) {
+		return;
+	}
+
+#ifndef _WIN32
+	if(event->running == 1) {
+		(void)(write(event->wakeup[1], "q", 1)+1);
+		pthread_join(event->pth, NULL);
+	}
+	if(event->wakeup[0] != -1) {
+		close(event->wakeup[0]);
+		close(event->wakeup[1]);
+	}
+	if(event->fd != -1) {
+		close(event->fd);
+	}
+#endif
+	dt_ring_free(event->ring);
+	FREE(event);
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+
+static void *gpioevent_thread(void *param) {
+	struct gpioevent_t *event = param;
+	struct gpio_v2_line_event events[GPIOEVENT_BATCH];
+	struct pollfd fds[2];
+	uint64_t duration = 0;
+	ssize_t n = 0;
+	int pulses[GPIOEVENT_BATCH], i = 0, x = 0, nr = 0, r = 0;
+
+	/* Make sure the edges are read before
+	   the kernel buffer fills up */
+	struct sched_param sched;
+	memset(&sched, 0, sizeof(sched));
+	sched.sched_priority = 80;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
+
+	memset(&fds, 0, sizeof(fds));
+	fds[0].fd = event->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = event->wakeup[0];
+	fds[1].events = POLLIN;
+
+	while(1) {
+		/*
+		 * Without a gap nothing ends a frame, so it is
+		 * committed once the line is quiet or the frame
+		 * spans GPIOEVENT_IDLE milliseconds.
+		 */
+		if((r = poll(fds, 2, (event->gap > 0) ? -1 : GPIOEVENT_IDLE)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logprintf(LOG_ERR, "gpio event poll: %s", strerror(errno));
+			break;
+		}
+		if(r == 0) {
+			gpioevent_commit(event);
+			continue;
+		}
+		if(fds[1].revents != 0) {
+			break;
+		}
+		if((fds[0].revents & POLLIN) == 0) {
+			/* The event source was closed */
+			break;
+		}
+
+		if((n = read(event->fd, events, sizeof(events))) <= 0) {
+			if(n < 0 && (errno == EINTR || errno == EAGAIN)) {
+				continue;
+			}
+			break;
+		}
+		nr = n/sizeof(struct gpio_v2_line_event);
+
+		for(i=0,x=0;i<nr;i++) {
+			if(event->last > 0) {
+				duration = (events[i].timestamp_ns-event->last)/1000;
+				pulses[x++] = (duration > INT_MAX) ? INT_MAX : (int)duration;
+			}
+			event->last = events[i].timestamp_ns;
+		}
+		if(event->length == 0 && x > 0) {
+			event->start = event->last;
+		}
+		gpioevent_push(event, pulses, x);
+		if(event->gap <= 0 && event->length > 0 &&
+			event->last-event->start >= GPIOEVENT_IDLE*1000000ULL) {
+			gpioevent_commit(event);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads struct gpio_v2_line_event records from any
+ * fd, like a line requested from a gpio-sim chip or
+ * a pipe filled with synthetic events.
+ */
+struct gpioevent_t *gpioevent_fd(int fd, int gap, struct metric_t *frames, struct metric_t *overruns) {
+	struct gpioevent_t *event = gpioevent_init(gap, frames, overruns);
+
+	if(pipe(event->wakeup) == -1) {
+		logprintf(LOG_ERR, "gpio event pipe: %s", strerror(errno));
+		event->wakeup[0] = -1;
+		gpioevent_close(event);
+		return NULL;
+	}
+
+	event->fd = fd;
+	if(pthread_create(&event->pth, NULL, gpioevent_thread, event) != 0) {
+		logprintf(LOG_ERR, "gpio event thread: %s", strerror(errno));
+		/* The caller still owns the fd */
+		event->fd = -1;
+		gpioevent_close(event);
+		return NULL;
+	}
+	event->running = 1;
+
+	return event;
+}
+
+struct gpioevent_t *gpioevent_open(char *chip, int line, int edges, int gap, struct metric_t *frames, struct metric_t *overruns) {
+	struct gpioevent_t *event = NULL;
+	struct gpio_v2_line_request req;
+	char path[PATH_MAX];
+	int fd = 0;
+
+	if(chip[0] == '/') {
+		snprintf(path, sizeof(path), "%s", chip);
+	} else {
+		snprintf(path, sizeof(path), "/dev/%s", chip);
+	}
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		logprintf(LOG_ERR, "cannot open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = (unsigned int)line;
+	req.num_lines = 1;
+	req.event_buffer_size = GPIOEVENT_BATCH*16;
+	strncpy(req.consumer, "pilight", sizeof(req.consumer)-1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if((edges & GPIOEVENT_RISING) == GPIOEVENT_RISING) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	}
+	if((edges & GPIOEVENT_FALLING) == GPIOEVENT_FALLING) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	}
+
+	if(ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+		logprintf(LOG_ERR, "cannot request line %d of %s: %s", line, path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	if((event = gpioevent_fd(req.fd, gap, frames, overruns)) == NULL) {
+		close(req.fd);
+		return NULL;
+	}
+	logprintf(LOG_DEBUG, "reading edges of line %d of %s", line, path);
+
+	return event;
+}
+
+#else
+
+struct gpioevent_t *gpioevent_fd(int fd, int gap, struct metric_t *frames, struct metric_t *overruns) {
+	logprintf(LOG_ERR, "gpio character devices are not supported on this platform");
+	return NULL;
+}
+
+struct gpioevent_t *gpioevent_open(char *chip, int line, int edges, int gap, struct metric_t *frames, struct metric_t *overruns) {
+	logprintf(LOG_ERR, "gpio character devices are not supported on this platform");
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _GPIOEVENT_H_
+#define _GPIOEVENT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "defines.h"
+#include "metrics.h"
+#include "../datatypes/ring.h"
+
+/*
+ * Edge capture through the GPIO v2 character device. The
+ * kernel timestamps every edge, a dedicated thread reads
+ * them in batches and turns them into the durations between
+ * edges in microseconds.
+ *
+ * The durations are collected into frames, which end with a
+ * pulse longer than gap microseconds or when a frame reaches
+ * WIRINGX_BUFFER. Without a gap the producer decides when a
+ * frame ends through gpioevent_commit. Complete frames are queued in a ring the
+ * consumer drains lock free, and the notify callback is
+ * called for each frame ended by a gap. A frame that doesn't
+ * fit in the ring is dropped and counted as an overrun.
+ */
+#define GPIOEVENT_RISING		1
+#define GPIOEVENT_FALLING		2
+#define GPIOEVENT_BOTH			3
+
+#define GPIOEVENT_BATCH			64
+/* Milliseconds after which a frame without a gap is committed */
+#define GPIOEVENT_IDLE			250
+#define GPIOEVENT_RING_SIZE	262144
+
+typedef struct gpioevent_t {
+	int fd;
+	int wakeup[2];
+	uint64_t last;
+	uint64_t start;
+
+	int gap;
+	int frame[WIRINGX_BUFFER];
+	int length;
+
+	struct ring_dt *ring;
+	unsigned long offset;
+
+	void (*notify)(void *userdata);
+	void *userdata;
+
+	struct metric_t *frames;
+	struct metric_t *overruns;
+
+	pthread_t pth;
+	int running;
+} gpioevent_t;
+
+struct gpioevent_t *gpioevent_init(int gap, struct metric_t *frames, struct metric_t *overruns);
+struct gpioevent_t *gpioevent_open(char *chip, int line, int edges, int gap, struct metric_t *frames, struct metric_t *overruns);
+struct gpioevent_t *gpioevent_fd(int fd, int gap, struct metric_t *frames, struct metric_t *overruns);
+void gpioevent_notify(struct gpioevent_t *event, void (*notify)(void *), void *userdata);
+void gpioevent_push(struct gpioevent_t *event, int *pulses, int nr);
+void gpioevent_commit(struct gpioevent_t *event);
+int gpioevent_read(struct gpioevent_t *event, int *pulses, int size);
+void gpioevent_close(struct gpioevent_t *event);
+
+#endif
@@ -44,6 +44,7 @@
 #include "socket.h"
 #include "log.h"
 #include "network.h"
+#include "dns.h"
 #include "webserver.h"
 #include "ssl.h"
 
@@ -54,13 +55,41 @@
 #define STEP_WRITE					0
 #define STEP_READ						1
 
+/*
+ * Connections are kept open per host after a complete
+ * response. More concurrent requests to the same host
+ * than HTTP_POOL_SIZE wait for a connection to finish.
+ */
+#define HTTP_POOL_SIZE			2
+#define HTTP_IDLE_TIMEOUT		30000
+
 typedef struct http_clients_t {
 	uv_poll_t *req;
 	int fd;
 	struct uv_custom_poll_t *data;
+
+	char *host;
+	int port;
+	int is_ssl;
+	int idle;
+	uv_timer_t *idle_req;
+
 	struct http_clients_t *next;
 } http_clients_t;
 
+typedef struct http_pending_t {
+	struct request_t *request;
+	struct http_pending_t *next;
+} http_pending_t;
+
+typedef struct http_session_t {
+	char *host;
+	int port;
+	int valid;
+	mbedtls_ssl_session session;
+	struct http_session_t *next;
+} http_session_t;
+
 #ifdef _WIN32
 	static uv_mutex_t http_lock;
 #else
@@ -69,6 +98,8 @@ typedef struct http_clients_t {
 #endif
 
 struct http_clients_t *http_clients = NULL;
+static struct http_pending_t *http_pending = NULL;
+static struct http_session_t *http_sessions = NULL;
 static int http_lock_init = 0;
 
 typedef struct request_t {
@@ -83,9 +114,13 @@ typedef struct request_t {
 	int reading;
 	int error;
 	int called;
+	int keepalive;
+	int reused;
+	int retried;
 	void *userdata;
 	uv_timer_t *timer_req;
 	uv_poll_t *poll_req;
+	struct http_clients_t *client;
 
 	int steps;
 	int request_method;
@@ -106,9 +141,15 @@ typedef struct request_t {
 
 
 static void timeout(uv_timer_t *req);
+static void close_cb(uv_handle_t *handle);
 static void http_client_close(uv_poll_t *req);
+static void http_connect(int inet, char *ip, void *userdata);
 
 static void free_request(struct request_t *request) {
+	if(request->timer_req != NULL) {
+		uv_timer_stop(request->timer_req);
+		uv_close((uv_handle_t *)request->timer_req, close_cb);
+	}
 	if(request->host != NULL) {
 		FREE(request->host);
 	}
@@ -126,6 +167,8 @@ static void free_request(struct request_t *request) {
 
 int http_gc(void) {
 	struct http_clients_t *node = NULL;
+	struct http_pending_t *pending = NULL;
+	struct http_session_t *session = NULL;
 
 #ifdef _WIN32
 	uv_mutex_lock(&http_lock);
@@ -146,19 +189,37 @@ int http_gc(void) {
 		}
 
 		struct uv_custom_poll_t *custom_poll_data = http_clients->data;
-		struct request_t *request = custom_poll_data->data;
-		if(request != NULL) {
-			free_request(request);
-		}
-
 		if(custom_poll_data != NULL) {
+			struct request_t *request = custom_poll_data->data;
+			if(request != NULL) {
+				free_request(request);
+			}
 			uv_custom_poll_free(custom_poll_data);
 		}
+		if(node->idle_req != NULL) {
+			uv_timer_stop(node->idle_req);
+		}
 
 		http_clients = http_clients->next;
+		FREE(node->host);
 		FREE(node);
 	}
 
+	while(http_pending) {
+		pending = http_pending;
+		http_pending = http_pending->next;
+		free_request(pending->request);
+		FREE(pending);
+	}
+
+	while(http_sessions) {
+		session = http_sessions;
+		http_sessions = http_sessions->next;
+		mbedtls_ssl_session_free(&session->session);
+		FREE(session->host);
+		FREE(session);
+	}
+
 #ifdef _WIN32
 	uv_mutex_unlock(&http_lock);
 #else
@@ -169,37 +230,65 @@ int http_gc(void) {
 	return 1;
 }
 
-static void http_client_add(uv_poll_t *req, struct uv_custom_poll_t *data) {
+/*
+ * The connection is registered before it is opened,
+ * so connections still being set up count towards
+ * the pool size of a host.
+ */
+static struct http_clients_t *http_client_add(struct request_t *request) {
 #ifdef _WIN32
 	uv_mutex_lock(&http_lock);
 #else
 	pthread_mutex_lock(&http_lock);
 #endif
 
-	int fd = -1, r = 0;
-
-	if((r = uv_fileno((uv_handle_t *)req, (uv_os_fd_t *)&fd)) != 0) {
-		logprintf(LOG_ERR, "uv_fileno: %s", uv_strerror(r)); /*LCOV_EXCL_LINE*/
-	}
-
 	struct http_clients_t *node = MALLOC(sizeof(struct http_clients_t));
 	if(node == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
-	node->req = req;
-	node->data = data;
-	node->fd = fd;
+	memset(node, 0, sizeof(struct http_clients_t));
+	node->fd = -1;
+	if((node->host = STRDUP(request->host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->port = request->port;
+	node->is_ssl = request->is_ssl;
 
 	node->next = http_clients;
 	http_clients = node;
+	request->client = node;
 #ifdef _WIN32
 	uv_mutex_unlock(&http_lock);
 #else
 	pthread_mutex_unlock(&http_lock);
 #endif
+
+	return node;
 }
 
-static void http_client_remove(uv_poll_t *req) {
+static struct http_clients_t *http_client_get(uv_poll_t *req) {
+	struct http_clients_t *node = NULL;
+
+#ifdef _WIN32
+	uv_mutex_lock(&http_lock);
+#else
+	pthread_mutex_lock(&http_lock);
+#endif
+	for(node = http_clients; node != NULL; node = node->next) {
+		if(node->req == req) {
+			break;
+		}
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&http_lock);
+#else
+	pthread_mutex_unlock(&http_lock);
+#endif
+
+	return node;
+}
+
+static void http_client_remove(struct http_clients_t *node) {
 #ifdef _WIN32
 	uv_mutex_lock(&http_lock);
 #else
@@ -210,14 +299,78 @@ static void http_client_remove(uv_poll_t *req) {
 	prevP = NULL;
 
 	for(currP = http_clients; currP != NULL; prevP = currP, currP = currP->next) {
-		if(currP->req == req) {
+		if(currP == node) {
 			if(prevP == NULL) {
 				http_clients = currP->next;
 			} else {
 				prevP->next = currP->next;
 			}
+			break;
+		}
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&http_lock);
+#else
+	pthread_mutex_unlock(&http_lock);
+#endif
+
+	if(node->idle_req != NULL) {
+		uv_timer_stop(node->idle_req);
+		uv_close((uv_handle_t *)node->idle_req, close_cb);
+	}
+	FREE(node->host);
+	FREE(node);
+}
+
+static void http_pending_add(struct request_t *request) {
+	struct http_pending_t *node = NULL, *tmp = NULL;
+
+	if((node = MALLOC(sizeof(struct http_pending_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	node->request = request;
+	node->next = NULL;
+
+#ifdef _WIN32
+	uv_mutex_lock(&http_lock);
+#else
+	pthread_mutex_lock(&http_lock);
+#endif
+	if(http_pending == NULL) {
+		http_pending = node;
+	} else {
+		tmp = http_pending;
+		while(tmp->next != NULL) {
+			tmp = tmp->next;
+		}
+		tmp->next = node;
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&http_lock);
+#else
+	pthread_mutex_unlock(&http_lock);
+#endif
+}
+
+static struct request_t *http_pending_get(char *host, int port, int is_ssl) {
+	struct http_pending_t *tmp = NULL, *prev = NULL;
+	struct request_t *request = NULL;
 
-			FREE(currP);
+#ifdef _WIN32
+	uv_mutex_lock(&http_lock);
+#else
+	pthread_mutex_lock(&http_lock);
+#endif
+	for(tmp = http_pending; tmp != NULL; prev = tmp, tmp = tmp->next) {
+		if(tmp->request->port == port && tmp->request->is_ssl == is_ssl &&
+			strcmp(tmp->request->host, host) == 0) {
+			if(prev == NULL) {
+				http_pending = tmp->next;
+			} else {
+				prev->next = tmp->next;
+			}
+			request = tmp->request;
+			FREE(tmp);
 			break;
 		}
 	}
@@ -226,6 +379,172 @@ static void http_client_remove(uv_poll_t *req) {
 #else
 	pthread_mutex_unlock(&http_lock);
 #endif
+
+	return request;
+}
+
+static struct http_session_t *http_session_get(char *host, int port) {
+	struct http_session_t *session = NULL;
+
+	for(session = http_sessions; session != NULL; session = session->next) {
+		if(session->port == port && strcmp(session->host, host) == 0) {
+			return session;
+		}
+	}
+
+	if((session = MALLOC(sizeof(struct http_session_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(session, 0, sizeof(struct http_session_t));
+	if((session->host = STRDUP(host)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	session->port = port;
+	mbedtls_ssl_session_init(&session->session);
+
+	session->next = http_sessions;
+	http_sessions = session;
+
+	return session;
+}
+
+/*
+ * Store the negotiated session, so the next
+ * connection to this host can resume it.
+ */
+static void http_handshake_cb(uv_poll_t *req) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct request_t *request = custom_poll_data->data;
+	struct http_session_t *session = NULL;
+
+	if(request == NULL) {
+		return;
+	}
+
+	session = http_session_get(request->host, request->port);
+	if(mbedtls_ssl_get_session(&custom_poll_data->ssl.ctx, &session->session) == 0) {
+		session->valid = 1;
+	} else {
+		session->valid = 0;
+	}
+}
+
+static void http_timer_start(struct request_t *request) {
+	if(request->timer_req == NULL) {
+		if((request->timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		request->timer_req->data = request;
+		uv_timer_init(uv_default_loop(), request->timer_req);
+	}
+	uv_timer_start(request->timer_req, (void (*)(uv_timer_t *))timeout, 3000, 0);
+}
+
+static void http_attach(struct http_clients_t *node, struct request_t *request) {
+	struct uv_custom_poll_t *custom_poll_data = node->data;
+
+	if(node->idle_req != NULL) {
+		uv_timer_stop(node->idle_req);
+	}
+	node->idle = 0;
+
+	request->client = node;
+	request->fd = node->fd;
+	request->poll_req = node->req;
+	request->reused = 1;
+	custom_poll_data->data = request;
+
+	http_timer_start(request);
+	request->steps = STEP_WRITE;
+	uv_custom_write(node->req);
+}
+
+/*
+ * Reuse an idle connection to the same host,
+ * open a new one when the pool isn't full yet
+ * or wait for one to become available.
+ */
+static void http_dispatch(struct request_t *request) {
+	struct http_clients_t *node = NULL, *idle = NULL;
+	int nr = 0;
+
+#ifdef _WIN32
+	uv_mutex_lock(&http_lock);
+#else
+	pthread_mutex_lock(&http_lock);
+#endif
+	for(node = http_clients; node != NULL; node = node->next) {
+		if(node->port == request->port && node->is_ssl == request->is_ssl &&
+			strcmp(node->host, request->host) == 0) {
+			if(node->idle == 1 && idle == NULL) {
+				idle = node;
+			}
+			nr++;
+		}
+	}
+	if(idle != NULL) {
+		idle->idle = 0;
+	} else if(nr >= HTTP_POOL_SIZE) {
+		http_pending_add(request);
+	} else {
+		http_client_add(request);
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&http_lock);
+#else
+	pthread_mutex_unlock(&http_lock);
+#endif
+
+	if(idle != NULL) {
+		http_attach(idle, request);
+	} else if(request->client != NULL) {
+		dns_resolve(request->host, http_connect, request);
+	}
+}
+
+static void http_idle_timeout(uv_timer_t *handle) {
+	struct http_clients_t *node = handle->data;
+
+	uv_custom_close(node->req);
+}
+
+/*
+ * Hand the connection to the next request waiting
+ * for this host or keep it open for a while.
+ */
+static void http_client_park(uv_poll_t *req) {
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct request_t *request = custom_poll_data->data;
+	struct http_clients_t *node = request->client;
+
+	custom_poll_data->data = NULL;
+	free_request(request);
+
+	/*
+	 * Anything left belongs to the finished response
+	 */
+	iobuf_remove(&custom_poll_data->recv_iobuf, custom_poll_data->recv_iobuf.len);
+
+	if((request = http_pending_get(node->host, node->port, node->is_ssl)) != NULL) {
+		http_attach(node, request);
+		return;
+	}
+
+	node->idle = 1;
+	if(node->idle_req == NULL) {
+		if((node->idle_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		node->idle_req->data = node;
+		uv_timer_init(uv_default_loop(), node->idle_req);
+	}
+	uv_timer_start(node->idle_req, http_idle_timeout, HTTP_IDLE_TIMEOUT, 0);
+
+	/*
+	 * Keep reading to notice the server
+	 * closing the connection.
+	 */
+	uv_custom_read(req);
 }
 
 static int prepare_request(struct request_t **request, int method, char *url, const char *contype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
@@ -250,6 +569,7 @@ static int prepare_request(struct request_t **request, int method, char *url, co
 		plen = 9;
 		if(ssl_client_init_status() == -1) {
 			logprintf(LOG_ERR, "HTTPS URL's require a properly initialized SSL library");
+			FREE((*request));
 			return -1;
 		}
 	} else {
@@ -483,10 +803,36 @@ static void http_client_close(uv_poll_t *req) {
 	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
 
 	struct uv_custom_poll_t *custom_poll_data = req->data;
-	struct request_t *request = custom_poll_data->data;
-	uv_timer_stop(request->timer_req);
+	struct http_clients_t *node = NULL;
+	struct request_t *request = NULL, *retry = NULL, *pending = NULL;
+	int fd = -1;
 
-	if(request->reading == 1) {
+	if(custom_poll_data == NULL) {
+		return;
+	}
+	request = custom_poll_data->data;
+	node = http_client_get(req);
+
+	if(node != NULL) {
+		fd = node->fd;
+	} else if(request != NULL) {
+		fd = request->fd;
+	}
+
+	if(request != NULL) {
+		uv_timer_stop(request->timer_req);
+	}
+
+	if(request != NULL && request->reused == 1 && request->gotheader == 0 && request->called == 0 && request->retried == 0) {
+		/*
+		 * The server closed the reused connection before
+		 * it handled our request, try once more on a new
+		 * connection.
+		 */
+		retry = request;
+		request = NULL;
+		custom_poll_data->data = NULL;
+	} else if(request != NULL && request->reading == 1) {
 		if(request->has_length == 0 && request->has_chunked == 0) {
 			if(request->callback != NULL && request->called == 0) {
 				request->called = 1;
@@ -502,24 +848,27 @@ static void http_client_close(uv_poll_t *req) {
 				request->callback(408, NULL, 0, NULL, request->userdata);
 			}
 		}
-	} else if(request->error == 1) {
+	} else if(request != NULL && request->error == 1) {
 		if(request->callback != NULL && request->called == 0) {
 			request->called = 1;
 			request->callback(404, NULL, 0, 0, request->userdata);
 		}
 	}
 
-	if(request->fd > -1) {
+	if(fd > -1) {
 #ifdef _WIN32
-		shutdown(request->fd, SD_BOTH);
-		closesocket(request->fd);
+		shutdown(fd, SD_BOTH);
+		closesocket(fd);
 #else
-		shutdown(request->fd, SHUT_RDWR);
-		close(request->fd);
+		shutdown(fd, SHUT_RDWR);
+		close(fd);
 #endif
 	}
 
-	http_client_remove(req);
+	if(node != NULL) {
+		pending = http_pending_get(node->host, node->port, node->is_ssl);
+		http_client_remove(node);
+	}
 
 	if(!uv_is_closing((uv_handle_t *)req)) {
 		uv_poll_stop(req);
@@ -535,6 +884,19 @@ static void http_client_close(uv_poll_t *req) {
 		uv_custom_poll_free(custom_poll_data);
 		req->data = NULL;
 	}
+
+	if(retry != NULL) {
+		retry->fd = 0;
+		retry->poll_req = NULL;
+		retry->client = NULL;
+		retry->reused = 0;
+		retry->retried = 1;
+		retry->error = 1;
+		http_dispatch(retry);
+	}
+	if(pending != NULL) {
+		http_dispatch(pending);
+	}
 }
 
 static void poll_close_cb(uv_poll_t *req) {
@@ -549,6 +911,11 @@ static void timeout(uv_timer_t *req) {
 	if(request->timer_req != NULL) {
 		uv_timer_stop(request->timer_req);
 	}
+	/*
+	 * The callback below already reports the
+	 * timeout, so don't retry this request.
+	 */
+	request->retried = 1;
 	http_client_close(request->poll_req);
 	if(callback != NULL && called == 0) {
 		callback(408, NULL, 0, NULL, userdata);
@@ -565,9 +932,18 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	struct uv_custom_poll_t *custom_poll_data = req->data;
 	struct request_t *request = custom_poll_data->data;
 	char *header = NULL, *p = NULL;
-	const char *a = NULL, *b = NULL;
+	const char *a = NULL, *b = NULL, *connection = NULL;
 	int pos = 0;
 
+	/*
+	 * Nothing should be received on an idle connection
+	 * except for the server closing it.
+	 */
+	if(request == NULL) {
+		uv_custom_close(req);
+		return;
+	}
+
 	if(*nread > 0) {
 		buf[*nread] = '\0';
 	}
@@ -597,9 +973,17 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 					request->callback(c.status_code, location, strlen(location), NULL, request->userdata);
 				}
 				FREE(header);
-				return;
+				goto close;
 			}
 			request->status_code = c.status_code;
+			if((connection = http_get_header(&c, "Connection")) == NULL) {
+				connection = http_get_header(&c, "connection");
+			}
+			if(strcmp(c.request_method, "HTTP/1.1") == 0) {
+				request->keepalive = (connection == NULL || stricmp(connection, "close") != 0);
+			} else {
+				request->keepalive = (connection != NULL && stricmp(connection, "keep-alive") == 0);
+			}
 			if((a = http_get_header(&c, "Content-Type")) != NULL || (b = http_get_header(&c, "Content-type")) != NULL) {
 				int len = 0, i = 0;
 				if(a != NULL) {
@@ -690,7 +1074,16 @@ static void read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	}
 
 close:
-	uv_custom_close(req);
+	/*
+	 * Only reuse connections of which we know
+	 * the complete response has been read.
+	 */
+	if(request->keepalive == 1 && request->reading == 0 && request->called == 1 &&
+		(request->has_chunked == 1 || (request->has_length == 1 && request->bytes_read == request->content_len))) {
+		http_client_park(req);
+	} else {
+		uv_custom_close(req);
+	}
 }
 
 static void write_cb(uv_poll_t *req) {
@@ -704,17 +1097,22 @@ static void write_cb(uv_poll_t *req) {
 	struct request_t *request = custom_poll_data->data;
 	char *header = NULL;
 
+	if(request == NULL) {
+		return;
+	}
+
 	switch(request->steps) {
 		case STEP_WRITE: {
 			if(request->request_method == HTTP_POST) {
-				append_to_header(&header, "POST %s HTTP/1.0\r\n", request->uri);
+				append_to_header(&header, "POST %s HTTP/1.1\r\n", request->uri);
 				append_to_header(&header, "Host: %s\r\n", request->host);
 				if(request->auth64 != NULL) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
 				append_to_header(&header, "Content-Type: %s\r\n", request->mimetype);
-				append_to_header(&header, "Content-Length: %lu\r\n\r\n", request->content_len);
+				append_to_header(&header, "Content-Length: %lu\r\n", request->content_len);
+				append_to_header(&header, "Connection: keep-alive\r\n\r\n");
 				append_to_header(&header, "%s", request->content);
 			} else if(request->request_method == HTTP_GET) {
 				append_to_header(&header, "GET %s HTTP/1.1\r\n", request->uri);
@@ -723,7 +1121,7 @@ static void write_cb(uv_poll_t *req) {
 					append_to_header(&header, "Authorization: Basic %s\r\n", request->auth64);
 				}
 				append_to_header(&header, "User-Agent: %s\r\n", USERAGENT);
-				append_to_header(&header, "Connection: close\r\n\r\n");
+				append_to_header(&header, "Connection: keep-alive\r\n\r\n");
 			}
 			iobuf_append(&custom_poll_data->send_iobuf, (void *)header, strlen(header));
 
@@ -739,157 +1137,135 @@ static void write_cb(uv_poll_t *req) {
 	}
 }
 
-char *http_process(int type, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
-	struct request_t *request = NULL;
+/*
+ * Called by the dns resolver, directly for cached hosts
+ * or from the main loop once the lookup finished.
+ */
+static void http_connect(int inet, char *ip, void *userdata) {
+	struct request_t *request = userdata, *pending = NULL;
 	struct uv_custom_poll_t *custom_poll_data = NULL;
+	struct http_clients_t *node = request->client;
+	struct http_session_t *session = NULL;
 	struct sockaddr_in addr4;
 	struct sockaddr_in6 addr6;
-	char *ip = NULL;
 	int r = 0;
 
-	if(http_lock_init == 0) {
-		http_lock_init = 1;
-#ifdef _WIN32
-		uv_mutex_init(&http_lock);
-#else
-		pthread_mutexattr_init(&http_attr);
-		pthread_mutexattr_settype(&http_attr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&http_lock, &http_attr);
-#endif
-	}
-
-#ifdef _WIN32
-	WSADATA wsa;
-
-	if(WSAStartup(0x202, &wsa) != 0) {
-		logprintf(LOG_ERR, "WSAStartup");
-		exit(EXIT_FAILURE);
-	}
-#endif
-
 	memset(&addr4, 0, sizeof(addr4));
 	memset(&addr6, 0, sizeof(addr6));
-	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
-		int inet = host2ip(request->host, &ip);
-		switch(inet) {
-			case AF_INET: {
-				memset(&addr4, '\0', sizeof(struct sockaddr_in));
-				r = uv_ip4_addr(ip, request->port, &addr4);
-				if(r != 0) {
-					/*LCOV_EXCL_START*/
-					logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
-					goto freeuv;
-					/*LCOV_EXCL_END*/
-				}
-			} break;
-			case AF_INET6: {
-				memset(&addr6, '\0', sizeof(struct sockaddr_in6));
-				r = uv_ip6_addr(ip, request->port, &addr6);
-				if(r != 0) {
-					/*LCOV_EXCL_START*/
-					logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
-					goto freeuv;
-					/*LCOV_EXCL_END*/
-				}
-			} break;
-			default: {
+
+	switch(inet) {
+		case AF_INET: {
+			memset(&addr4, '\0', sizeof(struct sockaddr_in));
+			r = uv_ip4_addr(ip, request->port, &addr4);
+			if(r != 0) {
 				/*LCOV_EXCL_START*/
-				logprintf(LOG_ERR, "host2ip");
+				logprintf(LOG_ERR, "uv_ip4_addr: %s", uv_strerror(r));
 				goto freeuv;
 				/*LCOV_EXCL_END*/
-			} break;
-		}
-		FREE(ip);
-
-		/*
-		 * Partly bypass libuv in case of ssl connections
-		 */
-		if((request->fd = socket(inet, SOCK_STREAM, 0)) < 0){
-			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "socket: %s", strerror(errno));
+			}
+		} break;
+		case AF_INET6: {
+			memset(&addr6, '\0', sizeof(struct sockaddr_in6));
+			r = uv_ip6_addr(ip, request->port, &addr6);
+			if(r != 0) {
+				/*LCOV_EXCL_START*/
+				logprintf(LOG_ERR, "uv_ip6_addr: %s", uv_strerror(r));
+				goto freeuv;
+				/*LCOV_EXCL_END*/
+			}
+		} break;
+		default: {
+			logprintf(LOG_ERR, "could not resolve %s", request->host);
 			goto freeuv;
-			/*LCOV_EXCL_STOP*/
-		}
+		} break;
+	}
+
+	/*
+	 * Partly bypass libuv in case of ssl connections
+	 */
+	if((request->fd = socket(inet, SOCK_STREAM, 0)) < 0){
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "socket: %s", strerror(errno));
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
+	}
 
 #ifdef _WIN32
-		unsigned long on = 1;
-		ioctlsocket(request->fd, FIONBIO, &on);
+	unsigned long on = 1;
+	ioctlsocket(request->fd, FIONBIO, &on);
 #else
-		long arg = fcntl(request->fd, F_GETFL, NULL);
-		fcntl(request->fd, F_SETFL, arg | O_NONBLOCK);
+	long arg = fcntl(request->fd, F_GETFL, NULL);
+	fcntl(request->fd, F_SETFL, arg | O_NONBLOCK);
 #endif
 
-		switch(inet) {
-			case AF_INET: {
-				r = connect(request->fd, (struct sockaddr *)&addr4, sizeof(addr4));
-			} break;
-			case AF_INET6: {
-				r = connect(request->fd, (struct sockaddr *)&addr6, sizeof(addr6));
-			} break;
-			default: {
-			} break;
-		}
+	switch(inet) {
+		case AF_INET: {
+			r = connect(request->fd, (struct sockaddr *)&addr4, sizeof(addr4));
+		} break;
+		case AF_INET6: {
+			r = connect(request->fd, (struct sockaddr *)&addr6, sizeof(addr6));
+		} break;
+		default: {
+		} break;
+	}
 
-		if(r < 0) {
+	if(r < 0) {
 #ifdef _WIN32
-			if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
+		if(!(WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEISCONN)) {
 #else
-			if(!(errno == EINPROGRESS || errno == EISCONN)) {
+		if(!(errno == EINPROGRESS || errno == EISCONN)) {
 #endif
-				/*LCOV_EXCL_START*/
-				logprintf(LOG_ERR, "connect: %s", strerror(errno));
-				goto freeuv;
-				/*LCOV_EXCL_STOP*/
-			}
-		}
-
-		request->poll_req = NULL;
-		if((request->poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		if((request->timer_req = MALLOC(sizeof(uv_timer_t))) == NULL) {
-			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-		}
-		uv_custom_poll_init(&custom_poll_data, request->poll_req, (void *)request);
-		custom_poll_data->is_ssl = request->is_ssl;
-		custom_poll_data->write_cb = write_cb;
-		custom_poll_data->read_cb = read_cb;
-		custom_poll_data->close_cb = poll_close_cb;
-		if((custom_poll_data->host = STRDUP(request->host)) == NULL) {
-			OUT_OF_MEMORY
-		}
-
-		request->timer_req->data = request;
-
-		r = uv_poll_init_socket(uv_default_loop(), request->poll_req, request->fd);
-		if(r != 0) {
 			/*LCOV_EXCL_START*/
-			logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
-			FREE(request->poll_req);
+			logprintf(LOG_ERR, "connect: %s", strerror(errno));
 			goto freeuv;
 			/*LCOV_EXCL_STOP*/
 		}
+	}
 
-		uv_timer_init(uv_default_loop(), request->timer_req);
-		uv_timer_start(request->timer_req, (void (*)(uv_timer_t *))timeout, 3000, 0);
+	request->poll_req = NULL;
+	if((request->poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	uv_custom_poll_init(&custom_poll_data, request->poll_req, (void *)request);
+	custom_poll_data->is_ssl = request->is_ssl;
+	custom_poll_data->write_cb = write_cb;
+	custom_poll_data->read_cb = read_cb;
+	custom_poll_data->close_cb = poll_close_cb;
+	if((custom_poll_data->host = STRDUP(request->host)) == NULL) {
+		OUT_OF_MEMORY
+	}
+	if(request->is_ssl == 1) {
+		session = http_session_get(request->host, request->port);
+		if(session->valid == 1) {
+			custom_poll_data->ssl.session = &session->session;
+		}
+		custom_poll_data->handshake_cb = http_handshake_cb;
+	}
 
-		http_client_add(request->poll_req, custom_poll_data);
-		request->steps = STEP_WRITE;
-		uv_custom_write(request->poll_req);
+	r = uv_poll_init_socket(uv_default_loop(), request->poll_req, request->fd);
+	if(r != 0) {
+		/*LCOV_EXCL_START*/
+		logprintf(LOG_ERR, "uv_poll_init_socket: %s", uv_strerror(r));
+		uv_custom_poll_free(custom_poll_data);
+		FREE(request->poll_req);
+		goto freeuv;
+		/*LCOV_EXCL_STOP*/
 	}
 
-	return NULL;
+	http_timer_start(request);
+
+	node->req = request->poll_req;
+	node->data = custom_poll_data;
+	node->fd = request->fd;
+	request->steps = STEP_WRITE;
+	uv_custom_write(request->poll_req);
+	return;
 
 freeuv:
-	if(request->timer_req != NULL) {
-		uv_timer_stop(request->timer_req);
-	}
 	if(request->callback != NULL && request->called == 0) {
 		request->called = 1;
 		request->callback(404, NULL, 0, 0, request->userdata);
 	}
-	FREE(request->uri);
-	FREE(request->host);
 
 	if(request->fd > 0) {
 #ifdef _WIN32
@@ -898,14 +1274,56 @@ freeuv:
 		close(request->fd);
 #endif
 	}
-	FREE(request);
-	return NULL;
+
+	pending = http_pending_get(node->host, node->port, node->is_ssl);
+	http_client_remove(node);
+	free_request(request);
+
+	if(pending != NULL) {
+		http_dispatch(pending);
+	}
+}
+
+/*
+ * Returns 0 when the request was started, the callback is
+ * then always called. Returns -1 when the url can't be
+ * requested, the callback is then never called.
+ */
+int http_process(int type, char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+	struct request_t *request = NULL;
+
+	if(http_lock_init == 0) {
+		http_lock_init = 1;
+#ifdef _WIN32
+		uv_mutex_init(&http_lock);
+#else
+		pthread_mutexattr_init(&http_attr);
+		pthread_mutexattr_settype(&http_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&http_lock, &http_attr);
+#endif
+	}
+
+#ifdef _WIN32
+	WSADATA wsa;
+
+	if(WSAStartup(0x202, &wsa) != 0) {
+		logprintf(LOG_ERR, "WSAStartup");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	if(prepare_request(&request, type, url, conttype, post, callback, userdata) == 0) {
+		http_dispatch(request);
+		return 0;
+	}
+
+	return -1;
 }
 
-char *http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+int http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata) {
 	return http_process(HTTP_GET, url, NULL, NULL, callback, userdata);
 }
 
-char *http_post_content(char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
+int http_post_content(char *url, const char *conttype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata) {
 	return http_process(HTTP_POST, url, conttype, post, callback, userdata);
 }
@@ -9,8 +9,8 @@
 #ifndef _HTTP_H_
 #define _HTTP_H_
 
-char *http_post_content(char *url, const char *contype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata);
-char *http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata);
+int http_post_content(char *url, const char *contype, char *post, void (*callback)(int, char *, int, char *, void *), void *userdata);
+int http_get_content(char *url, void (*callback)(int, char *, int, char *, void *), void *userdata);
 int http_gc(void);
 
 #endif
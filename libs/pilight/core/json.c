@@ -27,6 +27,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define JSON_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define JSON_NEON
+#endif
+
 #include "json.h"
 #include "mem.h"
 
@@ -48,12 +56,7 @@ static char *json_strdup(const char *str)
 
 /* String buffer */
 
-typedef struct
-{
-	char *cur;
-	char *end;
-	char *start;
-} SB;
+typedef JsonBuffer SB;
 
 static void sb_init(SB *sb)
 {
@@ -117,6 +120,245 @@ static void sb_free(SB *sb)
 	free(sb->start);
 }
 
+/* Arena */
+
+#define ARENA_BLOCK_SIZE	4096
+#define ARENA_ALIGN(a)		(((a) + 7) & ~((size_t)7))
+#define ARENA_HEADER		ARENA_ALIGN(sizeof(ArenaBlock))
+
+typedef struct ArenaBlock
+{
+	struct ArenaBlock *next;
+	size_t size;
+	size_t used;
+} ArenaBlock;
+
+struct JsonArena
+{
+	ArenaBlock *blocks;
+
+	/* malloc'd nodes appended to a node of this arena */
+	JsonNode **adopted;
+	int nradopted;
+	int adoptedsize;
+};
+
+static void *arena_alloc(JsonArena *arena, size_t size)
+{
+	ArenaBlock *block = arena->blocks;
+	char *ret;
+
+	size = ARENA_ALIGN(size);
+	if (block == NULL || block->size - block->used < size) {
+		size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+		block = (ArenaBlock*) malloc(ARENA_HEADER + bsize);
+		if (block == NULL)
+			out_of_memory();
+		block->size = bsize;
+		block->used = 0;
+
+		/*
+		 * Oversized requests get a block of their own,
+		 * so keep bumping from the current one after it.
+		 */
+		if (size > ARENA_BLOCK_SIZE && arena->blocks != NULL) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+	}
+
+	ret = (char*) block + ARENA_HEADER + block->used;
+	block->used += size;
+	return ret;
+}
+
+static char *arena_strdup(JsonArena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ret = (char*) arena_alloc(arena, len);
+	memcpy(ret, str, len);
+	return ret;
+}
+
+static void arena_adopt(JsonArena *arena, JsonNode *node)
+{
+	if (arena->nradopted >= arena->adoptedsize) {
+		arena->adoptedsize += 16;
+		arena->adopted = (JsonNode**) realloc(arena->adopted, sizeof(JsonNode*) * arena->adoptedsize);
+		if (arena->adopted == NULL)
+			out_of_memory();
+	}
+	arena->adopted[arena->nradopted++] = node;
+}
+
+static void arena_unadopt(JsonArena *arena, JsonNode *node)
+{
+	int i;
+
+	for (i = arena->nradopted - 1; i >= 0; i--) {
+		if (arena->adopted[i] == node) {
+			arena->adopted[i] = arena->adopted[--arena->nradopted];
+			break;
+		}
+	}
+}
+
+JsonArena *json_arena_new(void)
+{
+	JsonArena *arena = (JsonArena*) calloc(1, sizeof(JsonArena));
+	if (arena == NULL)
+		out_of_memory();
+	return arena;
+}
+
+void json_arena_free(JsonArena *arena)
+{
+	ArenaBlock *block, *next;
+
+	if (arena == NULL)
+		return;
+
+	while (arena->nradopted > 0)
+		json_delete(arena->adopted[arena->nradopted - 1]);
+	free(arena->adopted);
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena);
+}
+
+/*
+ * Scanning
+ *
+ * Each scan returns the length of the run of bytes of one class
+ * at the start of a null-terminated string, 16 bytes at a time with
+ * SSE2 or NEON. A 16 byte load is only done when it does not cross
+ * a page boundary, so reading past the terminating zero (which ends
+ * every run) can not fault. Everything else falls back to a plain
+ * byte loop.
+ */
+#if defined(JSON_SSE2) || defined(JSON_NEON)
+#define scan_safe(p) ((((uintptr_t)(p)) & 4095) <= 4096 - 16)
+#endif
+
+/* The over-read is deliberate, so keep AddressSanitizer quiet about it */
+#if defined(__SANITIZE_ADDRESS__)
+	#define scan_attr __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer)
+		#define scan_attr __attribute__((no_sanitize_address))
+	#endif
+#endif
+#ifndef scan_attr
+	#define scan_attr
+#endif
+
+#if defined(JSON_NEON)
+static inline bool neon_all(uint8x16_t m)
+{
+	uint64x2_t m64 = vreinterpretq_u64_u8(m);
+	return (vgetq_lane_u64(m64, 0) & vgetq_lane_u64(m64, 1)) == UINT64_MAX;
+}
+#endif
+
+/* JSON whitespace */
+scan_attr static size_t scan_space(const char *s)
+{
+	const char *p = s;
+
+#if defined(JSON_SSE2)
+	while (scan_safe(p)) {
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+		if (mask != 0xFFFF)
+			return (size_t)(p - s) + __builtin_ctz(~mask);
+		p += 16;
+	}
+#elif defined(JSON_NEON)
+	while (scan_safe(p)) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) p);
+		uint8x16_t m = vorrq_u8(
+			vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))),
+			vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r'))));
+		if (!neon_all(m))
+			break;
+		p += 16;
+	}
+#endif
+
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return (size_t)(p - s);
+}
+
+/* String literal bytes that need no further attention: ASCII, no control, quote or backslash */
+scan_attr static size_t scan_plain(const char *s)
+{
+	const char *p = s;
+
+#if defined(JSON_SSE2)
+	while (scan_safe(p)) {
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		/* signed compare, so 0x80..0xFF do not count as plain either */
+		__m128i m = _mm_andnot_si128(special, _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+		if (mask != 0xFFFF)
+			return (size_t)(p - s) + __builtin_ctz(~mask);
+		p += 16;
+	}
+#elif defined(JSON_NEON)
+	while (scan_safe(p)) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) p);
+		uint8x16_t special = vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')));
+		uint8x16_t m = vbicq_u8(vcgtq_s8(vreinterpretq_s8_u8(v), vdupq_n_s8(0x1F)), special);
+		if (!neon_all(m))
+			break;
+		p += 16;
+	}
+#endif
+
+	while ((unsigned char)*p >= 0x20 && (unsigned char)*p < 0x80 && *p != '"' && *p != '\\')
+		p++;
+	return (size_t)(p - s);
+}
+
+/* 0x01..0x7F */
+scan_attr static size_t scan_ascii(const char *s)
+{
+	const char *p = s;
+
+#if defined(JSON_SSE2)
+	while (scan_safe(p)) {
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_setzero_si128()));
+		if (mask != 0xFFFF)
+			return (size_t)(p - s) + __builtin_ctz(~mask);
+		p += 16;
+	}
+#elif defined(JSON_NEON)
+	while (scan_safe(p)) {
+		uint8x16_t v = vld1q_u8((const uint8_t *) p);
+		if (!neon_all(vcgtq_s8(vreinterpretq_s8_u8(v), vdupq_n_s8(0))))
+			break;
+		p += 16;
+	}
+#endif
+
+	while ((unsigned char)*p - 1U < 0x7F)
+		p++;
+	return (size_t)(p - s);
+}
+
 /*
  * Unicode helper functions
  *
@@ -211,6 +453,9 @@ static bool utf8_validate(const char *s)
 	int len;
 
 	for (; *s != 0; s += len) {
+		s += scan_ascii(s);
+		if (*s == 0)
+			break;
 		len = utf8_validate_cz(s);
 		if (len == 0)
 			return false;
@@ -331,11 +576,155 @@ static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
 #define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
 #define is_digit(c) ((c) >= '0' && (c) <= '9')
 
-static bool parse_value     (const char **sp, JsonNode        **out);
-static bool parse_string    (const char **sp, char            **out);
+/* Member index */
+
+/*
+ * Lookups that have to walk past this many members
+ * build a hash index of the object, so small objects
+ * keep their plain linked list.
+ */
+#define INDEX_THRESHOLD		16
+#define INDEX_TOMBSTONE		((JsonNode *) &index_tombstone)
+
+typedef struct IndexEntry
+{
+	unsigned int hash;
+	JsonNode *node;
+} IndexEntry;
+
+struct JsonIndex
+{
+	unsigned int size;
+	unsigned int used;
+	/* set when two members share a key */
+	bool dups;
+	IndexEntry entries[];
+};
+
+static char index_tombstone;
+
+static unsigned int index_hash(const char *key)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*key)
+		hash = (hash ^ (unsigned char) *key++) * 16777619U;
+	return hash;
+}
+
+static IndexEntry *index_lookup(JsonIndex *index, const char *key, unsigned int hash)
+{
+	unsigned int mask = index->size - 1;
+	unsigned int i;
+
+	for (i = hash & mask; index->entries[i].node != NULL; i = (i + 1) & mask) {
+		IndexEntry *entry = &index->entries[i];
+		if (entry->node != INDEX_TOMBSTONE && entry->hash == hash && strcmp(entry->node->key, key) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Add a member to the index. Only the first member
+ * with a given key is indexed, just as a linear scan
+ * would find it.
+ */
+static void index_insert(JsonIndex *index, JsonNode *member, bool first)
+{
+	unsigned int hash = index_hash(member->key);
+	unsigned int mask = index->size - 1;
+	IndexEntry *slot = NULL;
+	unsigned int i;
+
+	for (i = hash & mask; index->entries[i].node != NULL; i = (i + 1) & mask) {
+		IndexEntry *entry = &index->entries[i];
+		if (entry->node == INDEX_TOMBSTONE) {
+			if (slot == NULL)
+				slot = entry;
+		} else if (entry->hash == hash && strcmp(entry->node->key, member->key) == 0) {
+			index->dups = true;
+			if (first)
+				entry->node = member;
+			return;
+		}
+	}
+	if (slot == NULL) {
+		slot = &index->entries[i];
+		index->used++;
+	}
+	slot->hash = hash;
+	slot->node = member;
+}
+
+static JsonIndex *index_build(JsonNode *object)
+{
+	JsonIndex *index;
+	JsonNode *member;
+	unsigned int count = 0, size = 32;
+
+	json_foreach(member, object)
+		count++;
+	while (size < count * 2)
+		size <<= 1;
+
+	index = (JsonIndex*) calloc(1, sizeof(JsonIndex) + sizeof(IndexEntry) * size);
+	if (index == NULL)
+		out_of_memory();
+	index->size = size;
+
+	json_foreach(member, object)
+		index_insert(index, member, false);
+
+	return index;
+}
+
+static void index_free(JsonNode *object)
+{
+	free(object->children.index);
+	object->children.index = NULL;
+}
+
+/* Called after the member has been linked into the object */
+static void index_add(JsonNode *object, JsonNode *member, bool first)
+{
+	JsonIndex *index = object->children.index;
+
+	if (index == NULL)
+		return;
+
+	if ((index->used + 1) * 4 > index->size * 3) {
+		index_free(object);
+		object->children.index = index_build(object);
+	} else {
+		index_insert(index, member, first);
+	}
+}
+
+static void index_remove(JsonNode *object, JsonNode *member)
+{
+	JsonIndex *index = object->children.index;
+	IndexEntry *entry;
+
+	/*
+	 * Another member with the same key may have to take
+	 * over the entry, so simply start over.
+	 */
+	if (index->dups) {
+		index_free(object);
+		return;
+	}
+
+	entry = index_lookup(index, member->key, index_hash(member->key));
+	if (entry != NULL && entry->node == member)
+		entry->node = INDEX_TOMBSTONE;
+}
+
+static bool parse_value     (JsonArena *arena, const char **sp, JsonNode **out);
+static bool parse_string    (JsonArena *arena, const char **sp, char     **out);
 static bool parse_number    (const char **sp, double           *out, int *decimals);
-static bool parse_array     (const char **sp, JsonNode        **out);
-static bool parse_object    (const char **sp, JsonNode        **out);
+static bool parse_array     (JsonArena *arena, const char **sp, JsonNode **out);
+static bool parse_object    (JsonArena *arena, const char **sp, JsonNode **out);
 static bool parse_hex16     (const char **sp, uint16_t         *out);
 
 static bool expect_literal  (const char **sp, const char *str);
@@ -352,7 +741,7 @@ static void emit_object_indented    (SB *out, const JsonNode *object, const char
 
 static int write_hex16(char *out, uint16_t val);
 
-static JsonNode *mknode(JsonTag tag);
+static JsonNode *mknode(JsonArena *arena, JsonTag tag);
 static void append_node(JsonNode *parent, JsonNode *child);
 static void prepend_node(JsonNode *parent, JsonNode *child);
 static void append_member(JsonNode *object, char *key, JsonNode *value);
@@ -362,12 +751,17 @@ static bool tag_is_valid(unsigned int tag);
 static bool number_is_valid(const char *num);
 
 JsonNode *json_decode(const char *json)
+{
+	return json_decode_arena(NULL, json);
+}
+
+JsonNode *json_decode_arena(JsonArena *arena, const char *json)
 {
 	const char *s = json;
 	JsonNode *ret;
 
 	skip_space(&s);
-	if (!parse_value(&s, &ret))
+	if (!parse_value(arena, &s, &ret))
 		return NULL;
 
 	skip_space(&s);
@@ -412,12 +806,26 @@ void json_delete(JsonNode *node)
 	if (node != NULL) {
 		json_remove_from_parent(node);
 
+		if (node->arena != NULL) {
+			/* Only adopted descendants have memory of their own */
+			if (node->arena->nradopted > 0 && (node->tag == JSON_ARRAY || node->tag == JSON_OBJECT)) {
+				JsonNode *child, *next;
+				for (child = node->children.head; child != NULL; child = next) {
+					next = child->next;
+					json_delete(child);
+				}
+			}
+			return;
+		}
+
 		switch (node->tag) {
 			case JSON_STRING:
 				free(node->string_);
 				break;
-			case JSON_ARRAY:
 			case JSON_OBJECT:
+				index_free(node);
+				/* Fallthrough */
+			case JSON_ARRAY:
 			{
 				JsonNode *child, *next;
 				for (child = node->children.head; child != NULL; child = next) {
@@ -438,7 +846,7 @@ bool json_validate(const char *json)
 	const char *s = json;
 
 	skip_space(&s);
-	if (!parse_value(&s, NULL))
+	if (!parse_value(NULL, &s, NULL))
 		return false;
 
 	skip_space(&s);
@@ -468,15 +876,34 @@ JsonNode *json_find_element(JsonNode *array, int index)
 JsonNode *json_find_member(JsonNode *object, const char *name)
 {
 	JsonNode *member;
+	int count = 0;
 
 	if (object == NULL || object->tag != JSON_OBJECT)
 		return NULL;
 
-	json_foreach(member, object)
+	if (object->children.index != NULL) {
+		IndexEntry *entry = index_lookup(object->children.index, name, index_hash(name));
+		return entry != NULL ? entry->node : NULL;
+	}
+
+	json_foreach(member, object) {
 		if (strcmp(member->key, name) == 0)
-			return member;
+			break;
+		count++;
+	}
 
-	return NULL;
+	/*
+	 * Arena trees are short-lived, so they are not worth
+	 * indexing. Concurrent readers may race to build the
+	 * index, only one of them gets to publish it.
+	 */
+	if (count >= INDEX_THRESHOLD && object->arena == NULL) {
+		JsonIndex *index = index_build(object);
+		if (!__sync_bool_compare_and_swap(&object->children.index, NULL, index))
+			free(index);
+	}
+
+	return member;
 }
 
 JsonNode *json_first_child(const JsonNode *node)
@@ -486,59 +913,105 @@ JsonNode *json_first_child(const JsonNode *node)
 	return NULL;
 }
 
-static JsonNode *mknode(JsonTag tag)
+static JsonNode *mknode(JsonArena *arena, JsonTag tag)
 {
-	JsonNode *ret = (JsonNode*) calloc(1, sizeof(JsonNode));
-	if (ret == NULL)
-		out_of_memory();
+	JsonNode *ret;
+
+	if (arena != NULL) {
+		ret = (JsonNode*) arena_alloc(arena, sizeof(JsonNode));
+		memset(ret, 0, sizeof(JsonNode));
+		ret->arena = arena;
+	} else {
+		ret = (JsonNode*) calloc(1, sizeof(JsonNode));
+		if (ret == NULL)
+			out_of_memory();
+	}
 	ret->tag = tag;
 	return ret;
 }
 
 JsonNode *json_mknull(void)
 {
-	return mknode(JSON_NULL);
+	return mknode(NULL, JSON_NULL);
 }
 
-JsonNode *json_mkbool(bool b)
+static JsonNode *mkbool(JsonArena *arena, bool b)
 {
-	JsonNode *ret = mknode(JSON_BOOL);
+	JsonNode *ret = mknode(arena, JSON_BOOL);
 	ret->bool_ = b;
 	return ret;
 }
 
-static JsonNode *mkstring(char *s)
+JsonNode *json_mkbool(bool b)
 {
-	JsonNode *ret = mknode(JSON_STRING);
+	return mkbool(NULL, b);
+}
+
+static JsonNode *mkstring(JsonArena *arena, char *s)
+{
+	JsonNode *ret = mknode(arena, JSON_STRING);
 	ret->string_ = s;
 	return ret;
 }
 
 JsonNode *json_mkstring(const char *s)
 {
-	return mkstring(json_strdup(s));
+	return mkstring(NULL, json_strdup(s));
 }
 
-JsonNode *json_mknumber(double n, int decimals)
+JsonNode *json_mkstring_arena(JsonArena *arena, const char *s)
 {
-	JsonNode *node = mknode(JSON_NUMBER);
+	if (arena == NULL)
+		return json_mkstring(s);
+	return mkstring(arena, arena_strdup(arena, s));
+}
+
+JsonNode *json_mknumber_arena(JsonArena *arena, double n, int decimals)
+{
+	JsonNode *node = mknode(arena, JSON_NUMBER);
 	node->number_ = n;
 	node->decimals_ = decimals;
 	return node;
 }
 
+JsonNode *json_mknumber(double n, int decimals)
+{
+	return json_mknumber_arena(NULL, n, decimals);
+}
+
 JsonNode *json_mkarray(void)
 {
-	return mknode(JSON_ARRAY);
+	return mknode(NULL, JSON_ARRAY);
+}
+
+JsonNode *json_mkarray_arena(JsonArena *arena)
+{
+	return mknode(arena, JSON_ARRAY);
 }
 
 JsonNode *json_mkobject(void)
 {
-	return mknode(JSON_OBJECT);
+	return mknode(NULL, JSON_OBJECT);
+}
+
+JsonNode *json_mkobject_arena(JsonArena *arena)
+{
+	return mknode(arena, JSON_OBJECT);
+}
+
+/* Keys are owned by the parent of a node */
+static char *mkkey(JsonNode *object, const char *key)
+{
+	if (object->arena != NULL)
+		return arena_strdup(object->arena, key);
+	return json_strdup(key);
 }
 
 static void append_node(JsonNode *parent, JsonNode *child)
 {
+	if (parent->arena != NULL && child->arena == NULL)
+		arena_adopt(parent->arena, child);
+
 	child->parent = parent;
 	child->prev = parent->children.tail;
 	child->next = NULL;
@@ -552,6 +1025,9 @@ static void append_node(JsonNode *parent, JsonNode *child)
 
 static void prepend_node(JsonNode *parent, JsonNode *child)
 {
+	if (parent->arena != NULL && child->arena == NULL)
+		arena_adopt(parent->arena, child);
+
 	child->parent = parent;
 	child->prev = NULL;
 	child->next = parent->children.head;
@@ -567,6 +1043,7 @@ static void append_member(JsonNode *object, char *key, JsonNode *value)
 {
 	value->key = key;
 	append_node(object, value);
+	index_add(object, value, false);
 }
 
 void json_append_element(JsonNode *array, JsonNode *element)
@@ -590,7 +1067,7 @@ void json_append_member(JsonNode *object, const char *key, JsonNode *value)
 	assert(object->tag == JSON_OBJECT);
 	assert(value->parent == NULL);
 
-	append_member(object, json_strdup(key), value);
+	append_member(object, mkkey(object, key), value);
 }
 
 void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
@@ -598,8 +1075,9 @@ void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
 	assert(object->tag == JSON_OBJECT);
 	assert(value->parent == NULL);
 
-	value->key = json_strdup(key);
+	value->key = mkkey(object, key);
 	prepend_node(object, value);
+	index_add(object, value, true);
 }
 
 void json_remove_from_parent(JsonNode *node)
@@ -607,6 +1085,9 @@ void json_remove_from_parent(JsonNode *node)
 	JsonNode *parent = node->parent;
 
 	if (parent != NULL) {
+		if (parent->tag == JSON_OBJECT && parent->children.index != NULL)
+			index_remove(parent, node);
+
 		if (node->prev != NULL)
 			node->prev->next = node->next;
 		else
@@ -616,7 +1097,10 @@ void json_remove_from_parent(JsonNode *node)
 		else
 			parent->children.tail = node->prev;
 
-		free(node->key);
+		if (parent->arena == NULL)
+			free(node->key);
+		else if (node->arena == NULL)
+			arena_unadopt(parent->arena, node);
 
 		node->parent = NULL;
 		node->prev = node->next = NULL;
@@ -624,7 +1108,7 @@ void json_remove_from_parent(JsonNode *node)
 	}
 }
 
-static bool parse_value(const char **sp, JsonNode **out)
+static bool parse_value(JsonArena *arena, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
 
@@ -632,7 +1116,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 'n':
 			if (expect_literal(&s, "null")) {
 				if (out)
-					*out = json_mknull();
+					*out = mknode(arena, JSON_NULL);
 				*sp = s;
 				return true;
 			}
@@ -641,7 +1125,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 'f':
 			if (expect_literal(&s, "false")) {
 				if (out)
-					*out = json_mkbool(false);
+					*out = mkbool(arena, false);
 				*sp = s;
 				return true;
 			}
@@ -650,7 +1134,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 't':
 			if (expect_literal(&s, "true")) {
 				if (out)
-					*out = json_mkbool(true);
+					*out = mkbool(arena, true);
 				*sp = s;
 				return true;
 			}
@@ -658,9 +1142,9 @@ static bool parse_value(const char **sp, JsonNode **out)
 
 		case '"': {
 			char *str;
-			if (parse_string(&s, out ? &str : NULL)) {
+			if (parse_string(arena, &s, out ? &str : NULL)) {
 				if (out)
-					*out = mkstring(str);
+					*out = mkstring(arena, str);
 				*sp = s;
 				return true;
 			}
@@ -668,14 +1152,14 @@ static bool parse_value(const char **sp, JsonNode **out)
 		}
 
 		case '[':
-			if (parse_array(&s, out)) {
+			if (parse_array(arena, &s, out)) {
 				*sp = s;
 				return true;
 			}
 			return false;
 
 		case '{':
-			if (parse_object(&s, out)) {
+			if (parse_object(arena, &s, out)) {
 				*sp = s;
 				return true;
 			}
@@ -686,7 +1170,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 			int decimals = 0;
 			if (parse_number(&s, out ? &num : NULL, &decimals)) {
 				if (out)
-					*out = json_mknumber(num, decimals);
+					*out = json_mknumber_arena(arena, num, decimals);
 				*sp = s;
 				return true;
 			}
@@ -695,10 +1179,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 	}
 }
 
-static bool parse_array(const char **sp, JsonNode **out)
+static bool parse_array(JsonArena *arena, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkarray() : NULL;
+	JsonNode *ret = out ? mknode(arena, JSON_ARRAY) : NULL;
 	JsonNode *element;
 
 	if (*s++ != '[')
@@ -711,7 +1195,7 @@ static bool parse_array(const char **sp, JsonNode **out)
 	}
 
 	for (;;) {
-		if (!parse_value(&s, out ? &element : NULL))
+		if (!parse_value(arena, &s, out ? &element : NULL))
 			goto failure;
 		skip_space(&s);
 
@@ -739,10 +1223,10 @@ failure:
 	return false;
 }
 
-static bool parse_object(const char **sp, JsonNode **out)
+static bool parse_object(JsonArena *arena, const char **sp, JsonNode **out)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkobject() : NULL;
+	JsonNode *ret = out ? mknode(arena, JSON_OBJECT) : NULL;
 	char *key;
 	JsonNode *value;
 
@@ -756,7 +1240,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 	}
 
 	for (;;) {
-		if (!parse_string(&s, out ? &key : NULL))
+		if (!parse_string(arena, &s, out ? &key : NULL))
 			goto failure;
 		skip_space(&s);
 
@@ -764,7 +1248,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto failure_free_key;
 		skip_space(&s);
 
-		if (!parse_value(&s, out ? &value : NULL))
+		if (!parse_value(arena, &s, out ? &value : NULL))
 			goto failure_free_key;
 		skip_space(&s);
 
@@ -788,25 +1272,44 @@ success:
 	return true;
 
 failure_free_key:
-	if (out)
+	if (out && arena == NULL)
 		free(key);
 failure:
 	json_delete(ret);
 	return false;
 }
 
-bool parse_string(const char **sp, char **out)
+bool parse_string(JsonArena *arena, const char **sp, char **out)
 {
 	const char *s = *sp;
 	SB sb;
 	char throwaway_buffer[4];
 		/* enough space for a UTF-8 character */
 	char *b;
+	char *start = NULL;
 
 	if (*s++ != '"')
 		return false;
 
-	if (out) {
+	if (out && arena != NULL) {
+		/*
+		 * A decoded string is never longer than its
+		 * literal, so find the closing quote and take
+		 * that much from the arena in one go.
+		 */
+		const char *e = s;
+		while (*e != '"') {
+			e += scan_plain(e);
+			if (*e == '"')
+				break;
+			if (*e == '\\' && *(e + 1) != 0)
+				e++;
+			if (*e == 0)
+				return false;
+			e++;
+		}
+		start = b = (char*) arena_alloc(arena, (size_t)(e - s) + 1);
+	} else if (out) {
 		sb_init(&sb);
 		sb_need(&sb, 4);
 		b = sb.cur;
@@ -815,7 +1318,26 @@ bool parse_string(const char **sp, char **out)
 	}
 
 	while (*s != '"') {
-		unsigned char c = *s++;
+		size_t n = scan_plain(s);
+		unsigned char c;
+
+		/* Copy a run of plain characters at once. */
+		if (n > 0) {
+			if (out && arena == NULL) {
+				sb.cur = b;
+				sb_need(&sb, (int) n + 4);
+				memcpy(sb.cur, s, n);
+				sb.cur += n;
+				b = sb.cur;
+			} else if (out) {
+				memcpy(b, s, n);
+				b += n;
+			}
+			s += n;
+			continue;
+		}
+
+		c = *s++;
 
 		/* Parse next character, and write it to b. */
 		if (c == '\\') {
@@ -889,23 +1411,27 @@ bool parse_string(const char **sp, char **out)
 		 * Update sb to know about the new bytes,
 		 * and set up b to write another character.
 		 */
-		if (out) {
+		if (out && arena == NULL) {
 			sb.cur = b;
 			sb_need(&sb, 4);
 			b = sb.cur;
-		} else {
+		} else if (!out) {
 			b = throwaway_buffer;
 		}
 	}
 	s++;
 
-	if (out)
+	if (out && arena != NULL) {
+		*b = 0;
+		*out = start;
+	} else if (out) {
 		*out = sb_finish(&sb);
+	}
 	*sp = s;
 	return true;
 
 failed:
-	if (out)
+	if (out && arena == NULL)
 		sb_free(&sb);
 	return false;
 }
@@ -977,8 +1503,8 @@ bool parse_number(const char **sp, double *out, int *decimals)
 static void skip_space(const char **sp)
 {
 	const char *s = *sp;
-	while (is_space(*s))
-		s++;
+	if (is_space(*s))
+		s += scan_space(s);
 	*sp = s;
 }
 
@@ -1345,6 +1871,117 @@ static int write_hex16(char *out, uint16_t val)
 	return 4;
 }
 
+/* Writer */
+
+void json_writer_init(JsonWriter *w)
+{
+	sb_init(&w->sb);
+	w->depth = 0;
+}
+
+/* Separator and key of the next value */
+static void writer_key(JsonWriter *w, const char *key)
+{
+	if (w->depth > 0) {
+		if (w->filled[w->depth - 1])
+			sb_putc(&w->sb, ',');
+		w->filled[w->depth - 1] = true;
+	}
+	if (key != NULL) {
+		emit_string(&w->sb, key);
+		sb_putc(&w->sb, ':');
+	}
+}
+
+static void writer_open(JsonWriter *w, const char *key, char c)
+{
+	assert(w->depth < JSON_WRITER_MAXDEPTH);
+
+	writer_key(w, key);
+	sb_putc(&w->sb, c);
+	w->filled[w->depth++] = false;
+}
+
+static void writer_close(JsonWriter *w, char c)
+{
+	assert(w->depth > 0);
+
+	sb_putc(&w->sb, c);
+	w->depth--;
+}
+
+void json_writer_begin_object(JsonWriter *w, const char *key)
+{
+	writer_open(w, key, '{');
+}
+
+void json_writer_end_object(JsonWriter *w)
+{
+	writer_close(w, '}');
+}
+
+void json_writer_begin_array(JsonWriter *w, const char *key)
+{
+	writer_open(w, key, '[');
+}
+
+void json_writer_end_array(JsonWriter *w)
+{
+	writer_close(w, ']');
+}
+
+void json_writer_null(JsonWriter *w, const char *key)
+{
+	writer_key(w, key);
+	sb_puts(&w->sb, "null");
+}
+
+void json_writer_bool(JsonWriter *w, const char *key, bool b)
+{
+	writer_key(w, key);
+	sb_puts(&w->sb, b ? "true" : "false");
+}
+
+void json_writer_string(JsonWriter *w, const char *key, const char *s)
+{
+	writer_key(w, key);
+	emit_string(&w->sb, s);
+}
+
+void json_writer_number(JsonWriter *w, const char *key, double n, int decimals)
+{
+	writer_key(w, key);
+	emit_number(&w->sb, n, decimals);
+}
+
+void json_writer_node(JsonWriter *w, const char *key, const JsonNode *node)
+{
+	writer_key(w, key);
+	emit_value(&w->sb, node);
+}
+
+void json_writer_raw(JsonWriter *w, const char *key, const char *json)
+{
+	writer_key(w, key);
+	sb_puts(&w->sb, json);
+}
+
+size_t json_writer_length(const JsonWriter *w)
+{
+	return (size_t)(w->sb.cur - w->sb.start);
+}
+
+char *json_writer_finish(JsonWriter *w)
+{
+	assert(w->depth == 0);
+	return sb_finish(&w->sb);
+}
+
+void json_writer_free(JsonWriter *w)
+{
+	sb_free(&w->sb);
+}
+
 bool json_check(const JsonNode *node, char errmsg[256])
 {
 	#define problem(...) do { \
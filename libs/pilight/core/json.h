@@ -38,6 +38,8 @@
 #define JsonTag			int
 
 typedef struct JsonNode JsonNode;
+typedef struct JsonArena JsonArena;
+typedef struct JsonIndex JsonIndex;
 
 struct JsonNode
 {
@@ -49,6 +51,7 @@ struct JsonNode
 	char *key; /* Must be valid UTF-8. */
 
 	JsonTag tag;
+	int decimals_;
 	union {
 		/* JSON_BOOL */
 		bool bool_;
@@ -63,13 +66,23 @@ struct JsonNode
 		/* JSON_OBJECT */
 		struct {
 			JsonNode *head, *tail;
+			/* JSON_OBJECT only: member index, built once the object grows large */
+			JsonIndex *index;
 		} children;
 	};
-	int decimals_;
+
+	/* the arena this node was allocated from (NULL when malloc'd) */
+	JsonArena *arena;
 };
 
 /*** Encoding, decoding, and validation ***/
 
+/*
+ * json_decode validates while it parses and returns NULL on invalid
+ * input, so there is no need to call json_validate on the same text
+ * first.
+ */
+
 JsonNode   *json_decode         (const char *json);
 char       *json_encode         (const JsonNode *node);
 char       *json_encode_string  (const char *str);
@@ -108,6 +121,82 @@ void json_remove_from_parent(JsonNode *node);
 
 void json_free(void *a);
 
+/*** Arena allocation ***/
+
+/*
+ * Nodes, keys and strings of an arena tree are bump allocated from
+ * a few large blocks and released all at once by json_arena_free.
+ * This is meant for short-lived trees, e.g. messages that are decoded,
+ * inspected and thrown away again. Long-lived trees should keep using
+ * the regular (malloc'd) constructors.
+ *
+ * json_delete and json_remove_from_parent may still be used on arena
+ * nodes, but their memory is only returned by json_arena_free. Regular
+ * nodes appended to an arena tree are adopted and freed together with
+ * the arena. An arena node appended to a regular tree must not outlive
+ * its arena.
+ */
+JsonArena *json_arena_new(void);
+void json_arena_free(JsonArena *arena);
+
+JsonNode *json_decode_arena(JsonArena *arena, const char *json);
+JsonNode *json_mkstring_arena(JsonArena *arena, const char *s);
+JsonNode *json_mknumber_arena(JsonArena *arena, double n, int decimals);
+JsonNode *json_mkarray_arena(JsonArena *arena);
+JsonNode *json_mkobject_arena(JsonArena *arena);
+
+/*** Streaming output ***/
+
+/*
+ * Writes JSON straight into a growing buffer, without building a tree
+ * first. The output is byte-identical to json_stringify(node, NULL) of
+ * the equivalent tree. Members of an object take a key, elements of an
+ * array and the top-level value take NULL.
+ *
+ *   JsonWriter w;
+ *   json_writer_init(&w);
+ *   json_writer_begin_object(&w, NULL);
+ *   json_writer_string(&w, "origin", "receiver");
+ *   json_writer_number(&w, "repeats", 1, 0);
+ *   json_writer_end_object(&w);
+ *   char *out = json_writer_finish(&w);
+ *   ...
+ *   json_free(out);
+ */
+#define JSON_WRITER_MAXDEPTH	32
+
+typedef struct JsonBuffer
+{
+	char *cur;
+	char *end;
+	char *start;
+} JsonBuffer;
+
+typedef struct JsonWriter
+{
+	JsonBuffer sb;
+	int depth;
+	/* whether the open object or array already has a value */
+	bool filled[JSON_WRITER_MAXDEPTH];
+} JsonWriter;
+
+void json_writer_init(JsonWriter *w);
+void json_writer_begin_object(JsonWriter *w, const char *key);
+void json_writer_end_object(JsonWriter *w);
+void json_writer_begin_array(JsonWriter *w, const char *key);
+void json_writer_end_array(JsonWriter *w);
+void json_writer_null(JsonWriter *w, const char *key);
+void json_writer_bool(JsonWriter *w, const char *key, bool b);
+void json_writer_string(JsonWriter *w, const char *key, const char *s);
+void json_writer_number(JsonWriter *w, const char *key, double n, int decimals);
+void json_writer_node(JsonWriter *w, const char *key, const JsonNode *node);
+/* json must already be valid, compact JSON (e.g. json_stringify output) */
+void json_writer_raw(JsonWriter *w, const char *key, const char *json);
+size_t json_writer_length(const JsonWriter *w);
+/* returns the output, to be freed with json_free */
+char *json_writer_finish(JsonWriter *w);
+void json_writer_free(JsonWriter *w);
+
 /*** Debugging ***/
 
 /*
@@ -37,6 +37,7 @@
 #include "common.h"
 #include "gc.h"
 #include "log.h"
+#include "metrics.h"
 
 struct logqueue_t {
 	char *line;
@@ -308,9 +309,15 @@ void _logprintf(int prio, char *file, int line, const char *str, ...) {
 	errno = save_errno;
 }
 
+static double log_queue_length(void *param) {
+	return (double)logqueue_number;
+}
+
 void *logloop(void *param) {
 	pth = pthread_self();
 
+	metrics_gauge_callback("pilight_queue_length", "queue=\"log\"", "Number of items waiting in a queue", log_queue_length, NULL);
+
 	pthactive = 1;
 	pthfree = 1;
 
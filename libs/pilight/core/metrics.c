@@ -0,0 +1,291 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "../../libuv/uv.h"
+#include "log.h"
+#include "mem.h"
+#include "metrics.h"
+
+static struct metric_t *metrics = NULL;
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+
+typedef union metric_double_t {
+	double d;
+	unsigned long long u;
+} metric_double_t;
+
+static void metrics_init(void) {
+	uv_mutex_init(&lock);
+}
+
+/*
+ * Metrics with the same name are kept together,
+ * so the HELP and TYPE lines are only printed
+ * once for each name.
+ */
+static struct metric_t *metrics_register(int type, const char *name, const char *labels, const char *help) {
+	struct metric_t *tmp = NULL, *last = NULL, *metric = NULL;
+
+	uv_once(&once, metrics_init);
+
+	uv_mutex_lock(&lock);
+	tmp = metrics;
+	while(tmp) {
+		if(strcmp(tmp->name, name) == 0) {
+			if(strcmp(tmp->labels, (labels == NULL) ? "" : labels) == 0) {
+				uv_mutex_unlock(&lock);
+				if(tmp->type != type) {
+					logprintf(LOG_ERR, "metric %s was already registered with another type", name);
+					return NULL;
+				}
+				return tmp;
+			}
+			last = tmp;
+		} else if(last == NULL && tmp->next == NULL) {
+			last = tmp;
+		}
+		tmp = tmp->next;
+	}
+
+	if((metric = MALLOC(sizeof(struct metric_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(metric, 0, sizeof(struct metric_t));
+	metric->type = type;
+	if((metric->name = STRDUP((char *)name)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((metric->labels = STRDUP((labels == NULL) ? "" : (char *)labels)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	if((metric->help = STRDUP((help == NULL) ? "" : (char *)help)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	if(last == NULL) {
+		metrics = metric;
+	} else {
+		metric->next = last->next;
+		last->next = metric;
+	}
+	uv_mutex_unlock(&lock);
+
+	return metric;
+}
+
+struct metric_t *metrics_counter(const char *name, const char *labels, const char *help) {
+	return metrics_register(METRIC_COUNTER, name, labels, help);
+}
+
+struct metric_t *metrics_gauge(const char *name, const char *labels, const char *help) {
+	return metrics_register(METRIC_GAUGE, name, labels, help);
+}
+
+/*
+ * The callback is called for every scrape, so a value the
+ * module already keeps doesn't have to be updated twice.
+ */
+static struct metric_t *metrics_register_callback(int type, const char *name, const char *labels, const char *help, double (*callback)(void *), void *userdata) {
+	struct metric_t *metric = metrics_register(type, name, labels, help);
+
+	if(metric != NULL) {
+		metric->userdata = userdata;
+		metric->callback = callback;
+	}
+	return metric;
+}
+
+struct metric_t *metrics_counter_callback(const char *name, const char *labels, const char *help, double (*callback)(void *), void *userdata) {
+	return metrics_register_callback(METRIC_COUNTER, name, labels, help, callback, userdata);
+}
+
+struct metric_t *metrics_gauge_callback(const char *name, const char *labels, const char *help, double (*callback)(void *), void *userdata) {
+	return metrics_register_callback(METRIC_GAUGE, name, labels, help, callback, userdata);
+}
+
+struct metric_t *metrics_histogram(const char *name, const char *labels, const char *help, const double *bounds, int nrbounds) {
+	struct metric_t *metric = metrics_register(METRIC_HISTOGRAM, name, labels, help);
+
+	if(metric != NULL && metric->nrbuckets == 0) {
+		if(nrbounds > METRIC_MAXBUCKETS) {
+			nrbounds = METRIC_MAXBUCKETS;
+		}
+		memcpy(metric->bounds, bounds, sizeof(double)*nrbounds);
+		metric->nrbuckets = nrbounds;
+	}
+	return metric;
+}
+
+void metrics_inc(struct metric_t *metric, unsigned long long value) {
+	if(metric != NULL) {
+		__sync_add_and_fetch(&metric->value, value);
+	}
+}
+
+void metrics_set(struct metric_t *metric, long long value) {
+	long long old = 0;
+
+	if(metric != NULL) {
+		do {
+			old = metric->gauge;
+		} while(__sync_bool_compare_and_swap(&metric->gauge, old, value) == 0);
+	}
+}
+
+void metrics_add(struct metric_t *metric, long long value) {
+	if(metric != NULL) {
+		__sync_add_and_fetch(&metric->gauge, value);
+	}
+}
+
+void metrics_observe(struct metric_t *metric, double value) {
+	metric_double_t o, n;
+	int i = 0;
+
+	if(metric == NULL) {
+		return;
+	}
+
+	for(i=0;i<metric->nrbuckets;i++) {
+		if(value <= metric->bounds[i]) {
+			break;
+		}
+	}
+	__sync_add_and_fetch(&metric->buckets[i], 1);
+
+	do {
+		o.u = __sync_add_and_fetch(&metric->sum, 0);
+		n.d = o.d+value;
+	} while(__sync_bool_compare_and_swap(&metric->sum, o.u, n.u) == 0);
+}
+
+static void metrics_printf(char **out, size_t *len, size_t *size, const char *fmt, ...) {
+	va_list ap;
+	int n = 0;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if(*len+n+1 > *size) {
+		while(*len+n+1 > *size) {
+			*size = (*size == 0) ? 1024 : *size*2;
+		}
+		if((*out = REALLOC(*out, *size)) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+	}
+
+	va_start(ap, fmt);
+	vsprintf(&(*out)[*len], fmt, ap);
+	va_end(ap);
+
+	*len += n;
+}
+
+static void metrics_print_histogram(struct metric_t *metric, char **out, size_t *len, size_t *size) {
+	const char *sep = (strlen(metric->labels) > 0) ? "," : "";
+	unsigned long long count = 0;
+	metric_double_t sum;
+	int i = 0;
+
+	for(i=0;i<metric->nrbuckets;i++) {
+		count += __sync_add_and_fetch(&metric->buckets[i], 0);
+		metrics_printf(out, len, size, "%s_bucket{%s%sle=\"%g\"} %llu\n", metric->name, metric->labels, sep, metric->bounds[i], count);
+	}
+	count += __sync_add_and_fetch(&metric->buckets[i], 0);
+	metrics_printf(out, len, size, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", metric->name, metric->labels, sep, count);
+
+	sum.u = __sync_add_and_fetch(&metric->sum, 0);
+	if(strlen(metric->labels) > 0) {
+		metrics_printf(out, len, size, "%s_sum{%s} %.9g\n", metric->name, metric->labels, sum.d);
+		metrics_printf(out, len, size, "%s_count{%s} %llu\n", metric->name, metric->labels, count);
+	} else {
+		metrics_printf(out, len, size, "%s_sum %.9g\n", metric->name, sum.d);
+		metrics_printf(out, len, size, "%s_count %llu\n", metric->name, count);
+	}
+}
+
+/*
+ * Returns all metrics in the Prometheus text format.
+ * The result must be freed by the caller.
+ */
+char *metrics_print(void) {
+	const char *types[] = { "counter", "gauge", "histogram" };
+	struct metric_t *tmp = NULL;
+	char *out = NULL, *prev = NULL, labels[1024];
+	size_t len = 0, size = 0;
+
+	uv_once(&once, metrics_init);
+
+	metrics_printf(&out, &len, &size, "%s", "");
+
+	uv_mutex_lock(&lock);
+	tmp = metrics;
+	while(tmp) {
+		if(prev == NULL || strcmp(prev, tmp->name) != 0) {
+			if(strlen(tmp->help) > 0) {
+				metrics_printf(&out, &len, &size, "# HELP %s %s\n", tmp->name, tmp->help);
+			}
+			metrics_printf(&out, &len, &size, "# TYPE %s %s\n", tmp->name, types[tmp->type]);
+			prev = tmp->name;
+		}
+
+		labels[0] = '\0';
+		if(strlen(tmp->labels) > 0) {
+			snprintf(labels, sizeof(labels), "{%s}", tmp->labels);
+		}
+
+		if(tmp->callback != NULL) {
+			metrics_printf(&out, &len, &size, "%s%s %.9g\n", tmp->name, labels, tmp->callback(tmp->userdata));
+		} else {
+			switch(tmp->type) {
+				case METRIC_COUNTER:
+					metrics_printf(&out, &len, &size, "%s%s %llu\n", tmp->name, labels, __sync_add_and_fetch(&tmp->value, 0));
+				break;
+				case METRIC_GAUGE:
+					metrics_printf(&out, &len, &size, "%s%s %lld\n", tmp->name, labels, __sync_add_and_fetch(&tmp->gauge, 0));
+				break;
+				case METRIC_HISTOGRAM:
+					metrics_print_histogram(tmp, &out, &len, &size);
+				break;
+			}
+		}
+		tmp = tmp->next;
+	}
+	uv_mutex_unlock(&lock);
+
+	return out;
+}
+
+/*
+ * Modules keep pointers to their metrics, so this
+ * should only be called when all of them stopped.
+ */
+void metrics_gc(void) {
+	struct metric_t *tmp = NULL;
+
+	uv_once(&once, metrics_init);
+
+	uv_mutex_lock(&lock);
+	while(metrics) {
+		tmp = metrics;
+		metrics = metrics->next;
+		FREE(tmp->name);
+		FREE(tmp->labels);
+		FREE(tmp->help);
+		FREE(tmp);
+	}
+	uv_mutex_unlock(&lock);
+}
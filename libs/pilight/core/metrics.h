@@ -0,0 +1,57 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/*
+ * Registry of counters, gauges and histograms printed in the
+ * Prometheus text format. Registering takes a lock, updating
+ * a metric is a single atomic operation. All update functions
+ * accept NULL, so callers don't need to check the registration.
+ */
+#define METRIC_COUNTER		0
+#define METRIC_GAUGE			1
+#define METRIC_HISTOGRAM	2
+
+#define METRIC_MAXBUCKETS	12
+
+typedef struct metric_t {
+	char *name;
+	char *labels;
+	char *help;
+	int type;
+
+	volatile unsigned long long value;
+	volatile long long gauge;
+	double (*callback)(void *userdata);
+	void *userdata;
+
+	int nrbuckets;
+	double bounds[METRIC_MAXBUCKETS];
+	volatile unsigned long long buckets[METRIC_MAXBUCKETS+1];
+	volatile unsigned long long sum;
+
+	struct metric_t *next;
+} metric_t;
+
+struct metric_t *metrics_counter(const char *name, const char *labels, const char *help);
+struct metric_t *metrics_gauge(const char *name, const char *labels, const char *help);
+struct metric_t *metrics_counter_callback(const char *name, const char *labels, const char *help, double (*callback)(void *), void *userdata);
+struct metric_t *metrics_gauge_callback(const char *name, const char *labels, const char *help, double (*callback)(void *), void *userdata);
+struct metric_t *metrics_histogram(const char *name, const char *labels, const char *help, const double *bounds, int nrbounds);
+
+void metrics_inc(struct metric_t *metric, unsigned long long value);
+void metrics_set(struct metric_t *metric, long long value);
+void metrics_add(struct metric_t *metric, long long value);
+void metrics_observe(struct metric_t *metric, double value);
+
+char *metrics_print(void);
+void metrics_gc(void);
+
+#endif
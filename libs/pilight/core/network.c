@@ -66,13 +66,14 @@
 #endif
 #include <assert.h>
 
+#include "../../libuv/uv.h"
 #include "../config/settings.h"
+#include "../config/snapshot.h"
 #include "mem.h"
 #include "network.h"
+#include "dns.h"
 #include "log.h"
-
-static unsigned int ***whitelist_cache = NULL;
-static unsigned int whitelist_number;
+#include "rcu.h"
 
 int inetdevs(char ***array) {
 	unsigned int nrdevs = 0, i = 0, match = 0;
@@ -311,8 +312,21 @@ int dev2ip(char *dev, char **ip, sa_family_t type) {
 }
 
 int host2ip(char *host, char **ip) {
-	int rv = 0;
+	int rv = 0, family = 0;
 	struct addrinfo hints, *servinfo, *p;
+	char cached[INET6_ADDRSTRLEN+1];
+
+	switch(dns_cache_get(host, &family, cached)) {
+		case 0: {
+			if((*ip = STRDUP(cached)) == NULL) {
+				OUT_OF_MEMORY
+			}
+			return family;
+		} break;
+		case -1:
+			return -1;
+		break;
+	}
 
 #ifdef _WIN32
 	WSADATA wsa;
@@ -330,6 +344,7 @@ int host2ip(char *host, char **ip) {
 	if((rv = getaddrinfo(host, NULL , NULL, &servinfo)) != 0) {
 		/*LCOV_EXCL_START*/
 		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", host, gai_strerror(rv));
+		dns_cache_set(host, -1, NULL);
 		return -1;
 		/*LCOV_EXCL_STOP*/
 	}
@@ -355,6 +370,7 @@ int host2ip(char *host, char **ip) {
 		if(*ip != NULL && strlen(*ip) > 0) {
 			int r = p->ai_family;
 			freeaddrinfo(servinfo);
+			dns_cache_set(host, r, *ip);
 			return r;
 		}
 	}
@@ -558,135 +574,381 @@ void rep_freeifaddrs(struct ifaddrs *ifaddr) {
 }
 #endif
 
-int whitelist_check(char *ip) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/*
+ * The whitelist is compiled into sorted and merged address
+ * ranges each time the settings are published, so checking
+ * a client is a binary search on its binary address. Readers
+ * only hold the table for a single lookup, a new table is
+ * swapped in the same way as the config snapshot.
+ */
+typedef struct whitelist_ip4_t {
+	uint32_t lower;
+	uint32_t upper;
+} whitelist_ip4_t;
+
+typedef struct whitelist_ip6_t {
+	unsigned char lower[16];
+	unsigned char upper[16];
+} whitelist_ip6_t;
+
+typedef struct whitelist_t {
+	char *source;
+	struct whitelist_ip4_t *ip4;
+	int nrip4;
+	struct whitelist_ip6_t *ip6;
+	int nrip6;
+} whitelist_t;
+
+static struct rcu_t whitelist;
+static uv_mutex_t whitelist_lock;
+static uv_once_t whitelist_once = UV_ONCE_INIT;
+
+static void whitelist_init(void) {
+	uv_mutex_init(&whitelist_lock);
+}
 
-	char *whitelist = NULL;
-	unsigned int client[4] = {0};
-	int x = 0, i = 0, error = 1;
-	unsigned int n = 0;
-	char **array = NULL;
-	char wip[16] = {'\0'};
-
-	/* Check if there are any whitelisted ip address */
-	struct lua_state_t *state = plua_get_free_state();
-	if(config_setting_get_string(state->L, "whitelist", 0, &whitelist) != 0) {
-		assert(plua_check_stack(state->L, 0) == 0);
-		plua_clear_state(state);
-		return 0;
+/*
+ * Parses a.b.c.d, a.b.*.* or a.b.c.d/n into a range.
+ */
+static int whitelist_parse4(char *str, int bits, struct whitelist_ip4_t *range) {
+	char *p = str, *end = NULL;
+	int i = 0, wildcard = 0;
+	long n = 0;
+
+	range->lower = 0;
+	range->upper = 0;
+	for(i=0;i<4;i++) {
+		if(i > 0) {
+			if(*p != '.') {
+				return -1;
+			}
+			p++;
+		}
+		if(*p == '*') {
+			range->lower = range->lower << 8;
+			range->upper = (range->upper << 8) | 0xFF;
+			wildcard = 1;
+			p++;
+		} else {
+			if(isdigit((unsigned char)*p) == 0) {
+				return -1;
+			}
+			n = strtol(p, &end, 10);
+			if(n < 0 || n > 255) {
+				return -1;
+			}
+			range->lower = (range->lower << 8) | (uint32_t)n;
+			range->upper = (range->upper << 8) | (uint32_t)n;
+			p = end;
+		}
+	}
+	if(*p != '\0') {
+		return -1;
 	}
-	assert(plua_check_stack(state->L, 0) == 0);
-	plua_clear_state(state);
 
-	if(strlen(whitelist) == 0) {
-		FREE(whitelist);
-		return 0;
+	if(bits >= 0) {
+		if(wildcard == 1 || bits > 32) {
+			return -1;
+		}
+		uint32_t mask = (bits == 0) ? 0 : 0xFFFFFFFF << (32-bits);
+		range->lower &= mask;
+		range->upper = range->lower | ~mask;
 	}
+	return 0;
+}
+
+static int whitelist_parse6(char *str, int bits, struct whitelist_ip6_t *range) {
+	int i = 0;
 
-	/* Explode ip address to a 4 elements int array */
-	n = explode(ip, ".", &array);
-	x = 0;
-	for(x=0;x<n;x++) {
-		client[x] = (unsigned int)atoi(array[x]);
-		FREE(array[x]);
+	if(inet_pton(AF_INET6, str, range->lower) != 1) {
+		return -1;
 	}
-	if(n > 0) {
-		FREE(array);
+	if(bits < 0) {
+		bits = 128;
+	} else if(bits > 128) {
+		return -1;
 	}
 
+	for(i=0;i<16;i++) {
+		if(bits >= 8) {
+			range->upper[i] = range->lower[i];
+			bits -= 8;
+		} else {
+			unsigned char mask = (unsigned char)(0xFF << (8-bits));
+			range->lower[i] &= mask;
+			range->upper[i] = range->lower[i] | (unsigned char)~mask;
+			bits = 0;
+		}
+	}
+	return 0;
+}
 
-	if(whitelist_cache == NULL) {
-		char *tmp = whitelist;
-		x = 0;
-		/* Loop through all whitelised ip addresses */
-		while(*tmp != '\0') {
-			/* Remove any comma's and spaces */
-			while(*tmp == ',' || *tmp == ' ') {
-				tmp++;
-			}
-			/* Save ip address in temporary char array */
-			wip[x] = *tmp;
-			x++;
-			tmp++;
-
-			/* Each ip address is either terminated by a comma or EOL delimiter */
-			if(*tmp == '\0' || *tmp == ',') {
-				x = 0;
-				if((whitelist_cache = REALLOC(whitelist_cache, (sizeof(unsigned int ***)*(whitelist_number+1)))) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				if((whitelist_cache[whitelist_number] = MALLOC(sizeof(unsigned int **)*2)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				/* Lower boundary */
-				if((whitelist_cache[whitelist_number][0] = MALLOC(sizeof(unsigned int *)*4)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				/* Upper boundary */
-				if((whitelist_cache[whitelist_number][1] = MALLOC(sizeof(unsigned int *)*4)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
+static int whitelist_cmp4(const void *a, const void *b) {
+	uint32_t x = ((struct whitelist_ip4_t *)a)->lower;
+	uint32_t y = ((struct whitelist_ip4_t *)b)->lower;
 
-				/* Turn the whitelist ip address into a upper and lower boundary.
-				   If the ip address doesn't contain a wildcard, then the upper
-				   and lower boundary are the same. If the ip address does contain
-				   a wildcard, then this lower boundary number will be 0 and the
-				   upper boundary number 255. */
-				i = 0;
-				n = explode(wip, ".", &array);
-				for(i=0;i<n;i++) {
-					if(strcmp(array[i], "*") == 0) {
-						whitelist_cache[whitelist_number][0][i] = 0;
-						whitelist_cache[whitelist_number][1][i] = 255;
-					} else {
-						whitelist_cache[whitelist_number][0][i] = (unsigned int)atoi(array[i]);
-						whitelist_cache[whitelist_number][1][i] = (unsigned int)atoi(array[i]);
-					}
-					FREE(array[i]);
+	return (x > y) - (x < y);
+}
+
+static int whitelist_cmp6(const void *a, const void *b) {
+	return memcmp(((struct whitelist_ip6_t *)a)->lower, ((struct whitelist_ip6_t *)b)->lower, 16);
+}
+
+/*
+ * Sort the ranges and merge the overlapping ones, so
+ * a client can only fall inside a single range.
+ */
+static void whitelist_merge(struct whitelist_t *wl) {
+	int i = 0, n = 0;
+
+	if(wl->nrip4 > 0) {
+		qsort(wl->ip4, wl->nrip4, sizeof(struct whitelist_ip4_t), whitelist_cmp4);
+		for(i=1,n=0;i<wl->nrip4;i++) {
+			if(wl->ip4[n].upper == 0xFFFFFFFF || wl->ip4[i].lower <= wl->ip4[n].upper+1) {
+				if(wl->ip4[i].upper > wl->ip4[n].upper) {
+					wl->ip4[n].upper = wl->ip4[i].upper;
 				}
-				if(n > 0) {
-					FREE(array);
+			} else {
+				wl->ip4[++n] = wl->ip4[i];
+			}
+		}
+		wl->nrip4 = n+1;
+	}
+
+	if(wl->nrip6 > 0) {
+		qsort(wl->ip6, wl->nrip6, sizeof(struct whitelist_ip6_t), whitelist_cmp6);
+		for(i=1,n=0;i<wl->nrip6;i++) {
+			if(memcmp(wl->ip6[i].lower, wl->ip6[n].upper, 16) <= 0) {
+				if(memcmp(wl->ip6[i].upper, wl->ip6[n].upper, 16) > 0) {
+					memcpy(wl->ip6[n].upper, wl->ip6[i].upper, 16);
 				}
-				memset(wip, '\0', 16);
-				whitelist_number++;
+			} else {
+				wl->ip6[++n] = wl->ip6[i];
+			}
+		}
+		wl->nrip6 = n+1;
+	}
+}
+
+static struct whitelist_t *whitelist_compile(char *source) {
+	struct whitelist_t *wl = NULL;
+	char entry[INET6_ADDRSTRLEN+5], *p = source, *slash = NULL;
+	int len = 0, bits = 0;
+
+	if((wl = MALLOC(sizeof(struct whitelist_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+	memset(wl, 0, sizeof(struct whitelist_t));
+	if((wl->source = STRDUP(source)) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	while(*p != '\0') {
+		/* Remove any comma's and spaces */
+		while(*p == ',' || *p == ' ') {
+			p++;
+		}
+		len = 0;
+		while(*p != '\0' && *p != ',' && *p != ' ') {
+			if(len < (int)sizeof(entry)-1) {
+				entry[len++] = *p;
+			}
+			p++;
+		}
+		entry[len] = '\0';
+		if(len == 0) {
+			continue;
+		}
+
+		bits = -1;
+		if((slash = strchr(entry, '/')) != NULL) {
+			*slash = '\0';
+			if(isdigit((unsigned char)slash[1]) == 0) {
+				logprintf(LOG_ERR, "invalid whitelist entry %s/%s", entry, &slash[1]);
+				continue;
+			}
+			bits = atoi(&slash[1]);
+		}
+
+		if(strchr(entry, ':') != NULL) {
+			if((wl->ip6 = REALLOC(wl->ip6, sizeof(struct whitelist_ip6_t)*(wl->nrip6+1))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			if(whitelist_parse6(entry, bits, &wl->ip6[wl->nrip6]) == 0) {
+				wl->nrip6++;
+				continue;
+			}
+		} else {
+			if((wl->ip4 = REALLOC(wl->ip4, sizeof(struct whitelist_ip4_t)*(wl->nrip4+1))) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
+			if(whitelist_parse4(entry, bits, &wl->ip4[wl->nrip4]) == 0) {
+				wl->nrip4++;
+				continue;
 			}
 		}
+		if(slash != NULL) {
+			*slash = '/';
+		}
+		logprintf(LOG_ERR, "invalid whitelist entry %s", entry);
+	}
+
+	whitelist_merge(wl);
+
+	return wl;
+}
+
+static void whitelist_destroy(struct whitelist_t *wl) {
+	if(wl == NULL) {
+		return;
+	}
+	if(wl->ip4 != NULL) {
+		FREE(wl->ip4);
+	}
+	if(wl->ip6 != NULL) {
+		FREE(wl->ip6);
 	}
+	FREE(wl->source);
+	FREE(wl);
+}
 
-	for(x=0;x<whitelist_number;x++) {
-		/* Turn the different ip addresses into one single number and compare those
-		   against each other to see if the ip address is inside the lower and upper
-		   whitelisted boundary */
-		unsigned int wlower = whitelist_cache[x][0][0] << 24 | whitelist_cache[x][0][1] << 16 | whitelist_cache[x][0][2] << 8 | whitelist_cache[x][0][3];
-		unsigned int wupper = whitelist_cache[x][1][0] << 24 | whitelist_cache[x][1][1] << 16 | whitelist_cache[x][1][2] << 8 | whitelist_cache[x][1][3];
-		unsigned int nip = client[0] << 24 | client[1] << 16 | client[2] << 8 | client[3];
+static void whitelist_swap(struct whitelist_t *wl) {
+	whitelist_destroy(rcu_publish(&whitelist, wl));
+}
 
-		/* Always allow 127.0.0.1 connections */
-		if((nip >= wlower && nip <= wupper) || (nip == 2130706433)) {
-			error = 0;
+/*
+ * Called each time the settings are published. The table
+ * is only recompiled when the whitelist itself changed.
+ */
+void whitelist_update(void) {
+	struct whitelist_t *wl = NULL;
+	struct varcont_t val;
+	char *source = NULL;
+
+	uv_once(&whitelist_once, whitelist_init);
+
+	memset(&val, 0, sizeof(struct varcont_t));
+	if(config_snapshot_get("settings", "whitelist", 0, &val) == 0 && val.type_ == LUA_TSTRING) {
+		source = val.string_;
+	}
+
+	/* Only writers replace the whitelist, so it's stable under the lock */
+	uv_mutex_lock(&whitelist_lock);
+	wl = whitelist.ptr;
+	if(source == NULL || strlen(source) == 0) {
+		if(wl != NULL) {
+			whitelist_swap(NULL);
 		}
+	} else if(wl == NULL || strcmp(wl->source, source) != 0) {
+		whitelist_swap(whitelist_compile(source));
 	}
+	uv_mutex_unlock(&whitelist_lock);
 
-	if(whitelist != NULL) {
-		FREE(whitelist);
+	if(source != NULL) {
+		FREE(source);
 	}
-	return error;
 }
 
-void whitelist_free(void) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+static int whitelist_match4(struct whitelist_t *wl, uint32_t ip) {
+	int lower = 0, upper = wl->nrip4-1, mid = 0;
 
-	int i = 0;
-	if(whitelist_cache) {
-		for(i=0;i<whitelist_number;i++) {
-			FREE(whitelist_cache[i][0]);
-			FREE(whitelist_cache[i][1]);
-			FREE(whitelist_cache[i]);
+	while(lower <= upper) {
+		mid = (lower+upper)/2;
+		if(ip < wl->ip4[mid].lower) {
+			upper = mid-1;
+		} else if(ip > wl->ip4[mid].upper) {
+			lower = mid+1;
+		} else {
+			return 0;
 		}
-		FREE(whitelist_cache);
 	}
+	return 1;
+}
+
+static int whitelist_match6(struct whitelist_t *wl, unsigned char *ip) {
+	int lower = 0, upper = wl->nrip6-1, mid = 0;
+
+	while(lower <= upper) {
+		mid = (lower+upper)/2;
+		if(memcmp(ip, wl->ip6[mid].lower, 16) < 0) {
+			upper = mid-1;
+		} else if(memcmp(ip, wl->ip6[mid].upper, 16) > 0) {
+			lower = mid+1;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Returns 0 when the client is allowed to connect and 1
+ * when it isn't. Without a whitelist every client is
+ * allowed, local connections are always allowed.
+ */
+int whitelist_match(struct sockaddr *addr) {
+	struct whitelist_t *wl = NULL;
+	unsigned char *ip6 = NULL;
+	uint32_t ip4 = 0;
+	int family = addr->sa_family, r = 1, token = 0;
+
+	if(family == AF_INET) {
+		ip4 = ntohl(((struct sockaddr_in *)addr)->sin_addr.s_addr);
+	} else if(family == AF_INET6) {
+		ip6 = ((struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+		/* IPv4 clients on a dual stack socket */
+		if(memcmp(ip6, "\0\0\0\0\0\0\0\0\0\0\xff\xff", 12) == 0) {
+			ip4 = (uint32_t)ip6[12] << 24 | ip6[13] << 16 | ip6[14] << 8 | ip6[15];
+			family = AF_INET;
+		} else if(memcmp(ip6, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x01", 16) == 0) {
+			return 0;
+		}
+	} else {
+		return 1;
+	}
+
+	/* Always allow 127.0.0.1 connections */
+	if(family == AF_INET && ip4 == 0x7F000001) {
+		return 0;
+	}
+
+	if((wl = rcu_read_lock(&whitelist, &token)) == NULL) {
+		r = 0;
+	} else if(family == AF_INET) {
+		r = whitelist_match4(wl, ip4);
+	} else {
+		r = whitelist_match6(wl, ip6);
+	}
+	rcu_read_unlock(&whitelist, token);
+
+	return r;
+}
+
+int whitelist_check(char *ip) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct sockaddr_in6 addr6;
+	struct sockaddr_in addr4;
+
+	memset(&addr4, 0, sizeof(struct sockaddr_in));
+	memset(&addr6, 0, sizeof(struct sockaddr_in6));
+	if(inet_pton(AF_INET, ip, &addr4.sin_addr) == 1) {
+		addr4.sin_family = AF_INET;
+		return whitelist_match((struct sockaddr *)&addr4);
+	}
+	if(inet_pton(AF_INET6, ip, &addr6.sin6_addr) == 1) {
+		addr6.sin6_family = AF_INET6;
+		return whitelist_match((struct sockaddr *)&addr6);
+	}
+	return 1;
+}
+
+void whitelist_free(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	uv_once(&whitelist_once, whitelist_init);
+
+	uv_mutex_lock(&whitelist_lock);
+	whitelist_swap(NULL);
+	uv_mutex_unlock(&whitelist_lock);
 }
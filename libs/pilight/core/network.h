@@ -47,7 +47,9 @@ int dev2ip(char *dev, char **ip, __sa_family_t type);
 int dev2ip(char *dev, char **ip, sa_family_t type);
 #endif
 int host2ip(char *host, char **ip);
+int whitelist_match(struct sockaddr *addr);
 int whitelist_check(char *ip);
+void whitelist_update(void);
 void whitelist_free(void);
 
 #ifdef __FreeBSD__
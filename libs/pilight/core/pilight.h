@@ -55,6 +55,7 @@ typedef enum origin_t {
 #define ORIGIN_SENDER 1
 #define ORIGIN_MASTER 1
 #define ORIGIN_ACTION ACTION
+#define ORIGIN_RULE RULE
 
 #endif
 
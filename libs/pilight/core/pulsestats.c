@@ -0,0 +1,127 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define PULSESTATS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define PULSESTATS_NEON
+#endif
+
+#include "pulsestats.h"
+
+/*
+ * Returns the first cluster the pulse fits in, or -1. Unused
+ * clusters have an empty range, so all clusters can be
+ * compared at once.
+ */
+static int pulsestats_match(const struct pulsestats_t *stats, int pulse) {
+	int x = 0;
+
+#if defined(PULSESTATS_SSE2)
+	__m128i p = _mm_set1_epi32(pulse), lo, hi, m;
+	int mask = 0;
+
+	for(x=0;x<PULSESTATS_CLUSTERS;x+=4) {
+		lo = _mm_loadu_si128((const __m128i *)&stats->lower[x]);
+		hi = _mm_loadu_si128((const __m128i *)&stats->upper[x]);
+		m = _mm_or_si128(_mm_cmpgt_epi32(lo, p), _mm_cmpgt_epi32(p, hi));
+		if((mask = ~_mm_movemask_ps(_mm_castsi128_ps(m)) & 0xf) != 0) {
+			return x+__builtin_ctz(mask);
+		}
+	}
+#elif defined(PULSESTATS_NEON)
+	int32x4_t p = vdupq_n_s32(pulse);
+	uint32_t tmp[4];
+	int i = 0;
+
+	for(x=0;x<PULSESTATS_CLUSTERS;x+=4) {
+		vst1q_u32(tmp, vandq_u32(
+			vcleq_s32(vld1q_s32(&stats->lower[x]), p),
+			vcleq_s32(p, vld1q_s32(&stats->upper[x]))));
+		for(i=0;i<4;i++) {
+			if(tmp[i] != 0) {
+				return x+i;
+			}
+		}
+	}
+#else
+	for(x=0;x<PULSESTATS_CLUSTERS;x++) {
+		if(stats->lower[x] <= pulse && pulse <= stats->upper[x]) {
+			return x;
+		}
+	}
+#endif
+
+	return -1;
+}
+
+void pulsestats_compute(struct pulsestats_t *stats, const int *raw, int rawlen) {
+	int i = 0, x = 0;
+
+	memset(stats, 0, sizeof(struct pulsestats_t));
+	for(i=0;i<PULSESTATS_CLUSTERS;i++) {
+		stats->lower[i] = INT_MAX;
+		stats->upper[i] = INT_MIN;
+	}
+
+	if(rawlen <= 0) {
+		return;
+	}
+
+	stats->rawlen = rawlen;
+
+	for(i=0;i<rawlen-1;i++) {
+		if((x = pulsestats_match(stats, raw[i])) == -1) {
+			if(stats->nrclusters == PULSESTATS_CLUSTERS) {
+				stats->outliers++;
+				continue;
+			}
+			x = stats->nrclusters++;
+			stats->lower[x] = raw[i]-raw[i]/3;
+			stats->upper[x] = (raw[i] > INT_MAX-raw[i]/3) ? INT_MAX : raw[i]+raw[i]/3;
+		}
+		stats->count[x]++;
+	}
+}
+
+/*
+ * The percentage of the pulses before the footer that
+ * have one of the most common lengths. A train that
+ * only has a footer is always accepted.
+ */
+int pulsestats_quality(const struct pulsestats_t *stats, int lengths) {
+	int count[PULSESTATS_CLUSTERS], i = 0, x = 0, n = 0, tmp = 0;
+
+	if(stats->rawlen <= 1) {
+		return 100;
+	}
+	if(lengths <= 0 || lengths > stats->nrclusters) {
+		lengths = stats->nrclusters;
+	}
+
+	memcpy(count, stats->count, sizeof(count));
+	for(i=0;i<lengths;i++) {
+		for(x=i+1;x<stats->nrclusters;x++) {
+			if(count[x] > count[i]) {
+				tmp = count[i];
+				count[i] = count[x];
+				count[x] = tmp;
+			}
+		}
+		n += count[i];
+	}
+
+	return (n*100)/(stats->rawlen-1);
+}
@@ -0,0 +1,36 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _PULSESTATS_H_
+#define _PULSESTATS_H_
+
+/*
+ * Pulse length clusters of a received pulse train, used by
+ * the noise filter before the train is passed to the
+ * protocols. The pulses before the footer are grouped by
+ * length: a pulse belongs to the first cluster within a
+ * third of the length of the pulse that started it. Pulses
+ * that don't fit in any of the PULSESTATS_CLUSTERS clusters
+ * are outliers.
+ */
+#define PULSESTATS_CLUSTERS	8
+
+typedef struct pulsestats_t {
+	int rawlen;
+
+	int nrclusters;
+	int lower[PULSESTATS_CLUSTERS];
+	int upper[PULSESTATS_CLUSTERS];
+	int count[PULSESTATS_CLUSTERS];
+	int outliers;
+} pulsestats_t;
+
+void pulsestats_compute(struct pulsestats_t *stats, const int *raw, int rawlen);
+int pulsestats_quality(const struct pulsestats_t *stats, int lengths);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../libuv/uv.h"
+#include "rcu.h"
+
+static __thread int slot = -1;
+static volatile int nrslots = 0;
+
+static uv_mutex_t lock;
+static uv_once_t once = UV_ONCE_INIT;
+
+static void rcu_init(void) {
+	uv_mutex_init(&lock);
+}
+
+static int rcu_slot(void) {
+	if(slot == -1) {
+		slot = __sync_fetch_and_add(&nrslots, 1) % RCU_SLOTS;
+	}
+	return slot;
+}
+
+static unsigned long rcu_readers(struct rcu_t *rcu, int phase) {
+	unsigned long n = 0;
+	int i = 0;
+
+	for(i=0;i<RCU_SLOTS;i++) {
+		n += __sync_add_and_fetch(&rcu->slots[phase][i].readers, 0);
+	}
+	return n;
+}
+
+/*
+ * Returns the current pointer, which stays valid until
+ * rcu_read_unlock is called with the returned token.
+ */
+void *rcu_read_lock(struct rcu_t *rcu, int *token) {
+	int x = rcu_slot(), phase = 0;
+
+	while(1) {
+		phase = rcu->phase;
+		__sync_add_and_fetch(&rcu->slots[phase][x].readers, 1);
+		/*
+		 * A writer flipped the phase in between and may
+		 * already be waiting for this phase to drain.
+		 */
+		if(rcu->phase == phase) {
+			break;
+		}
+		__sync_sub_and_fetch(&rcu->slots[phase][x].readers, 1);
+	}
+
+	*token = (phase*RCU_SLOTS)+x;
+
+	return rcu->ptr;
+}
+
+void rcu_read_unlock(struct rcu_t *rcu, int token) {
+	__sync_sub_and_fetch(&rcu->slots[token/RCU_SLOTS][token%RCU_SLOTS].readers, 1);
+}
+
+/*
+ * Swaps in the new pointer and returns the old one as soon
+ * as no reader can still be using it, so the caller can free
+ * it. Readers hold the pointer for a single lookup, so the
+ * wait is short. Writers are serialized.
+ */
+void *rcu_publish(struct rcu_t *rcu, void *ptr) {
+	void *old = NULL;
+	int phase = 0;
+
+	uv_once(&once, rcu_init);
+
+	uv_mutex_lock(&lock);
+
+	do {
+		old = rcu->ptr;
+	} while(__sync_bool_compare_and_swap(&rcu->ptr, old, ptr) == 0);
+
+	phase = rcu->phase;
+	__sync_lock_test_and_set(&rcu->phase, phase ^ 1);
+	__sync_synchronize();
+
+	while(rcu_readers(rcu, phase) > 0) {
+		usleep(10);
+	}
+
+	uv_mutex_unlock(&lock);
+
+	return old;
+}
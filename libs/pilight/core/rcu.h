@@ -0,0 +1,40 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * A pointer that is read far more often than it is replaced.
+ * Readers announce themselves in one of RCU_SLOTS counters,
+ * picked per thread and each on its own cache line, so readers
+ * on different threads don't share a counter. The counters are
+ * split in two phases. A writer swaps the pointer, moves new
+ * readers to the other phase and then only waits for the
+ * readers of the old phase, so it can't be starved by a steady
+ * stream of new readers.
+ */
+#define RCU_SLOTS			16
+#define RCU_CACHELINE	64
+
+typedef struct rcu_slot_t {
+	volatile unsigned long readers;
+	char pad[RCU_CACHELINE-sizeof(unsigned long)];
+} rcu_slot_t;
+
+typedef struct rcu_t {
+	void *volatile ptr;
+	volatile int phase;
+	struct rcu_slot_t slots[2][RCU_SLOTS];
+} rcu_t;
+
+void *rcu_read_lock(struct rcu_t *rcu, int *token);
+void rcu_read_unlock(struct rcu_t *rcu, int token);
+void *rcu_publish(struct rcu_t *rcu, void *ptr);
+
+#endif
@@ -53,6 +53,7 @@
 #include "network.h"
 #include "log.h"
 #include "gc.h"
+#include "dns.h"
 #include "socket.h"
 #include "../config/settings.h"
 
@@ -233,6 +234,41 @@ int socket_get_clients(int i) {
 	return socket_clients[i];
 }
 
+/*
+ * The shared dns cache holds one address per host, which
+ * can be an IPv6 address, so only an IPv4 entry is taken
+ * from it. Otherwise an IPv4 address is asked for.
+ */
+static int socket_resolve(char *host, struct in_addr *addr) {
+	struct addrinfo hints, *servinfo = NULL;
+	char cached[INET6_ADDRSTRLEN+1];
+	int family = 0, rv = 0;
+
+	switch(dns_cache_get(host, &family, cached)) {
+		case 0:
+			if(family == AF_INET) {
+				return (inet_pton(AF_INET, cached, addr) == 1) ? 0 : -1;
+			}
+		break;
+		case -1:
+			return -1;
+		break;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if((rv = getaddrinfo(host, NULL, &hints, &servinfo)) != 0) {
+		logprintf(LOG_NOTICE, "getaddrinfo: %s, %s", host, gai_strerror(rv));
+		return -1;
+	}
+	memcpy(addr, &((struct sockaddr_in *)servinfo->ai_addr)->sin_addr, sizeof(struct in_addr));
+	freeaddrinfo(servinfo);
+
+	return 0;
+}
+
 int socket_connect(char *address, unsigned short port) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -261,7 +297,17 @@ int socket_connect(char *address, unsigned short port) {
 
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_port = htons(port);
-	inet_pton(AF_INET, address, &serv_addr.sin_addr);
+	if(inet_pton(AF_INET, address, &serv_addr.sin_addr) != 1) {
+		if(socket_resolve(address, &serv_addr.sin_addr) != 0) {
+			logprintf(LOG_ERR, "could not resolve %s", address);
+#ifdef _WIN32
+			closesocket(sockfd);
+#else
+			close(sockfd);
+#endif
+			return -1;
+		}
+	}
 
 	/* Connect to the server */
 	if(connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != -1) {
@@ -568,7 +614,7 @@ void *socket_wait(void *param) {
 			}
 			memset(&buf, '\0', INET_ADDRSTRLEN+1);
 			inet_ntop(AF_INET, (void *)&(address.sin_addr), buf, INET_ADDRSTRLEN+1);
-			if(whitelist_check(buf) != 0) {
+			if(whitelist_match((struct sockaddr *)&address) != 0) {
 				logprintf(LOG_INFO, "rejected client, ip: %s, port: %d", buf, ntohs(address.sin_port));
 				shutdown(socket_client, 2);
 				close(socket_client);
@@ -66,6 +66,7 @@
 #include "gc.h"
 #include "log.h"
 #include "json.h"
+#include "metrics.h"
 #include "webserver.h"
 #include "socket.h"
 #include "ssdp.h"
@@ -100,6 +101,7 @@ static uv_async_t *async_req = NULL;
 
 static int http_port = WEBSERVER_HTTP_PORT;
 static int websockets = WEBGUI_WEBSOCKETS;
+static struct metric_t *metric_sent = NULL;
 static int cache = 1;
 static char *authentication_username = NULL;
 static char *authentication_password = NULL;
@@ -147,6 +149,29 @@ typedef struct fcache_t {
 
 static struct fcache_t *fcache;
 
+/*
+ * Serialized /config and /values responses. An entry
+ * stays valid as long as the config generation it was
+ * built for did not change.
+ */
+#define RCACHE_CONFIG	0
+#define RCACHE_VALUES	1
+#define RCACHE_MAX		16
+
+typedef struct rcache_t {
+	int type;
+	int level;
+	char media[15];
+	unsigned long generation;
+	char etag[64];
+	char *bytes;
+	unsigned long size;
+	struct rcache_t *next;
+} rcache_t;
+
+static struct rcache_t *rcache = NULL;
+static time_t rcache_epoch = 0;
+
 #ifdef _WIN32
 	static uv_mutex_t webserver_lock;
 #else
@@ -214,6 +239,16 @@ int webserver_gc(void) {
 		}
 	}
 
+	{
+		struct rcache_t *tmp = rcache;
+		while(rcache) {
+			tmp = rcache;
+			json_free(tmp->bytes);
+			rcache = rcache->next;
+			FREE(tmp);
+		}
+	}
+
 	if(poll_http_req != NULL) {
 		poll_close_cb(poll_http_req);
 		poll_http_req = NULL;
@@ -241,18 +276,28 @@ int webserver_gc(void) {
 	return 1;
 }
 
-void webserver_create_header(char **p, const char *message, char *mimetype, unsigned long len) {
+static void create_header(char **p, const char *message, char *mimetype, unsigned long len, const char *etag) {
 	*p += sprintf((char *)*p,
 		"HTTP/1.0 %s\r\n"
 		"Server: pilight\r\n"
 		"Keep-Alive: timeout=15, max=100\r\n"
 		"Content-Type: %s\r\n",
 		message, mimetype);
+	if(etag != NULL) {
+		*p += sprintf((char *)*p,
+			"Cache-Control: no-cache\r\n"
+			"ETag: %s\r\n",
+			etag);
+	}
 	*p += sprintf((char *)*p,
 		"Content-Length: %lu\r\n\r\n",
 		len);
 }
 
+void webserver_create_header(char **p, const char *message, char *mimetype, unsigned long len) {
+	create_header(p, message, mimetype, len, NULL);
+}
+
 static void create_404_header(const char *in, char **p) {
 	char mimetype[] = "text/html";
 	webserver_create_header(p, "404 Not Found", mimetype, (unsigned long)(202+strlen((const char *)in)));
@@ -413,6 +458,7 @@ size_t websocket_write(uv_poll_t *req, int opcode, const char *data, unsigned lo
 	if(copy_len > 0) {
 		iobuf_append(&custom_poll_data->send_iobuf, (char *)copy, copy_len);
 		uv_custom_write(req);
+		metrics_inc(metric_sent, copy_len);
 	}
 
 	FREE(copy);
@@ -499,6 +545,116 @@ static size_t send_data(uv_poll_t *req, char *mimetype, void *data, unsigned lon
 	return 0;
 }
 
+static struct rcache_t *rcache_get(int type, int level, const char *media, unsigned long generation) {
+	struct rcache_t *tmp = rcache, *prev = NULL;
+
+	while(tmp) {
+		if(tmp->type == type && tmp->level == level && strcmp(tmp->media, media) == 0) {
+			if(tmp->generation != generation) {
+				return NULL;
+			}
+			/* Keep the most recently used entries in front */
+			if(prev != NULL) {
+				prev->next = tmp->next;
+				tmp->next = rcache;
+				rcache = tmp;
+			}
+			return tmp;
+		}
+		prev = tmp;
+		tmp = tmp->next;
+	}
+	return NULL;
+}
+
+/*
+ * Stores a json_stringify'd response, which is owned
+ * by the cache from then on.
+ */
+static struct rcache_t *rcache_set(int type, int level, const char *media, unsigned long generation, char *bytes) {
+	struct rcache_t *tmp = rcache, *prev = NULL;
+	int i = 0;
+
+	if(rcache_epoch == 0) {
+		rcache_epoch = time(NULL);
+	}
+
+	while(tmp) {
+		if(tmp->type == type && tmp->level == level && strcmp(tmp->media, media) == 0) {
+			break;
+		}
+		prev = tmp;
+		tmp = tmp->next;
+	}
+
+	if(tmp == NULL) {
+		if((tmp = MALLOC(sizeof(struct rcache_t))) == NULL) {
+			OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+		}
+		memset(tmp, 0, sizeof(struct rcache_t));
+		tmp->type = type;
+		tmp->level = level;
+		strncpy(tmp->media, media, sizeof(tmp->media)-1);
+	} else {
+		json_free(tmp->bytes);
+		if(prev != NULL) {
+			prev->next = tmp->next;
+		} else {
+			rcache = tmp->next;
+		}
+	}
+
+	tmp->generation = generation;
+	tmp->bytes = bytes;
+	tmp->size = strlen(bytes);
+	/*
+	 * The start time makes sure a tag of a previous
+	 * run is never mistaken for the current one.
+	 */
+	snprintf(tmp->etag, sizeof(tmp->etag), "\"%lx-%lx\"", (unsigned long)rcache_epoch, generation);
+
+	tmp->next = rcache;
+	rcache = tmp;
+
+	/* Drop the least recently used entries */
+	for(prev = rcache; prev != NULL; prev = prev->next) {
+		if(++i == RCACHE_MAX) {
+			while(prev->next != NULL) {
+				tmp = prev->next;
+				prev->next = tmp->next;
+				json_free(tmp->bytes);
+				FREE(tmp);
+			}
+			break;
+		}
+	}
+
+	return rcache;
+}
+
+static void send_rcache(uv_poll_t *req, struct rcache_t *node) {
+	/*
+	 * Make sure we execute in the main thread
+	 */
+	const uv_thread_t pth_cur_id = uv_thread_self();
+	assert(uv_thread_equal(&pth_main_id, &pth_cur_id));
+
+	struct uv_custom_poll_t *custom_poll_data = req->data;
+	struct connection_t *conn = custom_poll_data->data;
+	const char *match = http_get_header(conn, "If-None-Match");
+	char header[1024], *p = header;
+	memset(header, '\0', 1024);
+
+	if(match != NULL && (strstr(match, node->etag) != NULL || strcmp(match, "*") == 0)) {
+		create_header(&p, "304 Not Modified", "application/json", 0, node->etag);
+		iobuf_append(&custom_poll_data->send_iobuf, header, (int)(p-header));
+	} else {
+		create_header(&p, "200 OK", "application/json", node->size, node->etag);
+		iobuf_append(&custom_poll_data->send_iobuf, header, (int)(p-header));
+		iobuf_append(&custom_poll_data->send_iobuf, node->bytes, (int)node->size);
+	}
+}
+
 static size_t send_chunked_data(uv_poll_t *req, void *data, unsigned long data_len) {
 	/*
 	 * Make sure we execute in the main thread
@@ -526,6 +682,26 @@ static size_t send_chunked_data(uv_poll_t *req, void *data, unsigned long data_l
 	return 0;
 }
 
+/*
+ * Returns the value of a query string parameter, or NULL
+ * when there is none. Only whole parameter names match,
+ * so xsince= is not taken for since=.
+ */
+static const char *query_param(const char *query, const char *key) {
+	size_t len = strlen(key);
+	const char *p = query;
+
+	while(p != NULL && *p != '\0') {
+		if(strncmp(p, key, len) == 0 && p[len] == '=') {
+			return &p[len+1];
+		}
+		if((p = strchr(p, '&')) != NULL) {
+			p++;
+		}
+	}
+	return NULL;
+}
+
 static int parse_rest(uv_poll_t *req) {
 	/*
 	 * Make sure we execute in the main thread
@@ -936,26 +1112,76 @@ static int request_handler(uv_poll_t *req) {
 				int internal = CONFIG_USER;
 				strcpy(media, "web");
 				if(conn->query_string != NULL) {
-					sscanf(conn->query_string, "media=%14s%*[ \n\r]", media);
+					const char *p = NULL;
+					if((p = query_param(conn->query_string, "media")) != NULL) {
+						sscanf(p, "%14[^& \n\r]", media);
+					}
 					if(strstr(conn->query_string, "internal") != NULL) {
 						internal = CONFIG_INTERNAL;
 					}
 				}
 
+				unsigned long generation = config_generation();
+				struct rcache_t *node = NULL;
+				if(cache == 1 && (node = rcache_get(RCACHE_CONFIG, internal, media, generation)) != NULL) {
+					send_rcache(req, node);
+					return MG_TRUE;
+				}
+
 				struct JsonNode *jsend = config_print(internal, media);
 				if(jsend != NULL) {
 					char *output = json_stringify(jsend, NULL);
-					send_data(req, "application/json", output, strlen(output));
+					if(cache == 1) {
+						send_rcache(req, rcache_set(RCACHE_CONFIG, internal, media, generation, output));
+					} else {
+						send_data(req, "application/json", output, strlen(output));
+						json_free(output);
+					}
 					json_delete(jsend);
-					json_free(output);
 				}
 				jsend = NULL;
 				return MG_TRUE;
 			} else if(strcmp(conn->uri, "/values") == 0) {
 				char media[15];
+				const char *p = NULL;
+				int since = 0;
 				strcpy(media, "web");
 				if(conn->query_string != NULL) {
-					sscanf(conn->query_string, "media=%14s%*[ \n\r]", media);
+					if((p = query_param(conn->query_string, "media")) != NULL) {
+						sscanf(p, "%14[^& \n\r]", media);
+					}
+					if((p = query_param(conn->query_string, "since")) != NULL) {
+						since = 1;
+					}
+				}
+#ifndef PILIGHT_REWRITE
+				/*
+				 * A delta request only contains the devices
+				 * changed after the given generation, so it
+				 * is never cached.
+				 */
+				if(since == 1) {
+					/* Anything but a plain number gets a full dump */
+					unsigned long from = (*p >= '0' && *p <= '9') ? strtoul(p, NULL, 10) : 0, to = 0;
+					int full = 0;
+					struct JsonNode *jvalues = devices_values_since(media, from, &to, &full);
+					struct JsonNode *jsend = json_mkobject();
+					json_append_member(jsend, "generation", json_mknumber((double)to, 0));
+					json_append_member(jsend, "full", json_mknumber(full, 0));
+					json_append_member(jsend, "values", jvalues);
+
+					char *output = json_stringify(jsend, NULL);
+					send_data(req, "application/json", output, strlen(output));
+					json_free(output);
+					json_delete(jsend);
+					return MG_TRUE;
+				}
+#endif
+				unsigned long generation = config_generation();
+				struct rcache_t *node = NULL;
+				if(cache == 1 && (node = rcache_get(RCACHE_VALUES, 0, media, generation)) != NULL) {
+					send_rcache(req, node);
+					return MG_TRUE;
 				}
 #ifdef PILIGHT_REWRITE
 				struct JsonNode *jsend = values_print(media);
@@ -964,12 +1190,21 @@ static int request_handler(uv_poll_t *req) {
 #endif
 				if(jsend != NULL) {
 					char *output = json_stringify(jsend, NULL);
-					send_data(req, "application/json", output, strlen(output));
+					if(cache == 1) {
+						send_rcache(req, rcache_set(RCACHE_VALUES, 0, media, generation, output));
+					} else {
+						send_data(req, "application/json", output, strlen(output));
+						json_free(output);
+					}
 					json_delete(jsend);
-					json_free(output);
 				}
 				jsend = NULL;
 				return MG_TRUE;
+			} else if(strcmp(conn->uri, "/metrics") == 0) {
+				char *output = metrics_print();
+				send_data(req, "text/plain; version=0.0.4", output, strlen(output));
+				FREE(output);
+				return MG_TRUE;
 			} else if(strstr(conn->uri, "/") != NULL && strcmp(&conn->uri[(rstrstr(conn->uri, "/")-conn->uri)], "/") == 0) {
 				char indexes[2][11] = {"index.html","index.htm"};
 
@@ -1219,41 +1454,40 @@ static void *broadcast(int reason, void *param, void *userdata) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 	}
 	memset(node, 0, sizeof(struct broadcast_list_t));
-	if((node->out = MALLOC(1024)) == NULL) {
-		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-	}
 
 	int i = 0;
 	switch(reason) {
 		case REASON_CONFIG_UPDATE: {
 			struct reason_config_update_t *data = param;
-			node->len += snprintf(node->out, 1024,
-				"{\"origin\":\"update\",\"type\":%d,\"devices\":[",
-				data->type
-			);
+			JsonWriter w;
+
+			json_writer_init(&w);
+			json_writer_begin_object(&w, NULL);
+			json_writer_string(&w, "origin", "update");
+			json_writer_number(&w, "type", data->type, 0);
+			json_writer_begin_array(&w, "devices");
 			for(i=0;i<data->nrdev;i++) {
-				node->len += snprintf(&node->out[node->len], 1024-node->len, "\"%s\",", data->devices[i]);
+				json_writer_string(&w, NULL, data->devices[i]);
 			}
-			node->len += snprintf(&node->out[node->len-1], 1024-node->len, "],\"values\":{");
-			node->len -= 1;
+			json_writer_end_array(&w);
+			json_writer_begin_object(&w, "values");
 			for(i=0;i<data->nrval;i++) {
 				if(data->values[i].type == JSON_NUMBER) {
-					node->len += snprintf(&node->out[node->len], 1024-node->len,
-						"\"%s\":%.*f,",
-						data->values[i].name, data->values[i].decimals, data->values[i].number_
-					);
+					json_writer_number(&w, data->values[i].name, data->values[i].number_, data->values[i].decimals);
 				} else if(data->values[i].type == JSON_STRING) {
-					node->len += snprintf(&node->out[node->len], 1024-node->len,
-						"\"%s\":\"%s\",",
-						data->values[i].name, data->values[i].string_
-					);
+					json_writer_string(&w, data->values[i].name, data->values[i].string_);
 				}
 			}
-			node->len += snprintf(&node->out[node->len-1], 1024-node->len, "}}");
-			node->len -= 1;
+			json_writer_end_object(&w);
+			json_writer_end_object(&w);
+
+			node->len = json_writer_length(&w);
+			node->out = json_writer_finish(&w);
 		} break;
 		case REASON_BROADCAST_CORE:
-			strncpy(node->out, (char *)param, 1024);
+			if((node->out = STRDUP((char *)param)) == NULL) {
+				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+			}
 			node->len = strlen(node->out);
 		break;
 		default:
@@ -1427,6 +1661,31 @@ static void webserver_client_add(uv_poll_t *req) {
 #endif
 }
 
+static double webserver_websocket_clients(void *param) {
+	struct webserver_clients_t *tmp = NULL;
+	int nr = 0;
+
+#ifdef _WIN32
+	uv_mutex_lock(&webserver_lock);
+#else
+	pthread_mutex_lock(&webserver_lock);
+#endif
+	tmp = webserver_clients;
+	while(tmp) {
+		if(tmp->is_websocket == 1) {
+			nr++;
+		}
+		tmp = tmp->next;
+	}
+#ifdef _WIN32
+	uv_mutex_unlock(&webserver_lock);
+#else
+	pthread_mutex_unlock(&webserver_lock);
+#endif
+
+	return (double)nr;
+}
+
 static void webserver_client_remove(uv_poll_t *req) {
 #ifdef _WIN32
 	uv_mutex_lock(&webserver_lock);
@@ -1775,7 +2034,7 @@ static void server_read_cb(uv_poll_t *req, ssize_t *nread, char *buf) {
 	memset(&buffer, '\0', INET_ADDRSTRLEN+1);
 	uv_inet_ntop(AF_INET, (void *)&(servaddr.sin_addr), buffer, INET_ADDRSTRLEN+1);
 
-	if(whitelist_check(buffer) != 0) {
+	if(whitelist_match((struct sockaddr *)&servaddr) != 0) {
 		logprintf(LOG_INFO, "rejected client, ip: %s, port: %d", buffer, ntohs(servaddr.sin_port));
 #ifdef _WIN32
 		closesocket(client);
@@ -2045,6 +2304,9 @@ int webserver_start(void) {
 #endif
 	}
 
+	metric_sent = metrics_counter("pilight_websocket_sent_bytes_total", NULL, "Bytes sent to websocket clients");
+	metrics_gauge_callback("pilight_websocket_clients", NULL, "Number of connected websocket clients", webserver_websocket_clients, NULL);
+
 #ifdef PILIGHT_REWRITE	
 	if(settings_select_number(ORIGIN_WEBSERVER, "webserver-http-port", &itmp) == 0) { http_port = (int)itmp; }
 	if(settings_select_number(ORIGIN_WEBSERVER, "webgui-websockets", &itmp) == 0) { websockets = (int)itmp; }
@@ -0,0 +1,315 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../core/mem.h"
+#include "ring.h"
+
+#define RING_ALIGN(a)	(((a)+7) & ~((unsigned long)7))
+#define RING_MINSIZE	4096
+
+/*
+ * Every slot starts with this header. The payload
+ * follows directly and is padded to 8 bytes so it
+ * can be used for any (int, pointer) data.
+ */
+typedef struct ring_slot_t {
+	unsigned int len;
+	unsigned int wrap;
+} ring_slot_t;
+
+struct ring_dt *dt_ring_init(unsigned long size, int type) {
+	struct ring_dt *ring = NULL;
+	unsigned long n = RING_MINSIZE;
+
+	while(n < size) {
+		n <<= 1;
+	}
+
+	if((ring = MALLOC(sizeof(struct ring_dt))) == NULL) {
+		OUT_OF_MEMORY
+	}
+	memset(ring, 0, sizeof(struct ring_dt));
+
+	if((ring->buffer = MALLOC(n)) == NULL) {
+		OUT_OF_MEMORY
+	}
+	ring->size = n;
+	ring->type = type;
+
+	uv_mutex_init(&ring->wlock);
+	uv_mutex_init(&ring->lock);
+	uv_cond_init(&ring->signal);
+
+	return ring;
+}
+
+void dt_ring_free(struct ring_dt *ring) {
+	uv_mutex_destroy(&ring->wlock);
+	uv_mutex_destroy(&ring->lock);
+	uv_cond_destroy(&ring->signal);
+	FREE(ring->buffer);
+	FREE(ring);
+}
+
+/*
+ * Reserve a slot of len bytes. On success the
+ * producer fills the returned memory and publishes
+ * it with dt_ring_commit. NULL is returned, and
+ * counted as a drop, when the ring is full.
+ */
+void *dt_ring_reserve(struct ring_dt *ring, unsigned long len) {
+	struct ring_slot_t *slot = NULL;
+	unsigned long need = sizeof(struct ring_slot_t)+RING_ALIGN(len);
+	unsigned long head = 0, tail = 0, off = 0, pad = 0;
+
+	if(ring->type == RING_MPSC) {
+		uv_mutex_lock(&ring->wlock);
+	}
+
+	head = ring->head;
+	tail = ring->tail;
+	__sync_synchronize();
+
+	off = head & (ring->size-1);
+	if(ring->size-off < need) {
+		pad = ring->size-off;
+	}
+
+	if(need > ring->size/2 || need+pad > ring->size-(head-tail) || ring->stopped == 1) {
+		ring->dropped++;
+		if(ring->type == RING_MPSC) {
+			uv_mutex_unlock(&ring->wlock);
+		}
+		return NULL;
+	}
+
+	/*
+	 * The slot does not fit in the remainder
+	 * of the buffer, so mark the remainder as
+	 * skippable and start over at the front.
+	 */
+	if(pad > 0) {
+		slot = (struct ring_slot_t *)&ring->buffer[off];
+		slot->len = 0;
+		slot->wrap = 1;
+	}
+
+	slot = (struct ring_slot_t *)&ring->buffer[(head+pad) & (ring->size-1)];
+	slot->len = (unsigned int)len;
+	slot->wrap = 0;
+
+	ring->reserved = head+pad+need;
+
+	return (void *)(slot+1);
+}
+
+void dt_ring_commit(struct ring_dt *ring) {
+	unsigned long used = 0, items = 0;
+
+	__sync_synchronize();
+	ring->head = ring->reserved;
+	ring->enqueued++;
+
+	used = ring->head-ring->tail;
+	items = ring->enqueued-ring->dequeued;
+	if(used > ring->highwater) {
+		ring->highwater = used;
+	}
+	if(items > ring->maxitems) {
+		ring->maxitems = items;
+	}
+
+	if(ring->type == RING_MPSC) {
+		uv_mutex_unlock(&ring->wlock);
+	}
+
+	/*
+	 * Only take the lock when the consumer
+	 * is (about to go) asleep.
+	 */
+	__sync_synchronize();
+	if(ring->waiting == 1) {
+		uv_mutex_lock(&ring->lock);
+		uv_cond_signal(&ring->signal);
+		uv_mutex_unlock(&ring->lock);
+	}
+}
+
+/*
+ * Returns the oldest slot without removing it
+ * or NULL when the ring is empty. Must only be
+ * called by the consumer.
+ */
+void *dt_ring_peek(struct ring_dt *ring, unsigned long *len) {
+	struct ring_slot_t *slot = NULL;
+	unsigned long tail = ring->tail;
+
+	while(1) {
+		if(tail == ring->head) {
+			return NULL;
+		}
+		__sync_synchronize();
+
+		slot = (struct ring_slot_t *)&ring->buffer[tail & (ring->size-1)];
+		if(slot->wrap == 1) {
+			tail += ring->size-(tail & (ring->size-1));
+			ring->tail = tail;
+			continue;
+		}
+		break;
+	}
+
+	if(len != NULL) {
+		*len = slot->len;
+	}
+
+	return (void *)(slot+1);
+}
+
+/*
+ * Returns the slot after prev, or the oldest slot when
+ * prev is NULL, without removing anything. This lets
+ * the consumer look past slots it isn't done with yet.
+ * Must only be called by the consumer.
+ */
+void *dt_ring_next(struct ring_dt *ring, void *prev, unsigned long *len) {
+	struct ring_slot_t *slot = NULL;
+	unsigned long tail = ring->tail, head = ring->head, pos = tail, off = 0;
+
+	if(prev != NULL) {
+		slot = (struct ring_slot_t *)prev-1;
+		off = (unsigned long)((unsigned char *)slot-ring->buffer);
+		pos = tail+((off-(tail & (ring->size-1))) & (ring->size-1));
+		pos += sizeof(struct ring_slot_t)+RING_ALIGN(slot->len);
+	}
+
+	while(1) {
+		if(pos == head) {
+			return NULL;
+		}
+		__sync_synchronize();
+
+		slot = (struct ring_slot_t *)&ring->buffer[pos & (ring->size-1)];
+		if(slot->wrap == 1) {
+			pos += ring->size-(pos & (ring->size-1));
+			continue;
+		}
+		break;
+	}
+
+	if(len != NULL) {
+		*len = slot->len;
+	}
+
+	return (void *)(slot+1);
+}
+
+void dt_ring_release(struct ring_dt *ring) {
+	struct ring_slot_t *slot = NULL;
+	unsigned long tail = ring->tail;
+
+	if(tail == ring->head) {
+		return;
+	}
+
+	slot = (struct ring_slot_t *)&ring->buffer[tail & (ring->size-1)];
+	tail += sizeof(struct ring_slot_t)+RING_ALIGN(slot->len);
+
+	__sync_synchronize();
+	ring->tail = tail;
+	ring->dequeued++;
+}
+
+/*
+ * Block the consumer until there is something
+ * to read. Returns -1 when the ring was stopped.
+ */
+int dt_ring_wait(struct ring_dt *ring) {
+	uv_mutex_lock(&ring->lock);
+	ring->waiting = 1;
+	__sync_synchronize();
+	while(ring->head == ring->tail && ring->stopped == 0) {
+		uv_cond_wait(&ring->signal, &ring->lock);
+	}
+	ring->waiting = 0;
+	uv_mutex_unlock(&ring->lock);
+
+	return (ring->stopped == 1) ? -1 : 0;
+}
+
+/*
+ * Same as dt_ring_wait, but gives up after timeout
+ * nanoseconds. Returns 1 when nothing arrived in time.
+ */
+int dt_ring_timedwait(struct ring_dt *ring, uint64_t timeout) {
+	uv_mutex_lock(&ring->lock);
+	ring->waiting = 1;
+	__sync_synchronize();
+	if(ring->head == ring->tail && ring->stopped == 0) {
+		uv_cond_timedwait(&ring->signal, &ring->lock, timeout);
+	}
+	ring->waiting = 0;
+	uv_mutex_unlock(&ring->lock);
+
+	if(ring->stopped == 1) {
+		return -1;
+	}
+	return (ring->head == ring->tail) ? 1 : 0;
+}
+
+/*
+ * Block the consumer until a new slot is committed, even
+ * when the ring isn't empty. The enqueued argument is the
+ * number of enqueued items the consumer already saw. Gives
+ * up after timeout nanoseconds, a timeout of 0 waits forever.
+ * Returns 1 when nothing new arrived in time.
+ */
+int dt_ring_timedwait_enqueued(struct ring_dt *ring, unsigned long enqueued, uint64_t timeout) {
+	int r = 0;
+
+	uv_mutex_lock(&ring->lock);
+	ring->waiting = 1;
+	__sync_synchronize();
+	while(*(volatile unsigned long *)&ring->enqueued == enqueued && ring->stopped == 0) {
+		if(timeout == 0) {
+			uv_cond_wait(&ring->signal, &ring->lock);
+		} else if(uv_cond_timedwait(&ring->signal, &ring->lock, timeout) != 0) {
+			break;
+		}
+	}
+	ring->waiting = 0;
+	r = (*(volatile unsigned long *)&ring->enqueued == enqueued) ? 1 : 0;
+	uv_mutex_unlock(&ring->lock);
+
+	if(ring->stopped == 1) {
+		return -1;
+	}
+	return r;
+}
+
+void dt_ring_stop(struct ring_dt *ring) {
+	uv_mutex_lock(&ring->lock);
+	ring->stopped = 1;
+	uv_cond_broadcast(&ring->signal);
+	uv_mutex_unlock(&ring->lock);
+}
+
+void dt_ring_stats(struct ring_dt *ring, struct ring_stats_dt *stats) {
+	stats->size = ring->size;
+	stats->used = ring->head-ring->tail;
+	stats->enqueued = ring->enqueued;
+	stats->dequeued = ring->dequeued;
+	stats->items = stats->enqueued-stats->dequeued;
+	stats->dropped = ring->dropped;
+	stats->highwater = ring->highwater;
+	stats->maxitems = ring->maxitems;
+}
@@ -0,0 +1,68 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _DATATYPES_RING_T_
+#define _DATATYPES_RING_T_
+
+#include "../../libuv/uv.h"
+
+/*
+ * Fixed capacity ring of variable length slots. A single consumer
+ * reads lock free. With RING_SPSC the producer must be a single
+ * thread (or be serialized by the caller), with RING_MPSC the
+ * producers are serialized by the ring itself.
+ */
+#define RING_SPSC		0
+#define RING_MPSC		1
+
+typedef struct ring_stats_dt {
+	unsigned long size;
+	unsigned long used;
+	unsigned long items;
+	unsigned long enqueued;
+	unsigned long dequeued;
+	unsigned long dropped;
+	unsigned long highwater;
+	unsigned long maxitems;
+} ring_stats_dt;
+
+typedef struct ring_dt {
+	unsigned char *buffer;
+	unsigned long size;
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	unsigned long reserved;
+	int type;
+
+	uv_mutex_t wlock;
+	uv_mutex_t lock;
+	uv_cond_t signal;
+	volatile int waiting;
+	volatile int stopped;
+
+	unsigned long enqueued;
+	unsigned long dequeued;
+	unsigned long dropped;
+	unsigned long highwater;
+	unsigned long maxitems;
+} ring_dt;
+
+struct ring_dt *dt_ring_init(unsigned long, int);
+void dt_ring_free(struct ring_dt *);
+void *dt_ring_reserve(struct ring_dt *, unsigned long);
+void dt_ring_commit(struct ring_dt *);
+void *dt_ring_peek(struct ring_dt *, unsigned long *);
+void *dt_ring_next(struct ring_dt *, void *, unsigned long *);
+void dt_ring_release(struct ring_dt *);
+int dt_ring_wait(struct ring_dt *);
+int dt_ring_timedwait(struct ring_dt *, uint64_t);
+int dt_ring_timedwait_enqueued(struct ring_dt *, unsigned long, uint64_t);
+void dt_ring_stop(struct ring_dt *);
+void dt_ring_stats(struct ring_dt *, struct ring_stats_dt *);
+
+#endif
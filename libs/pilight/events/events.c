@@ -34,6 +34,7 @@
 #include "../core/json.h"
 #include "../core/ssdp.h"
 #include "../core/socket.h"
+#include "../core/metrics.h"
 #include "../datatypes/stack.h"
 
 #include "../lua_c/lua.h"
@@ -1956,9 +1957,18 @@ int event_parse_rule(char *rule, struct rules_t *obj, int depth, unsigned short
 	return -1;
 }
 
+static double events_queue_length(void *param) {
+	return (double)eventsqueue_number;
+}
+
 void *events_loop(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	double bounds[] = { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+	struct metric_t *metric = metrics_histogram("pilight_rule_duration_seconds", NULL,
+		"Time spent evaluating a triggered rule", bounds, sizeof(bounds)/sizeof(bounds[0]));
+	metrics_gauge_callback("pilight_queue_length", "queue=\"events\"", "Number of items waiting in a queue", events_queue_length, NULL);
+
 	if(eventslock_init == 0) {
 		pthread_mutexattr_init(&events_attr);
 		pthread_mutexattr_settype(&events_attr, PTHREAD_MUTEX_RECURSIVE);
@@ -2045,9 +2055,10 @@ void *events_loop(void *param) {
 						}
 #ifndef WIN32
 						clock_gettime(CLOCK_MONOTONIC, &tmp_rules->timestamp.second);
-						logprintf(LOG_DEBUG, "rule #%d %s was parsed in %.6f seconds", tmp_rules->nr, tmp_rules->name,
-							((double)tmp_rules->timestamp.second.tv_sec + 1.0e-9*tmp_rules->timestamp.second.tv_nsec) -
-							((double)tmp_rules->timestamp.first.tv_sec + 1.0e-9*tmp_rules->timestamp.first.tv_nsec));
+						double duration = ((double)tmp_rules->timestamp.second.tv_sec + 1.0e-9*tmp_rules->timestamp.second.tv_nsec) -
+							((double)tmp_rules->timestamp.first.tv_sec + 1.0e-9*tmp_rules->timestamp.first.tv_nsec);
+						logprintf(LOG_DEBUG, "rule #%d %s was parsed in %.6f seconds", tmp_rules->nr, tmp_rules->name, duration);
+						metrics_observe(metric, duration);
 #endif
 						tmp_rules->status = 0;
 					}
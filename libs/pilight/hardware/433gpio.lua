@@ -91,17 +91,16 @@ function M.callback(obj, nr, pulses)
 		return;
 	end
 	local config = pilight.config();
-	local data = config.getData();
 
 	local pulse = 0;
 	local length = 0;
 
-	local minrawlen = lookup(data, 'registry', 'hardware', 'RF433', 'minrawlen') or 0;
-	local maxrawlen = lookup(data, 'registry', 'hardware', 'RF433', 'maxrawlen') or 0;
-	local mingaplen = lookup(data, 'registry', 'hardware', 'RF433', 'mingaplen') or 0;
-	local maxgaplen = lookup(data, 'registry', 'hardware', 'RF433', 'maxgaplen') or 0;
+	local minrawlen = config.getRegistry('hardware.RF433.minrawlen') or 0;
+	local maxrawlen = config.getRegistry('hardware.RF433.maxrawlen') or 0;
+	local mingaplen = config.getRegistry('hardware.RF433.mingaplen') or 0;
+	local maxgaplen = config.getRegistry('hardware.RF433.maxgaplen') or 0;
 
-	data = obj.getUserdata();
+	local data = obj.getUserdata();
 	data['hardware'] = '433gpio';
 
 	if data['pulses'] == nil then
@@ -154,13 +153,14 @@ function M.validate()
 	end
 
 	for x in pairs(settings) do
-		if x ~= 'sender' and x ~= 'receiver' then
+		if x ~= 'sender' and x ~= 'receiver' and x ~= 'gpiochip' then
 			error(x .. "is an unknown parameter")
 		end
 	end
 
 	local receiver = data['hardware']['433gpio']['receiver'];
 	local sender = data['hardware']['433gpio']['sender'];
+	local gpiochip = data['hardware']['433gpio']['gpiochip'];
 
 	if receiver == nil then
 		error("receiver parameter missing");
@@ -197,7 +197,10 @@ function M.validate()
 	if receiver < -1 then
 		error("the receiver parameter cannot be " .. tostring(receiver));
 	end
-	if receiver == sender then
+	if gpiochip ~= nil and type(gpiochip) ~= 'string' then
+		error("the gpiochip parameter must be a string, but a " .. type(gpiochip) .. " was given");
+	end
+	if receiver == sender and gpiochip == nil then
 		error("sender and receiver cannot be the same GPIO");
 	end
 	if sender > -1 then
@@ -208,7 +211,11 @@ function M.validate()
 			error("GPIO #" .. sender .. " cannot be set to output mode");
 		end
 	end
-	if receiver > -1 then
+	if receiver > -1 and gpiochip ~= nil then
+		if obj.ISR(receiver, wiringX.ISR_MODE_BOTH, "callback", 250, gpiochip) == false then
+			error("line #" .. receiver .. " of " .. gpiochip .. " cannot be configured as interrupt");
+		end
+	elseif receiver > -1 then
 		if obj.hasGPIO(receiver) == false then
 			error(receiver .. " is an invalid receiver GPIO");
 		end
@@ -229,6 +236,7 @@ function M.run()
 
 	local receiver = lookup(data, 'hardware', '433gpio', 'receiver') or nil;
 	local sender = lookup(data, 'hardware', '433gpio', 'sender') or nil;
+	local gpiochip = lookup(data, 'hardware', '433gpio', 'gpiochip') or nil;
 
 	if platform == nil or sender == nil or receiver == nil then
 		return;
@@ -236,8 +244,12 @@ function M.run()
 
 	obj = wiringX.setup(platform);
 	obj.pinMode(sender, wiringX.PINMODE_OUTPUT);
-	obj.pinMode(receiver, wiringX.PINMODE_INPUT);
-	obj.ISR(receiver, wiringX.ISR_MODE_BOTH, "callback", 250);
+	if gpiochip ~= nil then
+		obj.ISR(receiver, wiringX.ISR_MODE_BOTH, "callback", 250, gpiochip);
+	else
+		obj.pinMode(receiver, wiringX.PINMODE_INPUT);
+		obj.ISR(receiver, wiringX.ISR_MODE_BOTH, "callback", 250);
+	end
 
 	local event = pilight.async.event();
 	event.register(pilight.reason.SEND_CODE);
@@ -253,7 +265,7 @@ end
 function M.info()
 	return {
 		name = "433gpio",
-		version = "4.1",
+		version = "4.2",
 		reqversion = "7.0",
 		reqcommit = "94"
 	}
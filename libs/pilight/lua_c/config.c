@@ -28,6 +28,8 @@
 #include "../core/log.h"
 #include "../config/config.h"
 #include "config/setting.h"
+#include "config/registry.h"
+#include "../config/snapshot.h"
 #include "config/hardware.h"
 #include "config/device.h"
 #include "async.h"
@@ -70,6 +72,8 @@ static int plua_config_set_data(lua_State *L) {
 			plua_metatable_parse_set(L, table);
 			lua_pop(L, 1);
 		}
+		config_snapshot_publish();
+		config_generation_bump();
 
 		lua_pushboolean(L, 1);
 		assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
@@ -123,6 +127,11 @@ static void plua_config_object(lua_State *L, void *foo) {
 	lua_pushcclosure(L, plua_config_setting, 0);
 	lua_settable(L, -3);
 
+	lua_pushstring(L, "getRegistry");
+	// lua_pushlightuserdata(L, timer);
+	lua_pushcclosure(L, plua_config_registry, 0);
+	lua_settable(L, -3);
+
 	lua_pushstring(L, "getHardware");
 	// lua_pushlightuserdata(L, timer);
 	lua_pushcclosure(L, plua_config_hardware, 0);
@@ -0,0 +1,59 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../../core/log.h"
+#include "../../config/snapshot.h"
+#include "../config.h"
+#include "registry.h"
+
+/*
+ * Reads straight from the registry snapshot, so hot
+ * paths like the hardware callbacks don't have to walk
+ * the shared config data table.
+ */
+int plua_config_registry(lua_State *L) {
+	char buf[128] = { '\0' }, *p = buf;
+	char *error = "string expected, got %s";
+	struct varcont_t val;
+
+	sprintf(p, error, lua_typename(L, lua_type(L, -1)));
+
+	luaL_argcheck(L,
+		(lua_type(L, -1) == LUA_TSTRING),
+		1, buf);
+
+	if(config_snapshot_get("registry", (char *)lua_tostring(L, -1), -1, &val) == 0) {
+		lua_remove(L, -1);
+		switch(val.type_) {
+			case LUA_TSTRING:
+				lua_pushstring(L, val.string_);
+				FREE(val.string_);
+				assert(plua_check_stack(L, 1, PLUA_TSTRING) == 0);
+			break;
+			case LUA_TBOOLEAN:
+				lua_pushboolean(L, val.bool_);
+				assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+			break;
+			default:
+				lua_pushnumber(L, val.number_);
+				assert(plua_check_stack(L, 1, PLUA_TNUMBER) == 0);
+			break;
+		}
+	} else {
+		lua_remove(L, -1);
+		lua_pushnil(L);
+		assert(plua_check_stack(L, 1, PLUA_TNIL) == 0);
+	}
+
+	return 1;
+}
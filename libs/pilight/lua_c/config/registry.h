@@ -0,0 +1,16 @@
+/*
+	Copyright (C) 2013 - 2016 CurlyMo
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _LUA_CONFIG_REGISTRY_H_
+#define _LUA_CONFIG_REGISTRY_H_
+
+#include "../lua.h"
+
+int plua_config_registry(lua_State *L);
+
+#endif
@@ -28,10 +28,41 @@
 #endif
 
 #include "../../core/log.h"
+#include "../../core/eventpool.h"
 #include "../../config/config.h"
+#include "../../config/registry.h"
 #include "../table.h"
 #include "../io.h"
 
+#define SERIAL_CODEC_NONE			0
+#define SERIAL_CODEC_433NANO	1
+
+#define NANO_IDLE			0
+#define NANO_KEY			1
+#define NANO_CODE			2
+#define NANO_PULSES		3
+#define NANO_FIELD		4
+#define NANO_SKIP			5
+
+#define NANO_MAXPULSES	10
+
+/*
+ * The pilight usb nano sends its frames as
+ * c:0102...;p:300,1200,...@ where every digit of
+ * the code is an index in the list of pulses.
+ */
+typedef struct serial_nano_t {
+	int state;
+	int key;
+	int value;
+	int hasvalue;
+	int handshake;
+	int nrcode;
+	int nrpulses;
+	unsigned char code[MAXPULSESTREAMLENGTH/2];
+	int pulses[NANO_MAXPULSES];
+} serial_nano_t;
+
 typedef struct lua_serial_t {
 	PLUA_INTERFACE_FIELDS
 
@@ -61,6 +92,9 @@ typedef struct lua_serial_t {
 	char *file;
 	int fd;
 
+	int codec;
+	struct serial_nano_t nano;
+
 } lua_serial_t;
 
 typedef struct serial_fd_list_t {
@@ -80,6 +114,8 @@ static int mutex_init = 0;
 
 static void plua_io_serial_object(lua_State *L, struct lua_serial_t *serial);
 static int plua_io_serial__open(struct lua_serial_t *serial, lua_State *L);
+static void plua_io_serial__read(struct lua_serial_t *serial);
+static void plua_io_serial__write(struct lua_serial_t *serial, char *content);
 
 /*
  * Remove from list
@@ -372,6 +408,165 @@ static void plua_io_serial_callback(char *type, uv_fs_t *req) {
 	plua_clear_state(state);
 }
 
+static void *plua_io_serial_nano_free(void *param) {
+	plua_metatable_free(param);
+	return NULL;
+}
+
+static void plua_io_serial_nano_frame(struct lua_serial_t *serial) {
+	struct serial_nano_t *nano = &serial->nano;
+	struct plua_metatable_t *table = NULL;
+	char key[32], *hardware = NULL;
+	int i = 0, x = 0;
+
+	if(nano->nrcode == 0 || nano->nrpulses == 0) {
+		return;
+	}
+	for(i=0;i<nano->nrcode;i++) {
+		if(nano->code[i] >= nano->nrpulses) {
+			logprintf(LOG_DEBUG, "serial: %s sent an invalid pulse index", serial->file);
+			return;
+		}
+	}
+
+	if(plua_metatable_get_string(serial->table, "hardware", &hardware) != 0) {
+		hardware = "433nano";
+	}
+
+	plua_metatable_init(&table);
+	plua_metatable_set_string(table, "hardware", hardware);
+	plua_metatable_set_number(table, "length", nano->nrcode*2);
+	for(i=0;i<nano->nrcode;i++) {
+		snprintf(key, sizeof(key), "pulses.%d", ++x);
+		plua_metatable_set_number(table, key, nano->pulses[0]);
+		snprintf(key, sizeof(key), "pulses.%d", ++x);
+		plua_metatable_set_number(table, key, nano->pulses[nano->code[i]]);
+	}
+
+	eventpool_trigger(REASON_RECEIVED_PULSETRAIN+10000, plua_io_serial_nano_free, table);
+}
+
+/*
+ * The nano needs to know which pulse trains it
+ * should forward before it sends anything useful.
+ */
+static void plua_io_serial_nano_handshake(struct lua_serial_t *serial) {
+	char *keys[] = { "hardware.RF433.minrawlen", "hardware.RF433.maxrawlen", "hardware.RF433.maxgaplen" };
+	struct varcont_t val;
+	char content[128];
+	int values[3] = { 0 }, i = 0;
+
+	struct lua_state_t *state = plua_get_free_state();
+	for(i=0;i<3;i++) {
+		memset(&val, 0, sizeof(struct varcont_t));
+		if(config_registry_get(state->L, keys[i], &val) == 0) {
+			if(val.type_ == LUA_TNUMBER) {
+				values[i] = (int)val.number_;
+			} else if(val.type_ == LUA_TSTRING) {
+				FREE(val.string_);
+			}
+		}
+	}
+	assert(plua_check_stack(state->L, 0) == 0);
+	plua_clear_state(state);
+
+	snprintf(content, sizeof(content), "s:%d,%d,%d,%d@", values[0], values[1], 5200, values[2]);
+	plua_io_serial__write(serial, content);
+}
+
+/*
+ * Parses the nano framing as it comes in, so a frame
+ * split over several reads doesn't have to be buffered
+ * as text.
+ */
+static void plua_io_serial_nano_parse(struct lua_serial_t *serial, const char *buffer, int len) {
+	struct serial_nano_t *nano = &serial->nano;
+	int i = 0;
+	char c = 0;
+
+	if(nano->handshake == 0) {
+		nano->handshake = 1;
+		plua_io_serial_nano_handshake(serial);
+	}
+
+	for(i=0;i<len;i++) {
+		c = buffer[i];
+
+		if(c == '@') {
+			if(nano->state == NANO_PULSES && nano->hasvalue == 1) {
+				if(nano->nrpulses < NANO_MAXPULSES) {
+					nano->pulses[nano->nrpulses++] = nano->value;
+				} else {
+					nano->state = NANO_SKIP;
+				}
+			}
+			if(nano->state != NANO_SKIP) {
+				plua_io_serial_nano_frame(serial);
+			}
+			nano->state = NANO_IDLE;
+			nano->nrcode = 0;
+			nano->nrpulses = 0;
+			nano->value = 0;
+			nano->hasvalue = 0;
+			continue;
+		}
+
+		switch(nano->state) {
+			case NANO_IDLE:
+				if(c != '\r' && c != '\n' && c != ';') {
+					nano->key = c;
+					nano->state = NANO_KEY;
+				}
+			break;
+			case NANO_KEY:
+				if(c != ':') {
+					nano->state = NANO_SKIP;
+				} else if(nano->key == 'c') {
+					nano->state = NANO_CODE;
+				} else if(nano->key == 'p') {
+					nano->value = 0;
+					nano->hasvalue = 0;
+					nano->state = NANO_PULSES;
+				} else {
+					nano->state = NANO_FIELD;
+				}
+			break;
+			case NANO_CODE:
+				if(c == ';') {
+					nano->state = NANO_IDLE;
+				} else if(c >= '0' && c <= '9' && nano->nrcode < MAXPULSESTREAMLENGTH/2) {
+					nano->code[nano->nrcode++] = (unsigned char)(c-'0');
+				} else {
+					nano->state = NANO_SKIP;
+				}
+			break;
+			case NANO_PULSES:
+				if(c >= '0' && c <= '9' && nano->value < 1000000) {
+					nano->value = (nano->value*10)+(c-'0');
+					nano->hasvalue = 1;
+				} else if((c == ',' || c == ';') && nano->hasvalue == 1 && nano->nrpulses < NANO_MAXPULSES) {
+					nano->pulses[nano->nrpulses++] = nano->value;
+					nano->value = 0;
+					nano->hasvalue = 0;
+					if(c == ';') {
+						nano->state = NANO_IDLE;
+					}
+				} else {
+					nano->state = NANO_SKIP;
+				}
+			break;
+			case NANO_FIELD:
+				if(c == ';') {
+					nano->state = NANO_IDLE;
+				}
+			break;
+			case NANO_SKIP:
+			default:
+			break;
+		}
+	}
+}
+
 static void plua_io_serial_read_callback(uv_fs_t *req) {
 	struct lua_serial_t *serial = req->data;
 	unsigned int len = req->result;
@@ -399,21 +594,18 @@ static void plua_io_serial_read_callback(uv_fs_t *req) {
 			}
 		}
 		if(serial->stop == 0) {
-			clock_gettime(CLOCK_MONOTONIC, &serial->timestamp.second);
-
-			uv_fs_t *read_req = NULL;
-			if((read_req = MALLOC(sizeof(uv_fs_t))) == NULL) {
-				OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-			}
-
-			read_req->data = serial;
-
-			uv_buf_t buf = uv_buf_init(serial->rbuffer, BUFFER_SIZE);
-			uv_fs_read(uv_default_loop(), read_req, serial->fd, &buf, 1, -1, plua_io_serial_read_callback);
+			plua_io_serial__read(serial);
 		}
 	} else if(len > 0) {
 		serial->rbuffer[req->result] = '\0';
-		plua_io_serial_callback("read", req);
+		if(serial->codec == SERIAL_CODEC_433NANO) {
+			plua_io_serial_nano_parse(serial, serial->rbuffer, len);
+			if(serial->stop == 0) {
+				plua_io_serial__read(serial);
+			}
+		} else {
+			plua_io_serial_callback("read", req);
+		}
 	}
 
 stop:
@@ -519,6 +711,9 @@ static int plua_io_serial__open(struct lua_serial_t *serial, lua_State *L) {
 
 	uv_fs_t open_req;
 
+	/* A reconnected nano expects a new handshake */
+	memset(&serial->nano, 0, sizeof(struct serial_nano_t));
+
 	if((serial->fd = uv_fs_open(uv_default_loop(), &open_req, serial->file, O_RDWR, 0, NULL)) == -1) {
 		logprintf(LOG_ERR, "serial.open: could not open serial device \"%s\"", serial->file);
 		lua_pushboolean(L, 0);
@@ -690,20 +885,92 @@ static int plua_io_serial_write(lua_State *L) {
 	content = (char *)lua_tostring(L, -1);
 	lua_remove(L, -1);
 
-	uv_fs_t *write_req = NULL;
-	if((write_req = MALLOC(sizeof(uv_fs_t))) == NULL) {
-		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	plua_io_serial__write(serial, content);
+
+	lua_pushboolean(L, 1);
+
+	assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+
+	return 1;
+}
+
+/*
+ * Encodes a pulse train in the nano framing in a single
+ * pass, with every distinct pulse sent only once.
+ */
+static int plua_io_serial_write_code(lua_State *L) {
+	struct lua_serial_t *serial = (void *)lua_topointer(L, lua_upvalueindex(1));
+	struct plua_metatable_t *table = NULL;
+	int pulses[NANO_MAXPULSES], nrpulses = 0, len = 0, i = 0, x = 0;
+	double rawlen = 0.0, txrpt = 0.0, pulse = 0.0;
+	char code[BUFFER_SIZE], key[32];
+
+	if(lua_gettop(L) != 1) {
+		pluaL_error(L, "serial.writeCode requires 1 argument, %d given", lua_gettop(L));
 	}
 
-	uv_buf_t wbuf = uv_buf_init(serial->wbuffer, BUFFER_SIZE);
+	if(serial == NULL) {
+		pluaL_error(L, "internal error: serial object not passed");
+	}
 
-	strcpy(wbuf.base, content);
-	wbuf.len = strlen(content);
-	write_req->data = serial;
+	char buf[128] = { '\0' }, *p = buf;
+	char *error = "userdata expected, got %s";
 
-	serial->wrunning = 1;
+	sprintf(p, error, lua_typename(L, lua_type(L, -1)));
 
-	uv_fs_write(uv_default_loop(), write_req, serial->fd, &wbuf, 1, -1, plua_io_serial_write_callback);
+	luaL_argcheck(L,
+		(lua_type(L, -1) == LUA_TLIGHTUSERDATA),
+		1, buf);
+
+	table = (void *)lua_topointer(L, -1);
+	lua_remove(L, -1);
+
+	if(serial->stopping == 1) {
+		lua_pushboolean(L, 0);
+		assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+		return 1;
+	}
+
+	plua_metatable_get_number(table, "rawlen", &rawlen);
+	plua_metatable_get_number(table, "txrpt", &txrpt);
+
+	if((int)rawlen <= 0 || (int)rawlen > sizeof(code)-128) {
+		logprintf(LOG_ERR, "serial.writeCode: invalid pulse train length %d", (int)rawlen);
+		lua_pushboolean(L, 0);
+		assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+		return 1;
+	}
+
+	len = snprintf(code, sizeof(code), "c:");
+	for(i=0;i<(int)rawlen;i++) {
+		snprintf(key, sizeof(key), "pulses.%d", i+1);
+		pulse = 0.0;
+		plua_metatable_get_number(table, key, &pulse);
+
+		for(x=0;x<nrpulses;x++) {
+			if(pulses[x] == (int)pulse) {
+				break;
+			}
+		}
+		if(x == nrpulses) {
+			if(nrpulses == NANO_MAXPULSES) {
+				logprintf(LOG_ERR, "serial.writeCode: more than %d different pulses", NANO_MAXPULSES);
+				lua_pushboolean(L, 0);
+				assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+				return 1;
+			}
+			pulses[nrpulses++] = (int)pulse;
+		}
+		code[len++] = (char)('0'+x);
+	}
+
+	len += snprintf(&code[len], sizeof(code)-len, ";p:");
+	for(x=0;x<nrpulses;x++) {
+		len += snprintf(&code[len], sizeof(code)-len, (x == 0) ? "%d" : ",%d", pulses[x]);
+	}
+	snprintf(&code[len], sizeof(code)-len, ";r:%d@", (int)txrpt);
+
+	plua_io_serial__write(serial, code);
 
 	lua_pushboolean(L, 1);
 
@@ -712,17 +979,64 @@ static int plua_io_serial_write(lua_State *L) {
 	return 1;
 }
 
-static int plua_io_serial_read(lua_State *L) {
+static int plua_io_serial_set_codec(lua_State *L) {
 	struct lua_serial_t *serial = (void *)lua_topointer(L, lua_upvalueindex(1));
+	const char *codec = NULL;
 
-	if(lua_gettop(L) != 0) {
-		pluaL_error(L, "serial.write requires 0 arguments, %d given", lua_gettop(L));
+	if(lua_gettop(L) != 1) {
+		pluaL_error(L, "serial.setCodec requires 1 argument, %d given", lua_gettop(L));
 	}
 
 	if(serial == NULL) {
 		pluaL_error(L, "internal error: serial object not passed");
 	}
 
+	char buf[128] = { '\0' }, *p = buf;
+	char *error = "string expected, got %s";
+
+	sprintf(p, error, lua_typename(L, lua_type(L, -1)));
+
+	luaL_argcheck(L,
+		(lua_type(L, -1) == LUA_TSTRING),
+		1, buf);
+
+	codec = lua_tostring(L, -1);
+
+	if(strcmp(codec, "433nano") == 0) {
+		serial->codec = SERIAL_CODEC_433NANO;
+		memset(&serial->nano, 0, sizeof(struct serial_nano_t));
+	} else if(strcmp(codec, "none") == 0) {
+		serial->codec = SERIAL_CODEC_NONE;
+	} else {
+		pluaL_error(L, "serial.setCodec: \"%s\" is an unsupported codec", codec);
+	}
+	lua_remove(L, -1);
+
+	lua_pushboolean(L, 1);
+
+	assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+
+	return 1;
+}
+
+static void plua_io_serial__write(struct lua_serial_t *serial, char *content) {
+	uv_fs_t *write_req = NULL;
+	if((write_req = MALLOC(sizeof(uv_fs_t))) == NULL) {
+		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+	}
+
+	uv_buf_t wbuf = uv_buf_init(serial->wbuffer, BUFFER_SIZE);
+
+	strncpy(wbuf.base, content, BUFFER_SIZE-1);
+	wbuf.len = strlen(wbuf.base);
+	write_req->data = serial;
+
+	serial->wrunning = 1;
+
+	uv_fs_write(uv_default_loop(), write_req, serial->fd, &wbuf, 1, -1, plua_io_serial_write_callback);
+}
+
+static void plua_io_serial__read(struct lua_serial_t *serial) {
 	uv_fs_t *read_req = NULL;
 	if((read_req = MALLOC(sizeof(uv_fs_t))) == NULL) {
 		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
@@ -732,9 +1046,22 @@ static int plua_io_serial_read(lua_State *L) {
 	clock_gettime(CLOCK_MONOTONIC, &serial->timestamp.second);
 
 	memset(serial->rbuffer, 0, BUFFER_SIZE);
-	uv_buf_t buffer = uv_buf_init(serial->rbuffer, BUFFER_SIZE);
+	uv_buf_t buffer = uv_buf_init(serial->rbuffer, BUFFER_SIZE-1);
 	uv_fs_read(uv_default_loop(), read_req, serial->fd, &buffer, 1, -1, plua_io_serial_read_callback);
+}
+
+static int plua_io_serial_read(lua_State *L) {
+	struct lua_serial_t *serial = (void *)lua_topointer(L, lua_upvalueindex(1));
+
+	if(lua_gettop(L) != 0) {
+		pluaL_error(L, "serial.write requires 0 arguments, %d given", lua_gettop(L));
+	}
+
+	if(serial == NULL) {
+		pluaL_error(L, "internal error: serial object not passed");
+	}
 
+	plua_io_serial__read(serial);
 
 	lua_pushboolean(L, 1);
 
@@ -834,6 +1161,16 @@ static void plua_io_serial_object(lua_State *L, struct lua_serial_t *serial) {
 	lua_pushcclosure(L, plua_io_serial_close, 1);
 	lua_settable(L, -3);
 
+	lua_pushstring(L, "setCodec");
+	lua_pushlightuserdata(L, serial);
+	lua_pushcclosure(L, plua_io_serial_set_codec, 1);
+	lua_settable(L, -3);
+
+	lua_pushstring(L, "writeCode");
+	lua_pushlightuserdata(L, serial);
+	lua_pushcclosure(L, plua_io_serial_write_code, 1);
+	lua_settable(L, -3);
+
 	lua_pushstring(L, "setCallback");
 	lua_pushlightuserdata(L, serial);
 	lua_pushcclosure(L, plua_io_serial_set_callback, 1);
@@ -31,6 +31,7 @@
 #include "../core/json.h"
 #include "../core/mem.h"
 #include "../core/common.h"
+#include "../core/metrics.h"
 #include "table.h"
 
 #ifdef PILIGHT_UNITTEST
@@ -64,9 +65,21 @@ static int init = 0;
  * Last state is a global state for global
  * garbage collection on pilight shutdown.
  */
-static struct lua_state_t lua_state[NRLUASTATES+1];
+static struct lua_state_t lua_state[PLUA_MAXSTATES+1];
+static volatile int nrstates = 0;
+static int maxstates = NRLUASTATES;
+static uv_mutex_t growlock;
+static uv_key_t affinity;
+static struct plua_stats_t stats;
+static struct metric_t *metric_wait = NULL;
 static uv_sem_t sem_used_states;
 static struct plua_module_t *modules = NULL;
+static char *package_path = NULL;
+static struct {
+	char *name;
+	int (*func)(lua_State *L);
+} overrides[8];
+static int nroverrides = 0;
 
 static int plua_metatable_index(lua_State *L, struct plua_metatable_t *node);
 static int plua_metatable_pairs(lua_State *, struct plua_metatable_t *node);
@@ -1537,18 +1550,93 @@ static int plua_metatable___gc(lua_State *L) {
 	return 0;
 }
 
+static struct lua_state_t *plua_state_create(int idx);
+
+static struct lua_state_t *plua_state_acquired(struct lua_state_t *state, uint64_t start) {
+	int busy = __sync_add_and_fetch(&stats.busy, 1), peak = 0;
+
+	uv_key_set(&affinity, (void *)(intptr_t)(state->idx+1));
+	__sync_add_and_fetch(&stats.acquired, 1);
+
+	while((peak = stats.peakbusy) < busy) {
+		if(__sync_bool_compare_and_swap(&stats.peakbusy, peak, busy)) {
+			break;
+		}
+	}
+
+	if(start > 0) {
+		unsigned long waited = (unsigned long)((uv_hrtime()-start)/1000), max = 0;
+		__sync_add_and_fetch(&stats.waits, 1);
+		__sync_add_and_fetch(&stats.waittime, waited);
+		while((max = stats.maxwait) < waited) {
+			if(__sync_bool_compare_and_swap(&stats.maxwait, max, waited)) {
+				break;
+			}
+		}
+		metrics_observe(metric_wait, (double)waited/1000000);
+	}
+
+	return state;
+}
+
+/*
+ * Adds a new state to the pool when all states are busy and
+ * the limit isn't reached yet. The new state is returned
+ * locked so no other thread can take it first.
+ */
+static struct lua_state_t *plua_state_grow(void) {
+	struct lua_state_t *state = NULL;
+
+	if(nrstates >= maxstates) {
+		return NULL;
+	}
+
+	uv_mutex_lock(&growlock);
+	if(nrstates >= maxstates || init == 0) {
+		uv_mutex_unlock(&growlock);
+		return NULL;
+	}
+
+	state = plua_state_create(nrstates);
+	uv_mutex_lock(&state->lock);
+
+	__sync_synchronize();
+	nrstates++;
+	uv_mutex_unlock(&growlock);
+
+	logprintf(LOG_DEBUG, "all lua states busy, added lua state #%d", state->idx+1);
+
+	return state;
+}
+
 struct lua_state_t *plua_get_free_state(void) {
+	struct lua_state_t *state = NULL;
+	intptr_t last = (intptr_t)uv_key_get(&affinity);
+	uint64_t start = 0;
 	int i = 0;
-	int error = 0;
+
+	/*
+	 * Prefer the state this thread used last, its
+	 * caches and allocations are probably still warm.
+	 */
+	if(last > 0 && last <= nrstates) {
+		if(uv_mutex_trylock(&lua_state[last-1].lock) == 0) {
+			__sync_add_and_fetch(&stats.affinity, 1);
+			return plua_state_acquired(&lua_state[last-1], 0);
+		}
+	}
 
 	while(1) {
-		for(i=0;i<NRLUASTATES;i++) {
+		for(i=0;i<nrstates;i++) {
 			if(uv_mutex_trylock(&lua_state[i].lock) == 0) {
-				return &lua_state[i];
+				return plua_state_acquired(&lua_state[i], start);
 			}
 		}
-		if(error == 0) {
-			error = 1;
+		if((state = plua_state_grow()) != NULL) {
+			return plua_state_acquired(state, start);
+		}
+		if(start == 0) {
+			start = uv_hrtime();
 			logprintf(LOG_DEBUG, "waiting free lua state to become available");
 		}
 		uv_sem_wait(&sem_used_states);
@@ -1558,7 +1646,7 @@ struct lua_state_t *plua_get_free_state(void) {
 
 struct lua_state_t *plua_get_current_state(lua_State *L) {
 	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
+	for(i=0;i<PLUA_MAXSTATES;i++) {
 		if(lua_state[i].L == L) {
 			return &lua_state[i];
 		}
@@ -1566,6 +1654,24 @@ struct lua_state_t *plua_get_current_state(lua_State *L) {
 	return NULL;
 }
 
+void plua_set_max_states(int max) {
+	if(max < NRLUASTATES) {
+		max = NRLUASTATES;
+	}
+	if(max > PLUA_MAXSTATES) {
+		max = PLUA_MAXSTATES;
+	}
+	uv_mutex_lock(&growlock);
+	maxstates = max;
+	uv_mutex_unlock(&growlock);
+}
+
+void plua_get_stats(struct plua_stats_t *out) {
+	memcpy(out, &stats, sizeof(struct plua_stats_t));
+	out->states = nrstates;
+	out->maxstates = maxstates;
+}
+
 void _plua_clear_state(struct lua_state_t *state, char *file, int line) {
 	int i = 0;
 	uv_mutex_lock(&state->gc.lock);
@@ -1593,6 +1699,7 @@ void _plua_clear_state(struct lua_state_t *state, char *file, int line) {
 		assert(plua_check_stack(state->L, 0) == 0);
 	}
 
+	__sync_sub_and_fetch(&stats.busy, 1);
 	uv_mutex_unlock(&state->lock);
 	uv_sem_post(&sem_used_states);
 }
@@ -2017,17 +2124,20 @@ void plua_module_load(char *file, int type) {
 	assert(lua_type(L, -1) == LUA_TTABLE);
 	lua_setglobal(L, name);
 
-	for(i=1;i<NRLUASTATES;i++) {
+	uv_mutex_lock(&growlock);
+	for(i=1;i<nrstates;i++) {
 		lua_State *L = lua_state[i].L;
 		luaL_loadbuffer(L, module->bytecode, module->size, module->name);
 		assert(plua_check_stack(L, 1, PLUA_TFUNCTION) == 0);
 		if(plua_pcall(L, module->file, 0, LUA_MULTRET) == -1) {
 			assert(plua_check_stack(L, 0) == 0);
+			uv_mutex_unlock(&growlock);
 			return;
 		}
 		assert(plua_check_stack(L, 1, PLUA_TTABLE) == 0);
 		lua_setglobal(L, name);
 	}
+	uv_mutex_unlock(&growlock);
 
 	lua_getglobal(L, name);
 	if(lua_type(L, -1) == LUA_TNIL) {
@@ -2091,7 +2201,7 @@ void plua_module_load(char *file, int type) {
 #endif
 	lua_pop(L, -1);
 
-	for(i=0;i<NRLUASTATES;i++) {
+	for(i=0;i<nrstates;i++) {
 		assert(plua_check_stack(lua_state[i].L, 0) == 0);
 	}
 }
@@ -2275,45 +2385,110 @@ void plua_set_file_line(lua_State *L, char *file, int line) {
 	state->file = file;
 }
 
+/*
+ * Creates a new state in slot idx with all libraries,
+ * overridden globals, package paths and already loaded
+ * modules, so it behaves like the states created on
+ * startup.
+ */
+static struct lua_state_t *plua_state_create(int idx) {
+	struct lua_state_t *state = &lua_state[idx];
+	struct plua_module_t *tmp = modules;
+	char name[512] = { '\0' };
+	int i = 0;
+
+	lua_State *L = luaL_newstate();
+
+	luaL_openlibs(L);
+	plua_register_library(L);
+	state->L = L;
+	state->idx = idx;
+	state->file = NULL;
+	state->line = -1;
+
+	lua_atpanic(L, &plua_atpanic);
+#ifdef PILIGHT_UNITTEST
+	lua_sethook(L, hook, LUA_MASKLINE, 0);
+#endif
+
+	for(i=0;i<nroverrides;i++) {
+		lua_getglobal(L, "_G");
+		lua_pushcfunction(L, overrides[i].func);
+		lua_setfield(L, -2, overrides[i].name);
+		lua_remove(L, -1);
+	}
+
+	if(package_path != NULL) {
+		lua_getglobal(L, "package");
+		lua_pushstring(L, package_path);
+		lua_setfield(L, -2, "path");
+		lua_pop(L, 1);
+	}
+
+	while(tmp) {
+		memset(name, '\0', sizeof(name));
+		if(plua_namespace(tmp, name) == 0) {
+			luaL_loadbuffer(L, tmp->bytecode, tmp->size, tmp->name);
+			if(plua_pcall(L, tmp->file, 0, 1) == 0 && lua_type(L, -1) == LUA_TTABLE) {
+				lua_setglobal(L, name);
+			} else {
+				lua_settop(L, 0);
+			}
+		}
+		tmp = tmp->next;
+	}
+
+	assert(plua_check_stack(L, 0) == 0);
+
+	return state;
+}
+
+static double plua_metric_states(void *param) {
+	return (double)nrstates;
+}
+
+static double plua_metric_busy(void *param) {
+	return (double)stats.busy;
+}
+
 void plua_init(void) {
+	static int once = 0;
+
 	if(init == 1) {
 		return;
 	}
 	init = 1;
 
+	if(once == 0) {
+		once = 1;
+		uv_mutex_init(&growlock);
+		uv_key_create(&affinity);
+	}
+
 	uv_sem_init(&sem_used_states, 0);
+	memset(&stats, 0, sizeof(struct plua_stats_t));
+
+	double bounds[] = { 0.0001, 0.001, 0.01, 0.1, 1 };
+	metric_wait = metrics_histogram("pilight_lua_state_wait_seconds", NULL,
+		"Time spent waiting for a free Lua state", bounds, sizeof(bounds)/sizeof(bounds[0]));
+	metrics_gauge_callback("pilight_lua_states", NULL, "Number of Lua states in the pool", plua_metric_states, NULL);
+	metrics_gauge_callback("pilight_lua_states_busy", NULL, "Number of Lua states in use", plua_metric_busy, NULL);
 
 	int i = 0;
-	for(i=0;i<NRLUASTATES+1;i++) {
+	for(i=0;i<PLUA_MAXSTATES+1;i++) {
 		memset(&lua_state[i], 0, sizeof(struct lua_state_t));
 		uv_mutex_init(&lua_state[i].lock);
 		uv_mutex_init(&lua_state[i].gc.lock);
+	}
 
-		lua_State *L = luaL_newstate();
-
-		luaL_openlibs(L);
-		plua_register_library(L);
-		lua_state[i].L = L;
-		lua_state[i].idx = i;
-		lua_state[i].file = NULL;
-		lua_state[i].line = -1;
-
-		lua_atpanic(L, &plua_atpanic);
-#ifdef PILIGHT_UNITTEST
-		lua_sethook(L, hook, LUA_MASKLINE, 0);
-#endif
+	for(i=0;i<NRLUASTATES;i++) {
+		plua_state_create(i);
 	}
+	nrstates = NRLUASTATES;
 
 	plua_override_global("pairs", luaB_pairs);
 	plua_override_global("ipairs", luaB_ipairs);
 	plua_override_global("next", luaB_next);
-
-	/*
-	 * Initialize global state garbage collector
-	 */
-	i--;
-	memset(&lua_state[i], 0, sizeof(struct lua_state_t));
-	uv_mutex_init(&lua_state[i].gc.lock);
 }
 
 int plua_module_exists(char *module, int type) {
@@ -2363,7 +2538,7 @@ void plua_gc_unreg(lua_State *L, void *ptr) {
 	struct lua_state_t *state = NULL;
 
 	if(L == NULL) {
-		state = &lua_state[NRLUASTATES];
+		state = &lua_state[PLUA_MAXSTATES];
 	} else {
 		state = plua_get_current_state(L);
 	}
@@ -2388,7 +2563,7 @@ void plua_gc_reg(lua_State *L, void *ptr, void (*callback)(void *ptr)) {
 	struct lua_state_t *state = NULL;
 
 	if(L == NULL) {
-		state = &lua_state[NRLUASTATES];
+		state = &lua_state[PLUA_MAXSTATES];
 	} else {
 		state = plua_get_current_state(L);
 	}
@@ -2483,7 +2658,22 @@ int plua_check_stack(lua_State *L, int numargs, ...) {
 //#ifdef PILIGHT_UNITTEST
 void plua_override_global(char *name, int (*func)(lua_State *L)) {
 	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
+
+	uv_mutex_lock(&growlock);
+	for(i=0;i<nroverrides;i++) {
+		if(strcmp(overrides[i].name, name) == 0) {
+			break;
+		}
+	}
+	if(i < (int)(sizeof(overrides)/sizeof(overrides[0]))) {
+		overrides[i].name = name;
+		overrides[i].func = func;
+		if(i == nroverrides) {
+			nroverrides++;
+		}
+	}
+
+	for(i=0;i<nrstates;i++) {
 		uv_mutex_lock(&lua_state[i].lock);
 
 		lua_getglobal(lua_state[i].L, "_G");
@@ -2495,6 +2685,7 @@ void plua_override_global(char *name, int (*func)(lua_State *L)) {
 
 		uv_mutex_unlock(&lua_state[i].lock);
 	}
+	uv_mutex_unlock(&growlock);
 }
 //#endif
 
@@ -2806,7 +2997,7 @@ int plua_gc(void) {
 	int i = 0, x = 0, _free = 1;
 	while(_free) {
 		_free = 0;
-		for(i=0;i<NRLUASTATES+1;i++) {
+		for(i=0;i<PLUA_MAXSTATES+1;i++) {
 			if(uv_mutex_trylock(&lua_state[i].lock) == 0) {
 				for(x=0;x<lua_state[i].gc.nr;x++) {
 					if(lua_state[i].gc.list[x]->free == 0) {
@@ -2832,7 +3023,16 @@ int plua_gc(void) {
 		}
 	}
 
+	uv_mutex_lock(&growlock);
+	nrstates = 0;
+	nroverrides = 0;
+	if(package_path != NULL) {
+		FREE(package_path);
+		package_path = NULL;
+	}
 	init = 0;
+	uv_mutex_unlock(&growlock);
+
 	logprintf(LOG_DEBUG, "garbage collected lua library");
 	return 0;
 }
@@ -2916,7 +3116,8 @@ int plua_flush_coverage(void) {
 
 void plua_package_path(const char *path) {
 	int i = 0;
-	for(i=0;i<NRLUASTATES;i++) {
+	uv_mutex_lock(&growlock);
+	for(i=0;i<nrstates;i++) {
 		lua_getglobal(lua_state[i].L, "package");
 		lua_getfield(lua_state[i].L, -1, "path");
 		const char *tmp = lua_tostring(lua_state[i].L, -1);
@@ -2932,6 +3133,19 @@ void plua_package_path(const char *path) {
 
 		lua_pop(lua_state[i].L, 1);
 		assert(plua_check_stack(lua_state[i].L, 0) == 0);
-		FREE(newpath);
+
+		/*
+		 * Remember the full path for states
+		 * that are added later on.
+		 */
+		if(i == 0) {
+			if(package_path != NULL) {
+				FREE(package_path);
+			}
+			package_path = newpath;
+		} else {
+			FREE(newpath);
+		}
 	}
+	uv_mutex_unlock(&growlock);
 }
@@ -17,7 +17,13 @@
 
 #include "../libs/pilight/core/common.h"
 
+/*
+ * NRLUASTATES are created on startup, more are added
+ * on demand up to the lua-states setting, which can
+ * never exceed PLUA_MAXSTATES.
+ */
 #define NRLUASTATES	4
+#define PLUA_MAXSTATES	16
 
 #define UNITTEST	0
 #define OPERATOR	1
@@ -46,7 +52,7 @@ typedef struct plua_metatable_t {
 		uv_mutex_t lock;
 	} *table;
 	int nrvar;
-	int iter[NRLUASTATES];
+	int iter[PLUA_MAXSTATES];
 
 	uv_mutex_t lock;
 	uv_sem_t *ref;
@@ -103,6 +109,18 @@ typedef struct plua_interface_t {
   PLUA_INTERFACE_FIELDS
 } plua_interface_t;
 
+typedef struct plua_stats_t {
+	int states;
+	int maxstates;
+	int busy;
+	int peakbusy;
+	unsigned long acquired;
+	unsigned long affinity;
+	unsigned long waits;
+	unsigned long waittime;
+	unsigned long maxwait;
+} plua_stats_t;
+
 void plua_set_file_line(lua_State *L, char *file, int line);
 void plua_metatable_to_json(struct plua_metatable_t *table, struct JsonNode **jnode);
 int plua_json_to_table(struct plua_metatable_t *table, struct JsonNode *jnode);
@@ -124,6 +142,8 @@ void _plua_clear_state(struct lua_state_t *state, char *file, int line);
 struct lua_state_t *plua_get_current_state(lua_State *L);
 struct plua_module_t *plua_get_modules(void);
 void plua_init(void);
+void plua_set_max_states(int max);
+void plua_get_stats(struct plua_stats_t *stats);
 int plua_check_stack(lua_State *L, int numargs, ...);
 #ifdef PILIGHT_UNITTEST
 void plua_pause_coverage(int status);
@@ -30,6 +30,9 @@
 #include "lua.h"
 #include "table.h"
 #include "../core/log.h"
+#include "../core/metrics.h"
+#include "../core/gpioevent.h"
+#include "../config/registry.h"
 
 struct lua_wiringx_t;
 
@@ -44,14 +47,13 @@ typedef struct lua_wiringx_gpio_t {
 		unsigned long second;
 	} timestamp;
 
-	struct {
-		int rbuffer[2][WIRINGX_BUFFER];
-		int idx;
-		int rptr;
-	} data;
+	/* Index 0 is never passed as a pulse */
+	int pulses[WIRINGX_BUFFER+1];
 
 	uv_poll_t *poll_req;
 	uv_timer_t *timer_req;
+	uv_async_t *async_req;
+	struct gpioevent_t *event;
 	char *callback;
 } lua_wiringx_gpio_t;
 
@@ -93,11 +95,34 @@ static struct lua_wiringx_gpio_t *plua_wiringx_get_gpio_struct(struct lua_wiring
 	return wiringx->gpio[i];
 }
 
+static void plua_wiringx_close_cb(uv_handle_t *handle) {
+	FREE(handle);
+}
+
 static void plua_wiringx_gc(void *ptr) {
 	struct lua_wiringx_t **data = ptr;
 	int i = 0, x = 0;
 	for(x=0;x<nrinits;x++) {
 		for(i=0;i<data[x]->nrgpio;i++) {
+			/*
+			 * The handles point to the gpio struct freed below,
+			 * the capture thread is stopped before its async
+			 * handle is closed.
+			 */
+			if(data[x]->gpio[i]->event != NULL) {
+				gpioevent_close(data[x]->gpio[i]->event);
+			}
+			if(data[x]->gpio[i]->async_req != NULL) {
+				uv_close((uv_handle_t *)data[x]->gpio[i]->async_req, plua_wiringx_close_cb);
+			}
+			if(data[x]->gpio[i]->timer_req != NULL) {
+				uv_timer_stop(data[x]->gpio[i]->timer_req);
+				uv_close((uv_handle_t *)data[x]->gpio[i]->timer_req, plua_wiringx_close_cb);
+			}
+			if(data[x]->gpio[i]->poll_req != NULL) {
+				uv_poll_stop(data[x]->gpio[i]->poll_req);
+				uv_close((uv_handle_t *)data[x]->gpio[i]->poll_req, plua_wiringx_close_cb);
+			}
 			if(data[x]->gpio[i]->callback != NULL) {
 				FREE(data[x]->gpio[i]->callback);
 			}
@@ -392,6 +417,14 @@ int plua_wiringx_pin_mode(struct lua_State *L) {
 	if(tmp->poll_req != NULL) {
 		uv_poll_stop(tmp->poll_req);
 	}
+	if(tmp->event != NULL) {
+		gpioevent_close(tmp->event);
+		tmp->event = NULL;
+	}
+	if(tmp->async_req != NULL) {
+		uv_close((uv_handle_t *)tmp->async_req, plua_wiringx_close_cb);
+		tmp->async_req = NULL;
+	}
 	if(tmp->callback != NULL) {
 		FREE(tmp->callback);
 	}
@@ -415,17 +448,7 @@ int plua_wiringx_pin_mode(struct lua_State *L) {
 	return 1;
 }
 
-static void plua_wiringx_poll_timer(uv_timer_t *req) {
-	struct lua_wiringx_gpio_t *data = req->data;
-	int nr = data->data.rptr, idx = data->data.idx;
-
-	if(nr == 1) {
-		return;
-	}
-
-	data->data.idx ^= 1;
-	data->data.rptr = 1;
-
+static void plua_wiringx_callback(struct lua_wiringx_gpio_t *data, int nr) {
 	char name[255], *p = name;
 	memset(name, '\0', 255);
 
@@ -465,7 +488,7 @@ static void plua_wiringx_poll_timer(uv_timer_t *req) {
 	int i = 0;
 	for(i=0;i<nr;i++) {
 		lua_pushnumber(state->L, i);
-		lua_pushnumber(state->L, data->data.rbuffer[idx][i]);
+		lua_pushnumber(state->L, data->pulses[i]);
 		lua_settable(state->L, -3);
 	}
 
@@ -485,6 +508,44 @@ static void plua_wiringx_poll_timer(uv_timer_t *req) {
 	return;
 }
 
+/*
+ * Every frame is passed to the callback on its own,
+ * so a frame ended by a gap is decoded right away
+ * instead of on the next timer tick.
+ */
+static void plua_wiringx_flush(struct lua_wiringx_gpio_t *data) {
+	int nr = 0;
+
+	if(data->event == NULL || data->callback == NULL) {
+		return;
+	}
+
+	while((nr = gpioevent_read(data->event, &data->pulses[1], WIRINGX_BUFFER)) > 0) {
+		plua_wiringx_callback(data, nr+1);
+	}
+}
+
+static void plua_wiringx_poll_timer(uv_timer_t *req) {
+	struct lua_wiringx_gpio_t *data = req->data;
+
+	/*
+	 * The sysfs edges are pushed from this loop as well,
+	 * so the partial frame can be committed from here.
+	 */
+	if(data->event != NULL && data->event->running == 0) {
+		gpioevent_commit(data->event);
+	}
+	plua_wiringx_flush(data);
+}
+
+static void plua_wiringx_async_cb(uv_async_t *req) {
+	plua_wiringx_flush(req->data);
+}
+
+static void plua_wiringx_notify(void *userdata) {
+	uv_async_send(userdata);
+}
+
 static void plua_wiringx_poll_cb(uv_poll_t *req, int status, int events) {
 	struct lua_wiringx_gpio_t *data = req->data;
 
@@ -507,12 +568,7 @@ static void plua_wiringx_poll_cb(uv_poll_t *req, int status, int events) {
 		data->timestamp.second = 1000000 * (unsigned int)tv.tv_sec + (unsigned int)tv.tv_usec;
 
 		int duration = (int)((int)data->timestamp.second-(int)data->timestamp.first);
-		data->data.rbuffer[data->data.idx][data->data.rptr++] = duration;
-
-		if(data->data.rptr > (WIRINGX_BUFFER-1)) {
-			logprintf(LOG_NOTICE, "433gpio pulse buffer full");
-			data->data.rptr = 0;
-		}
+		gpioevent_push(data->event, &duration, 1);
 	}
 
 	return;
@@ -531,11 +587,13 @@ static int plua_wiringx_isr(struct lua_State *L) {
 #endif
 
 	struct lua_wiringx_t *wiringx = (void *)lua_topointer(L, lua_upvalueindex(1));
-	char *func = NULL, name[255] = { '\0' };
-	int gpio = -1, mode = -1, interval = 250;
+	struct varcont_t val;
+	char *func = NULL, *chip = NULL, name[255] = { '\0' }, labels[32];
+	int gpio = -1, mode = -1, interval = 250, gap = 0;
+	struct metric_t *frames = NULL, *overruns = NULL;
 
-	if(lua_gettop(L) != 3 && lua_gettop(L) != 4) {
-		pluaL_error(L, "wiringx.ISR requires 3 or 4 arguments, %d given", lua_gettop(L));
+	if(lua_gettop(L) < 3 || lua_gettop(L) > 5) {
+		pluaL_error(L, "wiringx.ISR requires 3 to 5 arguments, %d given", lua_gettop(L));
 	}
 
 	if(wiringx == NULL) {
@@ -606,7 +664,7 @@ static int plua_wiringx_isr(struct lua_State *L) {
 			lua_remove(L, -1);
 		}
 
-		if(lua_gettop(L) == 1) 	{
+		if(lua_gettop(L) >= 1) 	{
 			char buf[128] = { '\0' }, *p = buf;
 			char *error = "number expected, got %s";
 			sprintf(p, error, lua_typename(L, lua_type(L, 1)));
@@ -621,17 +679,93 @@ static int plua_wiringx_isr(struct lua_State *L) {
 			}
 		}
 
+		/*
+		 * With a gpio chip the gpio is the line offset on
+		 * that chip and the edges are read from the character
+		 * device instead of through wiringX.
+		 */
+		if(lua_gettop(L) == 1) 	{
+			char buf[128] = { '\0' }, *p = buf;
+			char *error = "string expected, got %s";
+			sprintf(p, error, lua_typename(L, lua_type(L, 1)));
+
+			luaL_argcheck(L,
+				(lua_type(L, 1) == LUA_TSTRING),
+				1, buf);
+
+			if(lua_type(L, 1) == LUA_TSTRING) {
+				chip = (void *)lua_tostring(L, 1);
+			}
+		}
+
 		if(gpio >= 0) {
 			struct lua_wiringx_gpio_t *tmp = plua_wiringx_get_gpio_struct(wiringx, gpio);
 
-			if(wiringXISR(gpio, mode) < 0) {
+			if(tmp->event != NULL) {
+				gpioevent_close(tmp->event);
+				tmp->event = NULL;
+			}
+
+			/*
+			 * A pulse longer than the shortest footer ends a
+			 * frame and wakes up the callback. Without it, the
+			 * frames are only passed on every interval.
+			 */
+			memset(&val, 0, sizeof(struct varcont_t));
+			if(config_registry_get(NULL, "hardware.RF433.mingaplen", &val) == 0) {
+				if(val.type_ == LUA_TNUMBER) {
+					gap = (int)val.number_;
+				} else if(val.type_ == LUA_TSTRING) {
+					FREE(val.string_);
+				}
+			}
+
+			/* Registered before the capture thread can count anything */
+			snprintf(labels, sizeof(labels), "gpio=\"%d\"", gpio);
+			frames = metrics_counter("pilight_gpio_frames_total", labels,
+				"Pulse trains captured on a GPIO");
+			overruns = metrics_counter("pilight_gpio_overruns_total", labels,
+				"Pulse trains dropped because the receiver didn't keep up");
+
+			if(chip != NULL) {
+				int edges = GPIOEVENT_BOTH;
+				if(mode == ISR_MODE_RISING) {
+					edges = GPIOEVENT_RISING;
+				} else if(mode == ISR_MODE_FALLING) {
+					edges = GPIOEVENT_FALLING;
+				}
 				/*
-				 * FIXME
+				 * The line offset isn't a wiringX pin number,
+				 * so there is nothing to fall back to.
 				 */
-				// log
+				if((tmp->event = gpioevent_open(chip, gpio, edges, gap, frames, overruns)) == NULL) {
+					logprintf(LOG_ERR, "cannot receive on line #%d of %s", gpio, chip);
+				}
+			} else if(wiringXISR(gpio, mode) < 0) {
+				logprintf(LOG_ERR, "cannot receive on GPIO #%d", gpio);
+			} else {
+				tmp->event = gpioevent_init(gap, frames, overruns);
 			}
 
-			int fd = wiringXSelectableFd(gpio);
+			if(tmp->event == NULL) {
+				if(chip != NULL) {
+					lua_remove(L, 1);
+				}
+				lua_pushboolean(L, 0);
+
+				assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+
+				return 1;
+			}
+
+			if(tmp->async_req == NULL) {
+				if((tmp->async_req = MALLOC(sizeof(uv_async_t))) == NULL) {
+					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+				}
+				uv_async_init(uv_default_loop(), tmp->async_req, plua_wiringx_async_cb);
+			}
+			tmp->async_req->data = tmp;
+			gpioevent_notify(tmp->event, plua_wiringx_notify, tmp->async_req);
 
 			if(tmp->timer_req != NULL) {
 				uv_timer_stop(tmp->timer_req);
@@ -644,24 +778,26 @@ static int plua_wiringx_isr(struct lua_State *L) {
 
 			if(tmp->poll_req != NULL) {
 				uv_poll_stop(tmp->poll_req);
-			} else {
+			} else if(tmp->event->running == 0) {
 				if((tmp->poll_req = MALLOC(sizeof(uv_poll_t))) == NULL) {
 					OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
 				}
-				uv_poll_init(uv_default_loop(), tmp->poll_req, fd);
+				uv_poll_init(uv_default_loop(), tmp->poll_req, wiringXSelectableFd(gpio));
 			}
 
 			tmp->gpio = gpio;
 			tmp->mode = mode;
 			tmp->parent = wiringx;
 
-			tmp->poll_req->data = tmp;
+			if(tmp->event->running == 0) {
+				tmp->poll_req->data = tmp;
 
 #ifdef PILIGHT_UNITTEST
-			uv_poll_start(tmp->poll_req, UV_READABLE, plua_wiringx_poll_cb);
+				uv_poll_start(tmp->poll_req, UV_READABLE, plua_wiringx_poll_cb);
 #else
-			uv_poll_start(tmp->poll_req, UV_PRIORITIZED, plua_wiringx_poll_cb);
+				uv_poll_start(tmp->poll_req, UV_PRIORITIZED, plua_wiringx_poll_cb);
 #endif
+			}
 
 			if(tmp->callback == NULL || (tmp->callback != NULL && strcmp(tmp->callback, func) != 0)) {
 				if(tmp->callback != NULL) {
@@ -674,11 +810,17 @@ static int plua_wiringx_isr(struct lua_State *L) {
 			tmp->timer_req->data = tmp;
 			uv_timer_start(tmp->timer_req, (void (*)(uv_timer_t *))plua_wiringx_poll_timer, interval, interval);
 		}
+
+		if(chip != NULL) {
+			lua_remove(L, 1);
+		}
 	}
 
-	assert(plua_check_stack(L, 0) == 0);
+	lua_pushboolean(L, (gpio >= 0));
 
-	return 0;
+	assert(plua_check_stack(L, 1, PLUA_TBOOLEAN) == 0);
+
+	return 1;
 }
 
 static void plua_wiringx_object(lua_State *L, struct lua_wiringx_t *wiringx) {
@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "arctech_contact.h"
 
@@ -38,16 +39,19 @@
 #define MAX_RAW_LENGTH		148
 #define RAW_LENGTH				148
 
-static int validate(void) {
-	if(arctech_contact->rawlen == MIN_RAW_LENGTH || arctech_contact->rawlen == MAX_RAW_LENGTH) {
-		if(arctech_contact->raw[arctech_contact->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   arctech_contact->raw[arctech_contact->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV) &&
-			 arctech_contact->raw[1] >= AVG_PULSE_LENGTH*(PULSE_MULTIPLIER*2)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { MIN_RAW_LENGTH, MAX_RAW_LENGTH },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = 1,
+	.minstart = AVG_PULSE_LENGTH*(PULSE_MULTIPLIER*2),
+	.offset = 3,
+	.stride = 4,
+	.threshold = AVG_PULSE_LENGTH*PULSE_MULTIPLIER
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, arctech_contact->raw, arctech_contact->rawlen);
 }
 
 static void createMessage(int id, int unit, int state, int all) {
@@ -67,25 +71,19 @@ static void createMessage(int id, int unit, int state, int all) {
 }
 
 static void parseCode(void) {
-	int binary[MAX_RAW_LENGTH/4], x = 0, i = 0;
+	uint64_t binary = 0;
 
 	if(arctech_contact->rawlen>MAX_RAW_LENGTH) {
 		logprintf(LOG_ERR, "arctech_contact: parsecode - invalid parameter passed %d", arctech_contact->rawlen);
 		return;
 	}
 
-	for(x=0;x<arctech_contact->rawlen;x+=4) {
-		if(arctech_contact->raw[x+3] > AVG_PULSE_LENGTH*PULSE_MULTIPLIER) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, arctech_contact->raw, arctech_contact->rawlen, &binary);
 
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int unit = (int)bitslicer_field_rev(binary, 28, 31);
+	int state = bitslicer_bit(binary, 27);
+	int all = bitslicer_bit(binary, 26);
+	int id = (int)bitslicer_field_rev(binary, 0, 25);
 
 	createMessage(id, unit, state, all);
 }
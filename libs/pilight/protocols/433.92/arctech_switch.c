@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "arctech_switch.h"
 
@@ -38,16 +39,19 @@
 #define AVG_PULSE_LENGTH	315
 #define RAW_LENGTH				132
 
-static int validate(void) {
-	if(arctech_switch->rawlen == RAW_LENGTH) {
-		if(arctech_switch->raw[arctech_switch->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   arctech_switch->raw[arctech_switch->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV) &&
-			 arctech_switch->raw[1] >= AVG_PULSE_LENGTH*(PULSE_MULTIPLIER*1.5)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { RAW_LENGTH, 0 },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = 1,
+	.minstart = (int)(AVG_PULSE_LENGTH*(PULSE_MULTIPLIER*1.5)),
+	.offset = 3,
+	.stride = 4,
+	.threshold = (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, arctech_switch->raw, arctech_switch->rawlen);
 }
 
 static void createMessage(int id, int unit, int state, int all, int learn) {
@@ -75,25 +79,19 @@ static void createMessage(int id, int unit, int state, int all, int learn) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	uint64_t binary = 0;
 
 	if(arctech_switch->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "arctech_switch: parsecode - invalid parameter passed %d", arctech_switch->rawlen);
 		return;
 	}
 
-	for(x=0;x<arctech_switch->rawlen;x+=4) {
-		if(arctech_switch->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, arctech_switch->raw, arctech_switch->rawlen, &binary);
 
-	int unit = binToDecRev(binary, 28, 31);
-	int state = binary[27];
-	int all = binary[26];
-	int id = binToDecRev(binary, 0, 25);
+	int unit = (int)bitslicer_field_rev(binary, 28, 31);
+	int state = bitslicer_bit(binary, 27);
+	int all = bitslicer_bit(binary, 26);
+	int id = (int)bitslicer_field_rev(binary, 0, 25);
 
 	createMessage(id, unit, state, all, 0);
 }
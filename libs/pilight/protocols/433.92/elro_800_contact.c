@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "elro_800_contact.h"
 
@@ -36,15 +37,19 @@
 #define AVG_PULSE_LENGTH	300
 #define RAW_LENGTH				50
 
-static int validate(void) {
-	if(elro_800_contact->rawlen == RAW_LENGTH) {
-		if(elro_800_contact->raw[elro_800_contact->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   elro_800_contact->raw[elro_800_contact->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { RAW_LENGTH, 0 },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = -1,
+	.minstart = 0,
+	.offset = 3,
+	.stride = 4,
+	.threshold = (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, elro_800_contact->raw, elro_800_contact->rawlen);
 }
 
 static void createMessage(int systemcode, int unitcode, int state) {
@@ -59,24 +64,18 @@ static void createMessage(int systemcode, int unitcode, int state) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	uint64_t binary = 0;
 
 	if(elro_800_contact->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "elro_800_contact: parsecode - invalid parameter passed %d", elro_800_contact->rawlen);
 		return;
 	}
 
-	for(x=0;x<elro_800_contact->rawlen-2;x+=4) {
-		if(elro_800_contact->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, elro_800_contact->raw, elro_800_contact->rawlen, &binary);
 
-	int systemcode = binToDec(binary, 0, 4);
-	int unitcode = binToDec(binary, 5, 9);
-	int state = binary[11];
+	int systemcode = (int)bitslicer_field(binary, 0, 4);
+	int unitcode = (int)bitslicer_field(binary, 5, 9);
+	int state = bitslicer_bit(binary, 11);
 	createMessage(systemcode, unitcode, state);
 }
 
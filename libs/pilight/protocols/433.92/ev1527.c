@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "ev1527.h"
 
@@ -36,15 +37,19 @@
 #define AVG_PULSE_LENGTH	256
 #define RAW_LENGTH				50
 
-static int validate(void) {
-	if(ev1527->rawlen == RAW_LENGTH) {
-		if(ev1527->raw[ev1527->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   ev1527->raw[ev1527->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { RAW_LENGTH, 0 },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = -1,
+	.minstart = 0,
+	.offset = 3,
+	.stride = 2,
+	.threshold = (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, ev1527->raw, ev1527->rawlen);
 }
 
 static void createMessage(int unitcode, int state) {
@@ -58,23 +63,17 @@ static void createMessage(int unitcode, int state) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/2], x = 0, i = 0;
+	uint64_t binary = 0;
 
 	if(ev1527->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "ev1527: parsecode - invalid parameter passed %d", ev1527->rawlen);
 		return;
 	}
 
-	for(x=0;x<ev1527->rawlen-2;x+=2) {
-		if(ev1527->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, ev1527->raw, ev1527->rawlen, &binary);
 
-	int unitcode = binToDec(binary, 0, 19);
-	int state = binary[20];
+	int unitcode = (int)bitslicer_field(binary, 0, 19);
+	int state = bitslicer_bit(binary, 20);
 	createMessage(unitcode, state);
 }
 
@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "rc101.h"
 
@@ -36,15 +37,19 @@
 #define AVG_PULSE_LENGTH	241
 #define RAW_LENGTH				66
 
-static int validate(void) {
-	if(rc101->rawlen == RAW_LENGTH) {
-		if(rc101->raw[rc101->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   rc101->raw[rc101->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { RAW_LENGTH, 0 },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = -1,
+	.minstart = 0,
+	.offset = 0,
+	.stride = 2,
+	.threshold = (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, rc101->raw, rc101->rawlen);
 }
 
 static void createMessage(int id, int state, int unit, int all) {
@@ -63,24 +68,18 @@ static void createMessage(int id, int state, int unit, int all) {
 }
 
 static void parseCode(void) {
-	int i = 0, x = 0, binary[RAW_LENGTH/2];
+	uint64_t binary = 0;
 
 	if(rc101->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "rc101: parsecode - invalid parameter passed %d", rc101->rawlen);
 		return;
 	}
 
-	for(i=0;i<rc101->rawlen; i+=2) {
-		if(rc101->raw[i] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[x++] = 1;
-		} else {
-			binary[x++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, rc101->raw, rc101->rawlen, &binary);
 
-	int id = binToDec(binary, 0, 19);
-	int state = binary[20];
-	int unit = 7-binToDec(binary, 21, 23);
+	int id = (int)bitslicer_field(binary, 0, 19);
+	int state = bitslicer_bit(binary, 20);
+	int unit = 7-(int)bitslicer_field(binary, 21, 23);
 	int all = 0;
 	if(unit == 7 && state == 1) {
 		all = 1;
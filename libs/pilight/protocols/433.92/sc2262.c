@@ -27,6 +27,7 @@
 #include "../../core/log.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
+#include "../../core/bitslicer.h"
 #include "../../core/gc.h"
 #include "sc2262.h"
 
@@ -36,15 +37,19 @@
 #define AVG_PULSE_LENGTH	432
 #define RAW_LENGTH				50
 
-static int validate(void) {
-	if(sc2262->rawlen == RAW_LENGTH) {
-		if(sc2262->raw[sc2262->rawlen-1] >= (MIN_PULSE_LENGTH*PULSE_DIV) &&
-		   sc2262->raw[sc2262->rawlen-1] <= (MAX_PULSE_LENGTH*PULSE_DIV)) {
-			return 0;
-		}
-	}
+static const struct bitslicer_t slicer = {
+	.rawlen = { RAW_LENGTH, 0 },
+	.minfooter = MIN_PULSE_LENGTH*PULSE_DIV,
+	.maxfooter = MAX_PULSE_LENGTH*PULSE_DIV,
+	.start = -1,
+	.minstart = 0,
+	.offset = 3,
+	.stride = 4,
+	.threshold = (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))
+};
 
-	return -1;
+static int validate(void) {
+	return bitslicer_validate(&slicer, sc2262->raw, sc2262->rawlen);
 }
 
 static void createMessage(int systemcode, int unitcode, int state) {
@@ -59,24 +64,18 @@ static void createMessage(int systemcode, int unitcode, int state) {
 }
 
 static void parseCode(void) {
-	int binary[RAW_LENGTH/4], x = 0, i = 0;
+	uint64_t binary = 0;
 
 	if(sc2262->rawlen>RAW_LENGTH) {
 		logprintf(LOG_ERR, "sc2262: parsecode - invalid parameter passed %d", sc2262->rawlen);
 		return;
 	}
 
-	for(x=0;x<sc2262->rawlen-2;x+=4) {
-		if(sc2262->raw[x+3] > (int)((double)AVG_PULSE_LENGTH*((double)PULSE_MULTIPLIER/2))) {
-			binary[i++] = 1;
-		} else {
-			binary[i++] = 0;
-		}
-	}
+	bitslicer_decode(&slicer, sc2262->raw, sc2262->rawlen, &binary);
 
-	int systemcode = binToDec(binary, 0, 4);
-	int unitcode = binToDec(binary, 5, 9);
-	int state = binary[11];
+	int systemcode = (int)bitslicer_field(binary, 0, 4);
+	int unitcode = (int)bitslicer_field(binary, 5, 9);
+	int state = bitslicer_bit(binary, 11);
 	createMessage(systemcode, unitcode, state);
 }
 
@@ -44,6 +44,7 @@
 #include "../../core/datetime.h" // Full path because we also have a datetime protocol
 #include "../../core/log.h"
 #include "../../core/http.h"
+#include "../../core/fetch.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
 #include "../../core/json.h"
@@ -347,8 +348,7 @@ static void *reason_code_received_free(void *param) {
 }
 #endif
 
-static void callback(int code, char *data, int size, char *type, void *userdata) {
-	struct JsonNode *jdata = NULL;
+static void callback(int code, struct JsonNode *jdata, void *userdata) {
 	struct JsonNode *jmain = NULL;
 	struct JsonNode *jsys = NULL;
 	struct JsonNode *node = NULL;
@@ -361,150 +361,141 @@ static void callback(int code, char *data, int size, char *type, void *userdata)
 	memset(&tm_set, 0, sizeof(struct tm));
 
 	if(code == 200) {
-		if(strstr(type, "application/json") != NULL) {
-			if(json_validate(data) == true) {
-				if((jdata = json_decode(data)) != NULL) {
-					if((jmain = json_find_member(jdata, "main")) != NULL
-						 && (jsys = json_find_member(jdata, "sys")) != NULL) {
-						if((node = json_find_member(jmain, "temp")) == NULL) {
-							logprintf(LOG_NOTICE, "api.openweathermap.org json has no temp key");
-						} else if(json_find_number(jmain, "humidity", &humi) != 0) {
-							logprintf(LOG_NOTICE, "api.openweathermap.org json has no humidity key");
-						} else if(json_find_number(jsys, "sunrise", &sunrise) != 0) {
-							logprintf(LOG_NOTICE, "api.openweathermap.org json has no sunrise key");
-						} else if(json_find_number(jsys, "sunset", &sunset) != 0) {
-							logprintf(LOG_NOTICE, "api.openweathermap.org json has no sunset key");
-						} else {
-							if(node->tag != JSON_NUMBER) {
-								logprintf(LOG_NOTICE, "api.openweathermap.org json has no temp key");
-							} else {
-								temp = node->number_-273.15;
+		if(jdata != NULL) {
+			if((jmain = json_find_member(jdata, "main")) != NULL
+				 && (jsys = json_find_member(jdata, "sys")) != NULL) {
+				if((node = json_find_member(jmain, "temp")) == NULL) {
+					logprintf(LOG_NOTICE, "api.openweathermap.org json has no temp key");
+				} else if(json_find_number(jmain, "humidity", &humi) != 0) {
+					logprintf(LOG_NOTICE, "api.openweathermap.org json has no humidity key");
+				} else if(json_find_number(jsys, "sunrise", &sunrise) != 0) {
+					logprintf(LOG_NOTICE, "api.openweathermap.org json has no sunrise key");
+				} else if(json_find_number(jsys, "sunset", &sunset) != 0) {
+					logprintf(LOG_NOTICE, "api.openweathermap.org json has no sunset key");
+				} else {
+					if(node->tag != JSON_NUMBER) {
+						logprintf(LOG_NOTICE, "api.openweathermap.org json has no temp key");
+					} else {
+						temp = node->number_-273.15;
 
-								if(time_override > -1) {
-									timenow = time_override;
-								} else {
-									timenow = time(NULL);
-								}
+						if(time_override > -1) {
+							timenow = time_override;
+						} else {
+							timenow = time(NULL);
+						}
 
-								struct tm current;
-								memset(&current, '\0', sizeof(struct tm));
+						struct tm current;
+						memset(&current, '\0', sizeof(struct tm));
 #ifdef _WIN32
-								struct tm *tmp = gmtime(&timenow);
-								memcpy(&current, tmp, sizeof(struct tm));
+						struct tm *tmp = gmtime(&timenow);
+						memcpy(&current, tmp, sizeof(struct tm));
 #else
-								gmtime_r(&timenow, &current);
+						gmtime_r(&timenow, &current);
 #endif
 
-								int month = current.tm_mon+1;
-								int mday = current.tm_mday;
-								int year = current.tm_year+1900;
+						int month = current.tm_mon+1;
+						int mday = current.tm_mday;
+						int year = current.tm_year+1900;
 
-								time_t midnight = (datetime2ts(year, month, mday, 23, 59, 59)+1);
+						time_t midnight = (datetime2ts(year, month, mday, 23, 59, 59)+1);
 
-								char *_sun = NULL;
+						char *_sun = NULL;
 
-								time_t a = (time_t)sunrise;
-								memset(&tm_rise, '\0', sizeof(struct tm));
+						time_t a = (time_t)sunrise;
+						memset(&tm_rise, '\0', sizeof(struct tm));
 #ifdef _WIN32
-								tmp = gmtime(&a);
-								memcpy(&tm_rise, tmp, sizeof(struct tm));
+						tmp = gmtime(&a);
+						memcpy(&tm_rise, tmp, sizeof(struct tm));
 #else
-								gmtime_r(&a, &tm_rise);
+						gmtime_r(&a, &tm_rise);
 #endif
-								a = (time_t)sunset;
-								memset(&tm_set, '\0', sizeof(struct tm));
+						a = (time_t)sunset;
+						memset(&tm_set, '\0', sizeof(struct tm));
 #ifdef _WIN32
-								tmp = gmtime(&a);
-								memcpy(&tm_set, tmp, sizeof(struct tm));
+						tmp = gmtime(&a);
+						memcpy(&tm_set, tmp, sizeof(struct tm));
 #else
-								gmtime_r(&a, &tm_set);
+						gmtime_r(&a, &tm_set);
 #endif
-								if(timenow > (int)round(sunrise) && timenow < (int)round(sunset)) {
-									_sun = "rise";
-								} else {
-									_sun = "set";
-								}
+						if(timenow > (int)round(sunrise) && timenow < (int)round(sunset)) {
+							_sun = "rise";
+						} else {
+							_sun = "set";
+						}
 
 #ifdef PILIGHT_REWRITE
-								struct reason_code_received_t *data = MALLOC(sizeof(struct reason_code_received_t));
-								if(data == NULL) {
-									OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-								};
-								snprintf(data->message, 1024,
-									"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%.2f,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}",
-									settings->api, settings->location, settings->country, temp, humi, ((double)((tm_rise.tm_hour*100)+tm_rise.tm_min)/100), ((double)((tm_set.tm_hour*100)+tm_set.tm_min)/100), _sun
-								);
-								strncpy(data->origin, "receiver", 255);
-								data->protocol = openweathermap->id;
-								if(strlen(pilight_uuid) > 0) {
-									data->uuid = pilight_uuid;
-								} else {
-									data->uuid = NULL;
-								}
-								data->repeat = 1;
+						struct reason_code_received_t *data = MALLOC(sizeof(struct reason_code_received_t));
+						if(data == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						};
+						snprintf(data->message, 1024,
+							"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%.2f,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}",
+							settings->api, settings->location, settings->country, temp, humi, ((double)((tm_rise.tm_hour*100)+tm_rise.tm_min)/100), ((double)((tm_set.tm_hour*100)+tm_set.tm_min)/100), _sun
+						);
+						strncpy(data->origin, "receiver", 255);
+						data->protocol = openweathermap->id;
+						if(strlen(pilight_uuid) > 0) {
+							data->uuid = pilight_uuid;
+						} else {
+							data->uuid = NULL;
+						}
+						data->repeat = 1;
 
-								eventpool_trigger(REASON_CODE_RECEIVED, reason_code_received_free, data);
+						eventpool_trigger(REASON_CODE_RECEIVED, reason_code_received_free, data);
 #else
-								char message[1024];
-								snprintf(message, 1024,
-									"{\"origin\":\"receiver\",\"protocol\":\"%s\",\"message\":"\
-										"{\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%.2f,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}"\
-									"}",
-									openweathermap->id, settings->location, settings->country, temp, humi, ((double)((tm_rise.tm_hour*100)+tm_rise.tm_min)/100), ((double)((tm_set.tm_hour*100)+tm_set.tm_min)/100), _sun
-								);
-
-								openweathermap->message = json_decode(message);
-
-								if(pilight.broadcast != NULL) {
-									pilight.broadcast(openweathermap->id, openweathermap->message, PROTOCOL);
-								}
-								json_delete(openweathermap->message);
-								openweathermap->message = NULL;
+						char message[1024];
+						snprintf(message, 1024,
+							"{\"origin\":\"receiver\",\"protocol\":\"%s\",\"message\":"\
+								"{\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%.2f,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}"\
+							"}",
+							openweathermap->id, settings->location, settings->country, temp, humi, ((double)((tm_rise.tm_hour*100)+tm_rise.tm_min)/100), ((double)((tm_set.tm_hour*100)+tm_set.tm_min)/100), _sun
+						);
+
+						openweathermap->message = json_decode(message);
+
+						if(pilight.broadcast != NULL) {
+							pilight.broadcast(openweathermap->id, openweathermap->message, PROTOCOL);
+						}
+						json_delete(openweathermap->message);
+						openweathermap->message = NULL;
 #endif
-								/* Send message when sun rises */
-								if((int)round(sunrise) > timenow) {
-									if(((int)round(sunrise)-timenow) < settings->interval) {
-										settings->interval = (int)((int)round(sunrise)-timenow);
-									}
-								/* Send message when sun sets */
-								} else if((int)round(sunset) > timenow) {
-									if(((int)round(sunset)-timenow) < settings->interval) {
-										settings->interval = (int)((int)round(sunset)-timenow);
-									}
-								/* Update all values when a new day arrives */
-								} else {
-									if((midnight-timenow) < settings->interval) {
-										settings->interval = (int)(midnight-timenow);
-									}
-								}
-
-								if(time_override > -1) {
-									settings->update = time_override;
-								} else {
-									settings->update = time(NULL);
-								}
-
-								/*
-								 * Update all values on next event as described above
-								 */
-								assert(settings->interval > 0);
-								uv_timer_start(settings->update_timer_req, (void (*)(uv_timer_t *))update, settings->interval*1000, 0);
-								/*
-								 * Allow updating the values customly after INTERVAL seconds
-								 */
-								assert(min_interval > 0);
-								uv_timer_start(settings->enable_timer_req, (void (*)(uv_timer_t *))enable, min_interval*1000, 0);
+						/* Send message when sun rises */
+						if((int)round(sunrise) > timenow) {
+							if(((int)round(sunrise)-timenow) < settings->interval) {
+								settings->interval = (int)((int)round(sunrise)-timenow);
+							}
+						/* Send message when sun sets */
+						} else if((int)round(sunset) > timenow) {
+							if(((int)round(sunset)-timenow) < settings->interval) {
+								settings->interval = (int)((int)round(sunset)-timenow);
+							}
+						/* Update all values when a new day arrives */
+						} else {
+							if((midnight-timenow) < settings->interval) {
+								settings->interval = (int)(midnight-timenow);
 							}
 						}
-					} else {
-						logprintf(LOG_NOTICE, "api.openweathermap.org json has no current_observation key");
+
+						if(time_override > -1) {
+							settings->update = time_override;
+						} else {
+							settings->update = time(NULL);
+						}
+
+						/*
+						 * Update all values on next event as described above
+						 */
+						assert(settings->interval > 0);
+						uv_timer_start(settings->update_timer_req, (void (*)(uv_timer_t *))update, settings->interval*1000, 0);
+						/*
+						 * Allow updating the values customly after INTERVAL seconds
+						 */
+						assert(min_interval > 0);
+						uv_timer_start(settings->enable_timer_req, (void (*)(uv_timer_t *))enable, min_interval*1000, 0);
 					}
-					json_delete(jdata);
-				} else {
-					logprintf(LOG_NOTICE, "api.openweathermap.org json could not be parsed");
 				}
-			}  else {
-				logprintf(LOG_NOTICE, "api.openweathermap.org response was not in a valid json format");
+			} else {
+				logprintf(LOG_NOTICE, "api.openweathermap.org json has no current_observation key");
 			}
 		} else {
 			logprintf(LOG_NOTICE, "api.openweathermap.org response was not in a valid json format");
@@ -515,12 +506,11 @@ static void callback(int code, char *data, int size, char *type, void *userdata)
 	return;
 }
 
-static void thread_free(uv_work_t *req, int status) {
-	FREE(req);
-}
-
-static void thread(uv_work_t *req) {
-	struct data_t *settings = req->data;
+/*
+ * Devices polling the same location with the same
+ * api key share a single request to the server.
+ */
+static void request(struct data_t *settings) {
 	char parsed[1024];
 	char *enc = urlencode(settings->location);
 
@@ -528,10 +518,23 @@ static void thread(uv_work_t *req) {
 	snprintf(parsed, 1024, url, enc, settings->country, settings->api);
 	FREE(enc);
 
-	http_get_content(parsed, callback, settings);
+	fetch_json(parsed, min_interval, callback, settings);
+}
+
+static void thread(uv_work_t *req) {
 	return;
 }
 
+/*
+ * A manual update can come from any thread, but the
+ * request must be started from the main loop, where
+ * the after work callback runs.
+ */
+static void thread_free(uv_work_t *req, int status) {
+	request(req->data);
+	FREE(req);
+}
+
 static void *update(void *param) {
 	/*
 	 * Make sure we execute in the main thread
@@ -542,12 +545,7 @@ static void *update(void *param) {
 	uv_timer_t *timer_req = param;
 	struct data_t *settings = timer_req->data;
 
-	uv_work_t *work_req = NULL;
-	if((work_req = MALLOC(sizeof(uv_work_t))) == NULL) {
-		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-	}
-	work_req->data = settings;
-	uv_queue_work_s(work_req, "openweathermap", thread, thread_free);
+	request(settings);
 	if(time_override > -1) {
 		settings->update = time_override;
 	} else {
@@ -873,6 +871,7 @@ static void threadGC(void) {
 		uv_timer_stop(tmp->update_timer_req);
 		uv_timer_stop(tmp->enable_timer_req);
 #endif
+		fetch_cancel(tmp);
 		FREE(tmp->country);
 		FREE(tmp->location);
 		FREE(tmp->name);
@@ -941,7 +940,7 @@ void openweathermapInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "openweathermap";
-	module->version = "1.12";
+	module->version = "1.13";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
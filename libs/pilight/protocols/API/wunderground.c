@@ -41,6 +41,7 @@
 #include "../../core/datetime.h" // Full path because we also have a datetime protocol
 #include "../../core/log.h"
 #include "../../core/http.h"
+#include "../../core/fetch.h"
 #include "../protocol.h"
 #include "../../core/binary.h"
 #include "../../core/json.h"
@@ -413,9 +414,8 @@ static void *reason_code_received_free(void *param) {
 }
 #endif
 
-static void callback2(int code, char *data, int size, char *type, void *userdata) {
+static void callback2(int code, struct JsonNode *jdata, void *userdata) {
 	struct data_t *settings = userdata;
-	struct JsonNode *jdata = NULL;
 	struct JsonNode *jsun = NULL;
 	struct JsonNode *jsunr = NULL;
 	struct JsonNode *jsuns = NULL;
@@ -426,145 +426,136 @@ static void callback2(int code, char *data, int size, char *type, void *userdata
 	memset(&tm, 0, sizeof(struct tm));
 
 	if(code == 200) {
-		if(strstr(type, "application/json") != NULL) {
-			if(json_validate(data) == true) {
-				if((jdata = json_decode(data)) != NULL) {
-					if((jsun = json_find_member(jdata, "sun_phase")) != NULL) {
-						if((jsunr = json_find_member(jsun, "sunrise")) != NULL
-							 && (jsuns = json_find_member(jsun, "sunset")) != NULL) {
-							if(json_find_string(jsuns, "hour", &shour) != 0) {
-								logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset hour key");
-							} else if(json_find_string(jsuns, "minute", &smin) != 0) {
-								logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset minute key");
-							} else if(json_find_string(jsunr, "hour", &rhour) != 0) {
-								logprintf(LOG_NOTICE, "api.wunderground.com json has no sunrise hour key");
-							} else if(json_find_string(jsunr, "minute", &rmin) != 0) {
-								logprintf(LOG_NOTICE, "api.wunderground.com json has no sunrise minute key");
-							} else {
+		if(jdata != NULL) {
+			if((jsun = json_find_member(jdata, "sun_phase")) != NULL) {
+				if((jsunr = json_find_member(jsun, "sunrise")) != NULL
+					 && (jsuns = json_find_member(jsun, "sunset")) != NULL) {
+					if(json_find_string(jsuns, "hour", &shour) != 0) {
+						logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset hour key");
+					} else if(json_find_string(jsuns, "minute", &smin) != 0) {
+						logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset minute key");
+					} else if(json_find_string(jsunr, "hour", &rhour) != 0) {
+						logprintf(LOG_NOTICE, "api.wunderground.com json has no sunrise hour key");
+					} else if(json_find_string(jsunr, "minute", &rmin) != 0) {
+						logprintf(LOG_NOTICE, "api.wunderground.com json has no sunrise minute key");
+					} else {
 
-								time_t timenow;
-								if(time_override > -1) {
-									timenow = time_override;
-								} else {
-									timenow = time(NULL);
-								}
+						time_t timenow;
+						if(time_override > -1) {
+							timenow = time_override;
+						} else {
+							timenow = time(NULL);
+						}
 
-								struct tm current;
-								memset(&current, '\0', sizeof(struct tm));
-								/*
-								 * Retrieving the current day is fine with
-								 * the UTC timezone, because we don't do
-								 * anything with the hours, minutes or seconds.
-								 * We just need to know what day, month, and year
-								 * we are in.
-								 */
+						struct tm current;
+						memset(&current, '\0', sizeof(struct tm));
+						/*
+						 * Retrieving the current day is fine with
+						 * the UTC timezone, because we don't do
+						 * anything with the hours, minutes or seconds.
+						 * We just need to know what day, month, and year
+						 * we are in.
+						 */
 #ifdef _WIN32
-								struct tm *ptm;
-								ptm = gmtime(&timenow);
-								memcpy(&current, ptm, sizeof(struct tm));
+						struct tm *ptm;
+						ptm = gmtime(&timenow);
+						memcpy(&current, ptm, sizeof(struct tm));
 #else
-								gmtime_r(&timenow, &current);
+						gmtime_r(&timenow, &current);
 #endif
 
-								int month = current.tm_mon+1;
-								int mday = current.tm_mday;
-								int year = current.tm_year+1900;
-								char *_sun = NULL;
+						int month = current.tm_mon+1;
+						int mday = current.tm_mday;
+						int year = current.tm_year+1900;
+						char *_sun = NULL;
 
-								time_t midnight = (datetime2ts(year, month, mday, 23, 59, 59)+1);
-								time_t sunset = datetime2ts(year, month, mday, atoi(shour), atoi(smin), 0);
-								time_t sunrise = datetime2ts(year, month, mday, atoi(rhour), atoi(rmin), 0);
+						time_t midnight = (datetime2ts(year, month, mday, 23, 59, 59)+1);
+						time_t sunset = datetime2ts(year, month, mday, atoi(shour), atoi(smin), 0);
+						time_t sunrise = datetime2ts(year, month, mday, atoi(rhour), atoi(rmin), 0);
 
-								if(timenow > sunrise && timenow < sunset) {
-									_sun = "rise";
-								} else {
-									_sun = "set";
-								}
+						if(timenow > sunrise && timenow < sunset) {
+							_sun = "rise";
+						} else {
+							_sun = "set";
+						}
 
 #ifdef PILIGHT_REWRITE
-								struct reason_code_received_t *data = MALLOC(sizeof(struct reason_code_received_t));
-								if(data == NULL) {
-									OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-								}
-								snprintf(data->message, 1024,
-									"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%d,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}",
-									settings->api, settings->location, settings->country, settings->temp, settings->humi,
-									((double)((atoi(rhour)*100)+atoi(rmin))/100), ((double)((atoi(shour)*100)+atoi(smin))/100), _sun
-								);
-								strncpy(data->origin, "receiver", 255);
-								data->protocol = wunderground->id;
-								if(strlen(pilight_uuid) > 0) {
-									data->uuid = pilight_uuid;
-								} else {
-									data->uuid = NULL;
-								}
-								data->repeat = 1;
-								eventpool_trigger(REASON_CODE_RECEIVED, reason_code_received_free, data);
+						struct reason_code_received_t *data = MALLOC(sizeof(struct reason_code_received_t));
+						if(data == NULL) {
+							OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
+						}
+						snprintf(data->message, 1024,
+							"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%d,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}",
+							settings->api, settings->location, settings->country, settings->temp, settings->humi,
+							((double)((atoi(rhour)*100)+atoi(rmin))/100), ((double)((atoi(shour)*100)+atoi(smin))/100), _sun
+						);
+						strncpy(data->origin, "receiver", 255);
+						data->protocol = wunderground->id;
+						if(strlen(pilight_uuid) > 0) {
+							data->uuid = pilight_uuid;
+						} else {
+							data->uuid = NULL;
+						}
+						data->repeat = 1;
+						eventpool_trigger(REASON_CODE_RECEIVED, reason_code_received_free, data);
 #else
-								char message[1024];
-								snprintf(message, 1024,
-									"{\"origin\":\"receiver\",\"protocol\":\"%s\",\"message\":"\
-										"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%d,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}"\
-									"}",
-									wunderground->id, settings->api, settings->location, settings->country, settings->temp, settings->humi,
-									((double)((atoi(rhour)*100)+atoi(rmin))/100), ((double)((atoi(shour)*100)+atoi(smin))/100), _sun
-								);
-
-								wunderground->message = json_decode(message);
-
-								if(pilight.broadcast != NULL) {
-									pilight.broadcast(wunderground->id, wunderground->message, PROTOCOL);
-								}
-								json_delete(wunderground->message);
-								wunderground->message = NULL;
+						char message[1024];
+						snprintf(message, 1024,
+							"{\"origin\":\"receiver\",\"protocol\":\"%s\",\"message\":"\
+								"{\"api\":\"%s\",\"location\":\"%s\",\"country\":\"%s\",\"temperature\":%.2f,\"humidity\":%d,\"update\":0,\"sunrise\":%.2f,\"sunset\":%.2f,\"sun\":\"%s\"}"\
+							"}",
+							wunderground->id, settings->api, settings->location, settings->country, settings->temp, settings->humi,
+							((double)((atoi(rhour)*100)+atoi(rmin))/100), ((double)((atoi(shour)*100)+atoi(smin))/100), _sun
+						);
+
+						wunderground->message = json_decode(message);
+
+						if(pilight.broadcast != NULL) {
+							pilight.broadcast(wunderground->id, wunderground->message, PROTOCOL);
+						}
+						json_delete(wunderground->message);
+						wunderground->message = NULL;
 #endif
-								/* Send message when sun rises */
-								if(sunrise > timenow) {
-									if((sunrise-timenow) < settings->interval) {
-										settings->interval = (int)(sunrise-timenow);
-									}
-								/* Send message when sun sets */
-								} else if(sunset > timenow) {
-									if((sunset-timenow) < settings->interval) {
-										settings->interval = (int)(sunset-timenow);
-									}
-								/* Update all values when a new day arrives */
-								} else {
-									if((midnight-timenow) < settings->interval) {
-										settings->interval = (int)(midnight-timenow);
-									}
-								}
-
-								if(time_override > -1) {
-									settings->update = time_override;
-								} else {
-									settings->update = time(NULL);
-								}
-
-								/*
-								 * Update all values on next event as described above
-								 */
-								assert(settings->interval > 0);
-								uv_timer_start(settings->update_timer_req, (void (*)(uv_timer_t *))update, settings->interval*1000, 0);
-								/*
-								 * Allow updating the values customly after INTERVAL seconds
-								 */
-								assert(min_interval > 0);
-								uv_timer_start(settings->enable_timer_req, (void (*)(uv_timer_t *))enable, min_interval*1000, 0);
-
+						/* Send message when sun rises */
+						if(sunrise > timenow) {
+							if((sunrise-timenow) < settings->interval) {
+								settings->interval = (int)(sunrise-timenow);
 							}
+						/* Send message when sun sets */
+						} else if(sunset > timenow) {
+							if((sunset-timenow) < settings->interval) {
+								settings->interval = (int)(sunset-timenow);
+							}
+						/* Update all values when a new day arrives */
 						} else {
-							logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset and/or sunrise key");
+							if((midnight-timenow) < settings->interval) {
+								settings->interval = (int)(midnight-timenow);
+							}
 						}
-					} else {
-						logprintf(LOG_NOTICE, "api.wunderground.com json has no sun_phase key");
+
+						if(time_override > -1) {
+							settings->update = time_override;
+						} else {
+							settings->update = time(NULL);
+						}
+
+						/*
+						 * Update all values on next event as described above
+						 */
+						assert(settings->interval > 0);
+						uv_timer_start(settings->update_timer_req, (void (*)(uv_timer_t *))update, settings->interval*1000, 0);
+						/*
+						 * Allow updating the values customly after INTERVAL seconds
+						 */
+						assert(min_interval > 0);
+						uv_timer_start(settings->enable_timer_req, (void (*)(uv_timer_t *))enable, min_interval*1000, 0);
+
 					}
-					json_delete(jdata);
 				} else {
-					logprintf(LOG_NOTICE, "api.wunderground.com json could not be parsed");
+					logprintf(LOG_NOTICE, "api.wunderground.com json has no sunset and/or sunrise key");
 				}
-			}  else {
-				logprintf(LOG_NOTICE, "api.wunderground.com response was not in a valid json format");
+			} else {
+				logprintf(LOG_NOTICE, "api.wunderground.com json has no sun_phase key");
 			}
 		} else {
 			logprintf(LOG_NOTICE, "api.wunderground.com response was not in a valid json format");
@@ -575,61 +566,51 @@ static void callback2(int code, char *data, int size, char *type, void *userdata
 	return;
 }
 
-static void callback1(int code, char *data, int size, char *type, void *userdata) {
+static void callback1(int code, struct JsonNode *jdata, void *userdata) {
 	struct data_t *settings = userdata;
-	struct JsonNode *jdata = NULL;
 	struct JsonNode *jobs = NULL;
 	struct JsonNode *jloc = NULL;
 	struct JsonNode *node = NULL;
 	char *stmp = NULL;
 
 	if(code == 200) {
-		if(strstr(type, "application/json") != NULL) {
-			if(json_validate(data) == true) {
-				if((jdata = json_decode(data)) != NULL) {
-					if((jloc = json_find_member(jdata, "location")) != NULL) {
-						if((node = json_find_member(jloc, "tz_long")) == NULL) {
-							logprintf(LOG_NOTICE, "api.wunderground.com json has no tz_long key");
-						} else {
-							if(node->tag != JSON_STRING) {
-								logprintf(LOG_NOTICE, "api.wunderground.com json has no tz_long key");
+		if(jdata != NULL) {
+			if((jloc = json_find_member(jdata, "location")) != NULL) {
+				if((node = json_find_member(jloc, "tz_long")) == NULL) {
+					logprintf(LOG_NOTICE, "api.wunderground.com json has no tz_long key");
+				} else {
+					if(node->tag != JSON_STRING) {
+						logprintf(LOG_NOTICE, "api.wunderground.com json has no tz_long key");
+					} else {
+						strcpy(settings->tz, node->string_);
+						if((jobs = json_find_member(jdata, "current_observation")) != NULL) {
+							if((node = json_find_member(jobs, "temp_c")) == NULL) {
+								logprintf(LOG_NOTICE, "api.wunderground.com json has no temp_c key");
+							} else if(json_find_string(jobs, "relative_humidity", &stmp) != 0) {
+								logprintf(LOG_NOTICE, "api.wunderground.com json has no relative_humidity key");
 							} else {
-								strcpy(settings->tz, node->string_);
-								if((jobs = json_find_member(jdata, "current_observation")) != NULL) {
-									if((node = json_find_member(jobs, "temp_c")) == NULL) {
-										logprintf(LOG_NOTICE, "api.wunderground.com json has no temp_c key");
-									} else if(json_find_string(jobs, "relative_humidity", &stmp) != 0) {
-										logprintf(LOG_NOTICE, "api.wunderground.com json has no relative_humidity key");
-									} else {
-										if(node->tag != JSON_NUMBER) {
-											logprintf(LOG_NOTICE, "api.wunderground.com json has no temp_c key");
-										} else {
-											settings->temp = node->number_;
-											sscanf(stmp, "%d%%", &settings->humi);
-
-											char parsed[1024];
-											char *enc = urlencode(settings->location);
-											memset(parsed, '\0', 1024);
-											snprintf(parsed, 1024, url[1], settings->api, settings->country, enc);
-											FREE(enc);
-
-											http_get_content(parsed, callback2, userdata);
-										}
-									}
+								if(node->tag != JSON_NUMBER) {
+									logprintf(LOG_NOTICE, "api.wunderground.com json has no temp_c key");
 								} else {
-									logprintf(LOG_NOTICE, "api.wunderground.com json has no current_observation key");
+									settings->temp = node->number_;
+									sscanf(stmp, "%d%%", &settings->humi);
+
+									char parsed[1024];
+									char *enc = urlencode(settings->location);
+									memset(parsed, '\0', 1024);
+									snprintf(parsed, 1024, url[1], settings->api, settings->country, enc);
+									FREE(enc);
+
+									fetch_json(parsed, min_interval, callback2, userdata);
 								}
 							}
+						} else {
+							logprintf(LOG_NOTICE, "api.wunderground.com json has no current_observation key");
 						}
-					} else {
-						logprintf(LOG_NOTICE, "api.wunderground.com json has no location key");
 					}
-					json_delete(jdata);
-				} else {
-					logprintf(LOG_NOTICE, "api.wunderground.com json could not be parsed");
 				}
 			} else {
-				logprintf(LOG_NOTICE, "api.wunderground.com response was not in a valid json format");
+				logprintf(LOG_NOTICE, "api.wunderground.com json has no location key");
 			}
 		} else {
 			logprintf(LOG_NOTICE, "api.wunderground.com response was not in a valid json format");
@@ -640,12 +621,11 @@ static void callback1(int code, char *data, int size, char *type, void *userdata
 	return;
 }
 
-static void thread_free(uv_work_t *req, int status) {
-	FREE(req);
-}
-
-static void thread(uv_work_t *req) {
-	struct data_t *settings = req->data;
+/*
+ * Devices polling the same location with the same
+ * api key share a single request to the server.
+ */
+static void request(struct data_t *settings) {
 	char parsed[1024];
 	char *enc = urlencode(settings->location);
 
@@ -653,21 +633,28 @@ static void thread(uv_work_t *req) {
 	snprintf(parsed, 1024, url[0], settings->api, settings->country, enc);
 	FREE(enc);
 
-	http_get_content(parsed, callback1, settings);
+	fetch_json(parsed, min_interval, callback1, settings);
+}
 
+static void thread(uv_work_t *req) {
 	return;
 }
 
+/*
+ * A manual update can come from any thread, but the
+ * request must be started from the main loop, where
+ * the after work callback runs.
+ */
+static void thread_free(uv_work_t *req, int status) {
+	request(req->data);
+	FREE(req);
+}
+
 static void *update(void *param) {
 	uv_timer_t *timer_req = param;
 	struct data_t *settings = timer_req->data;
 
-	uv_work_t *work_req = NULL;
-	if((work_req = MALLOC(sizeof(uv_work_t))) == NULL) {
-		OUT_OF_MEMORY /*LCOV_EXCL_LINE*/
-	}
-	work_req->data = settings;
-	uv_queue_work_s(work_req, "wunderground", thread, thread_free);
+	request(settings);
 	if(time_override > -1) {
 		settings->update = time_override;
 	} else {
@@ -995,6 +982,7 @@ static void threadGC(void) {
 		uv_timer_stop(tmp->enable_timer_req);
 		uv_timer_stop(tmp->update_timer_req);
 #endif
+		fetch_cancel(tmp);
 		FREE(tmp->api);
 		FREE(tmp->country);
 		FREE(tmp->location);
@@ -1062,7 +1050,7 @@ void wundergroundInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "wunderground";
-	module->version = "1.13";
+	module->version = "1.14";
 	module->reqversion = "6.0";
 	module->reqcommit = "84";
 }
@@ -35,6 +35,7 @@
 #include "../core/dso.h"
 #include "../core/options.h"
 #include "../core/log.h"
+#include "../core/pulsestats.h"
 
 #include "../config/settings.h"
 
@@ -236,6 +237,10 @@ void protocol_register(protocol_t **proto) {
 
 	(*proto)->raw = NULL;
 
+	(*proto)->received = NULL;
+	(*proto)->decoded = NULL;
+	(*proto)->dropped = NULL;
+
 	struct protocols_t *pnode = MALLOC(sizeof(struct protocols_t));
 	if(pnode == NULL) {
 		fprintf(stderr, "out of memory\n");
@@ -372,6 +377,91 @@ int protocol_device_exists(protocol_t *proto, const char *id) {
 	return 1;
 }
 
+/*
+ * Offers a received pulse train to every protocol listening on
+ * hwtype. The train is dropped as noise when less than quality
+ * percent of its pulses have one of the most common pulse
+ * lengths, counting the given number of lengths. A quality of
+ * 0 disables the filter. Protocols that don't accept the length
+ * of the train are skipped.
+ *
+ * The callback is called for every protocol that validated the
+ * train, with protocol->message as set by parseCode, and for
+ * every protocol that didn't, so a caller can account for the
+ * time spent in each. A callback returning -1 stops the loop.
+ *
+ * Returns -1 when the train was dropped as noise, otherwise
+ * the number of protocols that validated it.
+ */
+int protocol_dispatch(int *raw, int rawlen, int hwtype, unsigned long timestamp, int quality, int lengths, int (*callback)(struct protocol_t *protocol, int matched, void *userdata), void *userdata) {
+	struct protocols_t *pnode = protocols;
+	struct protocol_t *protocol = NULL;
+	struct pulsestats_t stats;
+	int matched = 0, nr = 0, q = 0;
+
+	/*
+	 * Noise rarely repeats the same few pulse lengths,
+	 * so it can be dropped before all protocols have
+	 * to look at it.
+	 */
+	if(quality > 0) {
+		pulsestats_compute(&stats, raw, rawlen);
+		if((q = pulsestats_quality(&stats, lengths)) < quality) {
+			logprintf(LOG_DEBUG, "dropped pulse train of %d pulses as noise, %d%% in %d lengths",
+				rawlen, q, lengths);
+			return -1;
+		}
+	}
+
+	while(pnode != NULL) {
+		protocol = pnode->listener;
+		pnode = pnode->next;
+
+		/* None of the protocols accepts a length outside its own range */
+		if(protocol->maxrawlen > 0 &&
+		   (rawlen < protocol->minrawlen || rawlen > protocol->maxrawlen)) {
+			continue;
+		}
+
+		if((protocol->hwtype == hwtype || protocol->hwtype == -1 || hwtype == -1) &&
+		   (protocol->parseCode != NULL && protocol->validate != NULL)) {
+
+			if(rawlen < MAXPULSESTREAMLENGTH) {
+				protocol->raw = raw;
+			}
+			protocol->rawlen = rawlen;
+
+			if((matched = (protocol->validate() == 0)) == 1) {
+				logprintf(LOG_DEBUG, "possible %s protocol", protocol->id);
+				if(protocol->first > 0) {
+					protocol->first = protocol->second;
+				}
+				protocol->second = timestamp;
+				if(protocol->first == 0) {
+					protocol->first = protocol->second;
+				}
+
+				/* Reset # of repeats after a certain delay */
+				if(((int)protocol->second-(int)protocol->first) > 500000) {
+					protocol->repeats = 0;
+				}
+
+				protocol->repeats++;
+				logprintf(LOG_DEBUG, "caught minimum # of repeats %d of %s", protocol->repeats, protocol->id);
+				logprintf(LOG_DEBUG, "called %s parseRaw()", protocol->id);
+				protocol->parseCode();
+				nr++;
+			}
+
+			if(callback != NULL && callback(protocol, matched, userdata) == -1) {
+				break;
+			}
+		}
+	}
+
+	return nr;
+}
+
 int protocol_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
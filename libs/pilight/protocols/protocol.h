@@ -32,6 +32,7 @@
 #include "../core/options.h"
 #include "../core/threads.h"
 #include "../core/json.h"
+#include "../core/metrics.h"
 
 #include "../config/devices.h"
 #include "../config/hardware.h"
@@ -93,6 +94,11 @@ typedef struct protocol_t {
 
 	int *raw;
 
+	/* Registered when the first code is received */
+	struct metric_t *received;
+	struct metric_t *decoded;
+	struct metric_t *dropped;
+
 	hwtype_t hwtype;
 	devtype_t devtype;
 	struct protocol_devices_t *devices;
@@ -129,6 +135,7 @@ void protocol_plslen_add(protocol_t *proto, int plslen);
 void protocol_register(protocol_t **proto);
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc);
 int protocol_device_exists(protocol_t *proto, const char *id);
+int protocol_dispatch(int *raw, int rawlen, int hwtype, unsigned long timestamp, int quality, int lengths, int (*callback)(struct protocol_t *protocol, int matched, void *userdata), void *userdata);
 int protocol_gc(void);
 
 #endif